@@ -5,7 +5,7 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-28
+ * @date 2026-10-14
  */
 #pragma once
 #define SW_VERSION "s0.1.0"
@@ -42,6 +42,15 @@
 #define PIN_AMP_PWDN 6
 #define PIN_POWER_SAVE 7
 #define AMP_BIT_DEPTH 24
+#define AMP_CALIBRATION_CLOCKS 26  // Clock pulses needed to read a value and start offset calibration.
+#define AMP_SCLK_HALF_PERIOD_NS 200 // SCLK high and low times (ADS1232 minimum is 100ns).
+
+// Read both amplifiers together in one task, producing a single record for both sides each sample period (see
+// PowerMeter::readPairedTask()). Uncomment AMP_SYNCHRONISED to use this rather than a task for each side.
+// #define AMP_SYNCHRONISED
+#define AMP_PAIR_TIMEOUT (AMP_SAMPLE_PERIOD / 4) // Longest wait for the other side once one side has data ready (us).
+#define AMP_REALIGN_SKEW (AMP_SAMPLE_PERIOD / 8) // Reset both amps together once data ready is this far apart (us).
+#define AMP_REALIGN_INTERVAL 1000                // Shortest time between resets to realign the amps (ms).
 
 // Buttons and LEDs
 #if (HW_VERSION == HW_VERSION_V1_0_4) || (HW_VERSION == HW_VERSION_V1_0_5)
@@ -65,6 +74,9 @@
 #define I2C_BUS_FREQ 400000
 #define TEMP1_I2C 0b1001001
 #define TEMP2_I2C 0b1001000
+#define TEMP_SAMPLE_PERIOD 1000  // Time between temperature samples while active (ms).
+#define TEMP_CONVERSION_TIME 12  // Worst case time for a single shot conversion (ms).
+#define I2C_QUEUE_LENGTH 16      // Number of transactions that can wait for the I2C task.
 
 // Accelerometer
 #if (HW_VERSION == HW_VERSION_V1_0_4) || (HW_VERSION == HW_VERSION_V1_0_5)
@@ -78,8 +90,24 @@
 #define PIN_SPI_SCLK 41
 #define PIN_SPI_AC_CS 42
 #define IMU_SAMPLE_RATE 100 // Options are 12, 25, 50, 100, 200, 400, 800, 1600 Hz (any other value defaults to 100 Hz).
+
+// Change the IMU sample rate with cadence. Comment out IMU_ADAPTIVE_RATE to always use IMU_SAMPLE_RATE. The Kalman Q
+// matrix is tuned for IMU_SAMPLE_RATE and is scaled to suit the current rate.
+#define IMU_ADAPTIVE_RATE
+#define IMU_RATE_SLOW 25        // Sample rate when stationary or coasting (Hz, at least 25).
+#define IMU_RATE_FAST 200       // Sample rate when sprinting (Hz).
+#define IMU_SLOW_CADENCE 30     // Below this cadence, use the slow rate (rpm).
+#define IMU_FAST_CADENCE 110    // Above this cadence, use the fast rate (rpm).
+#define IMU_RATE_HYSTERESIS 5   // How far past a threshold the cadence has to go to leave a rate (rpm).
+#define IMU_RATE_DWELL 2000000  // Minimum time before reducing the rate again (us). Increases are immediate.
 #define IMU_ACCEL_RANGE 4   // Options are 2, 4, 8, 16 G (any other value defaults to 16 G).
 #define IMU_GYRO_RANGE 2000 // Options are 250, 500, 1000, 2000 dps (any other value defaults to 2000 dps).
+#define IMU_FIFO_MAX_FRAMES 32      // Maximum FIFO watermark / frames that can be read in one go.
+#define IMU_TIMESTAMP_RESOLUTION 1  // Microseconds per tick of the 16 bit timestamp in each FIFO frame.
+
+// Anti-aliased decimation of high speed and IMU data (see src/decimator.h). Uncomment DECIMATE_ESP_DSP to use the
+// esp-dsp component's SIMD dot product for the filters (the esp-dsp component needs to be available to the build).
+// #define DECIMATE_ESP_DSP
 
 // Power management
 #if HW_VERSION == HW_VERSION_V1_0_4
@@ -89,6 +117,18 @@
 #elif HW_VERSION == HW_VERSION_V1_1_1
 #define PIN_BATTERY_VOLTAGE 13 // Bodge wire as original is shorted to ground.
 #endif
+// #define PIN_BATTERY_CURRENT 14 // No hardware revision has a current sense amplifier yet.
+#define BATTERY_CURRENT_SCALE 1.0 // mA per mV at PIN_BATTERY_CURRENT.
+
+// Frequency scaling and light sleep (see src/power_manager.h). Comment out POWER_MANAGEMENT to always run at full speed.
+#define POWER_MANAGEMENT
+#define POWER_SAVE_OFF 0                                // Always at full speed.
+#define POWER_SAVE_DFS 1                                // Scale the CPU frequency down when idle.
+#define POWER_SAVE_LIGHT_SLEEP 2                        // Scale the frequency and light sleep between interrupts.
+#define POWER_CPU_MAX_MHZ CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ // CPU frequency when a lock is held.
+#define POWER_CPU_MIN_MHZ 80                            // CPU frequency when idle (80MHz keeps the APB at full speed).
+#define PM_WAKE_GUARD 2000                              // Stay awake for this long before an interrupt is due (us).
+#define AMP_SAMPLE_PERIOD 12500                         // Time between amplifier samples at 80 SPS (us).
 
 // Extra GPIO pins
 #if (HW_VERSION == HW_VERSION_V1_0_4) || (HW_VERSION == HW_VERSION_V1_0_5)
@@ -160,7 +200,8 @@ enum EnumSide
 enum EnumConnection
 {
     CONNECTION_MQTT,
-    CONNECTION_BLE
+    CONNECTION_BLE,
+    CONNECTION_ESPNOW
 };
 
 /**
@@ -185,6 +226,21 @@ enum EnumConnState
 #define RECONNECT_DELAY 1000
 #define MQTT_RETRY_ITERATIONS 20
 #define WIFI_RECONNECT_ATTEMPT_TIME 60000 // If not connected in 1 minute, disconnect and attempt again.
+#define CONN_IDLE_POLL_MS 100              // Longest time the connection task sleeps while connected if no data arrives (ms).
+
+/**
+ * Fast wake from deep sleep (see src/fast_wake.h). Comment out FAST_WAKE to always start from scratch.
+ */
+#define FAST_WAKE
+#define FAST_WAKE_LEASE_TIME 3600             // Longest time since DHCP to reuse the IP address after waking (s).
+#define FAST_WAKE_WIFI_TIMEOUT 3000           // Time to try the cached access point before scanning (ms).
+#define KALMAN_RESUME_POSITION_VARIANCE 0.25f // Minimum angle variance after waking as the crank may have moved (rad^2).
+
+/**
+ * Instrumentation settings (see src/stats.h). Comment out STATS_ENABLE to compile out the latency histograms.
+ */
+#define STATS_ENABLE
+#define STATS_PERIOD 5000 // Time between publishing snapshots (ms).
 
 // Constant constants.
 #define GRAVITY 9.81                   // Accelerometer operates in g, calculations are done in SI units.
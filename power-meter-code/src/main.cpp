@@ -5,7 +5,7 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-10-01
+ * @date 2026-10-14
  */
 #include <Arduino.h>
 #include "defines.h"
@@ -14,11 +14,16 @@
 #include "src/connections.h"
 #include "src/connection_mqtt.h"
 #include "src/connection_ble.h"
+#include "src/connection_espnow.h"
 #include "src/config.h"
+#include "src/task_topology.h"
+#include "src/stats.h"
+#include "src/power_manager.h"
+#include "src/fast_wake.h"
 
 SemaphoreHandle_t serialMutex;
+static StaticSemaphore_t serialMutexBuffer;
 TaskHandle_t imuTaskHandle, lowSpeedTaskHandle, connectionTaskHandle, ledTaskHandle;
-portMUX_TYPE spinlock = portMUX_INITIALIZER_UNLOCKED;
 Preferences prefs;
 
 // Main states for the state machine.
@@ -29,10 +34,18 @@ StateSleep sleepState(activeState);
 
 PowerMeter powerMeter;
 Config config;
+#ifdef STATS_ENABLE
+Stats stats;
+#endif
+#ifdef POWER_MANAGEMENT
+PowerManager powerManager;
+#endif
+FastWake fastWake;
 
 // Initialise the connection. We need a pointer to it's parent class that isn't on the stack to use as a task parameter.
 MQTTConnection connectionMQTT;
 BLEConnection connectionBLE;
+ESPNowConnection connectionESPNow;
 Connection *connectionBasePtr;
 
 void setup()
@@ -40,26 +53,24 @@ void setup()
     pinMode(PIN_LEDR, OUTPUT);
     digitalWrite(PIN_LEDR, HIGH);
     // Initialise mutexes
-    serialMutex = xSemaphoreCreateMutex(); // Needs to be created before logging anything.
+    serialMutex = xSemaphoreCreateMutexStatic(&serialMutexBuffer); // Needs to be created before logging anything.
     Serial.begin(SERIAL_BAUD); // Already running from the bootloader.
     Serial.setTimeout(30000);
     LOGI("Setup", "MHP Power meter " SW_VERSION ", " HW_VERSION_STR ". Compiled " __DATE__ ", " __TIME__);
+    fastWake.begin();
 
     // Load config
     config.load();
     config.print();
+    createTask(TASK_CONFIG_SAVE, taskConfigSave, &config, NULL);
+#ifdef POWER_MANAGEMENT
+    powerManager.begin();
+#endif
 
-    delay(50); // Help the temp sensors start?
-    // LEDs (important to get the task started early).
-    xTaskCreatePinnedToCore(
-        taskLED,
-        "LED",
-        2048,
-        NULL,
-        1,
-        &ledTaskHandle,
-        1);
-    delay(50); // Avoid race conditions and maybe help temp sensors start correctly?
+    // LEDs (important to get the task started early). Each task says when it has started rather than waiting for a
+    // fixed time, so that waking up from sleep is as quick as possible.
+    createTask(TASK_LED, taskLED, NULL, &ledTaskHandle);
+    waitForTask(TASK_LED, TASK_START_TIMEOUT);
 
     // Start the hardware.
     powerMeter.begin();
@@ -77,48 +88,35 @@ void setup()
         connectionBLE.begin();
         connectionBasePtr = &connectionBLE;
         break;
+    case CONNECTION_ESPNOW:
+        connectionESPNow.begin();
+        connectionBasePtr = &connectionESPNow;
+        break;
     }
 
-    xTaskCreatePinnedToCore(
-        taskConnection,
-        "Connection",
-        9000,
-        connectionBasePtr,
-        1,
-        &connectionTaskHandle,
-        1);
-    // TODO: Avoid race condition where the task handle is not initialised to enable or disable the connection.
-    delay(100); // Very dodgy way to make sure the condition is avoided.
+    createTask(TASK_CONNECTION, taskConnection, connectionBasePtr, &connectionTaskHandle);
+    // The connection's task handle must be set before it can be enabled or disabled.
+    waitForTask(TASK_CONNECTION, TASK_START_TIMEOUT);
 
-    // Start tasks
-    // TODO: Determine RAM allocations
+    // Start tasks. Stack sizes, priorities and cores are set in task_topology.cpp.
 
     // Communications need to have started before creating low speed. This also relies on queues created in power meter
     // Side::begin()
-    xTaskCreatePinnedToCore(
-        taskLowSpeed,
-        "LowSpeed",
-        4096,
-        NULL,
-        1, // Low priority.
-        &lowSpeedTaskHandle,
-        1);
-    delay(100);
+    createTask(TASK_LOW_SPEED, taskLowSpeed, NULL, &lowSpeedTaskHandle);
+    waitForTask(TASK_LOW_SPEED, TASK_START_TIMEOUT);
 
     // Low speed and communications need to have started before IMU.
-    xTaskCreatePinnedToCore(
-        taskIMU,
-        "IMU",
-        4096,
-        NULL,
-        3, // Make this a higher priority than other tasks.
-        &imuTaskHandle,
-        1);
-    delay(100);
+    createTask(TASK_IMU, taskIMU, NULL, &imuTaskHandle);
+    waitForTask(TASK_IMU, TASK_START_TIMEOUT);
 
     // Create tasks to read data from ADCs
-    powerMeter.sides[SIDE_LEFT].createDataTask(SIDE_LEFT);
-    powerMeter.sides[SIDE_RIGHT].createDataTask(SIDE_RIGHT);
+    powerMeter.createAmpTasks();
+#ifdef AMP_SYNCHRONISED
+    waitForTask(TASK_AMP_PAIRED, TASK_START_TIMEOUT);
+#else
+    waitForTask(TASK_AMP_LEFT, TASK_START_TIMEOUT);
+    waitForTask(TASK_AMP_RIGHT, TASK_START_TIMEOUT);
+#endif
 }
 
 void loop()
@@ -0,0 +1,151 @@
+/**
+ * @file amp_reader.cpp
+ * @brief Reads both ADS1232 strain gauge amplifiers using dedicated GPIO bundles.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "amp_reader.h"
+#include <esp_cpu.h>
+
+extern SemaphoreHandle_t serialMutex;
+
+void AmpReader::begin()
+{
+    if (m_sclkBundle)
+    {
+        // Already started.
+        return;
+    }
+
+    // Clock pins need to be low before the amplifiers are reset.
+    for (uint8_t side = SIDE_LEFT; side <= SIDE_RIGHT; side++)
+    {
+        pinMode(m_pinsSclk[side], OUTPUT);
+        digitalWrite(m_pinsSclk[side], LOW);
+    }
+
+    // Bundle channels are in the same order as the sides, so bit(side) addresses a side in both bundles.
+    const int sclkPins[2] = {m_pinsSclk[SIDE_LEFT], m_pinsSclk[SIDE_RIGHT]};
+    dedic_gpio_bundle_config_t sclkConfig = {
+        .gpio_array = sclkPins,
+        .array_size = 2,
+        .flags = {.out_en = 1}};
+    if (dedic_gpio_new_bundle(&sclkConfig, &m_sclkBundle) != ESP_OK)
+    {
+        LOGE("Amp", "Couldn't create the SCLK bundle");
+    }
+
+    const int doutPins[2] = {m_pinsDout[SIDE_LEFT], m_pinsDout[SIDE_RIGHT]};
+    dedic_gpio_bundle_config_t doutConfig = {
+        .gpio_array = doutPins,
+        .array_size = 2,
+        .flags = {.in_en = 1}};
+    if (dedic_gpio_new_bundle(&doutConfig, &m_doutBundle) != ESP_OK)
+    {
+        LOGE("Amp", "Couldn't create the DOUT bundle");
+    }
+    dedic_gpio_bundle_write(m_sclkBundle, bit(SIDE_LEFT) | bit(SIDE_RIGHT), 0);
+
+    // Work out how long to wait for each half of the clock. The CPU may be running slower now due to frequency
+    // scaling, but bursts are always at the maximum frequency (a slower clock only makes the pulses longer).
+    m_halfPeriodCycles = (AMP_SCLK_HALF_PERIOD_NS * POWER_CPU_MAX_MHZ) / 1000;
+}
+
+void AmpReader::setReadyFromISR(EnumSide side, uint32_t time)
+{
+    taskENTER_CRITICAL_ISR(&m_spinlock);
+    m_pending |= bit(side);
+    m_readyTime[side] = time;
+    taskEXIT_CRITICAL_ISR(&m_spinlock);
+}
+
+uint32_t AmpReader::collect(EnumSide side)
+{
+    // The burst takes a few us, so it is done in the critical section. This stops the clock from being stretched by
+    // other tasks or interrupts and stops the other side finding a half complete reading.
+    taskENTER_CRITICAL(&m_spinlock);
+    if (!(m_delivered & bit(side)))
+    {
+        // Not read as part of the other side's burst. Read every side that is ready now.
+        uint8_t sideMask = m_pending | bit(side);
+        m_burst(sideMask);
+        m_pending &= ~sideMask;
+        m_delivered |= sideMask;
+    }
+    m_delivered &= ~bit(side);
+    uint32_t raw = m_raw[side];
+    taskEXIT_CRITICAL(&m_spinlock);
+    return raw;
+}
+
+void AmpReader::enableOffsetCalibration(EnumSide side)
+{
+    taskENTER_CRITICAL(&m_spinlock);
+    m_calibrate |= bit(side);
+    taskEXIT_CRITICAL(&m_spinlock);
+}
+
+void AmpReader::clearReady()
+{
+    taskENTER_CRITICAL(&m_spinlock);
+    m_pending = 0;
+    m_delivered = 0;
+    taskEXIT_CRITICAL(&m_spinlock);
+}
+
+void AmpReader::m_burst(uint8_t sideMask)
+{
+    // Sides performing offset calibration get 2 additional clock pulses.
+    const uint8_t calibrateMask = sideMask & m_calibrate;
+    uint32_t raw[2] = {0, 0};
+
+    // Main reading loop. Every side in the mask is clocked and sampled at the same time.
+    for (uint8_t i = 0; i < AMP_CALIBRATION_CLOCKS; i++)
+    {
+        const uint32_t clockMask = i < AMP_BIT_DEPTH ? sideMask : calibrateMask;
+        if (!clockMask)
+        {
+            // No sides need the extra clock pulses.
+            break;
+        }
+
+        // Read 1 bit from each side.
+        dedic_gpio_bundle_write(m_sclkBundle, clockMask, clockMask);
+        m_halfPeriod();
+        const uint32_t levels = dedic_gpio_bundle_read_in(m_doutBundle);
+        dedic_gpio_bundle_write(m_sclkBundle, clockMask, 0);
+        for (uint8_t side = SIDE_LEFT; side <= SIDE_RIGHT; side++)
+        {
+            if (clockMask & bit(side))
+            {
+                raw[side] = (raw[side] << 1) | ((levels >> side) & 1);
+            }
+        }
+        m_halfPeriod();
+    }
+
+    // Save the results.
+    for (uint8_t side = SIDE_LEFT; side <= SIDE_RIGHT; side++)
+    {
+        if (calibrateMask & bit(side))
+        {
+            // Remove the extra 2 bits
+            raw[side] >>= AMP_CALIBRATION_CLOCKS - AMP_BIT_DEPTH;
+        }
+        if (sideMask & bit(side))
+        {
+            m_raw[side] = raw[side];
+        }
+    }
+    m_calibrate &= ~calibrateMask; // Disable automatically.
+}
+
+inline void AmpReader::m_halfPeriod()
+{
+    const uint32_t start = esp_cpu_get_cycle_count();
+    while (esp_cpu_get_cycle_count() - start < m_halfPeriodCycles)
+    {
+    }
+}
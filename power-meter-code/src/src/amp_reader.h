@@ -0,0 +1,135 @@
+/**
+ * @file amp_reader.h
+ * @brief Reads both ADS1232 strain gauge amplifiers using dedicated GPIO bundles.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+
+#include "../defines.h"
+#include <driver/dedic_gpio.h>
+
+/**
+ * @brief Class that clocks data out of both ADS1232 ADCs.
+ *
+ * The SCLK and DOUT pins of both amplifiers are routed to the CPU's dedicated GPIO bundles so that both clocks can be
+ * toggled and both data lines sampled in single instructions. When both sides have raised data ready, one burst reads
+ * both sides at the same time. The bundles belong to the core that created them, so `begin()` must be called from the
+ * same core that the amp tasks calling `collect()` run on.
+ *
+ */
+class AmpReader
+{
+public:
+    /**
+     * @brief Construct a new Amp Reader object.
+     *
+     * @param leftDout the data out / data ready pin of the left amplifier.
+     * @param leftSclk the clock pin of the left amplifier.
+     * @param rightDout the data out / data ready pin of the right amplifier.
+     * @param rightSclk the clock pin of the right amplifier.
+     */
+    AmpReader(const uint8_t leftDout, const uint8_t leftSclk, const uint8_t rightDout, const uint8_t rightSclk)
+        : m_pinsDout{leftDout, rightDout}, m_pinsSclk{leftSclk, rightSclk} {}
+
+    /**
+     * @brief Sets the clock pins to outputs and creates the dedicated GPIO bundles on the current core.
+     *
+     * Calling `pinMode()` on any of the pins afterwards will disconnect them from the bundles. Does nothing if already
+     * started.
+     */
+    void begin();
+
+    /**
+     * @brief Records that a side has data ready. Call this from the data ready interrupt.
+     *
+     * @param side the side that has data ready.
+     * @param time the time of the interrupt (us).
+     */
+    void setReadyFromISR(EnumSide side, uint32_t time);
+
+    /**
+     * @brief Gets the time that a side last had data ready.
+     *
+     * @param side the side.
+     * @return uint32_t the time given to `setReadyFromISR()` (us).
+     */
+    uint32_t readyTime(EnumSide side) { return m_readyTime[side]; }
+
+    /**
+     * @brief Obtains the latest reading for a side.
+     *
+     * If the reading was already collected as part of a burst started by the other side, that reading is returned.
+     * Otherwise every side that currently has data ready is read in a single burst. Only call this after the data
+     * ready interrupt for the side has occurred.
+     *
+     * @param side the side to get the reading for.
+     * @return uint32_t the raw 24 bit reading.
+     */
+    uint32_t collect(EnumSide side);
+
+    /**
+     * @brief Tells the ADC on a side to perform offset calibration the next time data is read.
+     *
+     * This state will be automatically cleared afterwards.
+     *
+     * @param side the side to calibrate.
+     */
+    void enableOffsetCalibration(EnumSide side);
+
+    /**
+     * @brief Forgets that any side has data ready, such as after the ADCs have been reset.
+     *
+     * Only call this while the data ready interrupts are detached.
+     */
+    void clearReady();
+
+private:
+    /**
+     * @brief Clocks data out of the given sides simultaneously.
+     *
+     * @param sideMask bit mask of the sides to read (`bit(SIDE_LEFT)`, `bit(SIDE_RIGHT)`).
+     */
+    void m_burst(uint8_t sideMask);
+
+    /**
+     * @brief Busy waits for half a clock period.
+     *
+     */
+    inline void m_halfPeriod();
+
+    const uint8_t m_pinsDout[2], m_pinsSclk[2];
+
+    dedic_gpio_bundle_handle_t m_sclkBundle = NULL, m_doutBundle = NULL;
+    uint32_t m_halfPeriodCycles;
+
+    /**
+     * @brief Sides with data ready that have not been read yet (set by the interrupts).
+     *
+     */
+    volatile uint8_t m_pending = 0;
+
+    /**
+     * @brief Sides that were read as part of a burst started by the other side and not yet collected.
+     *
+     */
+    volatile uint8_t m_delivered = 0;
+
+    /**
+     * @brief Sides that will have offset calibration performed on the next read.
+     *
+     */
+    volatile uint8_t m_calibrate = 0;
+
+    uint32_t m_raw[2];
+
+    /**
+     * @brief Time each side last had data ready.
+     *
+     */
+    volatile uint32_t m_readyTime[2] = {0, 0};
+
+    portMUX_TYPE m_spinlock = portMUX_INITIALIZER_UNLOCKED;
+};
@@ -4,21 +4,59 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-28
+ * @date 2026-10-14
  */
 #include "config.h"
+#include "task_topology.h"
 extern SemaphoreHandle_t serialMutex;
 extern Preferences prefs;
 
 // Uses this to limit the maximum number of packets to queue.
 #include "connection_mqtt.h"
 
-void StrainConf::writeJSON(JsonObject json)
+// Everything here is kept out of Config as the whole object is saved to flash as is.
+static SemaphoreHandle_t configMutex = NULL; // Held while changing the calibration or copying it to save.
+static StaticSemaphore_t configMutexBuffer;
+static SemaphoreHandle_t saveMutex = NULL; // Held while writing to flash so that only one save happens at a time.
+static StaticSemaphore_t saveMutexBuffer;
+static uint8_t saveBuffer[sizeof(Config)]; // Copy being written, only used while holding saveMutex.
+static TaskHandle_t saveTaskHandle = NULL;
+static std::atomic<bool> savePending{false};
+static Calibration snapshots[CONF_SNAPSHOT_COUNT];
+static std::atomic<Calibration *> currentSnapshot{&snapshots[0]};
+static std::atomic<uint32_t> currentVersion{0}; // Set after currentSnapshot so it is never ahead of it.
+
+#define CONF_TAKE() xSemaphoreTake(configMutex, portMAX_DELAY)
+#define CONF_GIVE() xSemaphoreGive(configMutex)
+
+CalibrationReader::CalibrationReader()
 {
-    json["offset"] = offset;
-    json["coef"] = coefficient;
-    json["temp-test"] = tempTest;
-    json["temp-coef"] = tempCoefficient;
+    // Mark the current snapshot as being read, then check it is still the current one. If it isn't, the writer may
+    // have already chosen to reuse it, so try again with the new one.
+    while (true)
+    {
+        m_snapshot = currentSnapshot.load();
+        m_snapshot->readers++;
+        if (m_snapshot == currentSnapshot.load())
+        {
+            break;
+        }
+        m_snapshot->readers--;
+    }
+}
+
+CalibrationReader::~CalibrationReader()
+{
+    m_snapshot->readers--;
+}
+
+void StrainConf::writeJSON(JsonWriter &json) const
+{
+    json.addUInt("offset", offset);
+    json.addFloat("coef", coefficient);
+    json.addFloat("temp-test", tempTest);
+    json.addFloat("temp-coef", tempCoefficient);
+    json.addFloat("temp-coef2", tempCoefficient2);
 }
 
 void StrainConf::readJSON(JsonObject doc)
@@ -27,10 +65,40 @@ void StrainConf::readJSON(JsonObject doc)
     coefficient = doc["coef"];
     tempTest = doc["temp-test"];
     tempCoefficient = doc["temp-coef"];
+    tempCoefficient2 = doc["temp-coef2"];
+}
+
+void BackpressureConf::writeJSON(JsonWriter &json)
+{
+    json.addUInt("housekeeping", housekeeping);
+    json.addUInt("low-speed", lowSpeed);
+    json.addUInt("high-speed", highSpeed);
+    json.addUInt("imu", imu);
+}
+
+void BackpressureConf::readJSON(JsonObject doc)
+{
+    housekeeping = m_readPolicy(doc, "housekeeping", false, housekeeping);
+    lowSpeed = m_readPolicy(doc, "low-speed", false, lowSpeed);
+    highSpeed = m_readPolicy(doc, "high-speed", true, highSpeed);
+    imu = m_readPolicy(doc, "imu", true, imu);
+}
+
+uint8_t BackpressureConf::m_readPolicy(JsonObject doc, const char *key, bool canDecimate, uint8_t current)
+{
+    uint8_t proposed = doc[key] | current; // Keep the current policy if missing.
+    if (proposed <= BACKPRESSURE_DROP_OLDEST || (canDecimate && proposed == BACKPRESSURE_DECIMATE))
+    {
+        return proposed;
+    }
+    LOGW(CONF_KEY, "Backpressure policy %u isn't supported for '%s'. Ignoring this field.", proposed, key);
+    return current;
 }
 
 void Config::load()
 {
+    configMutex = xSemaphoreCreateMutexStatic(&configMutexBuffer);
+    saveMutex = xSemaphoreCreateMutexStatic(&saveMutexBuffer);
     LOGI(CONF_KEY, "Loading preferences");
     prefs.begin(CONF_KEY);
 
@@ -54,16 +122,101 @@ void Config::load()
         // Defaults should have been set on initialise
         save();
     }
+    m_publishCalibration();
 }
 
 void Config::save()
+{
+    savePending = true;
+    if (saveTaskHandle)
+    {
+        xTaskNotifyGive(saveTaskHandle);
+    }
+    else
+    {
+        flush();
+    }
+}
+
+void Config::flush()
+{
+    // Only hold the config mutex while copying. Writing to NVS can take tens of ms, which would hold up the amp task
+    // if it is setting an offset.
+    xSemaphoreTake(saveMutex, portMAX_DELAY);
+    if (savePending.exchange(false))
+    {
+        CONF_TAKE();
+        memcpy(saveBuffer, (const void *)this, sizeof(*this));
+        CONF_GIVE();
+        m_write(saveBuffer);
+    }
+    xSemaphoreGive(saveMutex);
+}
+
+void Config::runSaveTask()
+{
+    saveTaskHandle = xTaskGetCurrentTaskHandle();
+    taskStarted(TASK_CONFIG_SAVE);
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        // Give any other changes that are part of the same update a chance to arrive.
+        vTaskDelay(pdMS_TO_TICKS(CONF_SAVE_DELAY));
+        flush();
+    }
+}
+
+void Config::setStrainOffset(EnumSide side, uint32_t offset)
+{
+    CONF_TAKE();
+    strain[side].offset = offset;
+    m_publishCalibration();
+    CONF_GIVE();
+}
+
+uint32_t Config::calibrationVersion()
+{
+    return currentVersion.load();
+}
+
+void Config::m_write(const uint8_t *blob)
 {
     LOGI(CONF_KEY, "Saving preferences");
     prefs.begin(CONF_KEY);
-    prefs.putBytes(CONF_KEY, this, sizeof(*this));
+    prefs.putBytes(CONF_KEY, blob, sizeof(*this));
     LOGV(CONF_KEY, "Finished saving");
 }
 
+void Config::m_publishCalibration()
+{
+    // Find a snapshot that isn't current and isn't being read. Readers only keep them briefly, so if there isn't one,
+    // one will be free shortly.
+    Calibration *current = currentSnapshot.load();
+    Calibration *next = NULL;
+    while (!next)
+    {
+        for (uint8_t i = 0; i < CONF_SNAPSHOT_COUNT; i++)
+        {
+            if (&snapshots[i] != current && !snapshots[i].readers)
+            {
+                next = &snapshots[i];
+                break;
+            }
+        }
+        if (!next)
+        {
+            vTaskDelay(1);
+        }
+    }
+
+    next->version = current->version + 1;
+    next->strain[SIDE_LEFT] = strain[SIDE_LEFT];
+    next->strain[SIDE_RIGHT] = strain[SIDE_RIGHT];
+    currentSnapshot.store(next);
+    currentVersion.store(next->version);
+    LOGD(CONF_KEY, "Published calibration version %lu", next->version);
+}
+
 void Config::print()
 {
     char text[CONF_JSON_TEXT_LENGTH];
@@ -98,12 +251,16 @@ bool Config::readJSON(char *text, uint32_t length)
         return false;
     }
 
+    // Only one task may change the config at a time.
+    CONF_TAKE();
+
     // Handle each known connection method
     uint8_t connection = json["connection"];
     switch (connection)
     {
     case CONNECTION_MQTT:
     case CONNECTION_BLE:
+    case CONNECTION_ESPNOW:
         connectionMethod = (EnumConnection)connection;
         break;
     default:
@@ -117,6 +274,17 @@ bool Config::readJSON(char *text, uint32_t length)
 
     // How often to send IMU data
     imuHowOften = json["imuHowOften"];
+
+    // How many IMU samples to read from the FIFO at a time. Keep the current setting if missing.
+    uint8_t proposedWatermark = json["imu-watermark"] | imuWatermark;
+    if (proposedWatermark >= 1 && proposedWatermark <= IMU_FIFO_MAX_FRAMES)
+    {
+        imuWatermark = proposedWatermark;
+    }
+    else
+    {
+        LOGW(CONF_KEY, "IMU watermark of %u is outside 1 to " xstringify(IMU_FIFO_MAX_FRAMES) ". Ignoring this field.", proposedWatermark);
+    }
     // How long to wait before going to sleep. Set to 0 to disable sleep.
     uint16_t proposedSleepTime = json["sleep-time"];
     if (proposedSleepTime == 0 || proposedSleepTime > 20)
@@ -128,10 +296,41 @@ bool Config::readJSON(char *text, uint32_t length)
         LOGW(CONF_KEY, "For safety reasons, this sleep time (%ds) is too short to set.", proposedSleepTime);
     }
 
+    // Frequency scaling and light sleep. Keep the current setting if missing.
+    uint8_t proposedPowerSave = json["power-save"] | powerSave;
+    if (proposedPowerSave <= POWER_SAVE_LIGHT_SLEEP)
+    {
+        powerSave = proposedPowerSave;
+    }
+    else
+    {
+        LOGW(CONF_KEY, "Power save mode %u is not valid. Ignoring this field.", proposedPowerSave);
+    }
+
+    // Torque profiles. Keep the current settings if these are missing.
+    uint8_t proposedBins = json["profile-bins"] | profileBins;
+    if (proposedBins <= PROFILE_MAX_BINS)
+    {
+        profileBins = proposedBins;
+    }
+    else
+    {
+        LOGW(CONF_KEY, "%u torque profile bins is more than " xstringify(PROFILE_MAX_BINS) ". Ignoring this field.", proposedBins);
+    }
+    sendHighSpeed = json["high-speed"] | sendHighSpeed;
+
+    // Anti-aliased decimation of each stream. Keep the current rates if missing.
+    JsonObject rateDoc = json["output-rate"];
+    highSpeedRate = rateDoc["high-speed"] | highSpeedRate;
+    imuRate = rateDoc["imu"] | imuRate;
+
     // Read the strain gauge input data.
     strain[SIDE_LEFT].readJSON(json["left-strain"]);
     strain[SIDE_RIGHT].readJSON(json["right-strain"]);
 
+    // What to do when data can't be sent fast enough.
+    backpressure.readJSON(json["backpressure"]);
+
     // MQTT
     JsonVariant mqttDoc = json["mqtt"];
 
@@ -145,9 +344,58 @@ bool Config::readJSON(char *text, uint32_t length)
     {
         LOGW(CONF_KEY, "MQTT size of %u is greater than buffer of " stringify(MQTT_FAST_BUFFER) ". Ignoring this field.", proposedSize);
     }
+
+    // Get the high speed packet format. Keep the current one (legacy by default) if missing.
+    uint8_t proposedFormat = mqttDoc["format"] | mqttPacketFormat;
+    if (proposedFormat <= PACKET_FORMAT_PACKED)
+    {
+        mqttPacketFormat = proposedFormat;
+    }
+    else
+    {
+        LOGW(CONF_KEY, "Unrecognised MQTT packet format %u. Ignoring this field.", proposedFormat);
+    }
+
+    // Get the low speed format.
+    uint8_t proposedLowSpeedFormat = mqttDoc["low-speed-format"] | lowSpeedFormat;
+    if (proposedLowSpeedFormat <= LOW_SPEED_FORMAT_BINARY)
+    {
+        lowSpeedFormat = proposedLowSpeedFormat;
+    }
+    else
+    {
+        LOGW(CONF_KEY, "Unrecognised low speed format %u. Ignoring this field.", proposedLowSpeedFormat);
+    }
+
     // Get the broker.
     m_safeReadString(mqttBroker, mqttDoc["broker"], CONF_MQTT_BROKER_MAX_LENGTH);
 
+    // ESP-NOW receiver. Keep the current settings if these are missing.
+    JsonVariant espnowDoc = json["espnow"];
+    const char *peer = espnowDoc["peer"];
+    if (peer)
+    {
+        uint8_t proposedPeer[6];
+        if (sscanf(peer, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &proposedPeer[0], &proposedPeer[1], &proposedPeer[2],
+                   &proposedPeer[3], &proposedPeer[4], &proposedPeer[5]) == 6)
+        {
+            memcpy(espnowPeer, proposedPeer, sizeof(espnowPeer));
+        }
+        else
+        {
+            LOGW(CONF_KEY, "ESP-NOW peer '%s' is not a MAC address. Ignoring this field.", peer);
+        }
+    }
+    uint8_t proposedChannel = espnowDoc["channel"] | espnowChannel;
+    if (proposedChannel >= 1 && proposedChannel <= 13)
+    {
+        espnowChannel = proposedChannel;
+    }
+    else
+    {
+        LOGW(CONF_KEY, "ESP-NOW channel %u is outside 1 to 13. Ignoring this field.", proposedChannel);
+    }
+
     // Get the WiFi SSID and password
     JsonVariant wifiDoc = json["wifi"];
     // Guard against someone sending redacted credentials back to this device.
@@ -160,62 +408,97 @@ bool Config::readJSON(char *text, uint32_t length)
     {
         LOGW(CONF_KEY, "WiFi settings were redacted, will not update.");
     }
+
+    // The sample path picks up the new calibration from the next reading.
+    m_publishCalibration();
+    CONF_GIVE();
     return true;
 }
 
 void Config::writeJSON(char *text, uint32_t length, bool showWiFi)
 {
-    JsonDocument doc;
-    writeJSON(doc, showWiFi);
-    serializeJson(doc, text, length);
+    JsonWriter json(text, length);
+    writeJSON(json, showWiFi);
 }
 
-void Config::writeJSON(JsonVariant doc, bool showWiFi)
+void Config::writeJSON(JsonWriter &json, bool showWiFi, const char *key)
 {
-    // Useful: https://arduinojson.org/v7/assistant
-    doc["connection"] = connectionMethod;
+    json.beginObject(key);
+    json.addUInt("connection", connectionMethod);
 
     // Kalman filter
-    JsonObject kalman = doc["kalman"].to<JsonObject>();
-    JsonArray kalmanQ = kalman["Q"].to<JsonArray>();
-    m_writeMatrix(kalmanQ, qEnvCovariance);
-
-    JsonArray kalmanR = kalman["R"].to<JsonArray>();
-    m_writeMatrix(kalmanR, rMeasCovariance);
+    json.beginObject("kalman");
+    m_writeMatrix(json, "Q", qEnvCovariance);
+    m_writeMatrix(json, "R", rMeasCovariance);
+    json.endObject();
 
     // How often to record IMU data.
-    doc["imuHowOften"] = imuHowOften;
+    json.addInt("imuHowOften", imuHowOften);
+    json.addUInt("imu-watermark", imuWatermark);
     // How long to wait before going to sleep. Set to 0 to disable sleep.
-    doc["sleep-time"] = sleepTime;
+    json.addUInt("sleep-time", sleepTime);
+    json.addUInt("power-save", powerSave);
+
+    // Read configs for each side from the current snapshot so that they are consistent.
+    {
+        CalibrationReader calibration;
+        json.beginObject("left-strain");
+        calibration->strain[SIDE_LEFT].writeJSON(json);
+        json.endObject();
+
+        json.beginObject("right-strain");
+        calibration->strain[SIDE_RIGHT].writeJSON(json);
+        json.endObject();
+    }
+
+    // Torque profiles and whether the raw data is also sent.
+    json.addUInt("profile-bins", profileBins);
+    json.addBool("high-speed", sendHighSpeed);
 
-    // Read configs for each side.
-    JsonObject leftStrain = doc["left-strain"].to<JsonObject>();
-    strain[SIDE_LEFT].writeJSON(leftStrain);
+    json.beginObject("output-rate");
+    json.addUInt("high-speed", highSpeedRate);
+    json.addUInt("imu", imuRate);
+    json.endObject();
 
-    JsonObject rightStrain = doc["right-strain"].to<JsonObject>();
-    strain[SIDE_RIGHT].writeJSON(rightStrain);
+    json.beginObject("backpressure");
+    backpressure.writeJSON(json);
+    json.endObject();
 
     // Read MQTT conf
-    JsonObject mqtt = doc["mqtt"].to<JsonObject>();
-    mqtt["length"] = mqttPacketSize;
-    mqtt["broker"] = mqttBroker;
+    json.beginObject("mqtt");
+    json.addUInt("length", mqttPacketSize);
+    json.addUInt("format", mqttPacketFormat);
+    json.addUInt("low-speed-format", lowSpeedFormat);
+    json.addString("broker", mqttBroker);
+    json.endObject();
+
+    // ESP-NOW receiver.
+    char peer[18];
+    snprintf(peer, sizeof(peer), "%02x:%02x:%02x:%02x:%02x:%02x", espnowPeer[0], espnowPeer[1], espnowPeer[2],
+             espnowPeer[3], espnowPeer[4], espnowPeer[5]);
+    json.beginObject("espnow");
+    json.addString("peer", peer);
+    json.addUInt("channel", espnowChannel);
+    json.endObject();
 
     // WiFi conf (if allowed to divulge such secrets).
-    JsonObject wifi = doc["wifi"].to<JsonObject>();
+    json.beginObject("wifi");
     if (showWiFi)
     {
         // Send the details.
-        wifi["ssid"] = wifiSSID;
-        wifi["psk"] = wifiPSK;
-        wifi["redacted"] = false;
+        json.addString("ssid", wifiSSID);
+        json.addString("psk", wifiPSK);
+        json.addBool("redacted", false);
     }
     else
     {
         // Don't send WiFi details.
-        wifi["ssid"] = "";
-        wifi["psk"] = "";
-        wifi["redacted"] = true;
+        json.addString("ssid", "");
+        json.addString("psk", "");
+        json.addBool("redacted", true);
     }
+    json.endObject();
+    json.endObject();
 }
 
 void Config::toggleConnection()
@@ -225,6 +508,11 @@ void Config::toggleConnection()
         connectionMethod = CONNECTION_BLE;
         LOGI("Config", "Setting connection method to BLE.");
     }
+    else if (connectionMethod == CONNECTION_BLE)
+    {
+        connectionMethod = CONNECTION_ESPNOW;
+        LOGI("Config", "Setting connection method to ESP-NOW.");
+    }
     else
     {
         connectionMethod = CONNECTION_MQTT;
@@ -235,7 +523,10 @@ void Config::toggleConnection()
 void Config::removeKey()
 {
     LOGI(CONF_KEY, "Removing key from storage.");
+    CONF_TAKE();
+    savePending = false; // Otherwise the key would be written again.
     prefs.remove(CONF_KEY);
+    CONF_GIVE();
 }
 
 inline void Config::m_safeReadString(char *dest, const char *source, size_t maxLength)
@@ -247,16 +538,22 @@ inline void Config::m_safeReadString(char *dest, const char *source, size_t maxL
     dest[maxLength - 1] = '\0';
 }
 
-void Config::m_writeMatrix(JsonArray jsonArray, Matrix<2, 2, float> matrix)
+void Config::m_writeMatrix(JsonWriter &json, const char *key, Matrix<2, 2, float> matrix)
 {
+    json.beginArray(key);
+
     // Top row
-    JsonArray topRow = jsonArray.add<JsonArray>();
-    topRow.add(matrix(0, 0));
-    topRow.add(matrix(0, 1));
+    json.beginArray();
+    json.addFloat(nullptr, matrix(0, 0));
+    json.addFloat(nullptr, matrix(0, 1));
+    json.endArray();
+
+    json.beginArray();
+    json.addFloat(nullptr, matrix(1, 0));
+    json.addFloat(nullptr, matrix(1, 1));
+    json.endArray();
 
-    JsonArray bottomRow = jsonArray.add<JsonArray>();
-    bottomRow.add(matrix(1, 0));
-    bottomRow.add(matrix(1, 1));
+    json.endArray();
 }
 
 Matrix<2, 2, float> Config::m_readMatrix(JsonArray jsonArray)
@@ -272,3 +569,9 @@ Matrix<2, 2, float> Config::m_readMatrix(JsonArray jsonArray)
 
     return matrix;
 }
+
+void taskConfigSave(void *pvParameters)
+{
+    Config *config = (Config *)pvParameters;
+    config->runSaveTask();
+}
@@ -4,17 +4,22 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-28
+ * @date 2026-10-14
  */
 #pragma once
 #include "../defines.h"
+#include "data_points.h"
 #include <BasicLinearAlgebra.h>
 #include <Preferences.h>
 #include <ArduinoJson.h>
+#include "json_writer.h"
+#include <atomic>
 using namespace BLA;
 
 #define CONF_KEY "power-conf"
 #define CONF_JSON_TEXT_LENGTH 1000
+#define CONF_SNAPSHOT_COUNT 4  // Calibration snapshots in the pool (the current one plus any still being read).
+#define CONF_SAVE_DELAY 500    // Time to wait after a change before saving, so that bursts of changes are saved once (ms).
 
 /**
  * @brief Class that bundles all the configs / calibration settings for a strain gauge.
@@ -24,11 +29,11 @@ class StrainConf
 {
 public:
     /**
-     * @brief Writes the strain gauge config to a JsonObject.
+     * @brief Writes the strain gauge config into the current object of a JsonWriter.
      *
-     * @param json is the object to write to.
+     * @param json is the writer to use.
      */
-    void writeJSON(JsonObject json);
+    void writeJSON(JsonWriter &json) const;
 
     /**
      * @brief Reads a JSON document into this object.
@@ -41,6 +46,90 @@ public:
     float coefficient = DEFAULT_STRAIN_COEFFICIENT;
     float tempTest = DEFAULT_STRAIN_TEST_TEMP;
     float tempCoefficient = DEFAULT_STRAIN_TEMP_CO;
+    float tempCoefficient2 = 0; // Quadratic temperature coefficient (per degree squared).
+};
+
+/**
+ * @brief Immutable copy of the calibration used by the sample path.
+ *
+ * A new snapshot is published each time the calibration changes. Readers use `CalibrationReader` so they never see a
+ * half updated calibration and never wait for the task that is updating it.
+ *
+ */
+struct Calibration
+{
+    uint32_t version = 0; // Goes up by one each time a new snapshot is published.
+    StrainConf strain[2];
+    std::atomic<uint8_t> readers{0}; // Number of CalibrationReaders using this snapshot.
+};
+
+/**
+ * @brief Gives access to the current calibration snapshot for as long as this object exists.
+ *
+ * The snapshot won't be reused for a newer calibration until every reader of it has been destroyed. Keep these short
+ * lived (for example a local variable while processing a sample).
+ *
+ */
+class CalibrationReader
+{
+public:
+    CalibrationReader();
+    ~CalibrationReader();
+    CalibrationReader(const CalibrationReader &) = delete;
+    CalibrationReader &operator=(const CalibrationReader &) = delete;
+
+    const Calibration *operator->() const { return m_snapshot; }
+
+private:
+    Calibration *m_snapshot;
+};
+
+/**
+ * @brief What to do when data arrives faster than a connection can send it.
+ *
+ */
+#define BACKPRESSURE_DROP_NEWEST 0 // Reject new data while full (original behaviour).
+#define BACKPRESSURE_DROP_OLDEST 1 // Discard the oldest waiting data so the newest is kept.
+#define BACKPRESSURE_DECIMATE 2    // Thin the data out while under sustained pressure (high speed and IMU data only).
+
+/**
+ * @brief Class that bundles the backpressure policy for each stream of data.
+ *
+ */
+class BackpressureConf
+{
+public:
+    /**
+     * @brief Writes the backpressure config into the current object of a JsonWriter.
+     *
+     * @param json is the writer to use.
+     */
+    void writeJSON(JsonWriter &json);
+
+    /**
+     * @brief Reads a JSON document into this object. If a field is missing or not allowed for that stream, the current
+     * value is kept.
+     *
+     * @param doc The document to read data from.
+     */
+    void readJSON(JsonObject doc);
+
+    uint8_t housekeeping = BACKPRESSURE_DROP_NEWEST;
+    uint8_t lowSpeed = BACKPRESSURE_DROP_NEWEST;
+    uint8_t highSpeed = BACKPRESSURE_DROP_NEWEST;
+    uint8_t imu = BACKPRESSURE_DROP_NEWEST;
+
+private:
+    /**
+     * @brief Reads and checks a single policy.
+     *
+     * @param doc the document to read from.
+     * @param key the key of the policy.
+     * @param canDecimate whether `BACKPRESSURE_DECIMATE` is allowed for this stream.
+     * @param current the current policy, kept if the new one is missing or invalid.
+     * @return uint8_t the policy to use.
+     */
+    uint8_t m_readPolicy(JsonObject doc, const char *key, bool canDecimate, uint8_t current);
 };
 
 #define CONF_WIFI_SSID_MAX_LENGTH 40   // Includes terminating null.
@@ -61,11 +150,41 @@ public:
     void load();
 
     /**
-     * @brief Saves the preferences to flash memory.
+     * @brief Saves the preferences to flash memory in the background so that the caller isn't held up by the write.
+     *
+     * Before the save task has started, this saves straight away. Call `flush()` before rebooting or sleeping so that
+     * a pending save isn't lost.
      *
      */
     void save();
 
+    /**
+     * @brief Saves the preferences now if a save is pending.
+     *
+     */
+    void flush();
+
+    /**
+     * @brief Runs the task that saves the preferences in the background.
+     *
+     */
+    void runSaveTask();
+
+    /**
+     * @brief Sets the zero offset of a strain gauge and publishes a new calibration snapshot.
+     *
+     * @param side the side.
+     * @param offset the raw reading when no torque is applied.
+     */
+    void setStrainOffset(EnumSide side, uint32_t offset);
+
+    /**
+     * @brief The version of the current calibration snapshot. This is cheap to check, so can be used to tell when
+     * anything calculated from the calibration needs updating.
+     *
+     */
+    static uint32_t calibrationVersion();
+
     /**
      * @brief Prints the current settings loaded into RAM.
      *
@@ -97,14 +216,16 @@ public:
     void writeJSON(char *text, uint32_t length, bool showWiFi = false);
 
     /**
-     * @brief Writes the config to a JSON object.
+     * @brief Writes the config as an object using a JsonWriter.
      *
-     * @param json is the object to write to.
+     * @param json is the writer to use.
+     * @param showWiFi whether to include the WiFi credentials.
+     * @param key the key of the object in its parent (nullptr at the top level).
      */
-    void writeJSON(JsonVariant doc, bool showWiFi = false);
+    void writeJSON(JsonWriter &json, bool showWiFi = false, const char *key = nullptr);
 
     /**
-     * @brief Toggles the connection between WiFi / MQTT and BLE.
+     * @brief Cycles the connection between WiFi / MQTT, BLE and ESP-NOW.
      *
      */
     void toggleConnection();
@@ -119,12 +240,23 @@ public:
     Matrix<2, 2, float> qEnvCovariance = DEFAULT_KALMAN_Q;
     Matrix<2, 2, float> rMeasCovariance = DEFAULT_KALMAN_R;
     int8_t imuHowOften = 1; // Set to -1 to disable sending IMU data.
-    StrainConf strain[2];
+    uint8_t imuWatermark = 1; // Number of IMU samples to wait for before reading the FIFO.
+    StrainConf strain[2]; // Editable calibration. The sample path must use a CalibrationReader instead.
     uint16_t mqttPacketSize = 50;
+    uint8_t mqttPacketFormat = PACKET_FORMAT_LEGACY; // Format of high speed packets (see data_points.h).
+    uint8_t lowSpeedFormat = LOW_SPEED_FORMAT_JSON;  // Format of low speed messages (see data_points.h).
     char wifiSSID[CONF_WIFI_SSID_MAX_LENGTH] = DEFAULT_WIFI_SSID;
     char wifiPSK[CONF_WIFI_PSK_MAX_LENGTH] = DEFAULT_WIFI_PASSWORD;
     char mqttBroker[CONF_MQTT_BROKER_MAX_LENGTH] = DEFAULT_MQTT_BROKER;
+    uint8_t espnowPeer[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff}; // Receiver's MAC address (broadcast by default).
+    uint8_t espnowChannel = 1; // WiFi channel the receiver listens on (1 to 13).
     uint16_t sleepTime = DEFAULT_SLEEP_TIME;
+    uint8_t powerSave = POWER_SAVE_DFS; // Power save mode (POWER_SAVE_OFF, POWER_SAVE_DFS or POWER_SAVE_LIGHT_SLEEP).
+    BackpressureConf backpressure;
+    uint8_t profileBins = 36; // Number of angular bins in each torque profile. Set to 0 to disable profiles.
+    bool sendHighSpeed = true; // Set to false to only send torque profiles and not the raw high speed data.
+    uint16_t highSpeedRate = 0; // Rate to filter and decimate high speed data down to (Hz). 0 sends every reading.
+    uint16_t imuRate = 0;       // Same for IMU data. Replaces imuHowOften when not 0.
     // TODO: device name, MQTT prefix.
 
 private:
@@ -138,12 +270,13 @@ private:
     void m_safeReadString(char *dest, const char *source, size_t maxLength);
 
     /**
-     * @brief Writes a matrix to a json document.
+     * @brief Writes a matrix as an array of rows.
      *
-     * @param json JSON array to write to.
+     * @param json the writer to use.
+     * @param key the key of the array.
      * @param matrix Matrix to use values from.
      */
-    void m_writeMatrix(JsonArray jsonArray, Matrix<2, 2, float> matrix);
+    void m_writeMatrix(JsonWriter &json, const char *key, Matrix<2, 2, float> matrix);
 
     /**
      * @brief Reads a 2x2 matrix from a JSON array.
@@ -152,4 +285,24 @@ private:
      * @return Matrix<2, 2, float> the matrix.
      */
     Matrix<2, 2, float> m_readMatrix(JsonArray jsonArray);
-};
\ No newline at end of file
+
+    /**
+     * @brief Writes a copy of the preferences to flash memory. The save mutex must be held.
+     *
+     * @param blob the copy to write, taken while holding the config mutex.
+     */
+    void m_write(const uint8_t *blob);
+
+    /**
+     * @brief Copies `strain` into an unused snapshot and makes it the current one. The config mutex must be held.
+     *
+     */
+    void m_publishCalibration();
+};
+
+/**
+ * @brief Task that saves the config in the background.
+ *
+ * @param pvParameters the Config object.
+ */
+void taskConfigSave(void *pvParameters);
\ No newline at end of file
@@ -4,20 +4,22 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-10
+ * @date 2026-10-14
  */
 #include "connection_ble.h"
+#include "power_manager.h"
 extern SemaphoreHandle_t serialMutex;
 #include "power_meter.h"
 extern PowerMeter powerMeter;
 
 void BLEConnection::begin()
 {
-    // Initialise the queues. Don't use high speed data.
+    // Initialise the queues.
     const int housekeeping = 1;
     const int lowSpeed = 1;
-    const int highSpeed = 0;
-    const int imu = 0;
+    const int highSpeed = BLE_STREAM_BUFFER;
+    const int imu = BLE_STREAM_BUFFER;
+    static_assert(storageSize(housekeeping, lowSpeed, highSpeed, imu) <= CONN_ARENA_SIZE, "BLE buffers don't fit in CONN_ARENA_SIZE");
     Connection::begin(housekeeping, lowSpeed, highSpeed, imu);
 
     if (!BLE.begin())
@@ -29,16 +31,27 @@ void BLEConnection::begin()
     LOGD("BLE", "Feature characteristic is '0x%8lx'", BLEFeatureCharacteristic::CHARACTERISTIC);
 
     BLE.setLocalName(DEVICE_NAME);
+
+    // Ask for a short connection interval so that the high speed data can keep up. The central has the final say.
+    BLE.setConnectionInterval(BLE_CONN_INTERVAL_MIN, BLE_CONN_INTERVAL_MAX);
     BLE.setAdvertisedService(m_cyclingPowerService);
     m_cyclingPowerService.addCharacteristic(m_cpsMeasurement);
     m_cyclingPowerService.addCharacteristic(m_cpsFeature);
     m_cyclingPowerService.addCharacteristic(m_cpsLocation);
     BLE.addService(m_cyclingPowerService); // TODO: Add battery service
-    // TODO: Finish up
+
+    // High speed data. Not advertised as there isn't room for another 128 bit UUID.
+    m_streamService.addCharacteristic(m_streamLeft);
+    m_streamService.addCharacteristic(m_streamRight);
+    m_streamService.addCharacteristic(m_streamIMU);
+    BLE.addService(m_streamService);
 }
 
-void BLEConnection::runActive()
+TickType_t BLEConnection::runActive()
 {
+    // Make room in buffers that keep the newest data.
+    trimBuffers();
+
     // Check the housekeeping queue
     HousekeepingData housekeeping;
     if (xQueueReceive(m_housekeepingQueue, &housekeeping, 0))
@@ -73,16 +86,84 @@ void BLEConnection::runActive()
 
         // Send
         m_cpsMeasurement.writeValue(m_measData, sizeof(m_measData));
-
-        // TODO: Send these less often?
-        m_cpsFeature.writeValue(m_featData, sizeof(m_featData));
-        // Set the location of the sensor. Left crank is as good as anywhere. We ideally want a location for cranks in
-        // general, but have to choose between left (5) and right (6). A spider-based power meter (15) or pedal-based
-        // (7 & 8) may be fitted, so don't wish to cause confusion by using these locations. See section 3.196.1 of the
-        // GATT specification supplement for more options.
-        m_cpsLocation.writeValue(5);
         powerMeter.leds.setConnState(CONN_STATE_ACTIVE);
     }
+
+    // High speed data
+    const uint16_t payloadSize = m_payloadSize();
+    m_notifyRecords(m_streamLeft, m_sideBuffers[SIDE_LEFT], STREAM_LEFT, payloadSize);
+    m_notifyRecords(m_streamRight, m_sideBuffers[SIDE_RIGHT], STREAM_RIGHT, payloadSize);
+    m_notifyRecords(m_streamIMU, m_imuBuffer, STREAM_IMU, payloadSize);
+
+    // Go around again straight away if there is more to send, otherwise sleep until there is.
+    return isDataWaiting() ? 0 : pdMS_TO_TICKS(BLE_IDLE_POLL_MS);
+}
+
+void BLEConnection::m_writeStaticCharacteristics()
+{
+    m_cpsFeature.writeValue(m_featData, sizeof(m_featData));
+    // Set the location of the sensor. Left crank is as good as anywhere. We ideally want a location for cranks in
+    // general, but have to choose between left (5) and right (6). A spider-based power meter (15) or pedal-based
+    // (7 & 8) may be fitted, so don't wish to cause confusion by using these locations. See section 3.196.1 of the
+    // GATT specification supplement for more options.
+    m_cpsLocation.writeValue(5);
+}
+
+uint16_t BLEConnection::m_payloadSize()
+{
+    // ArduinoBLE doesn't expose the connection handle, so look it up from the address of the central. The address
+    // string is most significant byte first, the opposite of how it is stored.
+    uint16_t mtu = BLE_DEFAULT_MTU;
+    uint8_t address[6];
+    if (sscanf(m_central.address().c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+               &address[5], &address[4], &address[3], &address[2], &address[1], &address[0]) == 6)
+    {
+        // The address type isn't exposed either, so try public (0) then random (1).
+        for (uint8_t addressType = 0; addressType <= 1; addressType++)
+        {
+            const uint16_t handle = ATT.connectionHandle(addressType, address);
+            if (handle != 0xffff)
+            {
+                mtu = ATT.mtu(handle);
+                break;
+            }
+        }
+    }
+
+    const uint16_t payloadSize = mtu - BLE_ATT_HEADER;
+    return payloadSize < BLE_STREAM_MAX_PAYLOAD ? payloadSize : BLE_STREAM_MAX_PAYLOAD;
+}
+
+template <typename T>
+void BLEConnection::m_notifyRecords(BLECharacteristic &characteristic, RingBuffer<T> &ring, EnumStream stream, uint16_t payloadSize)
+{
+    const uint16_t maxCount = payloadSize > T::PACKED_HEADER_SIZE ? (payloadSize - T::PACKED_HEADER_SIZE) / T::PACKED_BYTES_SIZE : 0;
+    setReadyThreshold(stream, maxCount); // The MTU may have changed.
+    if (!characteristic.subscribed() || !maxCount)
+    {
+        ring.pop(ring.available());
+        return;
+    }
+
+    // Wait until a notification can be filled.
+    if (ring.available() < maxCount)
+    {
+        return;
+    }
+
+    // Fill the notification with as many records as fit in a packed packet.
+    const uint16_t count = countPackable(ring, maxCount);
+    uint8_t buffer[BLE_STREAM_MAX_PAYLOAD];
+    BufferWriter writer(buffer);
+    m_streamRecords(writer, ring, count, true, T::PACKED_BYTES_SIZE);
+
+    powerMeter.leds.setConnState(CONN_STATE_SENDING);
+    PM_LOCK(PM_LOCK_RADIO);
+    isTransmitting = true;
+    characteristic.writeValue(buffer, writer.length());
+    isTransmitting = false;
+    PM_UNLOCK(PM_LOCK_RADIO);
+    powerMeter.leds.setConnState(CONN_STATE_ACTIVE);
 }
 
 uint16_t BLEConnection::m_scaleTime1024(uint32_t us)
@@ -119,11 +200,16 @@ State *BLEConnection::StateActive::enter()
 {
     m_connection.setAllowData(true);
     powerMeter.leds.setConnState(CONN_STATE_ACTIVE);
-    while (m_connection.m_central.connected() && !m_connection.isDisableWaiting(1))
+
+    // These don't change, so only need to be written once per connection.
+    m_connection.m_writeStaticCharacteristics();
+    // Sleep until there is data to send. Checking the connection also polls ArduinoBLE.
+    TickType_t wait = 0;
+    while (m_connection.m_central.connected() && !m_connection.isDisableWaiting(wait))
     {
-        // Check each queue and send data if present. Queue sets could be useful here.
+        // Check each queue and send data if present.
         // Call a function in the connection so that we have more convenient access to the queues.
-        m_connection.runActive();
+        wait = m_connection.runActive();
     }
     LOGI("BLE", "Lost connection");
     return &m_connection.m_stateBLEConnect;
@@ -4,12 +4,32 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-04
+ * @date 2026-10-14
  */
 #pragma once
 #include "../defines.h"
 #include "connections.h"
 #include <ArduinoBLE.h>
+#include <utility/ATT.h>
+
+/**
+ * @brief Vendor service for streaming packed high speed and IMU data.
+ *
+ * Each characteristic notifies complete packed packets (see `documents/ble_stream.md`), so each notification can be
+ * decoded on its own.
+ */
+#define BLE_STREAM_SERVICE_UUID "6d680001-7077-4d31-9a3c-2b1f5e8c0a01"
+#define BLE_STREAM_LEFT_UUID "6d680002-7077-4d31-9a3c-2b1f5e8c0a01"
+#define BLE_STREAM_RIGHT_UUID "6d680003-7077-4d31-9a3c-2b1f5e8c0a01"
+#define BLE_STREAM_IMU_UUID "6d680004-7077-4d31-9a3c-2b1f5e8c0a01"
+
+#define BLE_STREAM_BUFFER 200      // Records to buffer for each stream while waiting for enough to fill a notification.
+#define BLE_STREAM_MAX_PAYLOAD 244 // Largest notification (MTU of 247 less the 3 byte ATT header).
+#define BLE_ATT_HEADER 3           // Bytes of each notification used by the ATT header.
+#define BLE_DEFAULT_MTU 23         // MTU until the central requests a larger one.
+#define BLE_CONN_INTERVAL_MIN 6    // Preferred connection interval in 1.25ms units (7.5ms).
+#define BLE_CONN_INTERVAL_MAX 12   // 15ms.
+#define BLE_IDLE_POLL_MS 15        // ArduinoBLE only handles controller events when polled, so check once per interval (ms).
 
 /**
  * @brief Bits / config flags for the Cycling Power Measurement Characteristic.
@@ -116,7 +136,11 @@ public:
     BLEConnection()
         : Connection(m_stateBLEConnect), m_stateBLEConnect(*this), m_stateActive(*this), m_stateShutdown(*this),
           m_cyclingPowerService("1818"), m_cpsLocation("2A5D", BLERead), m_cpsFeature("2A65", BLERead, sizeof(m_featData)),
-          m_cpsMeasurement("2A63", BLERead | BLENotify, sizeof(m_measData)) {}
+          m_cpsMeasurement("2A63", BLERead | BLENotify, sizeof(m_measData)),
+          m_streamService(BLE_STREAM_SERVICE_UUID),
+          m_streamLeft(BLE_STREAM_LEFT_UUID, BLERead | BLENotify, BLE_STREAM_MAX_PAYLOAD),
+          m_streamRight(BLE_STREAM_RIGHT_UUID, BLERead | BLENotify, BLE_STREAM_MAX_PAYLOAD),
+          m_streamIMU(BLE_STREAM_IMU_UUID, BLERead | BLENotify, BLE_STREAM_MAX_PAYLOAD) {}
 
     /**
      * @brief Initialises the connection
@@ -128,8 +152,10 @@ protected:
     /**
      * @brief Checks the queues and acts on any new messages to publish.
      *
+     * @return TickType_t the longest time the connection task can sleep before calling this again if it isn't
+     *                    notified (0 if there is more to send straight away).
      */
-    void runActive();
+    TickType_t runActive();
 
     /**
      * @brief State for connecting to a central BLE device (bike computer).
@@ -284,7 +310,45 @@ protected:
 
     BLEDevice m_central;
 
+    /**
+     * @brief Vendor service and characteristics for streaming high speed data.
+     *
+     */
+    BLEService m_streamService;
+    BLECharacteristic m_streamLeft;
+    BLECharacteristic m_streamRight;
+    BLECharacteristic m_streamIMU;
+
 private:
+    /**
+     * @brief Notifies a packed packet of the oldest records in a ring buffer once there are enough to fill it.
+     *
+     * If nobody is subscribed or the MTU is too small to fit a record, waiting records are discarded so that the
+     * buffer doesn't fill up.
+     *
+     * @param characteristic the characteristic to notify on.
+     * @param ring the ring buffer to take records from.
+     * @param stream the stream the ring buffer is for, so the connection task is woken when a notification is full.
+     * @param payloadSize the largest notification that can be sent.
+     */
+    template <typename T>
+    void m_notifyRecords(BLECharacteristic &characteristic, RingBuffer<T> &ring, EnumStream stream, uint16_t payloadSize);
+
+    /**
+     * @brief Gets the largest notification that can currently be sent to the central.
+     *
+     * This depends on the MTU, which the central may change after connecting.
+     *
+     * @return uint16_t the number of bytes, up to `BLE_STREAM_MAX_PAYLOAD`.
+     */
+    uint16_t m_payloadSize();
+
+    /**
+     * @brief Writes the characteristics that don't change.
+     *
+     */
+    void m_writeStaticCharacteristics();
+
     /**
      * @brief Scales the given time in us to 1/1024 second units for BLE transmission.
      *
@@ -0,0 +1,227 @@
+/**
+ * @file connection_espnow.cpp
+ * @brief Class to handle sending data to a paired receiver on the bike over ESP-NOW.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "connection_espnow.h"
+#include "power_manager.h"
+#include "config.h"
+#include <WiFi.h>
+#include <esp_wifi.h>
+extern SemaphoreHandle_t serialMutex;
+extern Config config;
+#include "power_meter.h"
+extern PowerMeter powerMeter;
+
+SemaphoreHandle_t ESPNowConnection::m_sendDone = NULL;
+StaticSemaphore_t ESPNowConnection::m_sendDoneBuffer;
+std::atomic<uint32_t> ESPNowConnection::m_failedFrames{0};
+
+void ESPNowConnection::begin()
+{
+    // Initialise the queues.
+    const int housekeeping = 1;
+    const int lowSpeed = 2;
+    const int highSpeed = ESPNOW_STREAM_BUFFER;
+    const int imu = ESPNOW_STREAM_BUFFER;
+    static_assert(storageSize(housekeeping, lowSpeed, highSpeed, imu) <= CONN_ARENA_SIZE, "ESP-NOW buffers don't fit in CONN_ARENA_SIZE");
+    Connection::begin(housekeeping, lowSpeed, highSpeed, imu);
+
+    m_sendDone = xSemaphoreCreateBinaryStatic(&m_sendDoneBuffer);
+    LOGI("ESPNow", "Sending to %02x:%02x:%02x:%02x:%02x:%02x on channel %u", config.espnowPeer[0],
+         config.espnowPeer[1], config.espnowPeer[2], config.espnowPeer[3], config.espnowPeer[4],
+         config.espnowPeer[5], config.espnowChannel);
+}
+
+TickType_t ESPNowConnection::runActive()
+{
+    // Make room in buffers that keep the newest data.
+    trimBuffers();
+
+    // Housekeeping isn't sent to the receiver. Take it off the queue so it doesn't fill up.
+    HousekeepingData housekeeping;
+    xQueueReceive(m_housekeepingQueue, &housekeeping, 0);
+
+    // Low speed data is sent as soon as it arrives.
+    LowSpeedData lowSpeed;
+    if (xQueueReceive(m_lowSpeedQueue, &lowSpeed, 0))
+    {
+        uint8_t frame[ESPNOW_FRAME_HEADER + LowSpeedData::LOW_SPEED_BYTES_SIZE];
+        lowSpeed.toBytes(frame + ESPNOW_FRAME_HEADER);
+        m_sendFrame(ESPNOW_FRAME_LOW_SPEED, frame, sizeof(frame));
+    }
+
+    // High speed data
+    uint32_t wait = CONN_IDLE_POLL_MS;
+    m_sendRecords(ESPNOW_FRAME_LEFT, m_sideBuffers[SIDE_LEFT], STREAM_LEFT, wait);
+    m_sendRecords(ESPNOW_FRAME_RIGHT, m_sideBuffers[SIDE_RIGHT], STREAM_RIGHT, wait);
+    m_sendRecords(ESPNOW_FRAME_IMU, m_imuBuffer, STREAM_IMU, wait);
+
+    // Sleep until a frame fills up or the oldest record is due, whatever comes first.
+    return isDataWaiting() ? 0 : pdMS_TO_TICKS(wait);
+}
+
+bool ESPNowConnection::m_start()
+{
+    // ESP-NOW needs the radio running, but not connected to anything.
+    WiFi.mode(WIFI_STA);
+    WiFi.disconnect(false, false);
+    esp_err_t result = esp_wifi_set_channel(config.espnowChannel, WIFI_SECOND_CHAN_NONE);
+    if (result != ESP_OK)
+    {
+        LOGE("ESPNow", "Couldn't set the channel to %u (error %d)", config.espnowChannel, result);
+        return false;
+    }
+
+    result = esp_now_init();
+    if (result != ESP_OK)
+    {
+        LOGE("ESPNow", "Couldn't start ESP-NOW (error %d)", result);
+        return false;
+    }
+    m_started = true;
+    esp_now_register_send_cb(m_onSent);
+
+    esp_now_peer_info_t peer = {};
+    memcpy(peer.peer_addr, config.espnowPeer, sizeof(peer.peer_addr));
+    peer.channel = config.espnowChannel;
+    peer.ifidx = WIFI_IF_STA;
+    peer.encrypt = false;
+    result = esp_now_add_peer(&peer);
+    if (result != ESP_OK)
+    {
+        LOGE("ESPNow", "Couldn't add the receiver as a peer (error %d)", result);
+        return false;
+    }
+
+    // Nothing is being sent yet.
+    xSemaphoreGive(m_sendDone);
+    return true;
+}
+
+void ESPNowConnection::m_stop()
+{
+    if (m_started)
+    {
+        // Let the last frame go out first.
+        xSemaphoreTake(m_sendDone, pdMS_TO_TICKS(ESPNOW_SEND_TIMEOUT));
+        esp_now_unregister_send_cb();
+        esp_now_deinit();
+        m_started = false;
+    }
+    WiFi.mode(WIFI_OFF);
+}
+
+template <typename T>
+void ESPNowConnection::m_sendRecords(EnumESPNowFrame type, RingBuffer<T> &ring, EnumStream stream, uint32_t &wait)
+{
+    const uint16_t maxCount = (ESPNOW_MAX_PAYLOAD - T::PACKED_HEADER_SIZE) / T::PACKED_BYTES_SIZE;
+    const uint32_t available = ring.available();
+    if (!available)
+    {
+        // Wake for the first record so that its deadline is known.
+        setReadyThreshold(stream, 1);
+        return;
+    }
+    setReadyThreshold(stream, maxCount);
+
+    // Wait until a frame can be filled, unless the oldest record has already waited too long.
+    if (available < maxCount)
+    {
+        T *oldest;
+        ring.peek(oldest, 1);
+        const uint32_t age = micros() - oldest->timestamp;
+        if (age < ESPNOW_MAX_LATENCY * 1000UL)
+        {
+            const uint32_t due = (ESPNOW_MAX_LATENCY * 1000UL - age + 999) / 1000;
+            wait = due < wait ? due : wait;
+            return;
+        }
+    }
+
+    // Fill the frame with as many records as fit in a packed packet.
+    const uint16_t count = countPackable(ring, available < maxCount ? available : maxCount);
+    uint8_t frame[ESPNOW_MAX_FRAME];
+    BufferWriter writer(frame + ESPNOW_FRAME_HEADER);
+    m_streamRecords(writer, ring, count, true, T::PACKED_BYTES_SIZE);
+    m_sendFrame(type, frame, ESPNOW_FRAME_HEADER + writer.length());
+    wait = 0; // Work out the deadline of whatever is left.
+}
+
+void ESPNowConnection::m_sendFrame(EnumESPNowFrame type, uint8_t *frame, uint16_t length)
+{
+    // Header.
+    const uint16_t sequence = m_sequence[type]++;
+    frame[0] = type;
+    frame[1] = (uint8_t)sequence;
+    frame[2] = (uint8_t)(sequence >> 8);
+
+    // Only one frame can be in flight so that they arrive in order and the send queue never fills.
+    if (!xSemaphoreTake(m_sendDone, pdMS_TO_TICKS(ESPNOW_SEND_TIMEOUT)))
+    {
+        LOGW("ESPNow", "Timed out waiting for the last frame to be sent");
+    }
+
+    powerMeter.leds.setConnState(CONN_STATE_SENDING);
+    PM_LOCK(PM_LOCK_RADIO);
+    isTransmitting = true;
+    const esp_err_t result = esp_now_send(config.espnowPeer, frame, length);
+    isTransmitting = false;
+    PM_UNLOCK(PM_LOCK_RADIO);
+    powerMeter.leds.setConnState(CONN_STATE_ACTIVE);
+
+    if (result != ESP_OK)
+    {
+        // The callback won't be called, so nothing is in flight.
+        m_failedFrames++;
+        xSemaphoreGive(m_sendDone);
+    }
+}
+
+void ESPNowConnection::m_onSent(const uint8_t *mac, esp_now_send_status_t status)
+{
+    if (status != ESP_NOW_SEND_SUCCESS)
+    {
+        m_failedFrames++;
+    }
+    xSemaphoreGive(m_sendDone);
+}
+
+State *ESPNowConnection::StateESPNowConnect::enter()
+{
+    m_connection.setAllowData(false);
+    powerMeter.leds.setConnState(CONN_STATE_CONNECTING_1);
+
+    // There is nothing to connect to, so this only fails if the radio can't be started.
+    while (!m_connection.m_start())
+    {
+        m_connection.m_stop();
+        DELAY_WITH_DISABLE(pdMS_TO_TICKS(ESPNOW_RETRY_DELAY));
+    }
+    LOGI("ESPNow", "Started sending");
+    return &m_connection.m_stateActive;
+}
+
+State *ESPNowConnection::StateActive::enter()
+{
+    m_connection.setAllowData(true);
+    powerMeter.leds.setConnState(CONN_STATE_ACTIVE);
+    TickType_t wait = 0;
+    while (!m_connection.isDisableWaiting(wait))
+    {
+        wait = m_connection.runActive();
+    }
+    return &m_connection.m_stateShutdown;
+}
+
+State *ESPNowConnection::StateShutdown::enter()
+{
+    powerMeter.leds.setConnState(CONN_STATE_SHUTTING_DOWN);
+    m_connection.setAllowData(false);
+    m_connection.m_stop();
+    LOGI("ESPNow", "Shutting ESP-NOW down. %lu frames weren't acknowledged.", m_connection.m_failedFrames.load());
+    return &m_connection.m_stateDisabled;
+}
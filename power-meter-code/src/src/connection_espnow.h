@@ -0,0 +1,216 @@
+/**
+ * @file connection_espnow.h
+ * @brief Class to handle sending data to a paired receiver on the bike over ESP-NOW.
+ *
+ * ESP-NOW is connectionless, so no access point or broker is needed. Data is only sent (not received), so the receiver
+ * can come and go without the power meter noticing. See `documents/espnow_stream.md` for the frame format.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include "../defines.h"
+#include "connections.h"
+#include <esp_now.h>
+#include <atomic>
+
+#define ESPNOW_MAX_FRAME 250    // Largest frame ESP-NOW can send (ESP_NOW_MAX_DATA_LEN).
+#define ESPNOW_FRAME_HEADER 3   // Type and sequence number at the start of each frame.
+#define ESPNOW_MAX_PAYLOAD (ESPNOW_MAX_FRAME - ESPNOW_FRAME_HEADER)
+#define ESPNOW_STREAM_BUFFER 200 // Records to buffer for each stream while waiting to fill a frame.
+#define ESPNOW_MAX_LATENCY 50   // Send a partly full frame once the oldest record is this old (ms).
+#define ESPNOW_SEND_TIMEOUT 20  // Longest time to wait for the previous frame to be sent (ms).
+#define ESPNOW_RETRY_DELAY 1000 // Time between attempts to start ESP-NOW if it fails (ms).
+
+/**
+ * @brief Types of frame. These are the same as the entry types in the flash log / backfill topic.
+ *
+ */
+enum EnumESPNowFrame
+{
+    ESPNOW_FRAME_LEFT = 0,      // Packed strain gauge packet (left).
+    ESPNOW_FRAME_RIGHT = 1,     // Packed strain gauge packet (right).
+    ESPNOW_FRAME_IMU = 2,       // Packed IMU packet.
+    ESPNOW_FRAME_LOW_SPEED = 3, // LowSpeedData::toBytes() record.
+    ESPNOW_FRAME_COUNT
+};
+
+/**
+ * @brief Connection that streams data to a receiver using ESP-NOW.
+ *
+ */
+class ESPNowConnection : public Connection
+{
+public:
+    /**
+     * @brief Construct a new ESPNowConnection object.
+     *
+     */
+    ESPNowConnection()
+        : Connection(m_stateESPNowConnect), m_stateESPNowConnect(*this), m_stateActive(*this), m_stateShutdown(*this) {}
+
+    /**
+     * @brief Initialises the connection
+     *
+     */
+    virtual void begin();
+
+protected:
+    /**
+     * @brief Checks the queues and sends any data that is ready.
+     *
+     * @return TickType_t the longest time the connection task can sleep before calling this again if it isn't
+     *                    notified (0 if there is more to send straight away).
+     */
+    TickType_t runActive();
+
+    /**
+     * @brief State for starting the radio and adding the receiver as a peer.
+     *
+     */
+    class StateESPNowConnect : public State
+    {
+    public:
+        /**
+         * @brief Construct a new State ESP-NOW Connect object
+         *
+         * @param connection is the ESPNowConnection object to operate on.
+         */
+        StateESPNowConnect(ESPNowConnection &connection)
+            : State("ESPNowConnect"), m_connection(connection) {}
+
+        /**
+         * @brief Starts ESP-NOW, retrying until it works.
+         *
+         * @return State* Once started, returns `m_stateActive`.
+         * @return State* If interrupted, returns `m_stateShutdown`.
+         */
+        virtual State *enter();
+
+    private:
+        ESPNowConnection &m_connection;
+
+    } m_stateESPNowConnect;
+
+    /**
+     * @brief State for actively sending data.
+     *
+     */
+    class StateActive : public State
+    {
+    public:
+        /**
+         * @brief Construct a new State Active object
+         *
+         * @param connection is the ESPNowConnection object to operate on.
+         */
+        StateActive(ESPNowConnection &connection)
+            : State("Active"),
+              m_connection(connection) {}
+
+        /**
+         * @brief Sends data to the receiver until disabled.
+         *
+         * @return State* the state to transition to when interrupted.
+         */
+        virtual State *enter();
+
+    private:
+        ESPNowConnection &m_connection;
+
+    } m_stateActive;
+
+    /**
+     * @brief State for stopping ESP-NOW and turning the radio off.
+     *
+     */
+    class StateShutdown : public State
+    {
+    public:
+        /**
+         * @brief Construct a new State Shutdown object
+         *
+         * @param connection is the ESPNowConnection object to operate on.
+         */
+        StateShutdown(ESPNowConnection &connection)
+            : State("Shutting down"),
+              m_connection(connection) {}
+
+        /**
+         * @brief Stops ESP-NOW and turns the radio off.
+         *
+         * @return State* the disabled state.
+         */
+        virtual State *enter();
+
+    private:
+        ESPNowConnection &m_connection;
+
+    } m_stateShutdown;
+
+private:
+    /**
+     * @brief Starts the radio on the configured channel, starts ESP-NOW and adds the receiver as a peer.
+     *
+     * @return true if everything started.
+     * @return false if something failed. `m_stop()` should be called before trying again.
+     */
+    bool m_start();
+
+    /**
+     * @brief Stops ESP-NOW and turns the radio off.
+     *
+     */
+    void m_stop();
+
+    /**
+     * @brief Sends a packed packet of the oldest records in a ring buffer once there are enough to fill a frame, or
+     * the oldest record has waited ESPNOW_MAX_LATENCY.
+     *
+     * @param type the type of frame.
+     * @param ring the ring buffer to take records from.
+     * @param stream the stream the ring buffer is for, so the connection task is woken when a frame is full.
+     * @param wait reduced to the time until a partly full frame must be sent (ms), or 0 if this should be called
+     *             again straight away.
+     */
+    template <typename T>
+    void m_sendRecords(EnumESPNowFrame type, RingBuffer<T> &ring, EnumStream stream, uint32_t &wait);
+
+    /**
+     * @brief Adds the header to a frame and sends it to the receiver.
+     *
+     * Sending is asynchronous, so this waits for the previous frame to be sent first. Each type of frame has its own
+     * sequence number that goes up by one each time, whether or not the frame was sent successfully, so that the
+     * receiver can tell when frames are lost.
+     *
+     * @param type the type of frame.
+     * @param frame the frame with the payload starting ESPNOW_FRAME_HEADER bytes in.
+     * @param length the length of the frame including the header.
+     */
+    void m_sendFrame(EnumESPNowFrame type, uint8_t *frame, uint16_t length);
+
+    /**
+     * @brief Called by the WiFi task once a frame has been sent (or failed to be).
+     *
+     * @param mac the address the frame was sent to.
+     * @param status whether the receiver acknowledged the frame (always successful for broadcast).
+     */
+    static void m_onSent(const uint8_t *mac, esp_now_send_status_t status);
+
+    /**
+     * @brief Given by `m_onSent()` once the last frame has been sent.
+     *
+     */
+    static SemaphoreHandle_t m_sendDone;
+    static StaticSemaphore_t m_sendDoneBuffer;
+
+    /**
+     * @brief Number of frames that weren't acknowledged by the receiver.
+     *
+     */
+    static std::atomic<uint32_t> m_failedFrames;
+
+    uint16_t m_sequence[ESPNOW_FRAME_COUNT] = {};
+    bool m_started = false;
+};
@@ -4,10 +4,15 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-10-25
+ * @date 2026-10-14
  */
 #include "connection_mqtt.h"
 #include "config.h"
+#include "json_writer.h"
+#include "power_manager.h"
+#include "fast_wake.h"
+#include "task_topology.h"
+extern FastWake fastWake;
 extern SemaphoreHandle_t serialMutex;
 extern Config config;
 
@@ -19,6 +24,12 @@ PubSubClient mqtt(wifi);
 #include "power_meter.h"
 extern PowerMeter powerMeter;
 
+// The client isn't thread safe. The transmit task publishes while the connection task runs the loop and connects.
+static SemaphoreHandle_t mqttMutex;
+static StaticSemaphore_t mqttMutexBuffer;
+#define MQTT_TAKE() xSemaphoreTake(mqttMutex, portMAX_DELAY)
+#define MQTT_GIVE() xSemaphoreGive(mqttMutex)
+
 void MQTTConnection::begin()
 {
     // Initialise the queues
@@ -26,129 +37,360 @@ void MQTTConnection::begin()
     const int lowSpeed = 1;
     const int highSpeed = config.mqttPacketSize + MQTT_FAST_BUFFER;
     const int imu = config.mqttPacketSize + MQTT_FAST_BUFFER;
-    Connection::begin(housekeeping, lowSpeed, highSpeed, imu);
+    const int profile = 2;
+    static_assert(storageSize(housekeeping, lowSpeed, 2 * MQTT_FAST_BUFFER, 2 * MQTT_FAST_BUFFER, profile) <= CONN_ARENA_SIZE,
+                  "The largest MQTT packet size doesn't fit in CONN_ARENA_SIZE");
+    Connection::begin(housekeeping, lowSpeed, highSpeed, imu, profile);
+
+    // Outgoing messages are written from the packets, so the client's buffer only has to fit incoming messages.
+    if (!mqtt.setBufferSize(MQTT_CLIENT_BUFFER_LENGTH))
+    {
+        LOGE("MQTT", "Couldn't resize the MQTT buffer. Long messages mightn't be received");
+    }
 
-    // Set the buffer to be big enough for the high speed data.
-    if (!mqtt.setBufferSize(MQTT_BUFFER_LENGTH))
+    // Every packet starts off free.
+    mqttMutex = xSemaphoreCreateMutexStatic(&mqttMutexBuffer);
+    m_freePackets = xQueueCreateStatic(MQTT_PACKET_COUNT, sizeof(uint8_t), m_freePacketStorage, &m_freePacketBuffer);
+    m_readyPackets = xQueueCreateStatic(MQTT_PACKET_COUNT, sizeof(uint8_t), m_readyPacketStorage, &m_readyPacketBuffer);
+    for (uint8_t i = 0; i < MQTT_PACKET_COUNT; i++)
     {
-        LOGE("MQTT", "Couldn't resize the MQTT buffer. Long messages mightn't send");
+        xQueueSend(m_freePackets, &i, 0);
+    }
+    createTask(TASK_MQTT_TX, taskMQTTTransmit, this, &m_transmitTaskHandle);
+
+    // Find any data that was logged but not sent before the last reset.
+    if (!m_flashLog.isReady())
+    {
+        m_flashLog.begin();
     }
 }
 
-// Logging takes too long, so unless trying to debug stuff, do a simple version.
-// #define MQTT_LOG_PUBLISH(topic, payload) \
-//     LOGV(topic, "%s", payload);          \
-//     uint32_t start = micros();           \
-//     mqtt.publish(topic, payload);        \
-//     uint32_t end = micros();             \
-//     LOGI(topic, "%ldus to publish.", end - start)
-
-#define MQTT_LOG_PUBLISH(topic, payload)              \
-    powerMeter.leds.setConnState(CONN_STATE_SENDING); \
-    isTransmitting = true;                            \
-    mqtt.publish(topic, payload);                     \
-    isTransmitting = false;                           \
-    powerMeter.leds.setConnState(CONN_STATE_ACTIVE)
-
-#define MQTT_LOG_PUBLISH_FROM_STATE(topic, payload)   \
-    powerMeter.leds.setConnState(CONN_STATE_SENDING); \
-    m_connection.isTransmitting = true;               \
-    mqtt.publish(topic, payload);                     \
-    m_connection.isTransmitting = false;              \
-    powerMeter.leds.setConnState(CONN_STATE_ACTIVE)
-
-// #define MQTT_LOG_PUBLISH(topic, payload) mqtt.publish(topic, payload)
-
-// #define MQTT_LOG_PUBLISH_BUF(topic, payload, length) \
-//     LOGV(topic, "Binary data of length %d", length); \
-//     uint32_t start = micros();                       \
-//     mqtt.publish(topic, payload, length);            \
-//     uint32_t end = micros();                         \
-//     LOGI(topic, "%ldus to publish.", end - start)
-
-#define MQTT_LOG_PUBLISH_BUF(topic, payload, length)  \
-    powerMeter.leds.setConnState(CONN_STATE_SENDING); \
-    isTransmitting = true;                            \
-    mqtt.publish(topic, payload, length);             \
-    isTransmitting = false;                           \
-    powerMeter.leds.setConnState(CONN_STATE_ACTIVE)
-
-// #define MQTT_LOG_PUBLISH_BUF(topic, payload, length) mqtt.publish(topic, payload, length)
-
-#define MQTT_HOUSEKEEPING_STR "{\"temps\":{\"left\":%.2f,\"right\":%.2f, \"imu\":%.2f},\"battery\":%.2f,\"left-offset\":%lu,\"right-offset\":%lu}"
-#define MQTT_HOUSEKEEPING_STR_LEN (sizeof(MQTT_HOUSEKEEPING_STR) + 4 * 10 + 2 * 11)
-void MQTTConnection::runActive()
+void MQTTConnection::runTransmit()
 {
+    LOGI("MQTT", "Transmit task started");
+    while (true)
+    {
+        uint8_t index;
+        xQueueReceive(m_readyPackets, &index, portMAX_DELAY);
+        MQTTPacket &packet = m_packets[index];
+
+        // The packet is already assembled, so only the time spent writing to the socket is marked as transmitting.
+        MQTT_TAKE();
+        powerMeter.leds.setConnState(CONN_STATE_SENDING);
+        PM_LOCK(PM_LOCK_RADIO);
+        isTransmitting = true;
+        STATS_START(publishStart);
+        bool sent = false;
+        if (mqtt.beginPublish(packet.topic, packet.length, false))
+        {
+            sent = mqtt.write(packet.payload, packet.length) == packet.length;
+            sent &= mqtt.endPublish();
+        }
+        STATS_END(STAT_MQTT_PUBLISH, publishStart);
+        isTransmitting = false;
+        PM_UNLOCK(PM_LOCK_RADIO);
+        MQTT_GIVE();
+
+        // If not sent, the connection has most likely gone and the connection task will change the LEDs.
+        if (sent)
+        {
+            powerMeter.leds.setConnState(CONN_STATE_ACTIVE);
+        }
+        if (packet.isBackfill)
+        {
+            m_backfillState = sent ? BACKFILL_SENT : BACKFILL_FAILED;
+        }
+        xQueueSend(m_freePackets, &index, 0);
+
+        // Data may have been left waiting for a free packet.
+        m_notifyData();
+    }
+}
+
+size_t MQTTPacket::write(const uint8_t *data, size_t size)
+{
+    if (length + size > sizeof(payload))
+    {
+        size = sizeof(payload) - length;
+    }
+    memcpy(payload + length, data, size);
+    length += size;
+    return size;
+}
+
+MQTTPacket &MQTTConnection::m_beginPacket(const char *topic)
+{
+    uint8_t index;
+    xQueueReceive(m_freePackets, &index, 0); // Only this task takes from the queue, so this will succeed.
+    MQTTPacket &packet = m_packets[index];
+    strncpy(packet.topic, topic, sizeof(packet.topic) - 1);
+    packet.topic[sizeof(packet.topic) - 1] = '\0';
+    packet.length = 0;
+    packet.isBackfill = false;
+    return packet;
+}
+
+void MQTTConnection::m_sendPacket(MQTTPacket &packet)
+{
+    const uint8_t index = &packet - m_packets;
+    xQueueSend(m_readyPackets, &index, 0); // Never full as there are only MQTT_PACKET_COUNT packets.
+}
+
+void MQTTConnection::m_discardPacket(MQTTPacket &packet)
+{
+    const uint8_t index = &packet - m_packets;
+    xQueueSend(m_freePackets, &index, 0);
+}
+
+bool MQTTConnection::m_queueMessage(const char *topic, const uint8_t *payload, uint32_t length)
+{
+    if (!m_isPacketFree() || length > MQTT_PACKET_LENGTH)
+    {
+        LOGW("MQTT", "Couldn't queue a message for '%s'", topic);
+        return false;
+    }
+    MQTTPacket &packet = m_beginPacket(topic);
+    packet.write(payload, length);
+    m_sendPacket(packet);
+    return true;
+}
+
+bool MQTTConnection::m_waitForTransmit(TickType_t timeout)
+{
+    const TickType_t start = xTaskGetTickCount();
+    while (uxQueueMessagesWaiting(m_freePackets) < MQTT_PACKET_COUNT)
+    {
+        if (xTaskGetTickCount() - start >= timeout)
+        {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    return true;
+}
+
+#define MQTT_STREAM_JSON_LENGTH 130                                                  // Longest name and counters for a stream.
+#define MQTT_MEMORY_JSON_LENGTH (90 + TASK_COUNT * 20)                                // Heap, arena and each task's stack.
+#define MQTT_HOUSEKEEPING_JSON_LENGTH (160 + STREAM_COUNT * MQTT_STREAM_JSON_LENGTH + MQTT_MEMORY_JSON_LENGTH) // Temperatures, battery, offsets, streams and memory.
+#define MQTT_LOW_SPEED_JSON_LENGTH 100
+static const char *streamNames[STREAM_COUNT] = {"housekeeping", "low-speed", "left", "right", "imu", "profile-left", "profile-right"};
+void MQTTConnection::m_setReadyThresholds()
+{
+    setReadyThreshold(STREAM_LEFT, config.mqttPacketSize);
+    setReadyThreshold(STREAM_RIGHT, config.mqttPacketSize);
+    setReadyThreshold(STREAM_IMU, config.mqttPacketSize);
+}
+
+TickType_t MQTTConnection::runActive()
+{
+    // Make room in buffers that keep the newest data. The packet size may have been changed by a config message, so
+    // update the thresholds first as trimming keeps a full packet.
+    m_setReadyThresholds();
+    trimBuffers();
+
+    // Each message is only taken from its queue if there is a packet to put it in. Otherwise it waits until the
+    // transmit task has caught up.
+
     // Check the housekeeping queue
     HousekeepingData housekeeping;
-    if (xQueueReceive(m_housekeepingQueue, &housekeeping, 0))
+    if (m_isPacketFree() && xQueueReceive(m_housekeepingQueue, &housekeeping, 0))
     {
         // Housekeeping data can be sent. Generate a json string.
-        char payload[MQTT_HOUSEKEEPING_STR_LEN];
-        sprintf(
-            payload,
-            MQTT_HOUSEKEEPING_STR,
-            housekeeping.temperatures[SIDE_LEFT],
-            housekeeping.temperatures[SIDE_RIGHT],
-            housekeeping.temperatures[SIDE_IMU_TEMP],
-            housekeeping.battery,
-            housekeeping.offsets[SIDE_LEFT],
-            housekeeping.offsets[SIDE_RIGHT]);
+        MQTTPacket &packet = m_beginPacket(MQTT_TOPIC_HOUSEKEEPING);
+        JsonWriter json((char *)packet.payload, MQTT_HOUSEKEEPING_JSON_LENGTH);
+        json.beginObject();
+        json.beginObject("temps");
+        json.addFixed("left", housekeeping.temperatures[SIDE_LEFT], 2);
+        json.addFixed("right", housekeeping.temperatures[SIDE_RIGHT], 2);
+        json.addFixed("imu", housekeeping.temperatures[SIDE_IMU_TEMP], 2);
+        json.endObject();
+        json.addFixed("battery", housekeeping.battery, 2);
+        json.addFixed("current", housekeeping.current, 1);
+#ifdef POWER_MANAGEMENT
+        json.addUInt("power-save", powerManager.mode());
+#endif
+        json.addUInt("left-offset", housekeeping.offsets[SIDE_LEFT]);
+        json.addUInt("right-offset", housekeeping.offsets[SIDE_RIGHT]);
+
+        // Counters for each stream.
+        json.beginObject("streams");
+        for (uint8_t i = 0; i < STREAM_COUNT; i++)
+        {
+            const StreamStats &stats = getStreamStats((EnumStream)i);
+            json.beginObject(streamNames[i]);
+            json.addUInt("failed", stats.failed);
+            json.addUInt("dropped", stats.dropped);
+            json.addUInt("decimated", stats.decimated);
+            json.addUInt("high-water", stats.highWater);
+            json.addUInt("decimation", stats.decimation);
+            json.endObject();
+        }
+        json.endObject();
+
+        // Memory headroom. Stacks are the fewest bytes each task has had free since it started.
+        json.beginObject("memory");
+        json.addUInt("heap", esp_get_free_heap_size());
+        json.addUInt("heap-min", esp_get_minimum_free_heap_size());
+        json.addUInt("arena", arena().used());
+        json.addUInt("arena-size", arena().capacity());
+        json.beginObject("stacks");
+        for (uint8_t i = 0; i < TASK_COUNT; i++)
+        {
+            uint32_t headroom;
+            if (taskStackHeadroom((EnumTask)i, headroom))
+            {
+                json.addUInt(taskName((EnumTask)i), headroom);
+            }
+        }
+        json.endObject();
+        json.endObject();
+        json.endObject();
 
         // Publish
-        MQTT_LOG_PUBLISH(MQTT_TOPIC_HOUSEKEEPING, payload);
+        if (json.isValid())
+        {
+            packet.length = json.length();
+            m_sendPacket(packet);
+        }
+        else
+        {
+            LOGE("MQTT", "Housekeeping message is too long.");
+            m_discardPacket(packet);
+        }
     }
 
     // Check the low-speed queue
     LowSpeedData lowSpeed;
-    if (xQueueReceive(m_lowSpeedQueue, &lowSpeed, 0))
+    if (m_isPacketFree() && xQueueReceive(m_lowSpeedQueue, &lowSpeed, 0))
     {
-        // Low-speed data can be sent. Generate a json string.
-        char payload[100];
-        sprintf(
-            payload,
-            "{\"timestamp\":%lu,\"cadence\":%.1f,\"rotations\":%lu,\"power\":%.1f,\"balance\":%.1f}",
-            lowSpeed.timestamp,
-            lowSpeed.cadence(),
-            lowSpeed.rotationCount,
-            lowSpeed.power,
-            lowSpeed.balance);
-
-        // Publish
-        MQTT_LOG_PUBLISH(MQTT_TOPIC_LOW_SPEED, payload);
+        MQTTPacket &packet = m_beginPacket(MQTT_TOPIC_LOW_SPEED);
+        if (config.lowSpeedFormat == LOW_SPEED_FORMAT_BINARY)
+        {
+            // Same record as is used in the flash log.
+            lowSpeed.toBytes(packet.payload);
+            packet.length = LowSpeedData::LOW_SPEED_BYTES_SIZE;
+        }
+        else
+        {
+            // Low-speed data can be sent. Generate a json string.
+            JsonWriter json((char *)packet.payload, MQTT_LOW_SPEED_JSON_LENGTH);
+            json.beginObject();
+            json.addUInt("timestamp", lowSpeed.timestamp);
+            json.addFixed("cadence", lowSpeed.cadence(), 1);
+            json.addUInt("rotations", lowSpeed.rotationCount);
+            json.addFixed("power", lowSpeed.power, 1);
+            json.addFixed("balance", lowSpeed.balance, 1);
+            json.endObject();
+            packet.length = json.length();
+        }
+        m_sendPacket(packet);
     }
 
+    // Torque profiles
+    m_handleProfileQueue(SIDE_LEFT);
+    m_handleProfileQueue(SIDE_RIGHT);
+
     // High speed data
     m_handleSideQueue(SIDE_LEFT);
     m_handleSideQueue(SIDE_RIGHT);
 
     // IMU data
     m_handleIMUQueue();
+
+    // Data logged while disconnected. Live data is sent first and this is rate limited so that it can keep up.
+    if (m_flashLog.isPending() && millis() - m_lastBackfill >= MQTT_BACKFILL_INTERVAL)
+    {
+        m_publishBackfill();
+        m_lastBackfill = millis();
+    }
+
+#ifdef STATS_ENABLE
+    // Timing histograms.
+    if (millis() - m_lastStats >= STATS_PERIOD && m_isPacketFree())
+    {
+        MQTTPacket &packet = m_beginPacket(MQTT_TOPIC_STATS);
+        stats.toBytes(packet.payload);
+        packet.length = Stats::STATS_BYTES_SIZE;
+        m_sendPacket(packet);
+        m_lastStats = millis();
+    }
+#endif
+
+    // Go around again straight away if there is more that can be sent. Otherwise sleep until new data or a free
+    // packet wakes this task, waking regularly for the MQTT client and backfill.
+    if (m_isPacketFree() && isDataWaiting())
+    {
+        return 0;
+    }
+    uint32_t wait = CONN_IDLE_POLL_MS;
+    if (m_flashLog.isPending())
+    {
+        const uint32_t sinceBackfill = millis() - m_lastBackfill;
+        const uint32_t untilBackfill = sinceBackfill < MQTT_BACKFILL_INTERVAL ? MQTT_BACKFILL_INTERVAL - sinceBackfill : 0;
+        wait = untilBackfill < wait ? untilBackfill : wait;
+    }
+    return pdMS_TO_TICKS(wait);
 }
 
-void MQTTConnection::m_handleSideQueue(EnumSide side)
+void MQTTConnection::runOffline()
 {
-    if (uxQueueMessagesWaiting(m_sideQueues[side]) >= config.mqttPacketSize)
+    // Make room in buffers that keep the newest data.
+    m_setReadyThresholds();
+    trimBuffers();
+
+    // Housekeeping data isn't logged. Discard it so that it isn't stale when reconnected.
+    HousekeepingData housekeeping;
+    xQueueReceive(m_housekeepingQueue, &housekeeping, 0);
+
+    // Low speed data is small and infrequent, so log each record on its own.
+    LowSpeedData lowSpeed;
+    if (xQueueReceive(m_lowSpeedQueue, &lowSpeed, 0))
     {
-        // We have enough data to add.
-        const unsigned int PAYLOAD_SIZE = HighSpeedData::FAST_BYTES_SIZE * config.mqttPacketSize;
-        uint8_t buffer[PAYLOAD_SIZE];
-        for (int i = 0; i < config.mqttPacketSize; i++)
+        uint8_t payload[LowSpeedData::LOW_SPEED_BYTES_SIZE];
+        lowSpeed.toBytes(payload);
+        if (m_flashLog.beginEntry(LOG_ENTRY_LOW_SPEED, sizeof(payload)))
         {
-            // For each point in the queue, get it and add it to the packet buffer.
-            HighSpeedData data;
-            xQueueReceive(m_sideQueues[side], &data, portMAX_DELAY);
-            data.toBytes(buffer + HighSpeedData::FAST_BYTES_SIZE * i);
+            m_flashLog.write(payload, sizeof(payload));
+            m_flashLog.endEntry();
         }
+    }
 
-        // Send the buffer on the correct topic
+    // Torque profiles are logged like low speed data.
+    for (uint8_t side = SIDE_LEFT; side <= SIDE_RIGHT; side++)
+    {
+        TorqueProfile profile;
+        if (xQueueReceive(m_profileQueues[side], &profile, 0))
+        {
+            uint8_t payload[TorqueProfile::PROFILE_MAX_BYTES_SIZE];
+            profile.toBytes(payload);
+            if (m_flashLog.beginEntry(side == SIDE_LEFT ? LOG_ENTRY_PROFILE_LEFT : LOG_ENTRY_PROFILE_RIGHT, profile.bytesSize()))
+            {
+                m_flashLog.write(payload, profile.bytesSize());
+                m_flashLog.endEntry();
+            }
+        }
+    }
+
+    // High speed and IMU data is logged as packed packets.
+    m_logRecords(LOG_ENTRY_LEFT, m_sideBuffers[SIDE_LEFT]);
+    m_logRecords(LOG_ENTRY_RIGHT, m_sideBuffers[SIDE_RIGHT]);
+    m_logRecords(LOG_ENTRY_IMU, m_imuBuffer);
+}
+
+void MQTTConnection::m_handleSideQueue(EnumSide side)
+{
+    RingBuffer<HighSpeedData> &ring = m_sideBuffers[side];
+    const uint16_t packetSize = config.mqttPacketSize; // Read once, as the config task can change it at any time.
+    if (ring.available() >= packetSize)
+    {
+        // We have enough data to send on the correct topic.
         switch (side)
         {
         case SIDE_LEFT:
-            MQTT_LOG_PUBLISH_BUF(MQTT_TOPIC_HIGH_SPEED MQTT_TOPIC_LEFT, buffer, PAYLOAD_SIZE);
+            m_publishRecords(MQTT_TOPIC_HIGH_SPEED MQTT_TOPIC_LEFT, ring, HighSpeedData::FAST_BYTES_SIZE, packetSize);
             break;
         case SIDE_RIGHT:
-            MQTT_LOG_PUBLISH_BUF(MQTT_TOPIC_HIGH_SPEED MQTT_TOPIC_RIGHT, buffer, PAYLOAD_SIZE);
+            m_publishRecords(MQTT_TOPIC_HIGH_SPEED MQTT_TOPIC_RIGHT, ring, HighSpeedData::FAST_BYTES_SIZE, packetSize);
             break;
         }
     }
@@ -156,46 +398,168 @@ void MQTTConnection::m_handleSideQueue(EnumSide side)
 
 void MQTTConnection::m_handleIMUQueue()
 {
-    if (uxQueueMessagesWaiting(m_imuQueue) >= config.mqttPacketSize)
+    const uint16_t packetSize = config.mqttPacketSize; // Read once, as the config task can change it at any time.
+    if (m_imuBuffer.available() >= packetSize)
     {
-        // We have enough data to add.
-        const unsigned int PAYLOAD_SIZE = IMUData::IMU_BYTES_SIZE * config.mqttPacketSize;
-        uint8_t buffer[PAYLOAD_SIZE];
-        for (int i = 0; i < config.mqttPacketSize; i++)
+        // We have enough data to send.
+        m_publishRecords(MQTT_TOPIC_IMU, m_imuBuffer, IMUData::IMU_BYTES_SIZE, packetSize);
+    }
+}
+
+void MQTTConnection::m_handleProfileQueue(EnumSide side)
+{
+    TorqueProfile profile;
+    if (m_isPacketFree() && xQueueReceive(m_profileQueues[side], &profile, 0))
+    {
+        MQTTPacket &packet = m_beginPacket(side == SIDE_LEFT ? MQTT_TOPIC_PROFILE MQTT_TOPIC_LEFT : MQTT_TOPIC_PROFILE MQTT_TOPIC_RIGHT);
+        profile.toBytes(packet.payload);
+        packet.length = profile.bytesSize();
+        m_sendPacket(packet);
+    }
+}
+
+template <typename T>
+void MQTTConnection::m_publishRecords(const char *topic, RingBuffer<T> &ring, const uint16_t recordSize, const uint16_t packetSize)
+{
+    if (!m_isPacketFree())
+    {
+        // Both packets are still being sent. Leave the records where they are until one is free.
+        return;
+    }
+
+    // Work out how many records will be in this packet.
+    const bool packed = config.mqttPacketFormat == PACKET_FORMAT_PACKED;
+    const uint16_t encodedSize = packed ? T::PACKED_BYTES_SIZE : recordSize;
+    const uint16_t count = packed ? countPackable(ring, packetSize) : packetSize;
+
+    MQTTPacket &packet = m_beginPacket(topic);
+    m_streamRecords(packet, ring, count, packed, encodedSize);
+    m_sendPacket(packet);
+}
+
+template <typename T>
+void MQTTConnection::m_logRecords(EnumLogEntry type, RingBuffer<T> &ring)
+{
+    const uint16_t packetSize = config.mqttPacketSize; // Read once, as the config task can change it at any time.
+    if (ring.available() >= packetSize)
+    {
+        const uint16_t count = countPackable(ring, packetSize);
+        if (m_flashLog.beginEntry(type, T::PACKED_HEADER_SIZE + T::PACKED_BYTES_SIZE * count))
+        {
+            FlashLogWriter writer(m_flashLog, m_scratch, sizeof(m_scratch));
+            m_streamRecords(writer, ring, count, true, T::PACKED_BYTES_SIZE);
+            m_flashLog.endEntry();
+        }
+        else
         {
-            // For each point in the queue, get it and add it to the packet buffer.
-            IMUData data;
-            xQueueReceive(m_imuQueue, &data, portMAX_DELAY);
-            data.toBytes(buffer + IMUData::IMU_BYTES_SIZE * i);
+            // Couldn't log. Discard the data so that the buffer doesn't fill up.
+            ring.pop(count);
         }
+    }
+}
 
-        // Send the buffer on the correct topic
-        MQTT_LOG_PUBLISH_BUF(MQTT_TOPIC_IMU, buffer, PAYLOAD_SIZE);
+void MQTTConnection::m_publishBackfill()
+{
+    // Only mark the last chunk as sent if successful so that it is sent again after reconnecting. Only the head
+    // changes until then, so peekChunk() finds the same chunk again. If the log filled up while offline and the chunk
+    // was discarded, popChunk() does nothing.
+    switch (m_backfillState)
+    {
+    case BACKFILL_IN_FLIGHT:
+        return;
+    case BACKFILL_SENT:
+        m_flashLog.popChunk();
+        break;
+    default:
+        break;
     }
+    m_backfillState = BACKFILL_IDLE;
+    if (!m_isPacketFree())
+    {
+        return;
+    }
+
+    // Chunks always fit in a packet as they are no longer than a sector.
+    const uint32_t length = m_flashLog.peekChunk(MQTT_PACKET_LENGTH);
+    if (!length)
+    {
+        return;
+    }
+    MQTTPacket &packet = m_beginPacket(MQTT_TOPIC_BACKFILL);
+    if (!m_flashLog.readChunk(packet.payload))
+    {
+        m_discardPacket(packet);
+        return;
+    }
+    packet.length = length;
+    packet.isBackfill = true;
+    m_backfillState = BACKFILL_IN_FLIGHT;
+    m_sendPacket(packet);
 }
 
 State *MQTTConnection::StateWiFiConnect::enter()
 {
-    m_connection.setAllowData(false); // Make sure we aren't accepting data until we are ready.
+    // Keep accepting data while disconnected if it can be logged. `runOffline()` polls for it, so don't wake early.
+    m_connection.setAllowData(m_connection.m_flashLog.isReady(), false);
     powerMeter.leds.setConnState(CONN_STATE_CONNECTING_1);
-    // Wait until connected to WiFi.
-    do
-    {
-        // Reset and request connection.
-        WiFi.disconnect(); // Just to be safe.
-        LOGV("Networking", "Connecting to '%s'.", config.wifiSSID);
-        WiFi.begin(config.wifiSSID, config.wifiPSK);
 
-        // Wait until WiFi is connected.
-        for (uint32_t iterCount = 0; WiFi.status() != WL_CONNECTED && iterCount < WIFI_RECONNECT_ATTEMPT_TIME; iterCount++)
+    // Try the access point and address from last time first. This skips scanning every channel and DHCP.
+    FastWakeWiFi cached;
+    bool usedCache = false;
+    if (fastWake.getWiFi(cached))
+    {
+        LOGV("Networking", "Reconnecting to '%s' on channel %ld.", config.wifiSSID, cached.channel);
+        WiFi.config(IPAddress(cached.ip), IPAddress(cached.gateway), IPAddress(cached.subnet), IPAddress(cached.dns));
+        WiFi.begin(config.wifiSSID, config.wifiPSK, cached.channel, cached.bssid);
+        for (uint32_t iterCount = 0; WiFi.status() != WL_CONNECTED && iterCount < FAST_WAKE_WIFI_TIMEOUT; iterCount++)
         {
-            // Wait for a while.
             DELAY_WITH_DISABLE(2);
+            m_connection.runOffline();
+        }
+
+        usedCache = WiFi.status() == WL_CONNECTED;
+        if (!usedCache)
+        {
+            // The access point may have changed channel or the address given to someone else. Start from scratch.
+            LOGW("Networking", "Couldn't reconnect using the cached details, scanning instead");
+            fastWake.clearWiFi();
+            WiFi.config(IPAddress(), IPAddress(), IPAddress()); // Use DHCP again.
         }
-    } while (WiFi.status() != WL_CONNECTED);
+    }
+
+    // Wait until connected to WiFi.
+    if (!usedCache)
+    {
+        do
+        {
+            // Reset and request connection.
+            WiFi.disconnect(); // Just to be safe.
+            LOGV("Networking", "Connecting to '%s'.", config.wifiSSID);
+            WiFi.begin(config.wifiSSID, config.wifiPSK);
+
+            // Wait until WiFi is connected.
+            for (uint32_t iterCount = 0; WiFi.status() != WL_CONNECTED && iterCount < WIFI_RECONNECT_ATTEMPT_TIME; iterCount++)
+            {
+                // Wait for a while.
+                DELAY_WITH_DISABLE(2);
+                m_connection.runOffline();
+            }
+        } while (WiFi.status() != WL_CONNECTED);
+    }
 
     // Successfully connected.
     LOGI("Networking", "Connected with IP address '%s'.", WiFi.localIP().toString().c_str());
+    if (!usedCache)
+    {
+        // Only cache details from DHCP so that the lease time is kept from when it was actually given.
+        memcpy(cached.bssid, WiFi.BSSID(), sizeof(cached.bssid));
+        cached.channel = WiFi.channel();
+        cached.ip = WiFi.localIP();
+        cached.gateway = WiFi.gatewayIP();
+        cached.subnet = WiFi.subnetMask();
+        cached.dns = WiFi.dnsIP();
+        fastWake.setWiFi(cached);
+    }
 
 #ifdef OTA_ENABLE
     // Setup OTA updates if needed.
@@ -207,20 +571,38 @@ State *MQTTConnection::StateWiFiConnect::enter()
 State *MQTTConnection::StateMQTTConnect::enter()
 {
     // Initial setup
-    m_connection.setAllowData(false); // Make sure we aren't accepting data until we are ready.
+    // Keep accepting data while disconnected if it can be logged. `runOffline()` polls for it, so don't wake early.
+    m_connection.setAllowData(m_connection.m_flashLog.isReady(), false);
     powerMeter.leds.setConnState(CONN_STATE_CONNECTING_2);
+
+    // Packets are only queued while active. Once any left over have failed, the transmit task won't use the client
+    // again until this task is back in the active state. It may still be part way through a slow write if this times
+    // out, so the client is only used while holding the mutex below.
+    if (!m_connection.m_waitForTransmit(pdMS_TO_TICKS(MQTT_TRANSMIT_TIMEOUT)))
+    {
+        LOGW("MQTT", "Timed out waiting for the transmit task");
+    }
     LOGV("Networking", "Connecting to MQTT broker '%s' on port " xstringify(MQTT_PORT) ".", config.mqttBroker);
+    MQTT_TAKE();
     mqtt.setServer(config.mqttBroker, MQTT_PORT);
     mqtt.setCallback(mqttCallback);
+    MQTT_GIVE();
     int iterations = 0;
 
     // Wait until connected
-    while (!mqtt.connected())
+    while (true)
     {
-        mqtt.connect(MQTT_ID); // Modify here to set a password if needed.
+        MQTT_TAKE();
+        const bool connected = mqtt.connected() || mqtt.connect(MQTT_ID); // Modify here to set a password if needed.
+        MQTT_GIVE();
+        if (connected)
+        {
+            break;
+        }
 
         // Wait for a while
         DELAY_WITH_DISABLE(100);
+        m_connection.runOffline();
 
         // Check if WiFi is connected and reconnect if needed.
         if (WiFi.status() != WL_CONNECTED)
@@ -233,7 +615,9 @@ State *MQTTConnection::StateMQTTConnect::enter()
         if (iterations == MQTT_RETRY_ITERATIONS)
         {
             LOGD("Networking", "Having another go at connecting MQTT.");
+            MQTT_TAKE();
             mqtt.connect(MQTT_ID); // Modify here to set a password if needed.
+            MQTT_GIVE();
             iterations = 0;
         }
 
@@ -245,8 +629,10 @@ State *MQTTConnection::StateMQTTConnect::enter()
 
     // Successfully connected to MQTT
     LOGI("Networking", "Connected to MQTT broker.");
+    MQTT_TAKE();
     mqtt.subscribe(MQTT_TOPIC_CONFIG);
     mqtt.subscribe(MQTT_TOPIC_OFFSET_COMPENSATE);
+    MQTT_GIVE();
     return &m_connection.m_stateActive;
 }
 
@@ -254,11 +640,13 @@ State *MQTTConnection::StateActive::enter()
 {
     // Setup to send data
     powerMeter.leds.setConnState(CONN_STATE_ACTIVE);
+    LOGI("MQTT", "Ready to publish %lums after %s.", millis(), fastWake.isFastWake() ? "waking" : "starting");
     sendAboutMQTTMessage();
     m_connection.setAllowData(true); // We can start sending data.
 
-    // Check for data on the queues regularly and publish if so.
-    while (!m_connection.isDisableWaiting(1))
+    // Sleep until there is data to publish (or the MQTT client needs attention) and publish it.
+    TickType_t wait = 0;
+    while (!m_connection.isDisableWaiting(wait))
     {
         // Check if WiFi is connected and reconnect if needed.
         if (WiFi.status() != WL_CONNECTED)
@@ -267,14 +655,17 @@ State *MQTTConnection::StateActive::enter()
         }
 
         // Run the MQTT loop. Check if MQTT is connected and reconnect if needed.
-        if (!mqtt.loop())
+        MQTT_TAKE();
+        const bool connected = mqtt.loop();
+        MQTT_GIVE();
+        if (!connected)
         {
             return &m_connection.m_stateMQTTConnect;
         }
 
-        // Check each queue and send data if present. Queue sets could be useful here.
+        // Check each queue and send data if present.
         // Call a function in the connection so that we have more convenient access to the queues.
-        m_connection.runActive();
+        wait = m_connection.runActive();
 
 #ifdef OTA_ENABLE
         // Check OTA updates as needed
@@ -284,43 +675,66 @@ State *MQTTConnection::StateActive::enter()
     return &m_connection.m_stateShutdown;
 }
 
-#define ABOUT_STR "\
-{\
- \"name\": \"" DEVICE_NAME "\",\
- \"compiled\": \"" __DATE__ ", " __TIME__ "\",\
- \"sw_version\": \"" SW_VERSION "\",\
- \"hw_version\": \"" HW_VERSION_STR "\",\
- \"connect-time\": %lu,\
- \"calibration\": %s,\
- \"mac\": \"%02x:%02x:%02x:%02x:%02x:%02x\"\
-}"
-#define ABOUT_STR_BUFFER_SIZE (sizeof(ABOUT_STR) + (-3 + 10) + 6 * (-4 + 2) + CONF_JSON_TEXT_LENGTH) // Remove placeholders, add enough for time and MAC.
+#define ABOUT_JSON_LENGTH (CONF_JSON_TEXT_LENGTH + 300) // Calibration plus the device details.
 void MQTTConnection::StateActive::sendAboutMQTTMessage()
 {
     // About info can be sent. Generate a json string.
     uint8_t baseMac[6];
     esp_wifi_get_mac(WIFI_IF_STA, baseMac);
-    char confJSON[CONF_JSON_TEXT_LENGTH];
-    config.writeJSON(confJSON, CONF_JSON_TEXT_LENGTH);
-    char payload[ABOUT_STR_BUFFER_SIZE];
-    sprintf(
-        payload,
-        ABOUT_STR,
-        millis(),
-        confJSON,
-        baseMac[0], baseMac[1], baseMac[2], baseMac[3], baseMac[4], baseMac[5]);
+    char mac[18];
+    static const char hex[] = "0123456789abcdef";
+    for (uint8_t i = 0; i < 6; i++)
+    {
+        mac[3 * i] = hex[baseMac[i] >> 4];
+        mac[3 * i + 1] = hex[baseMac[i] & 0xf];
+        mac[3 * i + 2] = i < 5 ? ':' : '\0';
+    }
+
+    char payload[ABOUT_JSON_LENGTH];
+    JsonWriter json(payload, sizeof(payload));
+    json.beginObject();
+    json.addString("name", DEVICE_NAME);
+    json.addString("compiled", __DATE__ ", " __TIME__);
+    json.addString("sw_version", SW_VERSION);
+    json.addString("hw_version", HW_VERSION_STR);
+    json.addUInt("connect-time", millis());
+    json.addUInt("packet-format", config.mqttPacketFormat);
+    json.addUInt("low-speed-format", config.lowSpeedFormat);
+    config.writeJSON(json, false, "calibration");
+    json.addString("mac", mac);
+    json.endObject();
 
     // Successfully connected.
     // Publish
-    MQTT_LOG_PUBLISH_FROM_STATE(MQTT_TOPIC_ABOUT, payload);
+    if (json.isValid())
+    {
+        m_connection.m_queueMessage(MQTT_TOPIC_ABOUT, (uint8_t *)payload, json.length());
+    }
+    else
+    {
+        LOGE("MQTT", "About message is too long.");
+    }
 }
 
 State *MQTTConnection::StateShutdown::enter()
 {
     m_connection.setAllowData(false); // Stop accepting new data.
     powerMeter.leds.setConnState(CONN_STATE_SHUTTING_DOWN);
+
+    // Let the last packets go out before disconnecting.
+    m_connection.m_waitForTransmit(pdMS_TO_TICKS(MQTT_TRANSMIT_TIMEOUT));
+    MQTT_TAKE();
     mqtt.disconnect();
+    MQTT_GIVE();
     WiFi.disconnect(true, false); // Turn the radio hardware off, keep saved data.
+
+    // Nothing is being measured now, so get sectors ready for logging next time without stopping to erase them. This
+    // finishes before StateSleep powers down.
+    const uint32_t erased = m_connection.m_flashLog.eraseAhead(FLASH_LOG_ERASE_AHEAD_TIME);
+    if (erased)
+    {
+        LOGD("FlashLog", "Erased %lu sectors ahead.", erased);
+    }
     // TODO: Is disabling OTA updates needed?
     return &m_connection.m_stateDisabled;
 }
@@ -347,3 +761,9 @@ void mqttCallback(const char *topic, byte *payload, unsigned int length)
     }
     powerMeter.leds.setConnState(CONN_STATE_ACTIVE);
 }
+
+void taskMQTTTransmit(void *pvParameters)
+{
+    MQTTConnection *connection = (MQTTConnection *)pvParameters;
+    connection->runTransmit();
+}
@@ -4,16 +4,19 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-10
+ * @date 2026-10-14
  */
 #pragma once
 #include "../defines.h"
 #include "connections.h"
 #include "states.h"
 #include "ota.h"
+#include "flash_log.h"
+#include "stats.h"
 #include <WiFi.h>
 #include <esp_wifi.h>
 #include <PubSubClient.h>
+#include <atomic>
 
 /**
  * @brief MQTT Topics
@@ -29,9 +32,105 @@
 #define MQTT_TOPIC_RIGHT "right"
 #define MQTT_TOPIC_CONFIG MQTT_TOPIC_PREFIX "conf"
 #define MQTT_TOPIC_OFFSET_COMPENSATE MQTT_TOPIC_PREFIX "offset"
+#define MQTT_TOPIC_BACKFILL MQTT_TOPIC_PREFIX "backfill"
+#define MQTT_TOPIC_STATS MQTT_TOPIC_PREFIX "stats"
+#define MQTT_TOPIC_PROFILE MQTT_TOPIC_PREFIX "profile/"
 
 #define MQTT_FAST_BUFFER 200 // 160
-#define MQTT_BUFFER_LENGTH (MQTT_FAST_BUFFER*IMUData::IMU_BYTES_SIZE + 100)
+#define MQTT_BACKFILL_INTERVAL 100 // Minimum time between backfill messages (ms) so that live data still gets through.
+#define MQTT_PACKET_COUNT 2        // Packets that can be assembled or waiting to be sent at once.
+#define MQTT_PACKET_LENGTH (MQTT_FAST_BUFFER*IMUData::IMU_BYTES_SIZE + 100) // Longest payload (a full IMU packet).
+#define MQTT_TOPIC_MAX_LENGTH 32
+#define MQTT_CLIENT_BUFFER_LENGTH (CONF_JSON_TEXT_LENGTH + 100) // The client's own buffer only holds incoming messages.
+#define MQTT_SCRATCH_LENGTH 512    // Buffer used when serialising records for the flash log.
+#define MQTT_TRANSMIT_TIMEOUT 1000 // Longest time to wait for queued packets to be sent when changing state (ms).
+
+/**
+ * @brief A message waiting to be published by the transmit task.
+ *
+ */
+struct MQTTPacket
+{
+    char topic[MQTT_TOPIC_MAX_LENGTH];
+    uint32_t length;
+    bool isBackfill; // If true, the result is reported so that the chunk is only removed from the log once sent.
+    uint8_t payload[MQTT_PACKET_LENGTH];
+
+    /**
+     * @brief Appends to the payload.
+     *
+     * @return size_t the number of bytes written (less than `size` if the packet is full).
+     */
+    size_t write(const uint8_t *data, size_t size);
+
+    /**
+     * @brief Adds `size` bytes to the end of the payload to be filled in directly. This allows the packet to be used as
+     * a writer for `m_streamRecords()` without copying.
+     *
+     * There must be room in the payload. Packets of up to `MQTT_FAST_BUFFER` records always fit.
+     *
+     * @return uint8_t* where to write the bytes.
+     */
+    uint8_t *reserve(size_t size)
+    {
+        uint8_t *result = payload + length;
+        length += size;
+        return result;
+    }
+
+    /**
+     * @brief Does nothing as records are serialised straight into the payload.
+     *
+     */
+    void flush() {}
+};
+
+/**
+ * @brief Writer for `m_streamRecords()` that collects records in a scratch buffer and writes them to the flash log in
+ * chunks, as the log can't be serialised into directly.
+ *
+ */
+class FlashLogWriter
+{
+public:
+    FlashLogWriter(FlashLog &log, uint8_t *buffer, uint16_t bufferSize) : m_log(log), m_buffer(buffer), m_bufferSize(bufferSize) {}
+
+    /**
+     * @brief Returns space for `size` bytes in the scratch buffer, writing it out first if there isn't room.
+     *
+     * @param size the number of bytes needed. This must be no more than the size of the scratch buffer.
+     * @return uint8_t* where to write the bytes.
+     */
+    uint8_t *reserve(size_t size)
+    {
+        if (m_used + size > m_bufferSize)
+        {
+            flush();
+        }
+        uint8_t *result = m_buffer + m_used;
+        m_used += size;
+        return result;
+    }
+
+    /**
+     * @brief Writes whatever is in the scratch buffer to the log.
+     *
+     */
+    void flush()
+    {
+        if (m_used)
+        {
+            m_log.write(m_buffer, m_used);
+            m_used = 0;
+        }
+    }
+
+private:
+    FlashLog &m_log;
+    uint8_t *m_buffer;
+    const uint16_t m_bufferSize;
+    uint16_t m_used = 0;
+};
 
 /**
  * @brief Connection that handles MQTT messages.
@@ -57,14 +156,82 @@ public:
      */
     virtual void begin();
 
+    /**
+     * @brief Publishes packets as they are queued. This is run by the transmit task.
+     *
+     */
+    void runTransmit();
+
 protected:
     /**
      * @brief Checks the queues and acts on any new messages to publish.
      *
+     * @return TickType_t the longest time the connection task can sleep before calling this again if it isn't
+     *                    notified (0 if there is more to send straight away).
      */
-    void runActive();
+    TickType_t runActive();
+
+    /**
+     * @brief Checks the queues and stores any new data in the flash log while disconnected.
+     *
+     */
+    void runOffline();
 
 private:
+    /**
+     * @brief Whether a packet can be started without waiting.
+     *
+     */
+    bool m_isPacketFree() { return uxQueueMessagesWaiting(m_freePackets); }
+
+    /**
+     * @brief Wakes the connection task once `config.mqttPacketSize` records are waiting in a ring buffer.
+     *
+     */
+    void m_setReadyThresholds();
+
+    /**
+     * @brief Takes a free packet to fill. Only call this if `m_isPacketFree()` is true.
+     *
+     * @param topic the topic the packet will be published to.
+     * @return MQTTPacket& the empty packet.
+     */
+    MQTTPacket &m_beginPacket(const char *topic);
+
+    /**
+     * @brief Hands a filled packet to the transmit task. This returns straight away.
+     *
+     * @param packet the packet from `m_beginPacket()`.
+     */
+    void m_sendPacket(MQTTPacket &packet);
+
+    /**
+     * @brief Returns a packet without sending it.
+     *
+     * @param packet the packet from `m_beginPacket()`.
+     */
+    void m_discardPacket(MQTTPacket &packet);
+
+    /**
+     * @brief Copies a message into a free packet and queues it for sending.
+     *
+     * @param topic the topic to publish to.
+     * @param payload the message.
+     * @param length the length of the message in bytes.
+     * @return true if queued.
+     * @return false if there was no free packet or the message was too long. The message is dropped.
+     */
+    bool m_queueMessage(const char *topic, const uint8_t *payload, uint32_t length);
+
+    /**
+     * @brief Waits until the transmit task has finished with every packet.
+     *
+     * @param timeout the maximum time to wait in ticks.
+     * @return true if every packet is free.
+     * @return false if the timeout expired first.
+     */
+    bool m_waitForTransmit(TickType_t timeout);
+
     /**
      * @brief Checks if there is data for a side to send and does the sending if needed.
      *
@@ -78,6 +245,77 @@ private:
      */
     void m_handleIMUQueue();
 
+    /**
+     * @brief Checks if there is a torque profile for a side and publishes it if so.
+     *
+     * @param side the side to check.
+     */
+    void m_handleProfileQueue(EnumSide side);
+
+    /**
+     * @brief Queues up to `packetSize` records from a ring buffer as a single binary message.
+     *
+     * Records are serialised into a free packet, which the transmit task then publishes. The format is set by
+     * `config.mqttPacketFormat`. Packed packets may end early if there is a gap between records that is too long to
+     * represent. Nothing is done if there is no free packet, leaving the records in the ring buffer.
+     *
+     * @param topic the topic to publish to.
+     * @param ring the ring buffer to take records from. This should have at least `packetSize` records.
+     * @param recordSize the number of bytes each record takes when serialised using `toBytes()`.
+     * @param packetSize the number of records in a full packet (`config.mqttPacketSize`, read once by the caller).
+     */
+    template <typename T>
+    void m_publishRecords(const char *topic, RingBuffer<T> &ring, const uint16_t recordSize, const uint16_t packetSize);
+
+    /**
+     * @brief Stores a packed packet in the flash log if a ring buffer has at least `config.mqttPacketSize` records.
+     *
+     * @param type the type of entry to store the packet as.
+     * @param ring the ring buffer to take records from.
+     */
+    template <typename T>
+    void m_logRecords(EnumLogEntry type, RingBuffer<T> &ring);
+
+    /**
+     * @brief Queues the oldest unsent entries in the flash log on the backfill topic.
+     *
+     * The entries are only removed from the log once the transmit task says they were sent. Only one chunk is in
+     * flight at a time.
+     */
+    void m_publishBackfill();
+
+    /**
+     * @brief States of the chunk of the flash log being backfilled.
+     *
+     */
+    enum EnumBackfill
+    {
+        BACKFILL_IDLE,      // Nothing in flight.
+        BACKFILL_IN_FLIGHT, // Queued or being sent.
+        BACKFILL_SENT,      // Sent, waiting to be removed from the log.
+        BACKFILL_FAILED     // Couldn't be sent. Try again later.
+    };
+
+    MQTTPacket m_packets[MQTT_PACKET_COUNT];
+    QueueHandle_t m_freePackets;  // Indices of packets that can be filled.
+    QueueHandle_t m_readyPackets; // Indices of packets waiting for the transmit task.
+    uint8_t m_freePacketStorage[MQTT_PACKET_COUNT], m_readyPacketStorage[MQTT_PACKET_COUNT];
+    StaticQueue_t m_freePacketBuffer, m_readyPacketBuffer;
+    std::atomic<uint8_t> m_backfillState{BACKFILL_IDLE};
+    uint8_t m_scratch[MQTT_SCRATCH_LENGTH]; // Only used by the connection task when logging.
+    TaskHandle_t m_transmitTaskHandle;
+
+    /**
+     * @brief Stores data while disconnected so that it can be sent later.
+     *
+     */
+    FlashLog m_flashLog;
+    uint32_t m_lastBackfill = 0;
+
+#ifdef STATS_ENABLE
+    uint32_t m_lastStats = 0;
+#endif
+
     /**
      * @brief State for connecting to WiFi.
      *
@@ -208,4 +446,11 @@ private:
  */
 void mqttUpdateConf(char *payload, unsigned int length);
 
-void mqttCallback(const char* topic, byte* payload, unsigned int length);
\ No newline at end of file
+void mqttCallback(const char* topic, byte* payload, unsigned int length);
+
+/**
+ * @brief Task that publishes packets queued by the MQTT connection.
+ *
+ * @param pvParameters is a pointer to the MQTTConnection.
+ */
+void taskMQTTTransmit(void *pvParameters);
\ No newline at end of file
@@ -4,63 +4,53 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-10
+ * @date 2026-10-14
  */
 #pragma once
 #include "connections.h"
 #include "power_meter.h"
+#include "stats.h"
+#include "task_topology.h"
+#include "config.h"
 extern PowerMeter powerMeter;
+extern Config config;
 extern SemaphoreHandle_t serialMutex;
 
-void Connection::begin(const int housekeepingLength, const int lowSpeedLength, const int highSpeedLength, const int imuLength)
+// Only one connection is begun, so they all share the one block.
+alignas(STATIC_ARENA_ALIGN) static uint8_t connectionStorage[CONN_ARENA_SIZE];
+static StaticArena connectionArena(connectionStorage, sizeof(connectionStorage));
+
+const StaticArena &Connection::arena()
 {
-    // Housekeeping queue
-    // Check if the queue has already been created.
-    if (!m_housekeepingQueue)
-    {
-        // Doesn't exist, create.
-        m_housekeepingQueue = xQueueCreate(housekeepingLength, sizeof(HousekeepingData));
+    return connectionArena;
+}
 
-        // Check it was created successfully.
-        if (!m_housekeepingQueue)
-        {
-            LOGE("Queues", "Couldn't create housekeeping queue");
-        }
-    }
+void Connection::begin(const int housekeepingLength, const int lowSpeedLength, const int highSpeedLength, const int imuLength, const int profileLength)
+{
+    m_createQueue(m_housekeepingQueue, m_housekeepingQueueBuffer, housekeepingLength, sizeof(HousekeepingData), "housekeeping");
+    m_createQueue(m_lowSpeedQueue, m_lowSpeedQueueBuffer, lowSpeedLength, sizeof(LowSpeedData), "low-speed");
 
-    // Low-speed queue
-    // Check if the queue has already been created.
-    if (!m_lowSpeedQueue)
+    // High speed buffers. Only create them if needed.
+    if (highSpeedLength)
     {
-        // Doesn't exist, create.
-        m_lowSpeedQueue = xQueueCreate(lowSpeedLength, sizeof(LowSpeedData));
-
-        // Check it was created successfully.
-        if (!m_lowSpeedQueue)
-        {
-            LOGE("Queues", "Couldn't create low-speed queue");
-        }
+        m_createBuffer(m_sideBuffers[SIDE_LEFT], highSpeedLength, "left side");
+        m_createBuffer(m_sideBuffers[SIDE_RIGHT], highSpeedLength, "right side");
     }
 
-    // High speed queue. Check if the queue has already been created and is needed.
-    if (highSpeedLength)
+    if (imuLength)
     {
-        m_createSideQueue(SIDE_LEFT, highSpeedLength);
-        m_createSideQueue(SIDE_RIGHT, highSpeedLength);
+        m_createBuffer(m_imuBuffer, imuLength, "IMU");
     }
 
-    // Check if the queue has already been created and the queue is needed.
-    if (!m_imuQueue && imuLength)
+    // Torque profile queues. Only create them if needed.
+    if (profileLength)
     {
-        // Doesn't exist, create.
-        m_imuQueue = xQueueCreate(imuLength, sizeof(IMUData));
-
-        // Check it was created successfully.
-        if (!m_imuQueue)
+        for (uint8_t side = SIDE_LEFT; side <= SIDE_RIGHT; side++)
         {
-            LOGE("Queues", "Couldn't create IMU queue");
+            m_createQueue(m_profileQueues[side], m_profileQueueBuffers[side], profileLength, sizeof(TorqueProfile), "torque profile");
         }
     }
+    LOGI("Queues", "Using %u of %u bytes of connection storage", connectionArena.used(), connectionArena.capacity());
 }
 
 void Connection::enable()
@@ -92,40 +82,122 @@ void Connection::disable()
 void Connection::run(TaskHandle_t taskHandle)
 {
     m_taskHandle = taskHandle;
+    taskStarted(TASK_CONNECTION); // enable() and disable() can be used now that the handle is set.
     runStateMachine("Connections", &m_stateDisabled);
 }
 
 void Connection::addHousekeeping(HousekeepingData &data)
 {
-    m_addToQueue(m_housekeepingQueue, (void *)&data);
+    m_addToQueue(m_housekeepingQueue, data, STREAM_HOUSEKEEPING, config.backpressure.housekeeping);
 }
 
 void Connection::addLowSpeed(LowSpeedData &data)
 {
-    m_addToQueue(m_lowSpeedQueue, (void *)&data);
+    m_addToQueue(m_lowSpeedQueue, data, STREAM_LOW_SPEED, config.backpressure.lowSpeed);
 }
 
 void Connection::addHighSpeed(HighSpeedData &data, EnumSide side)
 {
-    if (m_sideQueues[side])
+    // Raw high speed data can be turned off to save bandwidth when only the torque profile is needed.
+    if (!config.sendHighSpeed)
+    {
+        return;
+    }
+    STATS_RECORD(side == SIDE_LEFT ? STAT_QUEUE_LEFT : STAT_QUEUE_RIGHT, m_sideBuffers[side].available());
+    m_addToBuffer(m_sideBuffers[side], data, side == SIDE_LEFT ? STREAM_LEFT : STREAM_RIGHT, config.backpressure.highSpeed);
+}
+
+void Connection::addPairedHighSpeed(PairedHighSpeedData &data)
+{
+    if (!config.sendHighSpeed)
+    {
+        return;
+    }
+    HighSpeedData left = data.side(SIDE_LEFT);
+    HighSpeedData right = data.side(SIDE_RIGHT);
+    RingBuffer<HighSpeedData> &leftRing = m_sideBuffers[SIDE_LEFT];
+    RingBuffer<HighSpeedData> &rightRing = m_sideBuffers[SIDE_RIGHT];
+    STATS_RECORD(STAT_QUEUE_LEFT, leftRing.available());
+    STATS_RECORD(STAT_QUEUE_RIGHT, rightRing.available());
+    if (config.backpressure.highSpeed != BACKPRESSURE_DECIMATE)
+    {
+        m_addToBuffer(leftRing, left, STREAM_LEFT, config.backpressure.highSpeed);
+        m_addToBuffer(rightRing, right, STREAM_RIGHT, config.backpressure.highSpeed);
+        return;
+    }
+
+    if (!m_isConnected() || !leftRing.capacity() || !rightRing.capacity())
+    {
+        return;
+    }
+
+    // Decide for both sides using the fuller buffer. The left side's counters keep track of the decimation.
+    const uint32_t leftDepth = leftRing.available();
+    const uint32_t rightDepth = rightRing.available();
+    StreamStats &leftStats = m_streamStats[STREAM_LEFT];
+    StreamStats &rightStats = m_streamStats[STREAM_RIGHT];
+    const bool skip = m_decimate(leftStats, leftDepth > rightDepth ? leftDepth : rightDepth, leftRing.capacity());
+    rightStats.decimation = leftStats.decimation;
+    if (skip)
     {
-        m_addToQueue(m_sideQueues[side], (void *)&data);
+        leftStats.decimated++;
+        rightStats.decimated++;
+        return;
     }
+    m_pushToBuffer(leftRing, left, STREAM_LEFT, leftDepth);
+    m_pushToBuffer(rightRing, right, STREAM_RIGHT, rightDepth);
 }
 
 void Connection::addIMU(IMUData &data)
 {
-    if (m_imuQueue)
+    STATS_RECORD(STAT_QUEUE_IMU, m_imuBuffer.available());
+    m_addToBuffer(m_imuBuffer, data, STREAM_IMU, config.backpressure.imu);
+}
+
+void Connection::addProfile(TorqueProfile &data, EnumSide side)
+{
+    // Profiles are produced once per rotation like low speed data, so use the same policy.
+    if (m_profileQueues[side])
     {
-        m_addToQueue(m_imuQueue, &data);
+        m_addToQueue(m_profileQueues[side], data, side == SIDE_LEFT ? STREAM_PROFILE_LEFT : STREAM_PROFILE_RIGHT, config.backpressure.lowSpeed);
     }
 }
 
+void Connection::trimBuffers()
+{
+    m_trimBuffer(m_sideBuffers[SIDE_LEFT], STREAM_LEFT, config.backpressure.highSpeed);
+    m_trimBuffer(m_sideBuffers[SIDE_RIGHT], STREAM_RIGHT, config.backpressure.highSpeed);
+    m_trimBuffer(m_imuBuffer, STREAM_IMU, config.backpressure.imu);
+}
+
 bool Connection::isDisableWaiting(uint32_t yieldTicks)
 {
     return isNotificationWaiting(yieldTicks, CONN_NOTIFY_DISABLE);
 }
 
+bool Connection::isDataWaiting()
+{
+    const bool queued = uxQueueMessagesWaiting(m_housekeepingQueue) || uxQueueMessagesWaiting(m_lowSpeedQueue) ||
+                        (m_profileQueues[SIDE_LEFT] && uxQueueMessagesWaiting(m_profileQueues[SIDE_LEFT])) ||
+                        (m_profileQueues[SIDE_RIGHT] && uxQueueMessagesWaiting(m_profileQueues[SIDE_RIGHT]));
+
+    // Buffers that weren't created have no capacity and are never ready.
+    RingBuffer<HighSpeedData> &left = m_sideBuffers[SIDE_LEFT];
+    RingBuffer<HighSpeedData> &right = m_sideBuffers[SIDE_RIGHT];
+    return queued ||
+           (left.capacity() && left.available() >= m_readyThresholds[STREAM_LEFT]) ||
+           (right.capacity() && right.available() >= m_readyThresholds[STREAM_RIGHT]) ||
+           (m_imuBuffer.capacity() && m_imuBuffer.available() >= m_readyThresholds[STREAM_IMU]);
+}
+
+void Connection::m_notifyData()
+{
+    if (m_taskHandle && m_wakeOnData)
+    {
+        xTaskNotify(m_taskHandle, CONN_NOTIFY_DATA, eSetBits);
+    }
+}
+
 inline bool Connection::m_isConnected()
 {
     // Accessing a boolean should be monatomic.
@@ -133,35 +205,54 @@ inline bool Connection::m_isConnected()
     return connected;
 }
 
-void Connection::setAllowData(bool state)
+void Connection::setAllowData(bool state, bool wakeOnData)
 {
     // Accessing a boolean should be monatomic.
     m_connected = state;
+    m_wakeOnData = state && wakeOnData;
 }
 
 inline bool Connection::isNotificationWaiting(uint32_t yieldTicks, uint32_t bits)
 {
     uint32_t notificationValue = 0;
     bool result = xTaskNotifyWait(
-        0x00,                // Don't clear anything on entry.
-        bits, // Clear disable bit on exit.
-        &notificationValue,  // Save the received
-        yieldTicks);         // How long to wait
+        0x00,                    // Don't clear anything on entry.
+        bits | CONN_NOTIFY_DATA, // Clear the given bits on exit. Data is checked for after every wait anyway.
+        &notificationValue,      // Save the received
+        yieldTicks);             // How long to wait
     return result && (notificationValue & bits);
 }
 
-void Connection::m_createSideQueue(EnumSide side, int length)
+void Connection::m_createQueue(QueueHandle_t &queue, StaticQueue_t &control, int length, size_t itemSize, const char *name)
 {
     // Check if the queue has already been created.
-    if (!m_sideQueues[side])
+    if (!queue)
     {
         // Doesn't exist, create.
-        m_sideQueues[side] = xQueueCreate(length, sizeof(HighSpeedData));
+        uint8_t *storage = (uint8_t *)connectionArena.allocate(length * itemSize);
+        if (storage)
+        {
+            queue = xQueueCreateStatic(length, itemSize, storage, &control);
+        }
 
         // Check it was created successfully.
-        if (!m_sideQueues[side])
+        if (!queue)
+        {
+            LOGE("Queues", "Couldn't create %s queue", name);
+        }
+    }
+}
+
+template <typename T>
+void Connection::m_createBuffer(RingBuffer<T> &buffer, int length, const char *name)
+{
+    // Check if the buffer has already been created.
+    if (!buffer.capacity())
+    {
+        // Doesn't exist, create.
+        if (!buffer.begin(length, connectionArena.allocate(RingBuffer<T>::storageSize(length))))
         {
-            LOGE("Queues", "Couldn't create queue for side %d", side);
+            LOGE("Queues", "Couldn't create %s buffer", name);
         }
     }
 }
@@ -179,20 +270,186 @@ State *Connection::StateDisabled::enter()
     return &m_enableState;
 }
 
-void Connection::m_addToQueue(QueueHandle_t queue, void *data)
+template <typename T>
+void Connection::m_addToQueue(QueueHandle_t queue, T &data, EnumStream stream, uint8_t policy)
 {
     // Check we can actually accept the data
     if (m_isConnected())
     {
+        StreamStats &stats = m_streamStats[stream];
+        if (policy == BACKPRESSURE_DROP_OLDEST && !uxQueueSpacesAvailable(queue))
+        {
+            // Make room by removing the oldest item. The consumer may have just taken it, which is fine too.
+            T discarded;
+            if (xQueueReceive(queue, &discarded, 0))
+            {
+                stats.dropped++;
+            }
+        }
+
         const int MAX_DELAY = 0;
-        int error = xQueueSend(queue, data, MAX_DELAY);
-        // if (error != pdTRUE)
-        // {
-        //     LOGE("Queues", "Couldn't add data to a queue (%d)", error);
-        // }
+        if (xQueueSend(queue, &data, MAX_DELAY) == pdTRUE)
+        {
+            const uint32_t waiting = uxQueueMessagesWaiting(queue);
+            if (waiting > stats.highWater)
+            {
+                stats.highWater = waiting;
+            }
+
+            // Messages on queues are sent as soon as possible.
+            m_notifyData();
+        }
+        else
+        {
+            stats.failed++;
+        }
+    }
+}
+
+template <typename T>
+void Connection::m_addToBuffer(RingBuffer<T> &ring, T &data, EnumStream stream, uint8_t policy)
+{
+    // Buffers that weren't created have no capacity and aren't used by this connection.
+    if (!m_isConnected() || !ring.capacity())
+    {
+        return;
+    }
+
+    StreamStats &stats = m_streamStats[stream];
+    const uint32_t depth = ring.available();
+    if (policy == BACKPRESSURE_DECIMATE)
+    {
+        if (m_decimate(stats, depth, ring.capacity()))
+        {
+            stats.decimated++;
+            return;
+        }
+    }
+    else
+    {
+        stats.decimation = 1;
+    }
+    m_pushToBuffer(ring, data, stream, depth);
+}
+
+template <typename T>
+void Connection::m_pushToBuffer(RingBuffer<T> &ring, T &data, EnumStream stream, uint32_t depth)
+{
+    StreamStats &stats = m_streamStats[stream];
+    if (ring.push(data))
+    {
+        if (depth + 1 > stats.highWater)
+        {
+            stats.highWater = depth + 1;
+        }
+
+        // Only wake the connection task once there is enough for a packet (or enough that it needs trimming), not
+        // for every record.
+        if (depth + 1 == m_readyThresholds[stream] || depth == ring.capacity() * 3 / 4)
+        {
+            m_notifyData();
+        }
+    }
+    else
+    {
+        stats.failed++;
+    }
+}
+
+bool Connection::m_decimate(StreamStats &stats, uint32_t depth, uint32_t capacity)
+{
+    // Keep track of how long the buffer has been (mostly) full or empty.
+    if (depth > capacity * 3 / 4)
+    {
+        stats.pressure = stats.pressure > 0 ? stats.pressure + 1 : 1;
+    }
+    else if (depth < capacity / 4)
+    {
+        stats.pressure = stats.pressure < 0 ? stats.pressure - 1 : -1;
     }
+
+    // Adjust the decimation if this has been sustained.
+    if (stats.pressure >= BACKPRESSURE_SUSTAIN)
+    {
+        if (stats.decimation < BACKPRESSURE_MAX_DECIMATION)
+        {
+            stats.decimation *= 2;
+        }
+        stats.pressure = 0;
+    }
+    else if (stats.pressure <= -BACKPRESSURE_SUSTAIN)
+    {
+        if (stats.decimation > 1)
+        {
+            stats.decimation /= 2;
+        }
+        stats.pressure = 0;
+    }
+
+    // Keep every nth record.
+    stats.skipped++;
+    if (stats.skipped < stats.decimation)
+    {
+        return true;
+    }
+    stats.skipped = 0;
+    return false;
 }
 
+template <typename T>
+void Connection::m_trimBuffer(RingBuffer<T> &ring, EnumStream stream, uint8_t policy)
+{
+    if (policy != BACKPRESSURE_DROP_OLDEST)
+    {
+        return;
+    }
+
+    // Always keep enough for a full packet. The packet size can be raised after the buffers are allocated, so 3/4 of
+    // the capacity may be less than that.
+    uint32_t limit = ring.capacity() * 3 / 4;
+    if (limit < m_readyThresholds[stream])
+    {
+        limit = m_readyThresholds[stream] < ring.capacity() ? m_readyThresholds[stream] : ring.capacity();
+    }
+    const uint32_t waiting = ring.available();
+    if (waiting > limit)
+    {
+        ring.pop(waiting - limit);
+        m_streamStats[stream].dropped += waiting - limit;
+    }
+}
+
+template <typename T>
+uint16_t Connection::countPackable(RingBuffer<T> &ring, uint16_t maxCount)
+{
+    // Stop at the first gap that is too long to represent using a time delta.
+    uint16_t count = 0;
+    uint32_t previousTimestamp = 0;
+    while (count < maxCount)
+    {
+        T *records;
+        const uint32_t blockCount = ring.peek(records, maxCount - count, count);
+        if (!blockCount)
+        {
+            // The ring buffer has fewer than `maxCount` records.
+            break;
+        }
+        for (uint32_t i = 0; i < blockCount; i++)
+        {
+            if (count && records[i].timestamp - previousTimestamp > PACKED_MAX_DELTA)
+            {
+                return count;
+            }
+            previousTimestamp = records[i].timestamp;
+            count++;
+        }
+    }
+    return count;
+}
+
+template uint16_t Connection::countPackable<HighSpeedData>(RingBuffer<HighSpeedData> &ring, uint16_t maxCount);
+template uint16_t Connection::countPackable<IMUData>(RingBuffer<IMUData> &ring, uint16_t maxCount);
+
 void taskConnection(void *pvParameters)
 {
     Connection *connection = (Connection *)pvParameters;
@@ -4,13 +4,95 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-04
+ * @date 2026-10-14
  */
 #pragma once
 #include "../defines.h"
 #include "states.h"
 #include "data_points.h"
+#include "ring_buffer.h"
+#include "static_arena.h"
 
+// Queues and ring buffers of whichever connection is in use are allocated from a static block of this many bytes.
+// Each connection checks its worst case fits at compile time using Connection::storageSize().
+#define CONN_ARENA_SIZE 36864
+
+#define BACKPRESSURE_SUSTAIN 50       // Records in a row under (or free of) pressure before the decimation changes.
+#define BACKPRESSURE_MAX_DECIMATION 4 // Keep at least 1 in this many records (note packed packets end at 65ms gaps).
+
+/**
+ * @brief Streams of data that are passed to a connection.
+ *
+ */
+enum EnumStream
+{
+    STREAM_HOUSEKEEPING,
+    STREAM_LOW_SPEED,
+    STREAM_LEFT,
+    STREAM_RIGHT,
+    STREAM_IMU,
+    STREAM_PROFILE_LEFT,
+    STREAM_PROFILE_RIGHT,
+    STREAM_COUNT
+};
+
+/**
+ * @brief Counters for a stream, used to work out when and why data is missing.
+ *
+ * Each counter is only written by one task (the producer, except for `dropped` on ring buffers which is written by
+ * the connection task), so they can be read without locking, although they may be slightly out of date.
+ */
+struct StreamStats
+{
+    uint32_t failed = 0;    // New records rejected because the stream was full.
+    uint32_t dropped = 0;   // Waiting records discarded to make room (BACKPRESSURE_DROP_OLDEST).
+    uint32_t decimated = 0; // Records skipped to reduce the rate (BACKPRESSURE_DECIMATE).
+    uint32_t highWater = 0; // Most records waiting at once.
+    uint8_t decimation = 1; // Current decimation factor (1 keeps every record).
+    uint8_t skipped = 0;    // Records skipped since the last one that was kept.
+    int16_t pressure = 0;   // Positive when the stream has been under pressure, negative when it has been free of it.
+};
+
+/**
+ * @brief Writer for `Connection::m_streamRecords()` that serialises records into a fixed buffer, such as a frame or
+ * notification that is sent in one go.
+ *
+ */
+class BufferWriter
+{
+public:
+    BufferWriter(uint8_t *buffer) : m_buffer(buffer) {}
+
+    /**
+     * @brief Adds `size` bytes to the end of the buffer to be filled in directly.
+     *
+     * There must be room in the buffer. The caller limits the number of records to make sure of this.
+     *
+     * @return uint8_t* where to write the bytes.
+     */
+    uint8_t *reserve(size_t size)
+    {
+        uint8_t *result = m_buffer + m_length;
+        m_length += size;
+        return result;
+    }
+
+    /**
+     * @brief Does nothing as records are serialised straight into the buffer.
+     *
+     */
+    void flush() {}
+
+    /**
+     * @brief Gets the number of bytes written so far.
+     *
+     */
+    uint16_t length() const { return m_length; }
+
+private:
+    uint8_t *m_buffer;
+    uint16_t m_length = 0;
+};
 
 #define DELAY_WITH_DISABLE(ticks)             \
     if (m_connection.isDisableWaiting(ticks)) \
@@ -42,8 +124,30 @@ public:
      * @param highSpeedLength maximum length of the high-speed queues. Set length to 0 to disable high speed data
      *                        recording.
      * @param imuLength maximum length of the imu queue. Set length to 0 to disable IMU recording.
+     * @param profileLength maximum length of the torque profile queues. Set length to 0 to disable torque profiles.
      */
-    virtual void begin(const int housekeepingLength, const int lowSpeedLength, const int highSpeedLength = 0, const int imuLength = 0);
+    virtual void begin(const int housekeepingLength, const int lowSpeedLength, const int highSpeedLength = 0, const int imuLength = 0, const int profileLength = 0);
+
+    /**
+     * @brief Gets the space in the connection arena that `begin()` needs for a given set of lengths.
+     *
+     * @return constexpr size_t the number of bytes, including padding.
+     */
+    static constexpr size_t storageSize(const int housekeepingLength, const int lowSpeedLength, const int highSpeedLength = 0, const int imuLength = 0, const int profileLength = 0)
+    {
+        return StaticArena::padded(housekeepingLength * sizeof(HousekeepingData)) +
+               StaticArena::padded(lowSpeedLength * sizeof(LowSpeedData)) +
+               2 * (highSpeedLength ? StaticArena::padded(RingBuffer<HighSpeedData>::storageSize(highSpeedLength)) : 0) +
+               (imuLength ? StaticArena::padded(RingBuffer<IMUData>::storageSize(imuLength)) : 0) +
+               2 * StaticArena::padded(profileLength * sizeof(TorqueProfile));
+    }
+
+    /**
+     * @brief Gets the arena that queues and buffers are allocated from.
+     *
+     * @return const StaticArena& the arena, shared by all connections (only one is used at a time).
+     */
+    static const StaticArena &arena();
 
     /**
      * @brief Enables the connection after sleep or on startup.
@@ -92,28 +196,51 @@ public:
     /**
      * @brief Adds high-speed data that can be transmitted.
      *
-     * Data is added to a queue to ensure this is thread-safe.
+     * Data is added to a single producer, single consumer ring buffer. Only the amp task for the side may call this.
      *
      * @param data is the high-speed data.
      * @param side is the side.
      */
     void addHighSpeed(HighSpeedData &data, EnumSide side);
 
+    /**
+     * @brief Adds high speed data for both sides from the same sample.
+     *
+     * Each side is added to its own buffer as with `addHighSpeed()`, but both sides are always kept or skipped
+     * together when decimating so that every record still has a partner on the other side.
+     *
+     * @param data the data to add.
+     */
+    void addPairedHighSpeed(PairedHighSpeedData &data);
+
     /**
      * @brief Adds high-speed IMU data that can be transmitted.
      *
-     * Data is added to a queue to ensure this is thread-safe.
+     * Data is added to a single producer, single consumer ring buffer. Only the IMU task may call this.
      *
      * @param data is the IMU data.
      */
     void addIMU(IMUData &data);
 
+    /**
+     * @brief Adds a torque profile that can be transmitted.
+     *
+     * Data is added to a queue to ensure this is thread-safe. Profiles are ignored if the connection doesn't use them.
+     *
+     * @param data is the torque profile for the last rotation.
+     * @param side is the side.
+     */
+    void addProfile(TorqueProfile &data, EnumSide side);
+
     /**
      * @brief Sets whether the connection should accept data to transmit.
      * 
      * @param state 
+     * @param wakeOnData whether producers should notify the connection task when there is data to send. States that
+     *                   accept data but poll for it (e.g. logging to flash while connecting) set this to false so that
+     *                   their waits aren't cut short.
      */
-    void setAllowData(bool state);
+    void setAllowData(bool state, bool wakeOnData = true);
 
     /**
      * @brief Indicates whether a message is currently being sent (in case the power supply rail does weird things and data needs to be discarded).
@@ -121,6 +248,14 @@ public:
      */
     bool isTransmitting = false;
 
+    /**
+     * @brief Gets the counters for a stream.
+     *
+     * @param stream the stream.
+     * @return const StreamStats& the counters.
+     */
+    const StreamStats &getStreamStats(EnumStream stream) { return m_streamStats[stream]; }
+
 protected:
     /**
      * @brief Queues that all connection types are expected to accept.
@@ -130,20 +265,34 @@ protected:
     QueueHandle_t m_lowSpeedQueue = 0;
 
     /**
-     * @brief Queues that all connection types are expected to accept.
+     * @brief Queues for the torque profile of each side. These are 0 if not used by the connection.
      *
-     * Using an array to allow for each side to be easily addressed.
+     */
+    QueueHandle_t m_profileQueues[2] = {0, 0};
+
+    /**
+     * @brief Control blocks of the queues above, so that nothing is allocated on the heap.
      *
      */
-    QueueHandle_t m_sideQueues[2] = {0, 0};
+    StaticQueue_t m_housekeepingQueueBuffer, m_lowSpeedQueueBuffer, m_profileQueueBuffers[2];
 
     /**
-     * @brief Queues that all connection types are expected to accept.
+     * @brief Ring buffers for high-speed data from each side.
      *
-     * Using an array to allow for each side to be easily addressed.
+     * Each side has exactly one producer (the amp task for that side, or the paired amp task with AMP_SYNCHRONISED)
+     * and one consumer (the connection task), so lock free ring buffers are used instead of queues. Using an array to allow for each side to be easily addressed.
+     * These have a capacity of 0 if high speed data is not used by the connection.
      *
      */
-    QueueHandle_t m_imuQueue = 0;
+    RingBuffer<HighSpeedData> m_sideBuffers[2];
+
+    /**
+     * @brief Ring buffer for IMU data (produced by the IMU task, consumed by the connection task).
+     *
+     * This has a capacity of 0 if IMU data is not used by the connection.
+     *
+     */
+    RingBuffer<IMUData> m_imuBuffer;
 
     /**
      * @brief Enumberator to represent channels to notify over.
@@ -151,8 +300,9 @@ protected:
      */
     enum ConnectionNotifyChannel
     {
-        CONN_NOTIFY_ENABLE = 0b01,
-        CONN_NOTIFY_DISABLE = 0b10
+        CONN_NOTIFY_ENABLE = 0b001,
+        CONN_NOTIFY_DISABLE = 0b010,
+        CONN_NOTIFY_DATA = 0b100 // A queue received a message or a ring buffer has enough for a packet.
     };
 
     /**
@@ -164,6 +314,9 @@ protected:
     /**
      * @brief Checks if the connection needs to be disabled and put to sleep.
      *
+     * Any notification ends the wait early, including `CONN_NOTIFY_DATA` from producers while waking on data. The
+     * active states use this to sleep until there is something to send rather than polling the queues.
+     *
      * @param yieldTicks is the maximum ticks to wait (i.e. can be used as a delay that might exit early).
      *
      * @return true `disable()` has been called since the last check.
@@ -198,19 +351,142 @@ protected:
      */
     bool m_isConnected();
 
+    /**
+     * @brief Discards the oldest records in ring buffers that use `BACKPRESSURE_DROP_OLDEST` so there is always room
+     * for new ones. Call this regularly from the connection task.
+     *
+     */
+    void trimBuffers();
+
+    /**
+     * @brief Counts how many of the oldest records can be put in a packed packet.
+     *
+     * @param ring the ring buffer to check. This should have at least `maxCount` records.
+     * @param maxCount the most records to put in the packet.
+     * @return uint16_t the number of records, up to `maxCount` or however many are in the ring buffer.
+     */
+    template <typename T>
+    static uint16_t countPackable(RingBuffer<T> &ring, uint16_t maxCount);
+
+    /**
+     * @brief Serialises records from a ring buffer into a writer.
+     *
+     * This is the only place the packed format is assembled, so every connection sends the same packets.
+     *
+     * @param writer where to write the serialised records. This needs `reserve(size)` to return space for `size` bytes
+     *               and `flush()` to finish writing (e.g. `BufferWriter`).
+     * @param ring the ring buffer to take records from. This should have at least `count` records.
+     * @param count the number of records to write and remove from the ring buffer. Fewer are written if the ring
+     *              buffer runs out. For the packed format, use `countPackable()` to find this.
+     * @param packed whether to use the packed format.
+     * @param encodedSize the number of bytes each serialised record takes.
+     */
+    template <typename T, typename W>
+    static void m_streamRecords(W &writer, RingBuffer<T> &ring, const uint16_t count, const bool packed, const uint16_t encodedSize);
+
+    /**
+     * @brief Sets how many records a ring buffer needs before the producer wakes the connection task.
+     *
+     * This should be the number of records in a full packet so that the task only wakes when it has something to
+     * send. Call it whenever the packet size may have changed. The task is also woken when a buffer is 3/4 full so
+     * that `trimBuffers()` can make room.
+     *
+     * @param stream the stream of the buffer (`STREAM_LEFT`, `STREAM_RIGHT` or `STREAM_IMU`).
+     * @param records the number of records (1 wakes the task for every record).
+     */
+    void setReadyThreshold(EnumStream stream, uint16_t records) { m_readyThresholds[stream] = records ? records : 1; }
+
+    /**
+     * @brief Checks whether any queue has a message or any ring buffer has reached its ready threshold.
+     *
+     * Call this after `setReadyThreshold()` so that records added in between aren't missed.
+     *
+     * @return true if there is something to send.
+     * @return false if the connection task can sleep until it is notified.
+     */
+    bool isDataWaiting();
+
+    /**
+     * @brief Wakes the connection task so that it checks for data to send (if it is accepting data).
+     *
+     */
+    void m_notifyData();
+
 private:
     /**
-     * @brief Attempts to add data to a queue and has a tantrum if it's full.
+     * @brief Attempts to add data to a queue, applying the backpressure policy and counting anything lost.
      *
      * @param queue the queue to add data to.
      * @param data the data.
+     * @param stream the stream the queue is for.
+     * @param policy the backpressure policy (`BACKPRESSURE_DROP_NEWEST` or `BACKPRESSURE_DROP_OLDEST`).
      */
-    void m_addToQueue(QueueHandle_t queue, void *data);
+    template <typename T>
+    void m_addToQueue(QueueHandle_t queue, T &data, EnumStream stream, uint8_t policy);
+
+    /**
+     * @brief Attempts to add data to a ring buffer, applying the backpressure policy and counting anything lost.
+     *
+     * `BACKPRESSURE_DROP_OLDEST` is handled by the consumer in `trimBuffers()` as only it can remove records.
+     *
+     * @param ring the ring buffer to add data to.
+     * @param data the data.
+     * @param stream the stream the ring buffer is for.
+     * @param policy the backpressure policy.
+     */
+    template <typename T>
+    void m_addToBuffer(RingBuffer<T> &ring, T &data, EnumStream stream, uint8_t policy);
+
+    /**
+     * @brief Adds data to a ring buffer once the backpressure policy has been applied.
+     *
+     * @param ring the ring buffer to add to.
+     * @param data the data to add.
+     * @param stream the stream the buffer is for (used for the counters).
+     * @param depth the number of records in the buffer before adding this one.
+     */
+    template <typename T>
+    void m_pushToBuffer(RingBuffer<T> &ring, T &data, EnumStream stream, uint32_t depth);
+
+    /**
+     * @brief Updates the decimation factor for a stream and decides whether to skip a record.
+     *
+     * The factor doubles when the buffer has been over 3/4 full for `BACKPRESSURE_SUSTAIN` records and halves when it
+     * has been under 1/4 full for as long.
+     *
+     * @param stats the stream.
+     * @param depth the number of records waiting.
+     * @param capacity the capacity of the buffer.
+     * @return true if the record should be skipped.
+     */
+    static bool m_decimate(StreamStats &stats, uint32_t depth, uint32_t capacity);
+
+    /**
+     * @brief Discards the oldest records in a ring buffer if it is over 3/4 full and uses `BACKPRESSURE_DROP_OLDEST`.
+     *
+     * Enough records for a full packet (the ready threshold) are always kept, even if that is more than 3/4.
+     *
+     * @param ring the ring buffer.
+     * @param stream the stream the ring buffer is for.
+     * @param policy the backpressure policy.
+     */
+    template <typename T>
+    void m_trimBuffer(RingBuffer<T> &ring, EnumStream stream, uint8_t policy);
+
+    StreamStats m_streamStats[STREAM_COUNT];
+
+    /**
+     * @brief Records needed in each ring buffer before the connection task is woken (see `setReadyThreshold()`).
+     *
+     * Written by the connection task and read by the producers. Accessing a uint16_t should be monatomic.
+     *
+     */
+    uint16_t m_readyThresholds[STREAM_COUNT] = {1, 1, 1, 1, 1, 1, 1};
 
     /**
      * @brief Checks / waits for a notification and checks if a particular bit is set.
      *
-     * Only the given bit is cleared if a notification is received.
+     * Only the given bits (and `CONN_NOTIFY_DATA`) are cleared if a notification is received.
      *
      * @param yieldTicks the maximum time delay.
      * @param bits the bits to listen for. Any notification will be received, but only these bits will be cleared and
@@ -221,17 +497,80 @@ private:
     static bool isNotificationWaiting(uint32_t yieldTicks, uint32_t bits);
 
     /**
-     * @brief Creates the queue for a side
+     * @brief Creates a queue in the connection arena if it doesn't already exist.
+     *
+     * @param queue the handle of the queue to create.
+     * @param control the queue's control block.
+     * @param length the number of items the queue can hold.
+     * @param itemSize the size of each item in bytes.
+     * @param name name of the queue for logging.
+     */
+    static void m_createQueue(QueueHandle_t &queue, StaticQueue_t &control, int length, size_t itemSize, const char *name);
+
+    /**
+     * @brief Creates a ring buffer in the connection arena if it doesn't already exist.
      *
-     * @param side the side.
-     * @param length the length of the queue.
+     * @param buffer the buffer to create.
+     * @param length the capacity of the buffer.
+     * @param name name of the buffer for logging.
      */
-    void m_createSideQueue(EnumSide side, int length);
+    template <typename T>
+    void m_createBuffer(RingBuffer<T> &buffer, int length, const char *name);
 
     bool m_connected = false;
+    bool m_wakeOnData = false; // Whether producers should send `CONN_NOTIFY_DATA`.
 
 };
 
+template <typename T, typename W>
+void Connection::m_streamRecords(W &writer, RingBuffer<T> &ring, const uint16_t count, const bool packed, const uint16_t encodedSize)
+{
+    uint32_t previousTimestamp = 0;
+    float baseVelocity = 0;
+    uint16_t added = 0;
+    while (added < count)
+    {
+        // Take a contiguous block of records from the ring buffer (at most 2 blocks are needed if it wraps).
+        T *records;
+        const uint32_t blockCount = ring.peek(records, count - added);
+        if (!blockCount)
+        {
+            // Fewer records than expected. Send what there is rather than waiting forever.
+            break;
+        }
+        for (uint32_t i = 0; i < blockCount; i++)
+        {
+            if (packed)
+            {
+                uint8_t *buffer;
+                if (added + i == 0)
+                {
+                    // First record in the packet sets the base values.
+                    buffer = writer.reserve(T::PACKED_HEADER_SIZE + encodedSize);
+                    records[i].packedHeader(buffer);
+                    buffer += T::PACKED_HEADER_SIZE;
+                    previousTimestamp = records[i].timestamp;
+                    baseVelocity = records[i].velocity;
+                }
+                else
+                {
+                    buffer = writer.reserve(encodedSize);
+                }
+                records[i].toPackedBytes(buffer, previousTimestamp, baseVelocity);
+                previousTimestamp = records[i].timestamp;
+            }
+            else
+            {
+                records[i].toBytes(writer.reserve(encodedSize));
+            }
+        }
+        ring.pop(blockCount);
+        added += blockCount;
+    }
+
+    // Write out whatever is left over.
+    writer.flush();
+}
 
 /**
  * @brief Task that runs the connection.
@@ -0,0 +1,221 @@
+/**
+ * @file crank_maths.h
+ * @brief Calculations in the hot paths that don't depend on any hardware.
+ *
+ * These are kept free of Arduino and FreeRTOS so that the exact same code can be compiled on a computer by the
+ * benchmarks in `scripts-testing/benchmarks`.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include <stdint.h>
+#include <math.h>
+
+/**
+ * @brief Precomputed conversion from raw strain gauge readings to torque.
+ *
+ * The gain includes the calibration coefficient and thermal compensation. It only needs to be recalculated when the
+ * calibration or temperature changes, so each reading costs one subtraction and one multiplication.
+ *
+ */
+struct TorqueConversion
+{
+    uint32_t offset = 0; // The raw reading when there is no torque.
+    float gain = 0;      // Torque per raw unit at the current temperature (Nm).
+};
+
+/**
+ * @brief Calculates the factor to multiply the gain by to compensate for temperature.
+ *
+ * The change in gain is modelled as a polynomial in the difference from the calibration temperature. Other models
+ * (for example a lookup table) can be used here without changing the per-reading maths.
+ *
+ * @param tempCoefficient the fractional change in gain per degree.
+ * @param tempCoefficient2 the fractional change in gain per degree squared (0 for a linear model).
+ * @param tempTest the temperature that the coefficient was measured at.
+ * @param temperature the current temperature.
+ * @return float the factor.
+ */
+inline float thermalGain(float tempCoefficient, float tempCoefficient2, float tempTest, float temperature)
+{
+    const float difference = temperature - tempTest;
+    return 1 - difference * (tempCoefficient + tempCoefficient2 * difference);
+}
+
+/**
+ * @brief Works out the conversion for the given calibration and temperature.
+ *
+ * @param offset the raw reading when there is no torque.
+ * @param coefficient the torque per raw unit (Nm).
+ * @param tempCoefficient the fractional change in gain per degree.
+ * @param tempCoefficient2 the fractional change in gain per degree squared.
+ * @param tempTest the temperature that the coefficient was measured at.
+ * @param temperature the current temperature.
+ * @return TorqueConversion the conversion.
+ */
+inline TorqueConversion makeTorqueConversion(uint32_t offset, float coefficient, float tempCoefficient,
+                                             float tempCoefficient2, float tempTest, float temperature)
+{
+    TorqueConversion conversion;
+    conversion.offset = offset;
+    conversion.gain = coefficient * thermalGain(tempCoefficient, tempCoefficient2, tempTest, temperature);
+    return conversion;
+}
+
+/**
+ * @brief Converts a raw strain gauge reading to a torque using a precomputed conversion.
+ *
+ * @param raw the raw reading from the amplifier.
+ * @param conversion the conversion from `makeTorqueConversion()`.
+ * @return float the torque in Nm.
+ */
+inline float applyTorqueConversion(uint32_t raw, const TorqueConversion &conversion)
+{
+    // There is a relatively linear relationship between the raw value and the torque.
+    const int32_t difference = raw - conversion.offset;
+    return difference * conversion.gain;
+}
+
+/**
+ * @brief Converts a raw strain gauge reading to a torque, working out the conversion each time.
+ *
+ * @param raw the raw reading from the amplifier.
+ * @param offset the raw reading when there is no torque.
+ * @param coefficient the torque per raw unit (Nm).
+ * @param tempCoefficient the fractional change in gain per degree.
+ * @param tempTest the temperature that the coefficient was measured at.
+ * @param temperature the current temperature.
+ * @param tempCoefficient2 the fractional change in gain per degree squared.
+ * @return float the torque in Nm.
+ */
+inline float rawToTorque(uint32_t raw, uint32_t offset, float coefficient, float tempCoefficient, float tempTest,
+                         float temperature, float tempCoefficient2 = 0)
+{
+    return applyTorqueConversion(
+        raw, makeTorqueConversion(offset, coefficient, tempCoefficient, tempCoefficient2, tempTest, temperature));
+}
+
+/**
+ * @brief Corrects a given reading for an axis for centripetal acceleration due to the offset of the IMU relative to
+ * the centre of rotation.
+ *
+ * @param reading the given acceleration in ms^-2
+ * @param radius the radius of the IMU for that axis (x or y offset most likely).
+ * @param velocity the angular velocity in radians per second.
+ * @return float the corrected acceleration value.
+ */
+inline float correctCentripetal(float reading, float radius, float velocity)
+{
+    return reading + radius * velocity * velocity;
+}
+
+/**
+ * @brief Calculates the angle based on two acceleration readings.
+ *
+ * @param x the x axis acceleration.
+ * @param y the y axis acceleration.
+ * @return float the calculated angle (radians).
+ */
+inline float accelToAngle(float x, float y)
+{
+    if (x != 0)
+    {
+        // Most cases, avoiding any chance of divide by 0 errors.
+        float angle = atanf(y / x);
+        if (x > 0)
+        {
+            // First or fourth quadrants
+            return angle;
+        }
+        else
+        {
+            // Second or third quadrants
+            if (y >= 0)
+            {
+                // Second
+                return M_PI + angle;
+            }
+            else
+            {
+                // Third
+                return -M_PI + angle;
+            }
+        }
+    }
+    else
+    {
+        // Very rare case when x is 0 (avoid division by 0).
+        if (y >= 0)
+        {
+            // Straight up.
+            return M_PI_2;
+        }
+        else
+        {
+            // Straight down.
+            return -M_PI_2;
+        }
+    }
+}
+
+/**
+ * @brief Estimates how long before a reading the crank angle wrapped around from pi to -pi.
+ *
+ * The time is worked out from the angle travelled since the wrap and the average velocity of the two readings either
+ * side of it. If the velocity isn't positive (for example while the filter is settling), the angle is linearly
+ * interpolated between the readings instead.
+ *
+ * @param previousPosition the angle of the reading before the wrap (rad).
+ * @param previousVelocity the angular velocity of the reading before the wrap (rad/s).
+ * @param position the angle of the reading after the wrap (rad).
+ * @param velocity the angular velocity of the reading after the wrap (rad/s).
+ * @param interval the time between the readings (us).
+ * @return uint32_t the time between the wrap and the reading after it (us), no more than `interval`.
+ */
+inline uint32_t timeSinceWrap(float previousPosition, float previousVelocity, float position, float velocity,
+                              uint32_t interval)
+{
+    const float sinceWrap = position + M_PI;
+    const float meanVelocity = (previousVelocity + velocity) / 2;
+    float elapsed;
+    if (meanVelocity > 0)
+    {
+        elapsed = sinceWrap / meanVelocity * 1e6f;
+    }
+    else
+    {
+        const float travelled = position + 2 * M_PI - previousPosition;
+        elapsed = travelled > 0 ? interval * sinceWrap / travelled : 0;
+    }
+
+    // Keep within the readings (also catches NaN).
+    if (!(elapsed >= 0))
+    {
+        return 0;
+    }
+    return elapsed < interval ? elapsed : interval;
+}
+
+/**
+ * @brief Assigns an angle to one of 3 sectors.
+ *
+ * @param angle the input angle.
+ * @return int8_t the sector (0, 1 or 2)
+ */
+inline int8_t angleToSector(float angle)
+{
+    if (angle < -M_PI / 3)
+    {
+        return 0;
+    }
+    else if (angle < M_PI / 3)
+    {
+        return 1;
+    }
+    else
+    {
+        return 2;
+    }
+}
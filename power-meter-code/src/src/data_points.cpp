@@ -4,7 +4,7 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-10-25
+ * @date 2026-10-14
  */
 #include "data_points.h"
 
@@ -25,28 +25,48 @@ float LowSpeedData::cadence()
     }
 }
 
+void LowSpeedData::toBytes(uint8_t *buffer)
+{
+    SCHEMA_SERIALISE(LowSpeedWire, LOW_SPEED_SCHEMA, buffer);
+}
+
 inline float BaseData::cadence()
 {
     return VELOCITY_TO_CADENCE(velocity);
 }
 
-void BaseData::baseBytes(uint8_t *buffer)
+void BaseData::packedHeader(uint8_t *buffer)
 {
-    // We can't just copy the entire struct due to the potential for byte packing.
-    ADD_TO_BYTES(timestamp, buffer, 0); // Add the timestamp
-    ADD_TO_BYTES(velocity, buffer, 4);  // Add the velocity
-    ADD_TO_BYTES(position, buffer, 8);  // Add the position
+    SCHEMA_SERIALISE(PackedHeaderWire, PACKED_HEADER_SCHEMA, buffer);
+}
+
+int16_t BaseData::toFixed(float value, float scale)
+{
+    float scaled = roundf(value * scale);
+    if (scaled > INT16_MAX)
+    {
+        return INT16_MAX;
+    }
+    else if (scaled < INT16_MIN)
+    {
+        return INT16_MIN;
+    }
+    return scaled;
 }
 
 void IMUData::toBytes(uint8_t *buffer)
 {
-    BaseData::baseBytes(buffer); // 12 bytes
-    ADD_TO_BYTES(xAccel, buffer, BASE_BYTES_SIZE);
-    ADD_TO_BYTES(yAccel, buffer, BASE_BYTES_SIZE + 4);
-    ADD_TO_BYTES(zAccel, buffer, BASE_BYTES_SIZE + 8);
-    ADD_TO_BYTES(xGyro, buffer, BASE_BYTES_SIZE + 12);
-    ADD_TO_BYTES(yGyro, buffer, BASE_BYTES_SIZE + 16);
-    ADD_TO_BYTES(zGyro, buffer, BASE_BYTES_SIZE + 20);
+    SCHEMA_SERIALISE(IMUWire, IMU_SCHEMA, buffer);
+}
+
+void IMUData::packedHeader(uint8_t *buffer)
+{
+    SCHEMA_SERIALISE(PackedIMUHeaderWire, PACKED_IMU_HEADER_SCHEMA, buffer);
+}
+
+void IMUData::toPackedBytes(uint8_t *buffer, uint32_t previousTimestamp, float baseVelocity)
+{
+    SCHEMA_SERIALISE(PackedIMUWire, PACKED_IMU_SCHEMA, buffer);
 }
 
 inline float HighSpeedData::power()
@@ -56,11 +76,33 @@ inline float HighSpeedData::power()
 
 void HighSpeedData::toBytes(uint8_t *buffer)
 {
-    baseBytes(buffer); // 12 bytes
-    ADD_TO_BYTES(raw, buffer, BASE_BYTES_SIZE);
-    float calcTorque = torque;
-    ADD_TO_BYTES(calcTorque, buffer, BASE_BYTES_SIZE + 4);
-    float calcPower = power();
-    ADD_TO_BYTES(calcPower, buffer, BASE_BYTES_SIZE + 8);
-    buffer[BASE_BYTES_SIZE + 12] = isTransmitting;
-}
\ No newline at end of file
+    SCHEMA_SERIALISE(HighSpeedWire, HIGH_SPEED_SCHEMA, buffer);
+}
+
+void HighSpeedData::toPackedBytes(uint8_t *buffer, uint32_t previousTimestamp, float baseVelocity)
+{
+    // Only the lower 24 bits of the raw reading are sent.
+    SCHEMA_SERIALISE(PackedHighSpeedWire, PACKED_HIGH_SPEED_SCHEMA, buffer);
+}
+
+HighSpeedData PairedHighSpeedData::side(EnumSide side)
+{
+    HighSpeedData data;
+    data.timestamp = timestamp;
+    data.velocity = velocity;
+    data.position = position;
+    data.isTransmitting = isTransmitting;
+    data.raw = raw[side];
+    data.torque = torque[side];
+    return data;
+}
+
+void TorqueProfile::toBytes(uint8_t *buffer)
+{
+    buffer[0] = PROFILE_FORMAT_VERSION;
+    ADD_TO_BYTES(timestamp, buffer, 1);
+    ADD_TO_BYTES(duration, buffer, 5);
+    buffer[9] = binCount;
+    memcpy(buffer + PROFILE_HEADER_SIZE, torque, 2 * binCount);
+}
+
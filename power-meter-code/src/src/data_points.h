@@ -4,10 +4,11 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-10-25
+ * @date 2026-10-14
  */
 #pragma once
 #include "../defines.h"
+#include "record_schema.h"
 
 #define VELOCITY_TO_CADENCE(vel) (vel * 60 / (2 * M_PI));
 
@@ -38,6 +39,12 @@ public:
      */
     float battery;
 
+    /**
+     * @brief Battery current in mA, or NAN if this hardware can't measure it.
+     *
+     */
+    float current = NAN;
+
     /**
      * @brief Calculates the average temperature of all sides.
      *
@@ -111,6 +118,15 @@ public:
      * 
      */
     bool rotationEvent = false;
+
+    /**
+     * @brief Converts the data to bytes for storing in the flash log.
+     *
+     * @param buffer is the buffer to put the data in. This needs to be at least LOW_SPEED_BYTES_SIZE bytes long.
+     */
+    void toBytes(uint8_t *buffer);
+
+    static const int LOW_SPEED_BYTES_SIZE = sizeof(LowSpeedWire);
 };
 
 class BaseData
@@ -144,13 +160,22 @@ public:
     float cadence();
 
     /**
-     * @brief Adds the current data point to a buffer for transmission.
+     * @brief Adds the header of a packed packet, using this as the first data point.
      *
-     * @param buffer is the buffer to put the data in. Needs to be at least BASE_BYTE_SIZE bytes long.
+     * @param buffer is the buffer to put the header in. Needs to be at least PACKED_HEADER_SIZE bytes long.
      */
-    void baseBytes(uint8_t *buffer);
+    void packedHeader(uint8_t *buffer);
+
+    static const int PACKED_HEADER_SIZE = sizeof(PackedHeaderWire);
 
-    static const int BASE_BYTES_SIZE = 12;
+    /**
+     * @brief Converts a float to a saturated 16 bit fixed point number.
+     *
+     * @param value the value to convert.
+     * @param scale the number to multiply by before rounding.
+     * @return int16_t the fixed point number.
+     */
+    static int16_t toFixed(float value, float scale);
 };
 
 /**
@@ -167,6 +192,12 @@ public:
     float yGyro;
     float zGyro;
 
+    /**
+     * @brief The IMU sample rate when this was captured (Hz).
+     *
+     */
+    uint16_t sampleRate = IMU_SAMPLE_RATE;
+
     /**
      * @brief Adds the current data point to a buffer for transmission.
      *
@@ -174,7 +205,28 @@ public:
      */
     void toBytes(uint8_t *buffer);
 
-    static const int IMU_BYTES_SIZE = 6*4 + BASE_BYTES_SIZE;
+    static const int IMU_BYTES_SIZE = sizeof(IMUWire);
+
+    /**
+     * @brief Adds the header of a packed packet, using this as the first data point. This includes the sample rate.
+     *
+     * @param buffer is the buffer to put the header in. Needs to be at least PACKED_HEADER_SIZE bytes long.
+     */
+    void packedHeader(uint8_t *buffer);
+
+    static const int PACKED_HEADER_SIZE = sizeof(PackedIMUHeaderWire);
+
+    /**
+     * @brief Adds the current data point to a buffer for transmission in a packed packet.
+     *
+     * @param buffer is the buffer to put the data in. This needs to be at least PACKED_BYTES_SIZE bytes long.
+     * @param previousTimestamp is the timestamp of the previous point in the packet (or this point if it is the
+     *                          first). This must be no more than PACKED_MAX_DELTA before this point.
+     * @param baseVelocity is the velocity of the first point in the packet.
+     */
+    void toPackedBytes(uint8_t *buffer, uint32_t previousTimestamp, float baseVelocity);
+
+    static const int PACKED_BYTES_SIZE = sizeof(PackedIMUWire);
 };
 
 /**
@@ -220,5 +272,114 @@ public:
      */
     void toBytes(uint8_t *buffer);
 
-    static const int FAST_BYTES_SIZE = 4 + 4 + 4 + BASE_BYTES_SIZE + 1;
-};
\ No newline at end of file
+    static const int FAST_BYTES_SIZE = sizeof(HighSpeedWire);
+
+    /**
+     * @brief Adds the current data point to a buffer for transmission in a packed packet.
+     *
+     * Power is not included as it can be calculated from the torque and velocity.
+     *
+     * @param buffer is the buffer to put the data in. This needs to be at least PACKED_BYTES_SIZE bytes long.
+     * @param previousTimestamp is the timestamp of the previous point in the packet (or this point if it is the
+     *                          first). This must be no more than PACKED_MAX_DELTA before this point.
+     * @param baseVelocity is the velocity of the first point in the packet.
+     */
+    void toPackedBytes(uint8_t *buffer, uint32_t previousTimestamp, float baseVelocity);
+
+    static const int PACKED_BYTES_SIZE = sizeof(PackedHighSpeedWire);
+};
+
+/**
+ * @brief High speed data for both sides taken at the same sample (see AMP_SYNCHRONISED).
+ *
+ * Both sides share the timestamp, position and velocity of a single prediction, so the records for each side are sent
+ * with identical timestamps and can be compared directly (for example, to get the instantaneous pedal balance).
+ *
+ */
+class PairedHighSpeedData : public BaseData
+{
+public:
+    /**
+     * @brief Flag for whether a transmission took place whilst reading this pair.
+     *
+     */
+    bool isTransmitting;
+
+    /**
+     * @brief The raw reading from the strain gauge on each side.
+     *
+     */
+    uint32_t raw[2];
+
+    /**
+     * @brief The torque on each side in Nm.
+     *
+     */
+    float torque[2];
+
+    /**
+     * @brief Gets the record for one side.
+     *
+     * @param side the side to get.
+     * @return HighSpeedData the data for that side.
+     */
+    HighSpeedData side(EnumSide side);
+};
+
+/**
+ * @brief Torque profile settings.
+ *
+ */
+#define PROFILE_MAX_BINS 72         // 5 degrees per bin.
+#define PROFILE_FORMAT_VERSION 1
+#define PROFILE_EMPTY_BIN INT16_MIN // Bins with no samples. Torques are saturated to +-327.67 Nm so this is never data.
+
+/**
+ * @brief Average torque in equally sized angular bins over a single rotation of the crank on one side.
+ *
+ * Bin `n` covers crank angles from `-pi + 2 * pi * n / binCount` up to `-pi + 2 * pi * (n + 1) / binCount` radians.
+ */
+class TorqueProfile
+{
+public:
+    /**
+     * @brief The time at which the rotation started (us).
+     *
+     */
+    uint32_t timestamp;
+
+    /**
+     * @brief The time taken to complete the rotation (us).
+     *
+     */
+    uint32_t duration;
+
+    /**
+     * @brief The number of bins used.
+     *
+     */
+    uint8_t binCount;
+
+    /**
+     * @brief The average torque in each bin in fixed point (PACKED_TORQUE_SCALE), or PROFILE_EMPTY_BIN if the bin had
+     * no samples.
+     *
+     */
+    int16_t torque[PROFILE_MAX_BINS];
+
+    /**
+     * @brief Converts the profile to bytes for transmission.
+     *
+     * @param buffer is the buffer to put the data in. This needs to be at least `bytesSize()` bytes long.
+     */
+    void toBytes(uint8_t *buffer);
+
+    /**
+     * @brief The number of bytes used by `toBytes()`.
+     *
+     */
+    uint16_t bytesSize() { return PROFILE_HEADER_SIZE + 2 * binCount; }
+
+    static const int PROFILE_HEADER_SIZE = 1 + 4 + 4 + 1;
+    static const int PROFILE_MAX_BYTES_SIZE = PROFILE_HEADER_SIZE + 2 * PROFILE_MAX_BINS;
+};
@@ -0,0 +1,177 @@
+/**
+ * @file decimator.cpp
+ * @brief Low pass filters and thins out high speed and IMU records before they are sent.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "decimator.h"
+#include <math.h>
+#ifdef DECIMATE_ESP_DSP
+#include <dsps_dotprod.h>
+#endif
+
+void DecimatorChannels<HighSpeedData>::read(const HighSpeedData &data, float *channels)
+{
+    channels[0] = data.torque;
+    channels[1] = data.raw; // 24 bit readings are exact as floats.
+}
+
+void DecimatorChannels<HighSpeedData>::write(HighSpeedData &data, const float *channels)
+{
+    data.torque = channels[0];
+    data.raw = lroundf(channels[1]);
+}
+
+void DecimatorChannels<IMUData>::read(const IMUData &data, float *channels)
+{
+    channels[0] = data.xAccel;
+    channels[1] = data.yAccel;
+    channels[2] = data.zAccel;
+    channels[3] = data.xGyro;
+    channels[4] = data.yGyro;
+    channels[5] = data.zGyro;
+}
+
+void DecimatorChannels<IMUData>::write(IMUData &data, const float *channels)
+{
+    data.xAccel = channels[0];
+    data.yAccel = channels[1];
+    data.zAccel = channels[2];
+    data.xGyro = channels[3];
+    data.yGyro = channels[4];
+    data.zGyro = channels[5];
+}
+
+/**
+ * @brief Multiplies and adds two arrays.
+ *
+ */
+static inline float dotProduct(const float *a, const float *b, uint8_t length)
+{
+#ifdef DECIMATE_ESP_DSP
+    // SIMD version on the ESP32-S3.
+    float result;
+    dsps_dotprod_f32(a, b, &result, length);
+    return result;
+#else
+    float result = 0;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        result += a[i] * b[i];
+    }
+    return result;
+#endif
+}
+
+template <typename T>
+void Decimator<T>::configure(uint16_t inputRate, uint16_t outputRate)
+{
+    if (inputRate == m_inputRate && outputRate == m_outputRate)
+    {
+        return;
+    }
+    m_inputRate = inputRate;
+    m_outputRate = outputRate;
+    m_primed = false;
+    m_count = 0;
+    m_maxGap = inputRate ? DECIMATE_GAP_RESET * 1000000 / inputRate : 0;
+
+    // Round to the nearest whole factor. Outputs must also be close enough together for each packed record's time delta.
+    uint32_t factor = outputRate && inputRate > outputRate ? (inputRate + outputRate / 2) / outputRate : 1;
+    const uint32_t maxFactor = (uint64_t)PACKED_MAX_DELTA * inputRate / 1000000;
+    factor = factor > maxFactor ? maxFactor : factor;
+    factor = factor > DECIMATE_MAX_FACTOR ? DECIMATE_MAX_FACTOR : factor;
+    m_factor = factor ? factor : 1;
+    m_taps = m_factor == 1 ? 1 : DECIMATE_TAPS_PER_FACTOR * m_factor + 1;
+
+    // Windowed sinc with the cutoff at the output Nyquist frequency.
+    const float cutoff = 0.5f / m_factor; // Cycles per input record.
+    const int8_t centre = m_taps / 2;
+    float sum = 0;
+    for (uint8_t i = 0; i < m_taps; i++)
+    {
+        const int8_t n = i - centre;
+        const float sinc = n ? sinf(2 * (float)M_PI * cutoff * n) / ((float)M_PI * n) : 2 * cutoff;
+        const float window = m_taps > 1 ? 0.54f - 0.46f * cosf(2 * (float)M_PI * i / (m_taps - 1)) : 1;
+        m_coefficients[i] = sinc * window;
+        sum += m_coefficients[i];
+    }
+
+    // Unity gain at DC.
+    for (uint8_t i = 0; i < m_taps; i++)
+    {
+        m_coefficients[i] /= sum;
+    }
+}
+
+template <typename T>
+bool Decimator<T>::add(const T &input, T &output)
+{
+    if (m_factor == 1)
+    {
+        // Nothing to do.
+        output = input;
+        return true;
+    }
+
+    float channels[DecimatorChannels<T>::COUNT];
+    DecimatorChannels<T>::read(input, channels);
+    if (!m_primed || input.timestamp - m_records[m_position].timestamp > m_maxGap)
+    {
+        // Readings stopped for a while (or this is the first). Don't mix in values from before.
+        m_reset(input, channels);
+    }
+    else
+    {
+        // Add to the history.
+        m_position = m_position + 1 == m_taps ? 0 : m_position + 1;
+        m_records[m_position] = input;
+        for (uint8_t c = 0; c < DecimatorChannels<T>::COUNT; c++)
+        {
+            m_history[c][m_position] = channels[c];
+            m_history[c][m_position + m_taps] = channels[c];
+        }
+    }
+
+    // Only calculate the outputs that are kept.
+    m_count++;
+    if (m_count < m_factor)
+    {
+        return false;
+    }
+    m_count = 0;
+
+    // The filter is linear phase, so its output lines up with the record in the middle of the history.
+    const uint8_t middle = m_position + m_taps - m_taps / 2;
+    output = m_records[middle >= m_taps ? middle - m_taps : middle];
+    for (uint8_t c = 0; c < DecimatorChannels<T>::COUNT; c++)
+    {
+        channels[c] = dotProduct(&m_history[c][m_position + 1], m_coefficients, m_taps);
+    }
+    DecimatorChannels<T>::write(output, channels);
+    return true;
+}
+
+template <typename T>
+void Decimator<T>::m_reset(const T &input, const float *channels)
+{
+    for (uint8_t i = 0; i < m_taps; i++)
+    {
+        m_records[i] = input;
+    }
+    for (uint8_t c = 0; c < DecimatorChannels<T>::COUNT; c++)
+    {
+        for (uint8_t i = 0; i < 2 * m_taps; i++)
+        {
+            m_history[c][i] = channels[c];
+        }
+    }
+    m_position = 0;
+    m_count = m_factor - (m_taps / 2 + 1); // Counting this record, output once it is in the middle.
+    m_primed = true;
+}
+
+template class Decimator<HighSpeedData>;
+template class Decimator<IMUData>;
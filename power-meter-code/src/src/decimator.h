@@ -0,0 +1,141 @@
+/**
+ * @file decimator.h
+ * @brief Low pass filters and thins out high speed and IMU records before they are sent.
+ *
+ * Dropping records (as `imuHowOften` does) folds anything above the new Nyquist frequency, such as pedal stroke
+ * harmonics and road vibration, back down into the data that is sent. These filter each value with a linear phase FIR
+ * low pass filter first and only calculate the outputs that are kept, so the work is spread over every input record.
+ *
+ * Like `pipeline.h`, this doesn't depend on the hardware or FreeRTOS so it can be benchmarked on a computer.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include "../defines.h"
+#include "data_points.h"
+
+#define DECIMATE_MAX_FACTOR 8                                         // Keep at least 1 in this many records.
+#define DECIMATE_TAPS_PER_FACTOR 8                                    // Filter length per step of the factor.
+#define DECIMATE_MAX_TAPS (DECIMATE_TAPS_PER_FACTOR * DECIMATE_MAX_FACTOR + 1) // Always odd so the delay is whole.
+#define DECIMATE_GAP_RESET 2.5f // Start the filter again if records are this many periods apart.
+
+/**
+ * @brief Which values of a record are filtered. Everything else (the timestamp, crank position and so on) is taken
+ * from the input record at the centre of the filter so it lines up with the filtered values.
+ *
+ * @tparam T the type of record.
+ */
+template <typename T>
+struct DecimatorChannels;
+
+template <>
+struct DecimatorChannels<HighSpeedData>
+{
+    static constexpr uint8_t COUNT = 2; // Torque and raw ADC reading.
+    static void read(const HighSpeedData &data, float *channels);
+    static void write(HighSpeedData &data, const float *channels);
+};
+
+template <>
+struct DecimatorChannels<IMUData>
+{
+    static constexpr uint8_t COUNT = 6; // Each axis of the accelerometer and gyro.
+    static void read(const IMUData &data, float *channels);
+    static void write(IMUData &data, const float *channels);
+};
+
+/**
+ * @brief Decimating FIR filter for one stream of records.
+ *
+ * The filter is a Hamming windowed sinc with its cutoff at the output Nyquist frequency and unity gain at DC, so
+ * torque and acceleration keep their units. It has `DECIMATE_TAPS_PER_FACTOR * factor + 1` taps, which delays the
+ * output by half that many input records. The timestamp of each output is moved back to match.
+ *
+ * Only one task may use each object.
+ *
+ * @tparam T the type of record.
+ */
+template <typename T>
+class Decimator
+{
+public:
+    /**
+     * @brief Sets the input and output rates, designing a new filter if they have changed.
+     *
+     * This is cheap when nothing has changed, so call it before every `add()` with the current rates.
+     *
+     * @param inputRate the rate records are added at (Hz).
+     * @param outputRate the rate wanted (Hz). 0 (or at least the input rate) passes every record straight through. This
+     *                   is rounded to a whole factor of the input rate, no more than DECIMATE_MAX_FACTOR and keeping
+     *                   outputs within PACKED_MAX_DELTA of each other.
+     */
+    void configure(uint16_t inputRate, uint16_t outputRate);
+
+    /**
+     * @brief Adds a record and gives a filtered one every `factor()` records.
+     *
+     * @param input the new record.
+     * @param output the filtered record is written here (this may be the same object as `input`).
+     * @return true if an output record is ready.
+     * @return false if this record was only added to the filter.
+     */
+    bool add(const T &input, T &output);
+
+    /**
+     * @brief Starts again from the next record, the same as after a gap in the records.
+     *
+     */
+    void reset() { m_primed = false; }
+
+    /**
+     * @brief Gets the number of input records per output record.
+     *
+     */
+    uint8_t factor() const { return m_factor; }
+
+    /**
+     * @brief Gets the rate of the output records (Hz).
+     *
+     */
+    uint16_t outputRate() const { return (m_inputRate + m_factor / 2) / m_factor; }
+
+private:
+    /**
+     * @brief Fills the history with a record so the filter starts from a steady state rather than zero.
+     *
+     * Nothing is output until this record reaches the middle of the history, so no timestamp is sent twice.
+     *
+     */
+    void m_reset(const T &input, const float *channels);
+
+    uint16_t m_inputRate = 0;
+    uint16_t m_outputRate = 0;
+    uint8_t m_factor = 1;
+    uint8_t m_taps = 1;
+
+    /**
+     * @brief Filter coefficients. The filter is symmetric, so the order doesn't matter.
+     *
+     */
+    float m_coefficients[DECIMATE_MAX_TAPS];
+
+    /**
+     * @brief History of each channel. Each value is written twice, `m_taps` apart, so that the newest `m_taps` values
+     * are always contiguous (starting at `m_position + 1`) for the dot product.
+     *
+     */
+    float m_history[DecimatorChannels<T>::COUNT][2 * DECIMATE_MAX_TAPS];
+
+    /**
+     * @brief The most recent input records, for the timestamp and other unfiltered values of each output.
+     *
+     */
+    T m_records[DECIMATE_MAX_TAPS];
+
+    uint8_t m_position = 0;  // Index of the newest record.
+    int16_t m_count = 0;     // Records added since the last output (negative until the centre record is real).
+    bool m_primed = false;   // Whether the history has been filled since the last reset.
+    uint32_t m_maxGap = 0;   // Longest time between records before starting again (us).
+};
@@ -0,0 +1,140 @@
+/**
+ * @file fast_wake.cpp
+ * @brief State kept in RTC memory across deep sleep so that waking up is faster than a cold start.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "fast_wake.h"
+#include "config.h"
+#include <esp_rom_crc.h>
+#include <stddef.h>
+#include <time.h>
+
+extern SemaphoreHandle_t serialMutex;
+extern Config config;
+
+#define FAST_WAKE_MAGIC 0x4d485057 // "MHPW"
+
+/**
+ * @brief Everything kept in RTC memory. This has no constructor so that it isn't reset when waking up.
+ *
+ */
+struct FastWakeCache
+{
+    uint32_t magic;
+    uint32_t crc;   // Of everything after this field.
+    uint32_t build; // Changes with each build so that a cache from other firmware isn't used.
+
+    // WiFi
+    bool wifiValid;
+    FastWakeWiFi wifi;
+    uint32_t ssidHash; // Of the SSID the details are for.
+    time_t leaseTime;  // When the IP address was obtained using DHCP (s). The RTC keeps counting in deep sleep.
+
+    // Filter
+    bool filterValid;
+    float state[2];
+    float covariance[3]; // p00, p01, p11 (symmetric).
+    uint32_t rotations;
+};
+
+static RTC_DATA_ATTR FastWakeCache cache;
+
+/**
+ * @brief Calculates the CRC of a string.
+ *
+ */
+static uint32_t stringHash(const char *text)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)text, strlen(text));
+}
+
+/**
+ * @brief Calculates the CRC of the cache after the crc field.
+ *
+ */
+static uint32_t cacheCRC()
+{
+    const size_t start = offsetof(FastWakeCache, build);
+    return esp_rom_crc32_le(0, (const uint8_t *)&cache + start, sizeof(cache) - start);
+}
+
+void FastWake::begin()
+{
+#ifdef FAST_WAKE
+    const uint32_t build = stringHash(SW_VERSION " " HW_VERSION_STR " " __DATE__ " " __TIME__);
+    m_valid = esp_reset_reason() == ESP_RST_DEEPSLEEP && cache.magic == FAST_WAKE_MAGIC && cache.crc == cacheCRC() &&
+              cache.build == build;
+    if (m_valid)
+    {
+        LOGI("Wake", "Woke from deep sleep with cached state (WiFi %d, filter %d)", cache.wifiValid, cache.filterValid);
+    }
+    else
+    {
+        memset(&cache, 0, sizeof(cache));
+        cache.build = build;
+    }
+
+    // Only valid again once prepareSleep() is called.
+    cache.magic = 0;
+#endif
+}
+
+bool FastWake::getWiFi(FastWakeWiFi &wifi)
+{
+#ifdef FAST_WAKE
+    if (!cache.wifiValid || cache.ssidHash != stringHash(config.wifiSSID))
+    {
+        return false;
+    }
+    if (time(NULL) - cache.leaseTime > FAST_WAKE_LEASE_TIME)
+    {
+        LOGD("Wake", "Cached IP address is too old to reuse");
+        return false;
+    }
+    wifi = cache.wifi;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void FastWake::setWiFi(const FastWakeWiFi &wifi)
+{
+    cache.wifi = wifi;
+    cache.ssidHash = stringHash(config.wifiSSID);
+    cache.leaseTime = time(NULL);
+    cache.wifiValid = true;
+}
+
+void FastWake::clearWiFi()
+{
+    cache.wifiValid = false;
+}
+
+bool FastWake::getFilter(FastWakeFilter &filter)
+{
+    if (!m_valid || !cache.filterValid)
+    {
+        return false;
+    }
+    filter.state = {cache.state[0], cache.state[1]};
+    filter.covariance = {cache.covariance[0], cache.covariance[1], cache.covariance[1], cache.covariance[2]};
+    filter.rotations = cache.rotations;
+    return true;
+}
+
+void FastWake::prepareSleep(const FastWakeFilter &filter)
+{
+    cache.state[0] = filter.state(0, 0);
+    cache.state[1] = filter.state(1, 0);
+    cache.covariance[0] = filter.covariance(0, 0);
+    cache.covariance[1] = filter.covariance(0, 1);
+    cache.covariance[2] = filter.covariance(1, 1);
+    cache.rotations = filter.rotations;
+    cache.filterValid = true;
+    cache.magic = FAST_WAKE_MAGIC;
+    cache.crc = cacheCRC();
+}
@@ -0,0 +1,104 @@
+/**
+ * @file fast_wake.h
+ * @brief State kept in RTC memory across deep sleep so that waking up is faster than a cold start.
+ *
+ * The access point, channel and DHCP lease are cached after connecting to WiFi, and the Kalman filter and rotation
+ * count are cached before sleeping. After waking from deep sleep (and only then), these are used to skip the WiFi scan
+ * and DHCP, and to start the filter from where it left off rather than from KALMAN_P0.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+
+#include "../defines.h"
+#include "kalman.h"
+
+/**
+ * @brief What is needed to reconnect to the same access point without scanning or DHCP.
+ *
+ */
+struct FastWakeWiFi
+{
+    uint8_t bssid[6];
+    int32_t channel;
+    uint32_t ip, gateway, subnet, dns;
+};
+
+/**
+ * @brief The state of the crank estimation when the power meter went to sleep.
+ *
+ */
+struct FastWakeFilter
+{
+    Matrix<2, 1, float> state;
+    Matrix<2, 2, float> covariance;
+    uint32_t rotations;
+};
+
+/**
+ * @brief Reads and writes the state cached in RTC memory.
+ *
+ * RTC memory survives deep sleep but not a reset or power cycle. The cache is also ignored after a cold start in case
+ * the RTC memory happened to keep its contents, and whenever the firmware or WiFi settings have changed.
+ *
+ */
+class FastWake
+{
+public:
+    /**
+     * @brief Works out whether this is a wake from deep sleep and if so, whether the cache is usable.
+     *
+     * Call this once near the start of `setup()`.
+     *
+     */
+    void begin();
+
+    /**
+     * @brief Whether this boot was a wake from deep sleep with a valid cache.
+     *
+     */
+    bool isFastWake() { return m_valid; }
+
+    /**
+     * @brief Gets the cached WiFi details if they can be used for the current WiFi settings.
+     *
+     * @param wifi the details are written to this.
+     * @return true if the details are valid and the lease shouldn't have expired.
+     * @return false if a full connection is needed.
+     */
+    bool getWiFi(FastWakeWiFi &wifi);
+
+    /**
+     * @brief Caches the WiFi details after a full connection (including DHCP).
+     *
+     * @param wifi the details to cache.
+     */
+    void setWiFi(const FastWakeWiFi &wifi);
+
+    /**
+     * @brief Forgets the cached WiFi details, for example if they didn't work.
+     *
+     */
+    void clearWiFi();
+
+    /**
+     * @brief Gets the cached filter state.
+     *
+     * @param filter the state is written to this.
+     * @return true if the state is valid.
+     * @return false if the filter should be started from scratch.
+     */
+    bool getFilter(FastWakeFilter &filter);
+
+    /**
+     * @brief Caches the filter state and marks the cache as valid. Call this just before deep sleep.
+     *
+     * @param filter the state to cache.
+     */
+    void prepareSleep(const FastWakeFilter &filter);
+
+private:
+    bool m_valid = false;
+};
@@ -0,0 +1,349 @@
+/**
+ * @file flash_log.cpp
+ * @brief Persistent ring log stored in a raw flash partition for keeping data while disconnected.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "flash_log.h"
+#include "stats.h"
+
+extern SemaphoreHandle_t serialMutex;
+
+#define SECTOR_ADDRESS(sector, offset) ((sector) * FLASH_LOG_SECTOR_SIZE + (offset))
+#define NEXT_SECTOR(sector) (((sector) + 1) % m_sectorCount)
+
+bool FlashLog::begin()
+{
+    m_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FLASH_LOG_PARTITION_LABEL);
+    if (!m_partition)
+    {
+        LOGW("FlashLog", "No '" FLASH_LOG_PARTITION_LABEL "' partition. Data will be lost while disconnected.");
+        return false;
+    }
+    m_sectorCount = m_partition->size / FLASH_LOG_SECTOR_SIZE;
+    if (m_sectorCount < 3)
+    {
+        // Need at least one sector each for the head and tail, plus one to erase when wrapping.
+        LOGE("FlashLog", "Partition is too small.");
+        m_partition = nullptr;
+        return false;
+    }
+
+    // Find the newest sector (head) and the oldest sector that still has unsent entries (tail).
+    bool found = false;
+    bool foundUndrained = false;
+    uint32_t oldestUndrained = 0;
+    for (uint32_t sector = 0; sector < m_sectorCount; sector++)
+    {
+        SectorHeader header;
+        esp_partition_read(m_partition, SECTOR_ADDRESS(sector, 0), &header, sizeof(header));
+        if (header.magic != FLASH_LOG_MAGIC)
+        {
+            continue;
+        }
+
+        if (!found || header.sequence > m_sequence)
+        {
+            m_sequence = header.sequence;
+            m_writeSector = sector;
+            found = true;
+        }
+
+        if (header.drained && (!foundUndrained || header.sequence < oldestUndrained))
+        {
+            oldestUndrained = header.sequence;
+            m_readSector = sector;
+            foundUndrained = true;
+        }
+    }
+
+    if (!found)
+    {
+        // Blank or unformatted partition.
+        LOGI("FlashLog", "Starting a new log.");
+        m_startSector(0);
+        m_readSector = m_writeSector;
+        m_readOffset = m_writeOffset;
+        return true;
+    }
+
+    // Find the end of the newest sector.
+    m_writeOffset = sizeof(SectorHeader);
+    EntryHeader entry;
+    while (m_readEntry(m_writeSector, m_writeOffset, entry))
+    {
+        m_writeOffset += sizeof(EntryHeader) + entry.length;
+    }
+    if (m_writeOffset + sizeof(EntryHeader) <= FLASH_LOG_SECTOR_SIZE)
+    {
+        esp_partition_read(m_partition, SECTOR_ADDRESS(m_writeSector, m_writeOffset), &entry, sizeof(entry));
+        if (entry.type != LOG_ENTRY_ERASED)
+        {
+            // Partially written header. Don't use the rest of this sector.
+            m_writeOffset = FLASH_LOG_SECTOR_SIZE;
+        }
+    }
+
+    // Find the first unsent entry.
+    if (!foundUndrained)
+    {
+        m_readSector = m_writeSector;
+    }
+    m_readOffset = sizeof(SectorHeader);
+    m_skipSent();
+
+    // Count the sectors that were erased ahead before the last reset or sleep.
+    for (uint32_t sector = NEXT_SECTOR(m_writeSector); sector != m_writeSector; sector = NEXT_SECTOR(sector))
+    {
+        uint32_t magic;
+        esp_partition_read(m_partition, SECTOR_ADDRESS(sector, 0), &magic, sizeof(magic));
+        if (magic != FLASH_LOG_MAGIC_ERASED)
+        {
+            break;
+        }
+        m_erasedAhead++;
+    }
+    LOGI("FlashLog", "Recovered log with head at %lu:%lu, tail at %lu:%lu and %lu sectors erased.", m_writeSector,
+         m_writeOffset, m_readSector, m_readOffset, m_erasedAhead);
+    return true;
+}
+
+bool FlashLog::isPending()
+{
+    return m_partition && !(m_readSector == m_writeSector && m_readOffset >= m_writeOffset);
+}
+
+uint32_t FlashLog::eraseAhead(uint32_t timeout)
+{
+    if (!m_partition)
+    {
+        return 0;
+    }
+
+    // Find the first sector after those already erased.
+    uint32_t sector = m_writeSector;
+    for (uint32_t i = 0; i <= m_erasedAhead; i++)
+    {
+        sector = NEXT_SECTOR(sector);
+    }
+
+    // Stop before the head or the oldest unsent entries.
+    const uint32_t start = millis();
+    uint32_t erased = 0;
+    while (m_erasedAhead < FLASH_LOG_ERASE_AHEAD && sector != m_writeSector && !(isPending() && sector == m_readSector) &&
+           millis() - start < timeout)
+    {
+        m_eraseSector(sector);
+        const uint32_t magic = FLASH_LOG_MAGIC_ERASED;
+        esp_partition_write(m_partition, SECTOR_ADDRESS(sector, 0), &magic, sizeof(magic));
+        m_erasedAhead++;
+        erased++;
+        sector = NEXT_SECTOR(sector);
+    }
+    return erased;
+}
+
+bool FlashLog::beginEntry(uint8_t type, uint16_t length)
+{
+    if (!m_partition || length > FLASH_LOG_MAX_ENTRY)
+    {
+        return false;
+    }
+
+    // Move to the next sector if the entry won't fit in this one.
+    if (m_writeOffset + sizeof(EntryHeader) + length > FLASH_LOG_SECTOR_SIZE)
+    {
+        m_nextWriteSector();
+    }
+
+    // Write the header. The state is left as erased so it can be updated once the payload has been written.
+    EntryHeader header = {type, FLASH_LOG_STATE_WRITING, length};
+    m_entryOffset = m_writeOffset;
+    m_entryLength = length;
+    esp_partition_write(m_partition, SECTOR_ADDRESS(m_writeSector, m_writeOffset), &header, sizeof(header));
+    m_writeOffset += sizeof(header);
+    return true;
+}
+
+size_t FlashLog::write(const uint8_t *buffer, size_t length)
+{
+    // Don't go past the end of the current entry.
+    const uint32_t entryEnd = m_entryOffset + sizeof(EntryHeader) + m_entryLength;
+    if (m_writeOffset + length > entryEnd)
+    {
+        length = entryEnd - m_writeOffset;
+    }
+    if (length && esp_partition_write(m_partition, SECTOR_ADDRESS(m_writeSector, m_writeOffset), buffer, length) != ESP_OK)
+    {
+        return 0;
+    }
+    m_writeOffset += length;
+    return length;
+}
+
+bool FlashLog::endEntry()
+{
+    const uint32_t entryEnd = m_entryOffset + sizeof(EntryHeader) + m_entryLength;
+    if (m_writeOffset != entryEnd)
+    {
+        // Short payload. Skip over the space that was reserved and leave it marked as writing.
+        LOGW("FlashLog", "Entry was only partially written.");
+        m_writeOffset = entryEnd;
+        return false;
+    }
+
+    const uint8_t state = FLASH_LOG_STATE_UNSENT;
+    esp_partition_write(m_partition, SECTOR_ADDRESS(m_writeSector, m_entryOffset + offsetof(EntryHeader, state)), &state, 1);
+    return true;
+}
+
+uint32_t FlashLog::peekChunk(uint32_t maxLength)
+{
+    m_chunkLength = 0;
+    if (!isPending())
+    {
+        return 0;
+    }
+
+    // Add whole entries until the limit, end of the sector or head is reached.
+    uint32_t offset = m_readOffset;
+    EntryHeader header;
+    while (!(m_readSector == m_writeSector && offset >= m_writeOffset) && m_readEntry(m_readSector, offset, header))
+    {
+        const uint32_t entryLength = sizeof(EntryHeader) + header.length;
+        if (m_chunkLength + entryLength > maxLength)
+        {
+            break;
+        }
+        m_chunkLength += entryLength;
+        offset += entryLength;
+    }
+    return m_chunkLength;
+}
+
+bool FlashLog::readChunk(uint8_t *buffer)
+{
+    return esp_partition_read(m_partition, SECTOR_ADDRESS(m_readSector, m_readOffset), buffer, m_chunkLength) == ESP_OK;
+}
+
+void FlashLog::popChunk()
+{
+    // Mark each entry as sent so that it isn't sent again after a reset.
+    const uint32_t chunkEnd = m_readOffset + m_chunkLength;
+    const uint8_t state = FLASH_LOG_STATE_SENT;
+    EntryHeader header;
+    while (m_readOffset < chunkEnd && m_readEntry(m_readSector, m_readOffset, header))
+    {
+        esp_partition_write(m_partition, SECTOR_ADDRESS(m_readSector, m_readOffset + offsetof(EntryHeader, state)), &state, 1);
+        m_readOffset += sizeof(EntryHeader) + header.length;
+    }
+    m_chunkLength = 0;
+    m_skipSent();
+}
+
+bool FlashLog::m_readEntry(uint32_t sector, uint32_t offset, EntryHeader &header)
+{
+    if (offset + sizeof(EntryHeader) > FLASH_LOG_SECTOR_SIZE)
+    {
+        return false;
+    }
+    esp_partition_read(m_partition, SECTOR_ADDRESS(sector, offset), &header, sizeof(header));
+    return header.type != LOG_ENTRY_ERASED && offset + sizeof(EntryHeader) + header.length <= FLASH_LOG_SECTOR_SIZE;
+}
+
+void FlashLog::m_nextWriteSector()
+{
+    const uint32_t next = NEXT_SECTOR(m_writeSector);
+    const bool wasEmpty = !isPending();
+    if (!wasEmpty && m_readSector == next)
+    {
+        // Log is full. Drop the oldest sector.
+        LOGW("FlashLog", "Log is full, discarding the oldest entries.");
+        m_readSector = NEXT_SECTOR(next);
+        m_readOffset = sizeof(SectorHeader);
+
+        // Any chunk found by peekChunk() was in the discarded sector. Forget it so that popChunk() doesn't mark entries
+        // at the new tail as sent when they never were.
+        m_chunkLength = 0;
+    }
+
+    m_startSector(next);
+    if (wasEmpty)
+    {
+        // Keep the tail with the head.
+        m_readSector = m_writeSector;
+        m_readOffset = m_writeOffset;
+    }
+    else
+    {
+        m_skipSent();
+    }
+}
+
+void FlashLog::m_startSector(uint32_t sector)
+{
+    if (m_erasedAhead && sector == NEXT_SECTOR(m_writeSector))
+    {
+        // Already erased. The header is written over FLASH_LOG_MAGIC_ERASED.
+        m_erasedAhead--;
+    }
+    else
+    {
+        // Nothing can run from flash while erasing, so readings taken meanwhile are lost.
+        m_erasedAhead = 0;
+        const uint32_t duration = m_eraseSector(sector);
+        LOGW("FlashLog", "Erased sector %lu in line. Readings taken in the last %luus were lost.", sector, duration);
+    }
+
+    // Leave drained as erased until the sector has been sent.
+    m_sequence++;
+    const uint32_t header[2] = {FLASH_LOG_MAGIC, m_sequence};
+    esp_partition_write(m_partition, SECTOR_ADDRESS(sector, 0), header, sizeof(header));
+    m_writeSector = sector;
+    m_writeOffset = sizeof(SectorHeader);
+}
+
+uint32_t FlashLog::m_eraseSector(uint32_t sector)
+{
+    const uint32_t start = micros();
+    if (esp_partition_erase_range(m_partition, SECTOR_ADDRESS(sector, 0), FLASH_LOG_SECTOR_SIZE) != ESP_OK)
+    {
+        LOGE("FlashLog", "Couldn't erase sector %lu.", sector);
+    }
+    const uint32_t duration = micros() - start;
+    STATS_RECORD(STAT_FLASH_ERASE, duration);
+    return duration;
+}
+
+void FlashLog::m_skipSent()
+{
+    EntryHeader header;
+    while (isPending())
+    {
+        if (!m_readEntry(m_readSector, m_readOffset, header))
+        {
+            if (m_readSector == m_writeSector)
+            {
+                // Rest of the head sector is unusable.
+                m_readOffset = m_writeOffset;
+                return;
+            }
+
+            // End of a sector that isn't the head. Mark it as drained so it can be skipped on boot.
+            const uint32_t drained = 0;
+            esp_partition_write(m_partition, SECTOR_ADDRESS(m_readSector, offsetof(SectorHeader, drained)), &drained, sizeof(drained));
+            m_readSector = NEXT_SECTOR(m_readSector);
+            m_readOffset = sizeof(SectorHeader);
+            continue;
+        }
+
+        if (header.state != FLASH_LOG_STATE_SENT)
+        {
+            // Found an unsent (or interrupted) entry.
+            return;
+        }
+        m_readOffset += sizeof(EntryHeader) + header.length;
+    }
+}
@@ -0,0 +1,230 @@
+/**
+ * @file flash_log.h
+ * @brief Persistent ring log stored in a raw flash partition for keeping data while disconnected.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include "../defines.h"
+#include <esp_partition.h>
+
+/**
+ * @brief Flash log settings.
+ *
+ * The partition is declared in `partitions.csv`. Each sector starts with a `SectorHeader`, followed by entries that each
+ * start with an `EntryHeader`. Entries never span sectors.
+ */
+#define FLASH_LOG_PARTITION_LABEL "datalog"
+#define FLASH_LOG_SECTOR_SIZE 4096
+#define FLASH_LOG_MAGIC 0x474f4c50 // "PLOG"
+#define FLASH_LOG_MAGIC_ERASED 0xff4f4c50 // Erased ahead of time. Only clears bits to become FLASH_LOG_MAGIC.
+#define FLASH_LOG_ERASE_AHEAD 64          // Sectors to keep erased so logging doesn't have to stop and erase (256kB).
+#define FLASH_LOG_ERASE_AHEAD_TIME 1500   // Longest time to spend erasing ahead before sleeping (ms).
+#define FLASH_LOG_MAX_ENTRY (FLASH_LOG_SECTOR_SIZE - sizeof(FlashLog::SectorHeader) - sizeof(FlashLog::EntryHeader))
+
+/**
+ * @brief Entry states. Flash bits can only be cleared without an erase, so each state can be written over the
+ * previous one in place.
+ *
+ */
+#define FLASH_LOG_STATE_WRITING 0xff // Interrupted before the whole entry was written.
+#define FLASH_LOG_STATE_UNSENT 0xfe
+#define FLASH_LOG_STATE_SENT 0x00
+
+/**
+ * @brief Types of entries in the log.
+ *
+ */
+enum EnumLogEntry
+{
+    LOG_ENTRY_LEFT = 0,          // Packed high speed packet for the left side.
+    LOG_ENTRY_RIGHT = 1,         // Packed high speed packet for the right side.
+    LOG_ENTRY_IMU = 2,           // Packed IMU packet.
+    LOG_ENTRY_LOW_SPEED = 3,     // LowSpeedData::toBytes() record.
+    LOG_ENTRY_PROFILE_LEFT = 4,  // TorqueProfile::toBytes() record for the left side.
+    LOG_ENTRY_PROFILE_RIGHT = 5, // TorqueProfile::toBytes() record for the right side.
+    LOG_ENTRY_ERASED = 0xff      // Nothing has been written here yet.
+};
+
+/**
+ * @brief Ring log of binary entries in a raw flash partition.
+ *
+ * Entries are appended at the head, erasing the oldest sector when the log wraps around. Entries that are yet to be
+ * sent are read from the tail in chunks of whole entries, then marked as sent. The head and tail are recovered by
+ * scanning the sector headers on boot, so unsent entries survive a reset.
+ *
+ * Erasing a sector takes tens of ms with the flash cache disabled on both cores. The amp and IMU interrupts and tasks
+ * aren't in IRAM, so readings are lost for as long as it takes. To avoid this while riding, `eraseAhead()` erases the
+ * sectors after the head while nothing is being measured and marks them with FLASH_LOG_MAGIC_ERASED. Sectors are only
+ * erased in line once these run out (see STAT_FLASH_ERASE for the time taken).
+ *
+ * This is not thread safe and should only be used from the connection task.
+ */
+class FlashLog
+{
+public:
+    /**
+     * @brief Header at the start of each sector.
+     *
+     */
+    struct SectorHeader
+    {
+        uint32_t magic;
+        uint32_t sequence; // Incremented each time a sector is started so that the newest and oldest can be found.
+        uint32_t drained;  // Cleared to 0 once every entry in the sector has been sent.
+    };
+
+    /**
+     * @brief Header at the start of each entry.
+     *
+     */
+    struct EntryHeader
+    {
+        uint8_t type;    // EnumLogEntry
+        uint8_t state;   // FLASH_LOG_STATE_...
+        uint16_t length; // Length of the payload following this header.
+    };
+
+    /**
+     * @brief Finds the partition and recovers the head and tail of the log.
+     *
+     * @return true if the log can be used.
+     * @return false if the partition doesn't exist or is too small.
+     */
+    bool begin();
+
+    /**
+     * @brief Checks if `begin()` was successful.
+     *
+     */
+    bool isReady() { return m_partition; }
+
+    /**
+     * @brief Checks if there are entries that are yet to be sent.
+     *
+     */
+    bool isPending();
+
+    /**
+     * @brief Erases up to FLASH_LOG_ERASE_AHEAD sectors after the head that don't hold unsent entries.
+     *
+     * This blocks for tens of ms per sector and stops anything outside IRAM on both cores from running, so only call
+     * it while readings aren't needed, such as before sleeping. A sector is only marked as erased once it has been,
+     * so being cut short by a reset or sleep is safe.
+     *
+     * @param timeout stop starting new sectors after this long (ms).
+     * @return uint32_t the number of sectors that were erased.
+     */
+    uint32_t eraseAhead(uint32_t timeout);
+
+    /**
+     * @brief Starts appending a new entry. The payload is then written using `write()` and finished with `endEntry()`.
+     *
+     * @param type the type of entry (EnumLogEntry).
+     * @param length the length of the payload. This must be no more than `FLASH_LOG_MAX_ENTRY`.
+     * @return true if the entry was started.
+     * @return false if the log isn't ready or the entry is too long.
+     */
+    bool beginEntry(uint8_t type, uint16_t length);
+
+    /**
+     * @brief Writes part of the payload of the current entry.
+     *
+     * @param buffer the data to write.
+     * @param length the number of bytes to write.
+     * @return size_t the number of bytes written.
+     */
+    size_t write(const uint8_t *buffer, size_t length);
+
+    /**
+     * @brief Finishes the current entry and marks it as unsent.
+     *
+     * @return true if the whole payload was written.
+     * @return false if the payload was short, in which case the entry is left in the writing state.
+     */
+    bool endEntry();
+
+    /**
+     * @brief Works out how many bytes of whole entries (including their headers) can be read from the tail in one go.
+     *
+     * A chunk always comes from a single sector so that it can be read sequentially.
+     *
+     * @param maxLength the maximum length of the chunk.
+     * @return uint32_t the length of the chunk (0 if nothing is pending).
+     */
+    uint32_t peekChunk(uint32_t maxLength);
+
+    /**
+     * @brief Reads the chunk found by `peekChunk()`.
+     *
+     * @param buffer the buffer to read into. This must be at least as long as the chunk.
+     * @return true if successful.
+     */
+    bool readChunk(uint8_t *buffer);
+
+    /**
+     * @brief Marks every entry in the chunk found by `peekChunk()` as sent and moves the tail past it.
+     *
+     * Nothing is marked if the chunk has since been discarded to make room for new entries.
+     */
+    void popChunk();
+
+private:
+    /**
+     * @brief Reads the header of the entry at a location and checks it fits in the sector.
+     *
+     * @param sector the sector to read from.
+     * @param offset the offset of the entry within the sector.
+     * @param header where to put the header.
+     * @return true if there is a valid entry at this location.
+     * @return false if the rest of the sector is empty or unusable.
+     */
+    bool m_readEntry(uint32_t sector, uint32_t offset, EntryHeader &header);
+
+    /**
+     * @brief Erases the next sector and moves the head to it, discarding the oldest unsent entries if needed.
+     *
+     */
+    void m_nextWriteSector();
+
+    /**
+     * @brief Erases a sector (unless it was erased ahead) and writes a new header to it.
+     *
+     * @param sector the sector to start.
+     */
+    void m_startSector(uint32_t sector);
+
+    /**
+     * @brief Erases a sector and records how long it took.
+     *
+     * @param sector the sector to erase.
+     * @return uint32_t the time taken (us).
+     */
+    uint32_t m_eraseSector(uint32_t sector);
+
+    /**
+     * @brief Moves the tail past any entries that have already been sent.
+     *
+     */
+    void m_skipSent();
+
+    const esp_partition_t *m_partition = nullptr;
+    uint32_t m_sectorCount = 0;
+    uint32_t m_sequence = 0;
+
+    // Head
+    uint32_t m_writeSector = 0;
+    uint32_t m_writeOffset = 0;
+    uint32_t m_erasedAhead = 0; // Sectors after the head that are already erased.
+
+    // Current entry being written
+    uint32_t m_entryOffset = 0;
+    uint16_t m_entryLength = 0;
+
+    // Tail
+    uint32_t m_readSector = 0;
+    uint32_t m_readOffset = 0;
+    uint32_t m_chunkLength = 0;
+};
@@ -0,0 +1,134 @@
+/**
+ * @file i2c_manager.cpp
+ * @brief Task that owns the I2C bus, sampling the temperature sensors and setting the LEDs attached to them.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "i2c_manager.h"
+#include "task_topology.h"
+#include <Wire.h>
+
+extern SemaphoreHandle_t serialMutex;
+
+void I2CManager::begin()
+{
+    // Nothing else is using the bus yet, so the sensors can be set up from here before the task starts.
+    Wire.begin(PIN_I2C_SDA, PIN_I2C_SCL, I2C_BUS_FREQ);
+    m_sensors[SIDE_LEFT]->begin();
+    m_sensors[SIDE_RIGHT]->begin();
+
+    m_transactionQueue = xQueueCreateStatic(I2C_QUEUE_LENGTH, sizeof(I2CTransaction), m_transactionStorage,
+                                            &m_transactionQueueBuffer);
+    m_syncSemaphore = xSemaphoreCreateBinaryStatic(&m_syncSemaphoreBuffer);
+    createTask(TASK_I2C, taskI2C, this, &taskHandle);
+}
+
+void I2CManager::setLEDs(bool state)
+{
+    m_queue({I2C_SET_LEDS, state});
+}
+
+void I2CManager::setSampling(bool enabled)
+{
+    m_sampling = enabled;
+    if (enabled)
+    {
+        m_queue({I2C_SAMPLE, false});
+    }
+}
+
+bool I2CManager::flush(TickType_t timeout)
+{
+    if (!m_transactionQueue)
+    {
+        return true;
+    }
+
+    // Clear any sync left over from a previous flush that timed out.
+    xSemaphoreTake(m_syncSemaphore, 0);
+    const I2CTransaction sync = {I2C_SYNC, false};
+    if (!xQueueSend(m_transactionQueue, &sync, timeout))
+    {
+        return false;
+    }
+    return xSemaphoreTake(m_syncSemaphore, timeout);
+}
+
+void I2CManager::run()
+{
+    LOGI("I2C", "I2C task started");
+    taskStarted(TASK_I2C);
+    while (true)
+    {
+        // Wait for a transaction or until the next sample is due.
+        TickType_t wait = pdMS_TO_TICKS(TEMP_SAMPLE_PERIOD);
+        if (m_sampling)
+        {
+            int32_t remaining = m_nextSample - xTaskGetTickCount();
+            wait = remaining > 0 ? remaining : 0;
+        }
+
+        I2CTransaction transaction;
+        if (xQueueReceive(m_transactionQueue, &transaction, wait))
+        {
+            m_process(transaction);
+        }
+
+        // Checked after every transaction so that a busy queue can't hold off sampling.
+        if (m_sampling && (int32_t)(xTaskGetTickCount() - m_nextSample) >= 0)
+        {
+            m_sampleTemperatures();
+            m_nextSample = xTaskGetTickCount() + pdMS_TO_TICKS(TEMP_SAMPLE_PERIOD);
+        }
+    }
+}
+
+void I2CManager::m_queue(const I2CTransaction &transaction)
+{
+    if (!m_transactionQueue)
+    {
+        // Not started yet.
+        return;
+    }
+
+    if (!xQueueSend(m_transactionQueue, &transaction, 0))
+    {
+        LOGW("I2C", "Transaction queue full, dropping type %d", transaction.type);
+    }
+}
+
+void I2CManager::m_process(const I2CTransaction &transaction)
+{
+    switch (transaction.type)
+    {
+    case I2C_SET_LEDS:
+        m_sensors[SIDE_LEFT]->setLED(transaction.state);
+        m_sensors[SIDE_RIGHT]->setLED(transaction.state);
+        break;
+    case I2C_SAMPLE:
+        m_nextSample = xTaskGetTickCount();
+        break;
+    case I2C_SYNC:
+        xSemaphoreGive(m_syncSemaphore);
+        break;
+    }
+}
+
+void I2CManager::m_sampleTemperatures()
+{
+    // Both conversions run at the same time. LED changes wait until they are done, as writing the config register
+    // mid-conversion could cancel it. The capture keeps the current LED state.
+    m_sensors[SIDE_LEFT]->startCapture();
+    m_sensors[SIDE_RIGHT]->startCapture();
+    vTaskDelay(pdMS_TO_TICKS(TEMP_CONVERSION_TIME));
+    m_sensors[SIDE_LEFT]->readTempRegister();
+    m_sensors[SIDE_RIGHT]->readTempRegister();
+}
+
+void taskI2C(void *pvParameters)
+{
+    I2CManager *manager = (I2CManager *)pvParameters;
+    manager->run();
+}
@@ -0,0 +1,133 @@
+/**
+ * @file i2c_manager.h
+ * @brief Task that owns the I2C bus, sampling the temperature sensors and setting the LEDs attached to them.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+
+#include "../defines.h"
+#include "temperature.h"
+
+/**
+ * @brief Types of transactions that can be queued for the I2C task.
+ *
+ */
+enum EnumI2CTransaction
+{
+    I2C_SET_LEDS, // Set the LEDs on the alarm pins of both temperature sensors.
+    I2C_SAMPLE,   // Sample the temperatures now rather than waiting for the next period.
+    I2C_SYNC      // Give the sync semaphore once everything before this has been done.
+};
+
+/**
+ * @brief A request for the I2C task.
+ *
+ */
+struct I2CTransaction
+{
+    EnumI2CTransaction type;
+    bool state;
+};
+
+/**
+ * @brief Serialises everything on the I2C bus through a single task.
+ *
+ * Both temperature sensors start a conversion at the same time and are read once the conversion has finished, so a
+ * sample of both takes one conversion time rather than two. Other tasks read the latest temperatures using
+ * `TempSensor::getLastTemp()` and queue LED changes without waiting for the bus.
+ *
+ */
+class I2CManager
+{
+public:
+    /**
+     * @brief Construct a new I2C manager.
+     *
+     * @param left the temperature sensor on the left side.
+     * @param right the temperature sensor on the right side.
+     */
+    I2CManager(TempSensor &left, TempSensor &right) : m_sensors{&left, &right} {}
+
+    /**
+     * @brief Starts the bus, initialises the sensors and creates the task.
+     *
+     */
+    void begin();
+
+    /**
+     * @brief Turns the LEDs attached to both temperature sensors on or off.
+     *
+     * This returns straight away. The change is made by the I2C task in the order requested.
+     *
+     * @param state if true, turns the LEDs on. If false, turns them off.
+     */
+    void setLEDs(bool state);
+
+    /**
+     * @brief Enables or disables periodic temperature sampling.
+     *
+     * @param enabled if true, both sensors are sampled straight away and then every TEMP_SAMPLE_PERIOD ms.
+     */
+    void setSampling(bool enabled);
+
+    /**
+     * @brief Waits until every transaction queued so far has been completed.
+     *
+     * Call this before sleeping or resetting so that the last LED change isn't lost.
+     *
+     * @param timeout the maximum time to wait in ticks.
+     * @return true all transactions were completed.
+     * @return false the timeout expired first.
+     */
+    bool flush(TickType_t timeout);
+
+    /**
+     * @brief Runs the task.
+     *
+     */
+    void run();
+
+    /**
+     * @brief The handle of the I2C task.
+     *
+     */
+    TaskHandle_t taskHandle;
+
+private:
+    /**
+     * @brief Queues a transaction, logging if the queue is full.
+     *
+     */
+    void m_queue(const I2CTransaction &transaction);
+
+    /**
+     * @brief Carries out a transaction.
+     *
+     */
+    void m_process(const I2CTransaction &transaction);
+
+    /**
+     * @brief Starts a conversion on both sensors, waits for them to finish and reads the results.
+     *
+     */
+    void m_sampleTemperatures();
+
+    TempSensor *m_sensors[2];
+    QueueHandle_t m_transactionQueue = NULL;
+    SemaphoreHandle_t m_syncSemaphore = NULL;
+    uint8_t m_transactionStorage[I2C_QUEUE_LENGTH * sizeof(I2CTransaction)];
+    StaticQueue_t m_transactionQueueBuffer;
+    StaticSemaphore_t m_syncSemaphoreBuffer;
+    volatile bool m_sampling = false;
+    TickType_t m_nextSample = 0; // Only used by the task.
+};
+
+/**
+ * @brief Task that owns the I2C bus.
+ *
+ * @param pvParameters is a pointer to the I2CManager to run.
+ */
+void taskI2C(void *pvParameters);
@@ -4,7 +4,7 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-28
+ * @date 2026-10-14
  */
 
 #include "imu.h"
@@ -13,15 +13,21 @@
 extern SemaphoreHandle_t serialMutex;
 extern TaskHandle_t imuTaskHandle;
 extern PowerMeter powerMeter;
-extern portMUX_TYPE spinlock;
 
 #include "connections.h"
+#include "power_manager.h"
+#include "task_topology.h"
+#include "fast_wake.h"
+extern FastWake fastWake;
 extern Connection *connectionBasePtr;
 
 #include <esp_sleep.h>
 #include <driver/rtc_io.h>
 
 volatile uint32_t imuTime;
+#ifdef STATS_ENABLE
+volatile uint32_t imuIrqCycles;
+#endif
 
 void IMUManager::begin()
 {
@@ -38,15 +44,27 @@ void IMUManager::begin()
     {
         LOGE("IMU", "Cannot connect to IMU, error %d.", result);
     }
+
+    // Carry on from where the filter was before sleeping. The crank may have been moved while asleep, so the angle is
+    // made less certain.
+    FastWakeFilter filter;
+    if (fastWake.getFilter(filter))
+    {
+        filter.covariance(0, 0) = max(filter.covariance(0, 0), KALMAN_RESUME_POSITION_VARIANCE);
+        kalman.resetState(filter.state, filter.covariance);
+        rotations = filter.rotations;
+        LOGD("IMU", "Restored the filter at %.2frad, %.2frad/s and %lu rotations", filter.state(0, 0),
+             filter.state(1, 0), rotations);
+    }
 }
 
 void IMUManager::startEstimating()
 {
     // Setup the IMU
-    // Set FIFO watermark to 1 so that we get a constant update rate instead of in batches.
-    imu.enableFifoInterrupt(PIN_ACCEL_INTERRUPT, irqIMUActive, 1);
-    imu.startAccel(IMU_SAMPLE_RATE, IMU_ACCEL_RANGE);
-    imu.startGyro(IMU_SAMPLE_RATE, IMU_GYRO_RANGE);
+    // A watermark of 1 gives a constant update rate. Higher values read the FIFO in batches, reducing the number of
+    // interrupts and SPI transactions at higher sample rates.
+    imu.enableFifoInterrupt(PIN_ACCEL_INTERRUPT, irqIMUActive, config.imuWatermark);
+    m_setSampleRate(IMU_SAMPLE_RATE);
 }
 
 void IMUManager::enableMotion()
@@ -55,77 +73,99 @@ void IMUManager::enableMotion()
     imu.startWakeOnMotion(PIN_ACCEL_INTERRUPT, irqIMUWake);
 }
 
-void IMUManager::processIMUEvent(inv_imu_sensor_event_t *evt)
+void IMUManager::readFifo(uint32_t interruptTime)
 {
-    if (imu.isAccelDataValid(evt) && imu.isGyroDataValid(evt))
+    // Copy every frame out of the FIFO. An anonymous function is used as callback to call the correct class method.
+    m_fifoCount = 0;
+    imu.getDataFromFifo(
+        [](inv_imu_sensor_event_t *evt)
+        {
+            IMUManager &manager = powerMeter.imuManager;
+            if (manager.m_fifoCount < IMU_FIFO_MAX_FRAMES)
+            {
+                manager.m_fifoFrames[manager.m_fifoCount] = *evt;
+                manager.m_fifoCount++;
+            }
+        });
+
+    if (!m_fifoCount)
     {
-        // Extract the data we need from the gyro.
-        float zGyro = SCALE_GYRO(evt->gyro[2]); // TODO: Work out direction and axis.
-        float xAccel = m_correctCentripedal(SCALE_ACCEL(evt->accel[0]), IMU_OFFSET_X, zGyro);
-        float yAccel = m_correctCentripedal(SCALE_ACCEL(evt->accel[1]), IMU_OFFSET_Y, zGyro);
+        return;
+    }
 
-        // Do stuff with timestamps
-        IMUData data;
-        data.timestamp = imuTime;
+    // Work out the time of each frame relative to the first one. The frames after the watermark arrived after the
+    // interrupt (the task may have been held up), so the watermark frame is used as the reference.
+    uint32_t offsets[IMU_FIFO_MAX_FRAMES];
+    offsets[0] = 0;
+    for (uint8_t i = 1; i < m_fifoCount; i++)
+    {
+        offsets[i] = offsets[i - 1] + m_frameDelta(m_fifoFrames[i - 1].timestamp_fsync, m_fifoFrames[i].timestamp_fsync);
+    }
+    uint8_t reference = min(m_fifoCount, config.imuWatermark) - 1;
+    uint32_t firstTime = interruptTime - offsets[reference];
+
+    // Process each frame in order.
+    for (uint8_t i = 0; i < m_fifoCount; i++)
+    {
+        processIMUEvent(&m_fifoFrames[i], firstTime + offsets[i]);
+    }
 
+#ifdef IMU_ADAPTIVE_RATE
+    // Only change between batches so that every frame in a batch was sampled at the same rate.
+    m_adaptSampleRate(kalman.getState()(1, 0), interruptTime);
+#endif
+}
+
+void IMUManager::processIMUEvent(inv_imu_sensor_event_t *evt, uint32_t timestamp)
+{
+    if (imu.isAccelDataValid(evt) && imu.isGyroDataValid(evt))
+    {
         // Save the temperature.
-        taskENTER_CRITICAL(&spinlock);
-        m_lastTemperature = evt->temperature;
-        taskEXIT_CRITICAL(&spinlock);
-
-        // Add to the Kalman filter
-        float theta = m_calculateAngle(xAccel, yAccel);
-        // LOGD("Accel", "%f", theta);
-        // log_printf("Angle measured: %f\n", theta);
-        Matrix<2, 1, float> measurement;
-        measurement(0, 0) = -theta;
-        measurement(1, 0) = zGyro;
-        kalman.update(measurement, data.timestamp);
-
-        // Get ready to send the data
-        Matrix<2, 1, float> state = kalman.getState();
-        data.position = state(0, 0);
-        data.velocity = state(1, 0);
+        m_lastTemperature.store(evt->temperature, std::memory_order_relaxed);
+
+        // Work out the angle, velocity and whether a rotation has occurred.
+        IMUData data;
+        STATS_START(kalmanStart);
+        bool rotated = m_estimator.update(kalman, timestamp, SCALE_ACCEL(evt->accel[0]), SCALE_ACCEL(evt->accel[1]),
+                                          SCALE_GYRO(evt->gyro[2]), data); // TODO: Work out direction and axis.
+        STATS_END(STAT_KALMAN_UPDATE, kalmanStart);
 
         // Check whether it should be sent.
-        if (m_sendCount >= config.imuHowOften)
+        if (config.imuRate)
+        {
+            // Filter every sample and send at the configured rate.
+            data.zAccel = SCALE_ACCEL(evt->accel[2]);
+            data.xGyro = SCALE_GYRO(evt->gyro[0]);
+            data.yGyro = SCALE_GYRO(evt->gyro[1]);
+            data.sampleRate = m_sampleRate.load(std::memory_order_relaxed);
+            m_decimator.configure(data.sampleRate, config.imuRate);
+            if (m_decimator.add(data, data))
+            {
+                data.sampleRate = m_decimator.outputRate();
+                connectionBasePtr->addIMU(data);
+            }
+        }
+        else if (m_sendCount >= config.imuHowOften)
         {
             // We should send this time.
-            data.xAccel = xAccel;
-            data.yAccel = yAccel;
             data.zAccel = SCALE_ACCEL(evt->accel[2]);
             data.xGyro = SCALE_GYRO(evt->gyro[0]);
             data.yGyro = SCALE_GYRO(evt->gyro[1]);
-            data.zGyro = zGyro;
+            data.sampleRate = m_sampleRate.load(std::memory_order_relaxed);
             connectionBasePtr->addIMU(data);
             m_sendCount = 0;
         }
         m_sendCount++;
 
-        // Calculate the number of rotations.
-        // Calculate the current sector.
-        int8_t rotationSector = m_angleToSector(data.position);
-
-        // Arm trigger if crossing from sector 0 to sector 1
-        if (rotationSector == 1 and m_lastRotationSector == 0)
+        if (rotated)
         {
-            m_armRotationCounter = true;
-        }
-
-        // If trigger is armed and we crossed from sector 2 back to sector 0, increase the count.
-        if (m_armRotationCounter && rotationSector == 0 && m_lastRotationSector == 2)
-        {
-            // We have a complete rotation. // TODO: Confirm direction.
-            m_armRotationCounter = false;
-
             // Write to variables that need to be protected
-            taskENTER_CRITICAL(&spinlock);
+            taskENTER_CRITICAL(&m_rotationSpinlock);
             rotations++;
-            m_lastRotationDuration = data.timestamp - m_lastRotationTime;
-            m_lastRotationTime = data.timestamp;
-            taskEXIT_CRITICAL(&spinlock);
+            m_lastRotationDuration = m_estimator.rotationTime() - m_lastRotationTime;
+            m_lastRotationTime = m_estimator.rotationTime();
+            taskEXIT_CRITICAL(&m_rotationSpinlock);
         }
-        m_lastRotationSector = rotationSector;
     }
     else
     {
@@ -136,98 +176,92 @@ void IMUManager::processIMUEvent(inv_imu_sensor_event_t *evt)
 void IMUManager::setLowSpeedData(LowSpeedData &data)
 {
     // Safely copy the data in to the object.
-    taskENTER_CRITICAL(&spinlock);
+    taskENTER_CRITICAL(&m_rotationSpinlock);
     data.lastRotationDuration = m_lastRotationDuration;
     data.timestamp = m_lastRotationTime;
     data.rotationCount = rotations;
-    taskEXIT_CRITICAL(&spinlock);
+    taskEXIT_CRITICAL(&m_rotationSpinlock);
 }
 
-float IMUManager::getLastTemperature()
+void IMUManager::getLastRotation(uint32_t &count, uint32_t &time)
 {
-    // Safely copy the data in to the object.
-    taskENTER_CRITICAL(&spinlock);
-    float temp = m_lastTemperature / 2 + 25;
-    taskEXIT_CRITICAL(&spinlock);
-    return temp;
+    taskENTER_CRITICAL(&m_rotationSpinlock);
+    count = rotations;
+    time = m_lastRotationTime;
+    taskEXIT_CRITICAL(&m_rotationSpinlock);
 }
 
-inline float const IMUManager::m_correctCentripedal(float reading, float radius, float velocity)
+float IMUManager::getLastTemperature()
 {
-    return reading + radius * velocity * velocity;
+    return m_lastTemperature.load(std::memory_order_relaxed) / 2 + 25;
 }
 
-float const IMUManager::m_calculateAngle(float x, float y)
+inline uint32_t IMUManager::m_frameDelta(uint16_t previous, uint16_t current)
 {
-    if (x != 0)
+    const uint16_t rate = m_sampleRate.load(std::memory_order_relaxed);
+    if (rate < 25)
     {
-        // Most cases, avoiding any chance of divide by 0 errors.
-        float angle = atanf(y / x);
-        if (x > 0)
-        {
-            // First or fourth quadrants
-            return angle;
-        }
-        else
-        {
-            // Second or third quadrants
-            if (y >= 0)
-            {
-                // Second
-                return M_PI + angle;
-            }
-            else
-            {
-                // Third
-                return -M_PI + angle;
-            }
-        }
-    }
-    else
-    {
-        // Very rare case when x is 0 (avoid division by 0).
-        if (y >= 0)
-        {
-            // Straight up.
-            return M_PI_2;
-        }
-        else
-        {
-            // Straight down.
-            return -M_PI_2;
-        }
+        // The 16 bit timestamp overflows in between frames at this rate, so use the nominal period.
+        return 1000000 / rate;
     }
+    return (uint16_t)(current - previous) * IMU_TIMESTAMP_RESOLUTION;
 }
 
-inline int8_t IMUManager::m_angleToSector(float angle)
+void IMUManager::m_setSampleRate(uint16_t rate)
 {
-    if (angle < -M_PI / 3)
+    imu.startAccel(rate, IMU_ACCEL_RANGE);
+    imu.startGyro(rate, IMU_GYRO_RANGE);
+
+    // Q is added every update, so scale it to keep the same noise per unit time as at the rate it was tuned for.
+    kalman.setQScale((float)IMU_SAMPLE_RATE / rate);
+    m_sampleRate.store(rate, std::memory_order_relaxed);
+}
+
+#ifdef IMU_ADAPTIVE_RATE
+void IMUManager::m_adaptSampleRate(float velocity, uint32_t timestamp)
+{
+    // Work out the rate for this cadence. It is easier to stay at the current rate than change to another.
+    const uint16_t current = m_sampleRate.load(std::memory_order_relaxed);
+    const float cadence = fabsf(velocity) * 60 / (2 * M_PI);
+    uint16_t rate = IMU_SAMPLE_RATE;
+    if (cadence < IMU_SLOW_CADENCE + (current == IMU_RATE_SLOW ? IMU_RATE_HYSTERESIS : 0))
     {
-        return 0;
+        rate = IMU_RATE_SLOW;
     }
-    else if (angle < M_PI / 3)
+    else if (cadence > IMU_FAST_CADENCE - (current == IMU_RATE_FAST ? IMU_RATE_HYSTERESIS : 0))
     {
-        return 1;
+        rate = IMU_RATE_FAST;
     }
-    else
+
+    // Speed up straight away so that tracking isn't lost, but avoid slowing down too often.
+    if (rate == current || (rate < current && timestamp - m_lastRateChange < IMU_RATE_DWELL))
     {
-        return 2;
+        return;
     }
+    LOGD("IMU", "Changing sample rate from %dHz to %dHz at %.0frpm", current, rate, cadence);
+    m_setSampleRate(rate);
+    m_lastRateChange = timestamp;
 }
+#endif
 
 void taskIMU(void *pvParameters)
 {
     LOGD("IMU", "Starting the IMU task");
+    uint32_t lastTime = micros();
+    taskStarted(TASK_IMU);
     while (true)
     {
-        // Wait for the interrupt to occur and we get a notification
-        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-        // Get data from the accelerometer. An anonymous function is used as callback to call the correct class method.
-        powerMeter.imuManager.imu.getDataFromFifo(
-            [](inv_imu_sensor_event_t *evt)
-            {
-                powerMeter.imuManager.processIMUEvent(evt);
-            });
+        // Wait for the interrupt to occur and we get a notification. The interrupt occurs once every watermark frames.
+        uint32_t count;
+        const uint32_t period = config.imuWatermark * 1000000UL / powerMeter.imuManager.getSampleRate();
+        PM_WAIT_FOR_INTERRUPT(count, lastTime, period, portMAX_DELAY, PM_LOCK_IMU_WAIT);
+        STATS_END(STAT_IMU_LATENCY, imuIrqCycles);
+        lastTime = imuTime;
+
+        // Get all waiting data from the accelerometer.
+        PM_LOCK(PM_LOCK_IMU_SPI);
+        powerMeter.imuManager.readFifo(lastTime);
+        PM_UNLOCK(PM_LOCK_IMU_SPI);
     }
 }
 
@@ -236,6 +270,7 @@ void irqIMUActive()
     // Notify the IMU task. If the IMU task has a higher priority than the one currently running, force a context
     // switch.
     imuTime = micros();
+    STATS_MARK(imuIrqCycles);
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
     vTaskNotifyGiveFromISR(imuTaskHandle, &xHigherPriorityTaskWoken);
     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
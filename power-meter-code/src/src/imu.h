@@ -4,7 +4,7 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-04
+ * @date 2026-10-14
  */
 
 #pragma once
@@ -12,9 +12,12 @@
 #include "Arduino.h"
 #include "../defines.h"
 #include "kalman.h"
+#include "pipeline.h"
+#include "decimator.h"
 #include "data_points.h"
 #include "config.h"
 #include <ICM42670P.h>
+#include <atomic>
 
 extern Config config;
 
@@ -61,12 +64,23 @@ public:
      */
     void enableMotion();
 
+    /**
+     * @brief Reads every frame waiting in the FIFO and processes them in order.
+     *
+     * The time of each frame is reconstructed from the timestamp the IMU stores in each frame. The frame that caused
+     * the FIFO to reach the watermark is taken to have occurred at the time of the interrupt.
+     *
+     * @param interruptTime the time (us) that the watermark interrupt occurred.
+     */
+    void readFifo(uint32_t interruptTime);
+
     /**
      * @brief Processes the IMU event to work out where we are.
      *
      * @param evt data from the IMU.
+     * @param timestamp the time the data was captured in microseconds.
      */
-    void processIMUEvent(inv_imu_sensor_event_t *evt);
+    void processIMUEvent(inv_imu_sensor_event_t *evt, uint32_t timestamp);
 
     /**
      * @brief Set the rotation count and last rotation duration in a low speed data object.
@@ -75,6 +89,20 @@ public:
      */
     void setLowSpeedData(LowSpeedData &data);
 
+    /**
+     * @brief Gets the rotation count and the time the last rotation was completed, thread safe.
+     *
+     * @param count the number of rotations.
+     * @param time the interpolated time of the last rotation (us).
+     */
+    void getLastRotation(uint32_t &count, uint32_t &time);
+
+    /**
+     * @brief The current IMU sample rate (Hz).
+     *
+     */
+    uint16_t getSampleRate() { return m_sampleRate.load(std::memory_order_relaxed); }
+
     /**
      * @brief Calculates and returns the last reported temperature in a thread-safe manner.
      * 
@@ -87,44 +115,53 @@ public:
     uint32_t rotations = 0;
 
 private:
+    CrankEstimator m_estimator; // Angle correction and rotation detection.
+    uint32_t m_lastRotationDuration = 0;
+    uint32_t m_lastRotationTime = 0;
+    uint8_t m_sendCount = 0; // Only send once every so often, defined in the config.
+    Decimator<IMUData> m_decimator; // Used instead of m_sendCount when config.imuRate is set.
+    std::atomic<uint16_t> m_lastTemperature{0};
+    std::atomic<uint16_t> m_sampleRate{IMU_SAMPLE_RATE};
+    uint32_t m_lastRateChange = 0; // Time the sample rate was last changed (us).
+
     /**
-     * @brief Corrects a given reading for an axis for centripedal acceleration due to the offset of the IMU relative
-     * to the centre of rotation.
+     * @brief Sets the sample rate of the accelerometer and gyroscope and scales the Kalman filter to suit.
      *
-     * @param reading the given acceleration in ms^-2
-     * @param radius the radius of the IMU for that axis (x or y offset most likely).
-     * @param velocity the angular velocity in radians per second.
-     * @return float const the corrected acceleration value.
+     * @param rate the new sample rate (Hz).
      */
-    float const m_correctCentripedal(float reading, float radius, float velocity);
+    void m_setSampleRate(uint16_t rate);
 
+#ifdef IMU_ADAPTIVE_RATE
     /**
-     * @brief Calculates the angle based on two acceleration readings.
+     * @brief Picks a sample rate for the current cadence and changes to it if needed.
      *
-     * @param x the x axis acceleration.
-     * @param y the y axis acceleration.
-     * @return float const the calculated angle (radians).
+     * @param velocity the current angular velocity (rad/s).
+     * @param timestamp the current time (us).
      */
-    float const m_calculateAngle(float x, float y);
+    void m_adaptSampleRate(float velocity, uint32_t timestamp);
+#endif
 
     /**
-     * @brief Assigns an angle to one of 3 sectors.
-     * 
-     * @param angle the input angle.
-     * @return int8_t the sector (0, 1 or 2)
+     * @brief Protects the rotation count, time and duration so they are always read together.
+     *
      */
-    int8_t m_angleToSector(float angle);
+    portMUX_TYPE m_rotationSpinlock = portMUX_INITIALIZER_UNLOCKED;
 
     /**
-     * @brief Stores the last sector of rotation so that complete turns can be detected.
-     * 
+     * @brief Calculates the time between two FIFO frames.
+     *
+     * @param previous the timestamp field of the previous frame.
+     * @param current the timestamp field of the current frame.
+     * @return uint32_t the time between the frames in us.
      */
-    int8_t m_lastRotationSector = 0;
-    bool m_armRotationCounter = false;
-    uint32_t m_lastRotationDuration = 0;
-    uint32_t m_lastRotationTime = 0;
-    uint8_t m_sendCount = 0; // Only send once every so often, defined in the config.
-    uint16_t m_lastTemperature;
+    uint32_t m_frameDelta(uint16_t previous, uint16_t current);
+
+    /**
+     * @brief Frames read from the FIFO that are waiting to be processed.
+     *
+     */
+    inv_imu_sensor_event_t m_fifoFrames[IMU_FIFO_MAX_FRAMES];
+    uint8_t m_fifoCount = 0;
 };
 
 /**
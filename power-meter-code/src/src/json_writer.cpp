@@ -0,0 +1,308 @@
+/**
+ * @file json_writer.cpp
+ * @brief Small JSON writer for outgoing messages that doesn't allocate or use printf.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "json_writer.h"
+#include <math.h>
+
+#define FLOAT_SIGNIFICANT_FIGURES 7
+
+static const uint32_t powersOf10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000};
+
+JsonWriter::JsonWriter(char *buffer, size_t size) : m_buffer(buffer), m_size(size)
+{
+    if (size)
+    {
+        buffer[0] = '\0';
+    }
+    else
+    {
+        m_overflow = true;
+    }
+}
+
+void JsonWriter::beginObject(const char *key)
+{
+    m_startValue(key);
+    m_put('{');
+    if (m_depth < JSON_WRITER_MAX_DEPTH)
+    {
+        m_depth++;
+        m_hasItems &= ~(1UL << (m_depth - 1));
+    }
+    else
+    {
+        m_overflow = true;
+    }
+}
+
+void JsonWriter::endObject()
+{
+    m_put('}');
+    if (m_depth)
+    {
+        m_depth--;
+    }
+}
+
+void JsonWriter::beginArray(const char *key)
+{
+    m_startValue(key);
+    m_put('[');
+    if (m_depth < JSON_WRITER_MAX_DEPTH)
+    {
+        m_depth++;
+        m_hasItems &= ~(1UL << (m_depth - 1));
+    }
+    else
+    {
+        m_overflow = true;
+    }
+}
+
+void JsonWriter::endArray()
+{
+    m_put(']');
+    if (m_depth)
+    {
+        m_depth--;
+    }
+}
+
+void JsonWriter::addUInt(const char *key, uint32_t value)
+{
+    m_startValue(key);
+    m_putDigits(value);
+}
+
+void JsonWriter::addInt(const char *key, int32_t value)
+{
+    m_startValue(key);
+    if (value < 0)
+    {
+        m_put('-');
+        m_putDigits(-(uint32_t)value);
+    }
+    else
+    {
+        m_putDigits(value);
+    }
+}
+
+void JsonWriter::addFixed(const char *key, float value, uint8_t decimals)
+{
+    if (decimals > JSON_WRITER_MAX_DECIMALS)
+    {
+        decimals = JSON_WRITER_MAX_DECIMALS;
+    }
+
+    // Scale to an integer number of the smallest decimal place.
+    const float scaled = roundf(value * powersOf10[decimals]);
+    if (!(fabsf(scaled) < 4e9f))
+    {
+        // Too large for the fast path, or not finite.
+        addFloat(key, value);
+        return;
+    }
+
+    m_startValue(key);
+    uint32_t magnitude = fabsf(scaled);
+    if (scaled < 0)
+    {
+        m_put('-');
+    }
+    m_putDigits(magnitude / powersOf10[decimals]);
+    if (decimals)
+    {
+        m_put('.');
+        m_putDigits(magnitude % powersOf10[decimals], decimals);
+    }
+}
+
+void JsonWriter::addFloat(const char *key, float value)
+{
+    m_startValue(key);
+    if (!isfinite(value))
+    {
+        m_puts("null");
+        return;
+    }
+    if (value == 0)
+    {
+        m_put('0');
+        return;
+    }
+    if (value < 0)
+    {
+        m_put('-');
+        value = -value;
+    }
+
+    // Split into 7 significant digits and a power of 10. Doubles are used as this is only for settings and the
+    // precision is needed to get the last digit right.
+    int32_t exponent = floor(log10((double)value));
+    uint32_t digits = llround(value / pow(10, exponent - (FLOAT_SIGNIFICANT_FIGURES - 1)));
+    if (digits >= powersOf10[FLOAT_SIGNIFICANT_FIGURES])
+    {
+        // Rounded up to the next power of 10.
+        digits /= 10;
+        exponent++;
+    }
+    else if (digits < powersOf10[FLOAT_SIGNIFICANT_FIGURES - 1])
+    {
+        // log10 was slightly too large.
+        digits *= 10;
+        exponent--;
+    }
+
+    // Remove trailing zeros.
+    uint8_t count = FLOAT_SIGNIFICANT_FIGURES;
+    while (count > 1 && digits % 10 == 0)
+    {
+        digits /= 10;
+        count--;
+    }
+
+    if (exponent >= 0 && exponent < FLOAT_SIGNIFICANT_FIGURES)
+    {
+        // Plain number with the decimal point somewhere in the digits or after them.
+        if (exponent + 1 >= count)
+        {
+            m_putDigits(digits * powersOf10[exponent + 1 - count]);
+        }
+        else
+        {
+            const uint32_t divisor = powersOf10[count - exponent - 1];
+            m_putDigits(digits / divisor);
+            m_put('.');
+            m_putDigits(digits % divisor, count - exponent - 1);
+        }
+    }
+    else if (exponent < 0 && exponent >= -4)
+    {
+        // Small number with leading zeros after the decimal point.
+        m_puts("0.");
+        m_putDigits(digits, count - exponent - 1);
+    }
+    else
+    {
+        // Scientific notation.
+        const uint32_t divisor = powersOf10[count - 1];
+        m_putDigits(digits / divisor);
+        if (count > 1)
+        {
+            m_put('.');
+            m_putDigits(digits % divisor, count - 1);
+        }
+        m_put('e');
+        if (exponent < 0)
+        {
+            m_put('-');
+            exponent = -exponent;
+        }
+        m_putDigits(exponent);
+    }
+}
+
+void JsonWriter::addBool(const char *key, bool value)
+{
+    m_startValue(key);
+    m_puts(value ? "true" : "false");
+}
+
+void JsonWriter::addString(const char *key, const char *value)
+{
+    m_startValue(key);
+    m_putString(value);
+}
+
+void JsonWriter::m_startValue(const char *key)
+{
+    if (m_depth)
+    {
+        const uint32_t bit = 1UL << (m_depth - 1);
+        if (m_hasItems & bit)
+        {
+            m_put(',');
+        }
+        m_hasItems |= bit;
+    }
+
+    if (key)
+    {
+        m_putString(key);
+        m_put(':');
+    }
+}
+
+void JsonWriter::m_put(char c)
+{
+    // Always leave space for the terminator.
+    if (m_overflow || m_length + 1 >= m_size)
+    {
+        m_overflow = true;
+        return;
+    }
+    m_buffer[m_length] = c;
+    m_length++;
+    m_buffer[m_length] = '\0';
+}
+
+void JsonWriter::m_puts(const char *text)
+{
+    while (*text)
+    {
+        m_put(*text);
+        text++;
+    }
+}
+
+void JsonWriter::m_putString(const char *text)
+{
+    static const char hex[] = "0123456789abcdef";
+    m_put('"');
+    for (; *text; text++)
+    {
+        const char c = *text;
+        if (c == '"' || c == '\\')
+        {
+            m_put('\\');
+            m_put(c);
+        }
+        else if ((uint8_t)c < 0x20)
+        {
+            // Control characters.
+            m_puts("\\u00");
+            m_put(hex[c >> 4]);
+            m_put(hex[c & 0xf]);
+        }
+        else
+        {
+            m_put(c);
+        }
+    }
+    m_put('"');
+}
+
+void JsonWriter::m_putDigits(uint32_t value, uint8_t minDigits)
+{
+    // Generate the digits backwards.
+    char digits[10];
+    uint8_t count = 0;
+    do
+    {
+        digits[count] = '0' + value % 10;
+        value /= 10;
+        count++;
+    } while (value || count < minDigits);
+
+    while (count)
+    {
+        count--;
+        m_put(digits[count]);
+    }
+}
@@ -0,0 +1,157 @@
+/**
+ * @file json_writer.h
+ * @brief Small JSON writer for outgoing messages that doesn't allocate or use printf.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define JSON_WRITER_MAX_DEPTH 32
+#define JSON_WRITER_MAX_DECIMALS 6
+
+/**
+ * @brief Writes compact JSON into a fixed size buffer.
+ *
+ * Commas are added automatically. Every `add...()` method takes the key to use, which should be `nullptr` when adding
+ * to an array. The buffer is always null terminated. If it runs out of space, writing stops and `isValid()` returns
+ * false so that a truncated message isn't sent.
+ *
+ * Numbers are formatted with integer arithmetic rather than newlib's printf, which is slow for floats. Non-finite
+ * floats are written as `null`.
+ */
+class JsonWriter
+{
+public:
+    /**
+     * @brief Construct a new writer.
+     *
+     * @param buffer the buffer to write to.
+     * @param size the size of the buffer, including the null terminator.
+     */
+    JsonWriter(char *buffer, size_t size);
+
+    /**
+     * @brief Starts an object.
+     *
+     * @param key the key of the object in its parent (nullptr at the top level or in an array).
+     */
+    void beginObject(const char *key = nullptr);
+
+    /**
+     * @brief Finishes the current object.
+     *
+     */
+    void endObject();
+
+    /**
+     * @brief Starts an array.
+     *
+     * @param key the key of the array in its parent (nullptr at the top level or in an array).
+     */
+    void beginArray(const char *key = nullptr);
+
+    /**
+     * @brief Finishes the current array.
+     *
+     */
+    void endArray();
+
+    /**
+     * @brief Adds an unsigned integer.
+     *
+     */
+    void addUInt(const char *key, uint32_t value);
+
+    /**
+     * @brief Adds a signed integer.
+     *
+     */
+    void addInt(const char *key, int32_t value);
+
+    /**
+     * @brief Adds a float with a fixed number of decimal places.
+     *
+     * This is the fast path for values with a known range such as temperatures and powers. Values too large to be
+     * scaled to an integer are written using `addFloat()` instead.
+     *
+     * @param decimals the number of decimal places (up to JSON_WRITER_MAX_DECIMALS).
+     */
+    void addFixed(const char *key, float value, uint8_t decimals);
+
+    /**
+     * @brief Adds a float with 7 significant figures, using an exponent if it is very large or small.
+     *
+     * This is slower than `addFixed()` and is intended for settings such as calibration coefficients.
+     */
+    void addFloat(const char *key, float value);
+
+    /**
+     * @brief Adds true or false.
+     *
+     */
+    void addBool(const char *key, bool value);
+
+    /**
+     * @brief Adds a string, escaping it as needed.
+     *
+     */
+    void addString(const char *key, const char *value);
+
+    /**
+     * @brief Checks that everything fitted in the buffer.
+     *
+     * @return true if the buffer holds everything that was added.
+     * @return false if the output was truncated.
+     */
+    bool isValid() { return !m_overflow; }
+
+    /**
+     * @brief The number of characters written (excluding the null terminator).
+     *
+     */
+    size_t length() { return m_length; }
+
+private:
+    /**
+     * @brief Adds a comma if needed and the key, ready for a value.
+     *
+     */
+    void m_startValue(const char *key);
+
+    /**
+     * @brief Adds a single character.
+     *
+     */
+    void m_put(char c);
+
+    /**
+     * @brief Adds characters without escaping them.
+     *
+     */
+    void m_puts(const char *text);
+
+    /**
+     * @brief Adds a string in quotes, escaping it.
+     *
+     */
+    void m_putString(const char *text);
+
+    /**
+     * @brief Adds the digits of an unsigned integer.
+     *
+     * @param value the number.
+     * @param minDigits the minimum number of digits, padded with leading zeros.
+     */
+    void m_putDigits(uint32_t value, uint8_t minDigits = 1);
+
+    char *m_buffer;
+    size_t m_size;
+    size_t m_length = 0;
+    bool m_overflow = false;
+    uint8_t m_depth = 0;
+    uint32_t m_hasItems = 0; // Bit for each level that is set once something has been added to that level.
+};
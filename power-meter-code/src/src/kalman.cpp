@@ -4,22 +4,61 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-04
+ * @date 2026-10-14
  */
 #include "kalman.h"
-
-#ifdef PROTECT_KALMAN_STATES
-extern portMUX_TYPE spinlock;
-#endif
+#include <math.h>
 
 template <typename T>
 void Kalman<T>::update(Matrix<2, 1, T> &measurement, uint32_t time)
 {
+#ifdef KALMAN_CLOSED_FORM
+    // Get the current states. This is the only writer, so no need to check for changes.
+    Snapshot snapshot = m_snapshot;
+    Matrix<2, 1, T> &x = snapshot.xState;
+    Covariance &p = snapshot.pCovariance;
+
+    // Run the prediction
+    const T timestep = (time - snapshot.lastTimestamp) * 1e-6;
+    snapshot.lastTimestamp = time;
+    x(0, 0) = limitAngle(x(0, 0) + timestep * x(1, 0));
+    m_predictCovariance(timestep, p);
+
+    // Refinement step.
+    // Assuming that the measurements match the state (h = [[1, 0], [0, 1]]).
+    // S = P + R is symmetric, so its inverse is [[s11, -s01], [-s01, s00]] / det(S).
+    const T s00 = p.p00 + m_rMeasCovariance(0, 0);
+    const T s01 = p.p01 + m_rMeasCovariance(0, 1);
+    const T s11 = p.p11 + m_rMeasCovariance(1, 1);
+    const T invDet = 1 / (s00 * s11 - s01 * s01);
+
+    // K = P * S^-1
+    const T k00 = (p.p00 * s11 - p.p01 * s01) * invDet;
+    const T k01 = (p.p01 * s00 - p.p00 * s01) * invDet;
+    const T k10 = (p.p01 * s11 - p.p11 * s01) * invDet;
+    const T k11 = (p.p11 * s00 - p.p01 * s01) * invDet;
+
+    // P = P - K * P (the result is symmetric, so the bottom left element isn't needed).
+    Covariance pNew;
+    pNew.p00 = p.p00 - (k00 * p.p00 + k01 * p.p01);
+    pNew.p01 = p.p01 - (k00 * p.p01 + k01 * p.p11);
+    pNew.p11 = p.p11 - (k10 * p.p01 + k11 * p.p11);
+    p = pNew;
+
+    // x = x + K * (z - x)
+    Matrix<2, 1, T> error = subtractStates(measurement, x);
+    x(0, 0) = limitAngle(x(0, 0) + k00 * error(0, 0) + k01 * error(1, 0));
+    x(1, 0) += k10 * error(0, 0) + k11 * error(1, 0);
+
+    // Save the new state.
+    m_writeSnapshot(snapshot);
+#else
     // Run the predition
-    Matrix<2, 1, T> x;
-    Matrix<2, 2, T> p;
+    Snapshot snapshot;
+    Matrix<2, 1, T> &x = snapshot.xState;
+    Matrix<2, 2, T> &p = snapshot.pCovariance;
     predict(time, x, p);
-    m_lastTimestamp = time; // Should be atomic?
+    snapshot.lastTimestamp = time;
 
     // Refinement step.
     // Assuming that the measurements match the state (h = [[1, 0], [0, 1]]).
@@ -29,17 +68,23 @@ void Kalman<T>::update(Matrix<2, 1, T> &measurement, uint32_t time)
     x(0,0) = limitAngle(x(0,0));
 
     // Save the new state.
-    TAKE_KALMAN_PROTECT();
-    m_xState = x;
-    m_pCovariance = p;
-    GIVE_KALMAN_PROTECT();
+    m_writeSnapshot(snapshot);
+#endif
 }
 
 template <typename T>
 void Kalman<T>::predict(uint32_t time, Matrix<2, 1, T> &xState)
 {
+#ifdef KALMAN_CLOSED_FORM
+    // The covariance isn't needed, so only predict the state.
+    const Snapshot snapshot = m_readSnapshot();
+    xState = snapshot.xState;
+    const T timestep = (time - snapshot.lastTimestamp) * 1e-6;
+    xState(0, 0) = limitAngle(xState(0, 0) + timestep * xState(1, 0));
+#else
     Matrix<2, 2, T> pState; // Matrix that can be chucked away afterwards.
     predict(time, xState, pState);
+#endif
 }
 
 template <typename T>
@@ -77,47 +122,117 @@ inline Matrix<2, 1, T> Kalman<T>::subtractStates(Matrix<2, 1, T> state1, Matrix<
 template <typename T>
 inline void Kalman<T>::resetState(Matrix<2, 1, T> xInitialState, Matrix<2, 2, T> pInitialCovariance)
 {
-    m_xState = xInitialState;
-    m_pCovariance = pInitialCovariance;
+    Snapshot snapshot = m_snapshot;
+    snapshot.xState = xInitialState;
+#ifdef KALMAN_CLOSED_FORM
+    snapshot.pCovariance.p00 = pInitialCovariance(0, 0);
+    snapshot.pCovariance.p01 = pInitialCovariance(0, 1);
+    snapshot.pCovariance.p11 = pInitialCovariance(1, 1);
+#else
+    snapshot.pCovariance = pInitialCovariance;
+#endif
+    m_writeSnapshot(snapshot);
 }
 
 template <typename T>
 inline Matrix<2, 2, T> Kalman<T>::getCovariance()
 {
-    TAKE_KALMAN_PROTECT();
-    Matrix<2, 2, T> result = m_pCovariance;
-    GIVE_KALMAN_PROTECT();
+#ifdef KALMAN_CLOSED_FORM
+    const Covariance p = m_readSnapshot().pCovariance;
+    Matrix<2, 2, T> result = {p.p00, p.p01, p.p01, p.p11};
     return result;
+#else
+    return m_readSnapshot().pCovariance;
+#endif
 }
 
 template <typename T>
 inline Matrix<2, 1, T> Kalman<T>::getState()
 {
-    TAKE_KALMAN_PROTECT();
-    Matrix<2, 1, T> result = m_xState;
-    GIVE_KALMAN_PROTECT();
-    return result;
+    return m_readSnapshot().xState;
 }
 
 template <typename T>
 void Kalman<T>::predict(uint32_t time, Matrix<2, 1, T> &xState, Matrix<2, 2, T> &pCovariance)
 {
+#ifdef KALMAN_CLOSED_FORM
     // Get the current states.
-    TAKE_KALMAN_PROTECT();
-    xState = m_xState;
-    pCovariance = m_pCovariance;
-    GIVE_KALMAN_PROTECT();
+    const Snapshot snapshot = m_readSnapshot();
+    xState = snapshot.xState;
+    Covariance p = snapshot.pCovariance;
+
+    // Prediction step with F = [[1, dt], [0, 1]] expanded by hand.
+    const T timestep = (time - snapshot.lastTimestamp) * 1e-6;
+    xState(0, 0) = limitAngle(xState(0, 0) + timestep * xState(1, 0));
+    m_predictCovariance(timestep, p);
+    pCovariance(0, 0) = p.p00;
+    pCovariance(0, 1) = p.p01;
+    pCovariance(1, 0) = p.p01;
+    pCovariance(1, 1) = p.p11;
+#else
+    // Get the current states.
+    const Snapshot snapshot = m_readSnapshot();
+    xState = snapshot.xState;
+    pCovariance = snapshot.pCovariance;
 
     // Prediction step.
     Matrix<2, 2, T> fPrediction = {1, 0, 0, 1};
-    T timestep = (time - m_lastTimestamp) * 1e-6; // Calculate the timestep.
+    T timestep = (time - snapshot.lastTimestamp) * 1e-6; // Calculate the timestep.
     fPrediction(0, 1) = timestep;
     // log_printf("fPrediction: {%f, %f, %f, %f}\n", fPrediction(0, 0), fPrediction(0, 1), fPrediction(1, 0), fPrediction(1, 1));
     xState = fPrediction * xState;
     xState(0, 0) = limitAngle(xState(0, 0)); // Make sure we wrap around if needed.
     // log_printf("X: {%f, %f}\n", x(0,0), x(1,0));
     // P[k] = F * P_prev * Transpose(F) + Q
-    pCovariance = ((fPrediction * pCovariance) * ~fPrediction) + m_qEnvCovariance;
+    pCovariance = ((fPrediction * pCovariance) * ~fPrediction) + m_qEnvCovariance * m_qScale.load(std::memory_order_relaxed);
+#endif
+}
+
+#ifdef KALMAN_CLOSED_FORM
+template <typename T>
+inline void Kalman<T>::m_predictCovariance(T timestep, Covariance &p)
+{
+    // P[k] = F * P_prev * Transpose(F) + Q
+    const T qScale = m_qScale.load(std::memory_order_relaxed);
+    p.p00 += timestep * (2 * p.p01 + timestep * p.p11) + m_qEnvCovariance(0, 0) * qScale;
+    p.p01 += timestep * p.p11 + m_qEnvCovariance(0, 1) * qScale;
+    p.p11 += m_qEnvCovariance(1, 1) * qScale;
+}
+#endif
+
+template <typename T>
+inline typename Kalman<T>::Snapshot Kalman<T>::m_readSnapshot()
+{
+#ifdef PROTECT_KALMAN_STATES
+    Snapshot snapshot;
+    uint32_t before, after;
+    do
+    {
+        // Wait for any write in progress to finish, copy, then check nothing was written during the copy.
+        before = m_sequence.load(std::memory_order_acquire);
+        snapshot = m_snapshot;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = m_sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return snapshot;
+#else
+    return m_snapshot;
+#endif
+}
+
+template <typename T>
+inline void Kalman<T>::m_writeSnapshot(const Snapshot &snapshot)
+{
+#ifdef PROTECT_KALMAN_STATES
+    // Make the sequence number odd whilst writing so readers know to retry.
+    const uint32_t sequence = m_sequence.load(std::memory_order_relaxed);
+    m_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_snapshot = snapshot;
+    m_sequence.store(sequence + 2, std::memory_order_release);
+#else
+    m_snapshot = snapshot;
+#endif
 }
 
 template class Kalman<float>;
@@ -4,20 +4,21 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-04
+ * @date 2026-10-14
  */
 #pragma once
 // #include "defines.h"
 #include <BasicLinearAlgebra.h>
+#include <atomic>
 
-#define PROTECT_KALMAN_STATES // Enables protection of the state variable in the Kalman filter.
-#ifdef PROTECT_KALMAN_STATES
-    // All access operations are very quick. For efficiency, making this a critical section should be ok.
-    #define TAKE_KALMAN_PROTECT() taskENTER_CRITICAL(&spinlock)
-    #define GIVE_KALMAN_PROTECT() taskEXIT_CRITICAL(&spinlock)
-#else
-    #define TAKE_KALMAN_PROTECT()
-    #define GIVE_KALMAN_PROTECT()
+// Enables protection of the state variables in the Kalman filter. A sequence lock is used so that readers in other
+// tasks never block the writer or disable interrupts. Only one task may call `update()` or `resetState()`.
+#define PROTECT_KALMAN_STATES
+
+#ifndef KALMAN_GENERIC
+    // Uses hand-expanded 2x2 maths with a symmetric covariance rather than BasicLinearAlgebra's generic multiplication
+    // and Inverse(). Define KALMAN_GENERIC before including this file to use the generic version instead.
+    #define KALMAN_CLOSED_FORM
 #endif
 
 using namespace BLA;
@@ -44,8 +45,12 @@ public:
      * @param pInitialCovariance The covariance matrix of the initial state. Large values in this will allow wildy
      *                           inaccurate initial guesses to be quickly forgotten.
      */
-    Kalman(Matrix<2, 2, T> &qEnvCovariance, Matrix<2, 2, T> &rMeasCovariance, Matrix<2, 1, T> xInitialState,
-        Matrix<2, 2, T> pInitialCovariance) : m_qEnvCovariance(qEnvCovariance), m_rMeasCovariance(rMeasCovariance), m_xState(xInitialState), m_pCovariance(pInitialCovariance) {}
+    Kalman(const Matrix<2, 2, T> &qEnvCovariance, const Matrix<2, 2, T> &rMeasCovariance,
+        Matrix<2, 1, T> xInitialState, Matrix<2, 2, T> pInitialCovariance)
+        : m_qEnvCovariance(qEnvCovariance), m_rMeasCovariance(rMeasCovariance)
+    {
+        resetState(xInitialState, pInitialCovariance);
+    }
     
     /**
      * @brief Adds a new set of measurements to the model.
@@ -97,6 +102,18 @@ public:
      */
     void predict(uint32_t time, Matrix<2, 1, T> &xState);
 
+    /**
+     * @brief Scales the process noise added at each step.
+     *
+     * Q is added once per update, so when the time between updates changes, scale it by the ratio of the new period
+     * to the period Q was tuned for.
+     *
+     * This may be called from a different task to the one running the filter.
+     *
+     * @param scale the multiplier for Q.
+     */
+    void setQScale(T scale) { m_qScale.store(scale, std::memory_order_relaxed); }
+
 private:
     /**
      * @brief Limits an angle to between -pi and pi.
@@ -118,17 +135,69 @@ private:
     Matrix<2, 1, T> subtractStates(Matrix<2, 1, T> state1, Matrix<2, 1, T> state2);
 
     const Matrix<2, 2, T> &m_qEnvCovariance, &m_rMeasCovariance;
+    std::atomic<T> m_qScale{1}; // Written by the IMU task and read by the tasks running the filter.
+
+#ifdef KALMAN_CLOSED_FORM
+    /**
+     * @brief Covariance matrix with the off-diagonal elements stored once as it is always symmetric.
+     *
+     * `Q` and `R` are assumed to be symmetric, so only their top right elements are used.
+     *
+     */
+    struct Covariance
+    {
+        T p00, p01, p11;
+    };
+
+    /**
+     * @brief Predicts the covariance after a given time step.
+     *
+     * @param timestep the time step in seconds.
+     * @param p the covariance to update.
+     */
+    void m_predictCovariance(T timestep, Covariance &p);
+#else
+    typedef Matrix<2, 2, T> Covariance;
+#endif
+
+    /**
+     * @brief Snapshot of everything that is needed to make a prediction.
+     *
+     */
+    struct Snapshot
+    {
+        Matrix<2, 1, T> xState;
+        Covariance pCovariance;
+        uint32_t lastTimestamp = 0; // The time of the last reading in microseconds.
+    };
+
+    /**
+     * @brief Gets a consistent copy of the current state.
+     *
+     * If the writer changes the state part way through, the copy is retried.
+     *
+     * @return Snapshot the copy.
+     */
+    Snapshot m_readSnapshot();
+
+    /**
+     * @brief Publishes a new state to readers.
+     *
+     * @param snapshot the new state.
+     */
+    void m_writeSnapshot(const Snapshot &snapshot);
 
     /**
      * @brief Current state variables.
      * 
      */
-    Matrix<2, 1, T> m_xState;
-    Matrix<2, 2, T> m_pCovariance;
+    Snapshot m_snapshot;
 
+#ifdef PROTECT_KALMAN_STATES
     /**
-     * @brief The time of the last reading in microseconds
-     * 
+     * @brief Sequence number for the snapshot. This is odd whilst the snapshot is being written.
+     *
      */
-    uint32_t m_lastTimestamp = 0;
+    std::atomic<uint32_t> m_sequence{0};
+#endif
 };
\ No newline at end of file
@@ -0,0 +1,166 @@
+/**
+ * @file pipeline.cpp
+ * @brief Processing of the IMU and strain gauge readings that doesn't depend on the hardware or FreeRTOS.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "pipeline.h"
+
+bool CrankEstimator::update(Kalman<float> &kalman, uint32_t timestamp, float xAccel, float yAccel, float zGyro, IMUData &data)
+{
+    data.timestamp = timestamp;
+    data.xAccel = correctCentripetal(xAccel, IMU_OFFSET_X, zGyro);
+    data.yAccel = correctCentripetal(yAccel, IMU_OFFSET_Y, zGyro);
+    data.zGyro = zGyro;
+
+    // Add to the Kalman filter
+    float theta = accelToAngle(data.xAccel, data.yAccel);
+    Matrix<2, 1, float> measurement;
+    measurement(0, 0) = -theta;
+    measurement(1, 0) = zGyro;
+    kalman.update(measurement, timestamp);
+
+    Matrix<2, 1, float> state = kalman.getState();
+    data.position = state(0, 0);
+    data.velocity = state(1, 0);
+
+    // Calculate the number of rotations.
+    // Calculate the current sector.
+    int8_t rotationSector = angleToSector(data.position);
+    bool rotated = false;
+
+    // Arm trigger if crossing from sector 0 to sector 1
+    if (rotationSector == 1 and m_lastRotationSector == 0)
+    {
+        m_armRotationCounter = true;
+    }
+
+    // If trigger is armed and we crossed from sector 2 back to sector 0, increase the count.
+    if (m_armRotationCounter && rotationSector == 0 && m_lastRotationSector == 2)
+    {
+        // We have a complete rotation. // TODO: Confirm direction.
+        m_armRotationCounter = false;
+        rotated = true;
+        m_rotationTime = timestamp - timeSinceWrap(m_lastPosition, m_lastVelocity, data.position, data.velocity,
+                                                   timestamp - m_lastTimestamp);
+    }
+    m_lastRotationSector = rotationSector;
+    m_lastTimestamp = timestamp;
+    m_lastPosition = data.position;
+    m_lastVelocity = data.velocity;
+    return rotated;
+}
+
+bool PowerAccumulator::update(uint32_t timestamp, float power, uint32_t rotations, uint32_t rotationTime,
+                              uint8_t profileBins, TorqueProfile &profile)
+{
+    // Check if a full rotation occurred.
+    if (rotations == m_lastRotation)
+    {
+        return false;
+    }
+
+    // Rotation has occurred, calculate average power and reset accumulator.
+    m_lastRotation = rotations;
+
+    // Work out where to split the energy. If the rotation time doesn't make sense (it is after this reading or before
+    // the current rotation started), split at this reading as it is the best we have.
+    uint32_t boundary = timestamp;
+    float carried = 0; // Energy already added that belongs to the new rotation.
+    if ((int32_t)(timestamp - rotationTime) >= 0 && (int32_t)(rotationTime - m_segStartTime) > 0)
+    {
+        boundary = rotationTime;
+        if ((int32_t)(boundary - m_lastTime) > 0)
+        {
+            // Between the last reading and this one. Part of the gap belongs to the old rotation.
+            m_energy += power * (boundary - m_lastTime) * 1e-6;
+            m_lastTime = boundary;
+        }
+        else
+        {
+            // The rotation was detected after some readings of the new rotation had been added.
+            carried = m_lastPower * (m_lastTime - boundary) * 1e-6;
+            m_energy -= carried;
+        }
+    }
+
+    // Calculate the average power over the rotation. This variable will remain set until the next rotation.
+    m_averagePower = m_energy / (boundary - m_segStartTime) * 1e6;
+    m_finishProfile(boundary, profileBins, profile);
+    m_segStartTime = boundary;
+
+    // Reset accumulator.
+    m_energy = carried;
+    return true;
+}
+
+void PowerAccumulator::add(const HighSpeedData &data)
+{
+    // Accumulate the torque profile and energy
+    m_addToProfile(data.position, data.torque);
+    m_lastPower = data.velocity * data.torque;
+    m_energy += m_lastPower * (data.timestamp - m_lastTime) * 1e-6;
+    m_lastTime = data.timestamp;
+}
+
+void PowerAccumulator::m_addToProfile(float position, float torque)
+{
+    if (!m_profileBins)
+    {
+        return;
+    }
+
+    // Position is from -pi to pi. Clamp in case of rounding at the edges.
+    int32_t bin = (position + M_PI) * m_profileBins / (2 * M_PI);
+    if (bin < 0)
+    {
+        bin = 0;
+    }
+    else if (bin >= m_profileBins)
+    {
+        bin = m_profileBins - 1;
+    }
+    m_binTorque[bin] += torque;
+    m_binSamples[bin]++;
+}
+
+void PowerAccumulator::m_finishProfile(uint32_t timestamp, uint8_t profileBins, TorqueProfile &profile)
+{
+    // Fill in the profile for the previous rotation if there was one.
+    profile.binCount = 0;
+    if (m_profileBins)
+    {
+        profile.timestamp = m_segStartTime;
+        profile.duration = timestamp - m_segStartTime;
+        bool hasSamples = false;
+        for (uint8_t i = 0; i < m_profileBins; i++)
+        {
+            if (m_binSamples[i])
+            {
+                // Keep clear of the value used for empty bins.
+                int16_t packed = BaseData::toFixed(m_binTorque[i] / m_binSamples[i], PACKED_TORQUE_SCALE);
+                profile.torque[i] = packed == PROFILE_EMPTY_BIN ? PROFILE_EMPTY_BIN + 1 : packed;
+                hasSamples = true;
+            }
+            else
+            {
+                profile.torque[i] = PROFILE_EMPTY_BIN;
+            }
+        }
+
+        if (hasSamples)
+        {
+            profile.binCount = m_profileBins;
+        }
+    }
+
+    // Start the next profile, picking up any change to the number of bins.
+    m_profileBins = profileBins <= PROFILE_MAX_BINS ? profileBins : 0;
+    for (uint8_t i = 0; i < m_profileBins; i++)
+    {
+        m_binTorque[i] = 0;
+        m_binSamples[i] = 0;
+    }
+}
@@ -0,0 +1,140 @@
+/**
+ * @file pipeline.h
+ * @brief Processing of the IMU and strain gauge readings that doesn't depend on the hardware or FreeRTOS.
+ *
+ * `IMUManager` and `Side` pass readings through these classes and then handle the locking and sending. Keeping these
+ * free of hardware means recorded sessions can be replayed through the same code on a computer (see
+ * `scripts-testing/benchmarks`).
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include "../defines.h"
+#include "kalman.h"
+#include "data_points.h"
+#include "crank_maths.h"
+
+/**
+ * @brief Estimates the crank angle and velocity from IMU readings and counts rotations.
+ *
+ */
+class CrankEstimator
+{
+public:
+    /**
+     * @brief Corrects an IMU reading, updates the Kalman filter and checks for a complete rotation.
+     *
+     * @param kalman the filter to update.
+     * @param timestamp the time the reading was taken (us).
+     * @param xAccel the x axis acceleration (ms^-2) before centripetal correction.
+     * @param yAccel the y axis acceleration (ms^-2) before centripetal correction.
+     * @param zGyro the z axis angular velocity (rad/s).
+     * @param data the timestamp, position, velocity, corrected accelerations and z gyro are written to this.
+     * @return true if this reading completed a rotation. `rotationTime()` gives when it happened.
+     * @return false otherwise.
+     */
+    bool update(Kalman<float> &kalman, uint32_t timestamp, float xAccel, float yAccel, float zGyro, IMUData &data);
+
+    /**
+     * @brief The time that the last rotation was completed (us).
+     *
+     * This is interpolated to when the crank angle wrapped around between the two readings either side, rather than
+     * the time of the reading that detected it.
+     *
+     */
+    uint32_t rotationTime() { return m_rotationTime; }
+
+private:
+    /**
+     * @brief Stores the last sector of rotation so that complete turns can be detected.
+     *
+     */
+    int8_t m_lastRotationSector = 0;
+    bool m_armRotationCounter = false;
+
+    // The previous reading, used to interpolate the time of each rotation.
+    uint32_t m_lastTimestamp = 0;
+    float m_lastPosition = 0, m_lastVelocity = 0;
+    uint32_t m_rotationTime = 0;
+};
+
+/**
+ * @brief Accumulates energy and the torque profile for each rotation of one side.
+ *
+ */
+class PowerAccumulator
+{
+public:
+    /**
+     * @brief Finishes the previous rotation if the rotation count has changed since the last call.
+     *
+     * This should be called before adding each reading, as the rotation most likely occurred before it. The energy is
+     * split between the rotations at `rotationTime`, assuming the power between readings is constant.
+     *
+     * @param timestamp the time of the reading about to be added, or the current time if there isn't one (us).
+     * @param power the power of the reading about to be added (W), or 0 if there isn't one.
+     * @param rotations the current rotation count.
+     * @param rotationTime the time that the last rotation was completed (us).
+     * @param profileBins the number of bins to use for the next profile (0 to disable).
+     * @param profile the profile of the finished rotation is written to this. `binCount` is set to 0 if there is
+     *                nothing to send.
+     * @return true if a rotation was finished, in which case `averagePower()` has been updated.
+     * @return false if the rotation count hasn't changed.
+     */
+    bool update(uint32_t timestamp, float power, uint32_t rotations, uint32_t rotationTime, uint8_t profileBins,
+                TorqueProfile &profile);
+
+    /**
+     * @brief Adds a reading to the energy and torque profile of the current rotation.
+     *
+     * @param data the reading with the torque calculated.
+     */
+    void add(const HighSpeedData &data);
+
+    /**
+     * @brief The average power over the last finished rotation (W).
+     *
+     */
+    float averagePower() { return m_averagePower; }
+
+    /**
+     * @brief Carries on counting from a rotation count restored after a fast wake.
+     *
+     * Without this, the first call to `update()` would treat the restored count as a finished rotation.
+     *
+     * @param rotations the rotation count the IMU manager restored.
+     */
+    void restoreRotation(uint32_t rotations) { m_lastRotation = rotations; }
+
+private:
+    /**
+     * @brief Adds a torque reading to the bin for the current crank angle.
+     *
+     * @param position the crank angle in radians (-pi to pi).
+     * @param torque the torque in Nm.
+     */
+    void m_addToProfile(float position, float torque);
+
+    /**
+     * @brief Fills in the torque profile for the rotation that just finished and starts a new one.
+     *
+     * @param timestamp the time at which the new rotation started.
+     * @param profileBins the number of bins to use for the next profile.
+     * @param profile where to put the finished profile.
+     */
+    void m_finishProfile(uint32_t timestamp, uint8_t profileBins, TorqueProfile &profile);
+
+    // Variables for accumulating energy
+    uint32_t m_lastTime = 0, m_segStartTime = 0; // Time that the last sample occurred and time that the current period started.
+    float m_energy = 0;                          // Accumulator for the energy.
+    float m_lastPower = 0;                       // Power of the last sample, used when splitting at a rotation.
+    uint32_t m_lastRotation = 0;                 // What the last rotation was on.
+    float m_averagePower = 0;
+
+    // Variables for accumulating the torque profile. The bin count is only changed at the start of a rotation.
+    float m_binTorque[PROFILE_MAX_BINS];     // Sum of the torques in each bin.
+    uint16_t m_binSamples[PROFILE_MAX_BINS]; // Number of samples in each bin.
+    uint8_t m_profileBins = 0;               // Number of bins in use for the current rotation (0 if disabled).
+};
@@ -0,0 +1,119 @@
+/**
+ * @file power_manager.cpp
+ * @brief Dynamic frequency scaling, automatic light sleep and the power management locks that control them.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "power_manager.h"
+#include "config.h"
+
+extern SemaphoreHandle_t serialMutex;
+extern Config config;
+
+// Type and name of each lock. Order must match EnumPMLock.
+static const struct
+{
+    esp_pm_lock_type_t type;
+    const char *name;
+} lockTypes[PM_LOCK_COUNT] = {
+    {ESP_PM_CPU_FREQ_MAX, "amp-burst"},
+    {ESP_PM_NO_LIGHT_SLEEP, "amp-left"},
+    {ESP_PM_NO_LIGHT_SLEEP, "amp-right"},
+    {ESP_PM_NO_LIGHT_SLEEP, "imu-wait"},
+    {ESP_PM_APB_FREQ_MAX, "imu-spi"},
+    {ESP_PM_CPU_FREQ_MAX, "radio"}};
+
+void PowerManager::begin()
+{
+    for (uint8_t i = 0; i < PM_LOCK_COUNT; i++)
+    {
+        if (esp_pm_lock_create(lockTypes[i].type, 0, lockTypes[i].name, &m_locks[i]) != ESP_OK)
+        {
+            // Power management isn't enabled in this build. Locks that weren't created are skipped.
+            LOGW("Power", "Couldn't create the '%s' lock", lockTypes[i].name);
+            m_locks[i] = NULL;
+        }
+    }
+    m_apply(config.powerSave);
+}
+
+void PowerManager::update()
+{
+    if (config.powerSave != m_requested)
+    {
+        m_apply(config.powerSave);
+    }
+}
+
+void PowerManager::acquire(EnumPMLock lock)
+{
+    if (m_locks[lock])
+    {
+        esp_pm_lock_acquire(m_locks[lock]);
+    }
+}
+
+void PowerManager::release(EnumPMLock lock)
+{
+    if (m_locks[lock])
+    {
+        esp_pm_lock_release(m_locks[lock]);
+    }
+}
+
+bool PowerManager::waitForInterrupt(uint32_t &value, uint32_t lastTime, uint32_t period, TickType_t timeout,
+                                    EnumPMLock lock)
+{
+    if (m_mode == POWER_SAVE_LIGHT_SLEEP)
+    {
+        // Sleep is allowed until shortly before the interrupt is due. If the last interrupt was a long time ago, the
+        // timing is unknown, so stay awake.
+        const int32_t untilGuard = lastTime + period - PM_WAKE_GUARD - micros();
+        if (untilGuard > 0 && untilGuard < (int32_t)period)
+        {
+            const TickType_t ticks = untilGuard / (1000 * portTICK_PERIOD_MS);
+            if (ticks && xTaskNotifyWait(0, 0xffffffff, &value, ticks < timeout ? ticks : timeout))
+            {
+                // Arrived early (and the CPU happened to be awake to see it).
+                return true;
+            }
+        }
+    }
+
+    // The interrupt is due. Stay awake so the edge isn't missed.
+    acquire(lock);
+    const bool received = xTaskNotifyWait(0, 0xffffffff, &value, timeout);
+    release(lock);
+    return received;
+}
+
+void PowerManager::m_apply(uint8_t mode)
+{
+    m_requested = mode;
+    esp_pm_config_t pmConfig = {
+        .max_freq_mhz = POWER_CPU_MAX_MHZ,
+        .min_freq_mhz = mode == POWER_SAVE_OFF ? POWER_CPU_MAX_MHZ : POWER_CPU_MIN_MHZ,
+        .light_sleep_enable = mode == POWER_SAVE_LIGHT_SLEEP};
+    esp_err_t result = esp_pm_configure(&pmConfig);
+    if (result != ESP_OK && pmConfig.light_sleep_enable)
+    {
+        // Most likely tickless idle isn't enabled in this build.
+        LOGW("Power", "Light sleep isn't supported (error %d), using frequency scaling only", result);
+        mode = POWER_SAVE_DFS;
+        pmConfig.light_sleep_enable = false;
+        result = esp_pm_configure(&pmConfig);
+    }
+
+    if (result == ESP_OK)
+    {
+        m_mode = mode;
+        LOGI("Power", "Power save mode %d (%d to %dMHz)", mode, pmConfig.min_freq_mhz, pmConfig.max_freq_mhz);
+    }
+    else
+    {
+        m_mode = POWER_SAVE_OFF;
+        LOGW("Power", "Couldn't configure power management (error %d)", result);
+    }
+}
@@ -0,0 +1,113 @@
+/**
+ * @file power_manager.h
+ * @brief Dynamic frequency scaling, automatic light sleep and the power management locks that control them.
+ *
+ * Each task holds a lock while it needs the clocks or needs to stay awake. PM_LOCK() and PM_UNLOCK() compile to
+ * nothing when POWER_MANAGEMENT is not defined.
+ *
+ * Automatic light sleep needs `CONFIG_FREERTOS_USE_TICKLESS_IDLE`, which the prebuilt Arduino libraries may not have.
+ * If it isn't available, only frequency scaling is used and a warning is logged.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+
+#include "../defines.h"
+#include <esp_pm.h>
+
+/**
+ * @brief Power management locks. Each user has its own lock so they can be told apart when profiling.
+ *
+ */
+enum EnumPMLock
+{
+    PM_LOCK_AMP_BURST,  // CPU at full speed while clocking data out of the amplifiers (timing is in CPU cycles).
+    PM_LOCK_AMP_LEFT,   // No light sleep while the left amplifier's data ready edge is due.
+    PM_LOCK_AMP_RIGHT,  // No light sleep while the right amplifier's data ready edge is due.
+    PM_LOCK_IMU_WAIT,   // No light sleep while the IMU interrupt is due.
+    PM_LOCK_IMU_SPI,    // APB at full speed while reading the IMU over SPI.
+    PM_LOCK_RADIO,      // CPU at full speed while transmitting.
+    PM_LOCK_COUNT
+};
+
+/**
+ * @brief Sets up power management and keeps it in line with the config.
+ *
+ */
+class PowerManager
+{
+public:
+    /**
+     * @brief Creates the locks and applies the mode in the config.
+     *
+     */
+    void begin();
+
+    /**
+     * @brief Applies the mode in the config if it has changed.
+     *
+     */
+    void update();
+
+    /**
+     * @brief Acquires a lock. Locks are counted, so each call must be matched by a call to `release()`.
+     *
+     */
+    void acquire(EnumPMLock lock);
+
+    /**
+     * @brief Releases a lock.
+     *
+     */
+    void release(EnumPMLock lock);
+
+    /**
+     * @brief The mode in use, which may be less than requested if light sleep isn't supported.
+     *
+     */
+    uint8_t mode() { return m_mode; }
+
+    /**
+     * @brief Waits for a notification from an interrupt that occurs regularly, allowing light sleep until just
+     * before it is due.
+     *
+     * GPIO edge interrupts aren't detected in light sleep, so sleep is blocked from PM_WAKE_GUARD before the
+     * interrupt is expected until it arrives.
+     *
+     * @param value the notification value is written to this.
+     * @param lastTime the time of the last interrupt (us).
+     * @param period the expected time between interrupts (us).
+     * @param timeout the longest time to wait in ticks.
+     * @param lock the lock to hold while the interrupt is due.
+     * @return true if a notification was received.
+     * @return false if the timeout expired.
+     */
+    bool waitForInterrupt(uint32_t &value, uint32_t lastTime, uint32_t period, TickType_t timeout, EnumPMLock lock);
+
+private:
+    /**
+     * @brief Configures frequency scaling and light sleep.
+     *
+     * @param mode the requested mode (POWER_SAVE_...).
+     */
+    void m_apply(uint8_t mode);
+
+    esp_pm_lock_handle_t m_locks[PM_LOCK_COUNT] = {};
+    uint8_t m_mode = POWER_SAVE_OFF;
+    uint8_t m_requested = POWER_SAVE_OFF;
+};
+
+#ifdef POWER_MANAGEMENT
+extern PowerManager powerManager;
+#define PM_LOCK(lock) powerManager.acquire(lock)
+#define PM_UNLOCK(lock) powerManager.release(lock)
+#define PM_WAIT_FOR_INTERRUPT(value, lastTime, period, timeout, lock) \
+    powerManager.waitForInterrupt(value, lastTime, period, timeout, lock)
+#else
+#define PM_LOCK(lock)
+#define PM_UNLOCK(lock)
+#define PM_WAIT_FOR_INTERRUPT(value, lastTime, period, timeout, lock) \
+    xTaskNotifyWait(0, 0xffffffff, &(value), timeout)
+#endif
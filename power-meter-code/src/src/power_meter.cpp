@@ -4,7 +4,7 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-10-25
+ * @date 2026-10-14
  */
 
 #include "power_meter.h"
@@ -13,189 +13,182 @@ extern SemaphoreHandle_t serialMutex;
 extern PowerMeter powerMeter;
 
 #include "connections.h"
+#include "task_topology.h"
+#include "power_manager.h"
 extern Connection *connectionBasePtr;
 
 extern TaskHandle_t imuTaskHandle, lowSpeedTaskHandle, connectionTaskHandle, ledTaskHandle;
-extern portMUX_TYPE spinlock;
-
-void Side::begin()
-{
-    LOGD("Side", "Starting hardware for a side");
-    tempSensor.begin();
-}
 
 void Side::createDataTask(uint8_t id)
 {
-    char buff[6];
-    sprintf(buff, "Amp%d", id);
-    xTaskCreatePinnedToCore(
-        taskAmp,
-        buff,
-        4096,
-        this,
-        2,
-        &taskHandle,
-        1);
+    createTask(id == SIDE_LEFT ? TASK_AMP_LEFT : TASK_AMP_RIGHT, taskAmp, this, &taskHandle);
 }
 
 void Side::readDataTask()
 {
     LOGI("AMP", "Starting to read data");
+    const EnumPMLock waitLock = m_side == SIDE_LEFT ? PM_LOCK_AMP_LEFT : PM_LOCK_AMP_RIGHT;
+    uint32_t lastTimestamp = micros();
+    taskStarted(m_side == SIDE_LEFT ? TASK_AMP_LEFT : TASK_AMP_RIGHT);
     while (true)
     {
         // Wait for the interrupt to occur and we get a notification. The time of the interrupt is passed using the
         // notification.
         uint32_t timestamp;
-        bool success = xTaskNotifyWait(0, 0xffffffff, &timestamp, pdMS_TO_TICKS(100));
+        bool success = PM_WAIT_FOR_INTERRUPT(timestamp, lastTimestamp, AMP_SAMPLE_PERIOD, pdMS_TO_TICKS(100), waitLock);
         bool isTransmitting = connectionBasePtr->isTransmitting;
 
-        uint32_t raw;
         if (success)
         {
+            STATS_END(m_side == SIDE_LEFT ? STAT_AMP_LATENCY_LEFT : STAT_AMP_LATENCY_RIGHT, irqCycles);
+
             // Interrupt occured, data is ready to read. We have many ms for the data to sit in the ADC's buffer, so not
             // too much of a rush now we have the time that the reading was made available by the ADC.
             // Using predict so we can have a lower sample rate on the IMU hopefully.
             Matrix<2, 1, float> state;
             powerMeter.imuManager.kalman.predict(timestamp, state);
-            // Valid data was received.
-            raw = m_readADC();
+            // Valid data was received. If the other side also has data ready, both are read in the same burst.
+            lastTimestamp = timestamp;
+            HighSpeedData data;
+            data.timestamp = timestamp;
+            data.position = state(0, 0);
+            data.velocity = state(1, 0);
+            data.isTransmitting = isTransmitting;
+            STATS_START(readStart);
+            PM_LOCK(PM_LOCK_AMP_BURST);
+            data.raw = powerMeter.ampReader.collect(m_side);
+            PM_UNLOCK(PM_LOCK_AMP_BURST);
+            STATS_END(m_side == SIDE_LEFT ? STAT_AMP_READ_LEFT : STAT_AMP_READ_RIGHT, readStart);
 
             // Enable interrupts again
-            attachInterrupt(digitalPinToInterrupt(m_pinDout), m_irq, FALLING);
+            rearm();
 
             // Handle the data. Either perform offset calibration or use the data.
-            if (m_offsetSteps == 0)
+            if (processReading(data) && decimate(data))
             {
-                // No offset compensation. Proceed as normal.
-                processData(timestamp, state, raw, isTransmitting);
-            }
-            else
-            {
-                // Offset compensation mode.
-                taskENTER_CRITICAL(&spinlock);
-                config.strain[m_side].offset += raw / OFFSET_COMPENSATION_SAMPLES;
-                m_offsetSteps--;
-                taskEXIT_CRITICAL(&spinlock);
-
-                m_updateAveragePower(timestamp);
+                connectionBasePtr->addHighSpeed(data, m_side);
             }
         }
         else
         {
-            // No data. Don't calculate the energy, check and send a rotation notification if needed to allow low speed
-            // data to be sent in the event that one side dies.
-
-            // Enable interrupts again just in case something recovers.
-            attachInterrupt(digitalPinToInterrupt(m_pinDout), m_irq, FALLING);
+            // No data. Enable interrupts again just in case something recovers.
+            rearm();
+            processMissing();
+        }
+    }
+}
 
-            m_updateAveragePower(micros()); // We don't have the time the interrupt occured to use, so just do now as
-            // close enough.
+bool Side::processReading(HighSpeedData &data)
+{
+    if (m_offsetSteps != 0)
+    {
+        // Offset compensation mode.
+        taskENTER_CRITICAL(&m_offsetSpinlock);
+        m_offsetSum += data.raw / OFFSET_COMPENSATION_SAMPLES;
+        m_offsetSteps--;
+        const bool finished = m_offsetSteps == 0;
+        const uint32_t offset = m_offsetSum;
+        taskEXIT_CRITICAL(&m_offsetSpinlock);
+
+        if (finished)
+        {
+            // Publish the new offset. Torque is calculated using it from the next reading.
+            config.setStrainOffset(m_side, offset);
         }
+
+        m_updateAveragePower(data.timestamp, 0);
+        return false;
     }
+
+    // No offset compensation. Proceed as normal.
+    data.torque = m_calculateTorque(data.raw, tempSensor.getLastTemp());
+
+    // The rotation most likely occurred before this reading, so calculate average power for the previous rotation. The
+    // gap between the last reading and this one is split at the rotation.
+    m_updateAveragePower(data.timestamp, data.velocity * data.torque);
+
+    // Accumulate the torque profile and energy
+    m_accumulator.add(data);
+    return true;
 }
 
-inline void Side::processData(uint32_t timestamp, Matrix<2, 1, float> state, uint32_t raw, bool isTransmitting)
+bool Side::decimate(HighSpeedData &data)
 {
-    // Create the object and copy main parameters
-    HighSpeedData data;
-    data.timestamp = timestamp;
-    data.position = state(0, 0);
-    data.velocity = state(1, 0);
-    data.raw = raw;
+    m_decimator.configure(1000000 / AMP_SAMPLE_PERIOD, config.highSpeedRate);
+    return m_decimator.add(data, data);
+}
 
-    // Finish calculating and send raw to where it needs to go.
-    data.torque = m_calculateTorque(raw, tempSensor.getLastTemp());
-    data.isTransmitting = isTransmitting;
-    connectionBasePtr->addHighSpeed(data, m_side);
+void Side::processMissing()
+{
+    // Don't calculate the energy, check and send a rotation notification if needed. We don't have the time the
+    // interrupt occured to use, so just do now as close enough.
+    m_updateAveragePower(micros(), 0);
+}
 
-    // The rotation most likely occurred before this reading, so calculate average power for the previous rotation and
-    // use this reading as the first in the next rotation.
-    m_updateAveragePower(data.timestamp);
+inline void Side::rearm()
+{
+    attachInterrupt(digitalPinToInterrupt(m_pinDout), m_irq, FALLING);
+}
 
-    // Accumulate energy
-    m_energy += data.velocity * data.torque * (data.timestamp - m_lastTime) * 1e-6;
-    m_lastTime = data.timestamp;
+inline void Side::disarm()
+{
+    detachInterrupt(digitalPinToInterrupt(m_pinDout));
 }
 
 inline void Side::enableADCOffsetCalibration()
 {
-    m_adcOffsetCalibration = true;
+    powerMeter.ampReader.enableOffsetCalibration(m_side);
 }
 
 inline void Side::enableStrainOffsetCalibration()
 {
     enableADCOffsetCalibration();
-    taskENTER_CRITICAL(&spinlock);
+    taskENTER_CRITICAL(&m_offsetSpinlock);
     m_offsetSteps = OFFSET_COMPENSATION_SAMPLES;
-    config.strain[m_side].offset = 0; // Reset the offset.
-    taskEXIT_CRITICAL(&spinlock);
+    m_offsetSum = 0;
+    taskEXIT_CRITICAL(&m_offsetSpinlock);
 }
 
 inline void Side::startAmp()
 {
     enableADCOffsetCalibration();
-    attachInterrupt(digitalPinToInterrupt(m_pinDout), m_irq, FALLING);
+    rearm();
 }
 
-inline uint32_t Side::m_readADC()
+float Side::m_calculateTorque(uint32_t raw, float temperature)
 {
-    // Start reading
-    uint32_t raw = 0;
-    uint8_t clockBits = 24;
-    if (m_adcOffsetCalibration)
-    {
-        // Add 2 additional clock pulses to enter offset calibrarion mode.
-        clockBits = 26;
-    }
-
-    // Main reading loop
-    for (uint8_t i = 0; i < clockBits; i++)
+    if (Config::calibrationVersion() != m_conversionVersion || temperature != m_conversionTemp)
     {
-        // Read 1 bit
-        digitalWrite(m_pinSclk, HIGH);
-        delayMicroseconds(1);
-        raw = (raw << 1) | digitalRead(m_pinDout);
-        digitalWrite(m_pinSclk, LOW);
-        delayMicroseconds(1);
+        // Config updates from other tasks publish a new snapshot rather than changing this one.
+        CalibrationReader calibration;
+        const StrainConf &conf = calibration->strain[m_side];
+
+        // Don't compensate until the first temperature reading.
+        const float compensateTemp = temperature == INVALID_TEMPERATURE ? conf.tempTest : temperature;
+        m_conversion = makeTorqueConversion(conf.offset, conf.coefficient, conf.tempCoefficient,
+                                            conf.tempCoefficient2, conf.tempTest, compensateTemp);
+        m_conversionVersion = calibration->version;
+        m_conversionTemp = temperature;
     }
-
-    // Send the contents of raw somewhere as needed.
-    if (m_adcOffsetCalibration)
-    {
-        // Remove the extra 2 bits
-        raw >>= 2;
-        m_adcOffsetCalibration = false; // Disable automatically.
-    }
-    return raw;
-}
-
-float Side::m_calculateTorque(uint32_t raw, float temperature)
-{
-    StrainConf &conf = config.strain[m_side];
-    // There is a relatively linear relationship between the raw value and the torque.
-    int32_t difference = raw - conf.offset;
-    float torque = difference * conf.coefficient;
-
-    // Thermal compensation. // TODO: In the strain gauge datasheet, this looks like it may be quadratic?
-    torque *= (1 - conf.tempCoefficient * (temperature - conf.tempTest));
-    return torque;
+    return applyTorqueConversion(raw, m_conversion);
 }
 
-void Side::m_updateAveragePower(uint32_t timestamp)
+void Side::m_updateAveragePower(uint32_t timestamp, float power)
 {
     // Check if a full rotation occurred.
-    if (powerMeter.imuManager.rotations != m_lastRotation)
+    uint32_t rotations, rotationTime;
+    powerMeter.imuManager.getLastRotation(rotations, rotationTime);
+    TorqueProfile profile;
+    if (m_accumulator.update(timestamp, power, rotations, rotationTime, config.profileBins, profile))
     {
-        // Rotation has occurred, calculate average power and reset accumulator.
-        m_lastRotation = powerMeter.imuManager.rotations;
+        // This variable will remain set until the next rotation.
+        averagePower = m_accumulator.averagePower();
 
-        // Calculate the average power over the rotation, aligned to the sample rate. This variable will remain
-        // set until the next rotation.
-        averagePower = m_energy / (timestamp - m_segStartTime) * 1e6;
-        m_segStartTime = timestamp;
-
-        // Reset accumulator.
-        m_energy = 0;
+        // Send the torque profile for the previous rotation if it has any samples.
+        if (profile.binCount)
+        {
+            connectionBasePtr->addProfile(profile, m_side);
+        }
 
         // Send the notification.
         xTaskNotify(lowSpeedTaskHandle, (2 << m_side), eSetBits);
@@ -208,6 +201,14 @@ void taskAmp(void *pvParameters)
     side->readDataTask();
 }
 
+#ifdef AMP_SYNCHRONISED
+void taskAmpPaired(void *pvParameters)
+{
+    PowerMeter *meter = (PowerMeter *)pvParameters;
+    meter->readPairedTask();
+}
+#endif
+
 template <EnumSide sideEnum, uint8_t pinDout>
 void irqAmp()
 {
@@ -217,10 +218,17 @@ void irqAmp()
 
     // Disable this interrupt being called again until the data is retrieved.
     detachInterrupt(digitalPinToInterrupt(pinDout));
+    uint32_t time = micros();
+    powerMeter.ampReader.setReadyFromISR(sideEnum, time);
 
     // Give the notification and perform a context switch if necessary.
-    uint32_t time = micros();
+    STATS_MARK(powerMeter.sides[sideEnum].irqCycles);
+#ifdef AMP_SYNCHRONISED
+    // Both sides notify the same task, so the notification says which side is ready and the reader keeps the time.
+    xTaskNotifyFromISR(powerMeter.sides[sideEnum].taskHandle, bit(sideEnum), eSetBits, &xHigherPriorityTaskWoken);
+#else
     xTaskNotifyFromISR(powerMeter.sides[sideEnum].taskHandle, time, eSetValueWithOverwrite, &xHigherPriorityTaskWoken);
+#endif
     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
@@ -271,6 +279,7 @@ void LEDs::setImpendingSleep()
 void LEDs::run()
 {
     m_taskExists = true;
+    taskStarted(TASK_LED);
     while (true)
     {
         if (m_sleepPending)
@@ -323,17 +332,14 @@ void LEDs::powerDown()
 #endif
 
     // I2C
-    powerMeter.sides[SIDE_LEFT].tempSensor.setLED(false);
-    powerMeter.sides[SIDE_RIGHT].tempSensor.setLED(false);
+    powerMeter.i2cManager.setLEDs(false);
 }
 
 void LEDs::m_cycleConnConnecting1()
 {
-    powerMeter.sides[SIDE_LEFT].tempSensor.setLED(true);
-    powerMeter.sides[SIDE_RIGHT].tempSensor.setLED(true);
+    powerMeter.i2cManager.setLEDs(true);
     NOTIFY_DELAY_RETURN(100);
-    powerMeter.sides[SIDE_LEFT].tempSensor.setLED(false);
-    powerMeter.sides[SIDE_RIGHT].tempSensor.setLED(false);
+    powerMeter.i2cManager.setLEDs(false);
     NOTIFY_DELAY_RETURN(400);
 #ifdef HAS_BLUE_LED
     digitalWrite(PIN_LEDB, HIGH);
@@ -351,11 +357,9 @@ void LEDs::m_cycleConnConnecting1()
 
 void LEDs::m_cycleConnConnecting2()
 {
-    powerMeter.sides[SIDE_LEFT].tempSensor.setLED(true);
-    powerMeter.sides[SIDE_RIGHT].tempSensor.setLED(true);
+    powerMeter.i2cManager.setLEDs(true);
     NOTIFY_DELAY_RETURN(100);
-    powerMeter.sides[SIDE_LEFT].tempSensor.setLED(false);
-    powerMeter.sides[SIDE_RIGHT].tempSensor.setLED(false);
+    powerMeter.i2cManager.setLEDs(false);
     NOTIFY_DELAY_RETURN(100);
     digitalWrite(PIN_LEDG, HIGH);
     NOTIFY_DELAY_RETURN(50);
@@ -371,8 +375,7 @@ void taskLED(void *pvParameters)
     // digitalWrite(PIN_LEDR, HIGH);
     // digitalWrite(PIN_LEDB, HIGH);
     // digitalWrite(PIN_LEDG, HIGH);
-    // powerMeter.sides[SIDE_RIGHT].tempSensor.setLED(true);
-    // powerMeter.sides[SIDE_LEFT].tempSensor.setLED(true);
+    // powerMeter.i2cManager.setLEDs(true);
     // while (true)
     // {
     //     delay(1000);
@@ -381,8 +384,7 @@ void taskLED(void *pvParameters)
     // digitalWrite(PIN_LEDR, LOW);
     // digitalWrite(PIN_LEDB, LOW);
     // digitalWrite(PIN_LEDG, LOW);
-    // powerMeter.sides[SIDE_RIGHT].tempSensor.setLED(false);
-    // powerMeter.sides[SIDE_LEFT].tempSensor.setLED(false);
+    // powerMeter.i2cManager.setLEDs(false);
     // while (true)
     // {
     //     delay(1000);
@@ -392,26 +394,238 @@ void taskLED(void *pvParameters)
 void PowerMeter::begin()
 {
     LOGD("Power", "Starting hardware");
-    // Initialise I2C for the temperature sensors
-    Wire.begin(PIN_I2C_SDA, PIN_I2C_SCL, I2C_BUS_FREQ);
-
-    // Initialise the strain gauges
-    sides[SIDE_LEFT].begin();
-    sides[SIDE_RIGHT].begin();
+    // Initialise I2C for the temperature sensors. From here on, only the I2C task talks to them.
+    i2cManager.begin();
 
     // Start the LEDs now the temperature sensors and their attached LEDs are started.
     leds.begin();
 
     // Initialise the IMU
     imuManager.begin();
+
+    // The IMU may have restored the rotation count from before sleeping, so don't count it as a finished rotation.
+    uint32_t rotations, rotationTime;
+    imuManager.getLastRotation(rotations, rotationTime);
+    sides[SIDE_LEFT].restoreRotation(rotations);
+    sides[SIDE_RIGHT].restoreRotation(rotations);
+}
+
+void PowerMeter::createAmpTasks()
+{
+#ifdef AMP_SYNCHRONISED
+    createTask(TASK_AMP_PAIRED, taskAmpPaired, this, &sides[SIDE_LEFT].taskHandle);
+    sides[SIDE_RIGHT].taskHandle = sides[SIDE_LEFT].taskHandle;
+#else
+    sides[SIDE_LEFT].createDataTask(SIDE_LEFT);
+    sides[SIDE_RIGHT].createDataTask(SIDE_RIGHT);
+#endif
+}
+
+#ifdef AMP_SYNCHRONISED
+#define AMP_BOTH_SIDES (bit(SIDE_LEFT) | bit(SIDE_RIGHT))
+
+/**
+ * @brief Records the interrupt latency of each side that has just notified the paired task.
+ *
+ */
+static inline void recordPairLatency(uint32_t sideMask)
+{
+    if (sideMask & bit(SIDE_LEFT))
+    {
+        STATS_END(STAT_AMP_LATENCY_LEFT, powerMeter.sides[SIDE_LEFT].irqCycles);
+    }
+    if (sideMask & bit(SIDE_RIGHT))
+    {
+        STATS_END(STAT_AMP_LATENCY_RIGHT, powerMeter.sides[SIDE_RIGHT].irqCycles);
+    }
 }
 
+void PowerMeter::readPairedTask()
+{
+    LOGI("AMP", "Starting to read both sides as pairs");
+    uint32_t lastTimestamp = micros();
+    uint32_t lastRealign = millis();
+    taskStarted(TASK_AMP_PAIRED);
+    while (true)
+    {
+        // Wait for the first side. Light sleep is allowed until shortly before the next pair is due.
+        uint32_t ready = 0;
+        uint32_t bits;
+        if (PM_WAIT_FOR_INTERRUPT(bits, lastTimestamp, AMP_SAMPLE_PERIOD, pdMS_TO_TICKS(100), PM_LOCK_AMP_LEFT))
+        {
+            recordPairLatency(bits);
+            ready = bits & AMP_BOTH_SIDES;
+        }
+
+        // Wait for the other side, staying awake as it is due any moment.
+        if (ready && ready != AMP_BOTH_SIDES)
+        {
+            PM_LOCK(PM_LOCK_AMP_RIGHT);
+            if (xTaskNotifyWait(0, 0xffffffff, &bits, pdMS_TO_TICKS(AMP_PAIR_TIMEOUT / 1000)))
+            {
+                recordPairLatency(bits);
+                ready |= bits & AMP_BOTH_SIDES;
+            }
+            PM_UNLOCK(PM_LOCK_AMP_RIGHT);
+        }
+        const bool isTransmitting = connectionBasePtr->isTransmitting;
+
+        if (!ready)
+        {
+            // No data from either side.
+            for (uint8_t side = SIDE_LEFT; side <= SIDE_RIGHT; side++)
+            {
+                sides[side].rearm();
+                sides[side].processMissing();
+            }
+            continue;
+        }
+
+        // Use the midpoint of the two interrupts, or the time of the only one.
+        const uint32_t leftTime = ampReader.readyTime(SIDE_LEFT);
+        const uint32_t rightTime = ampReader.readyTime(SIDE_RIGHT);
+        uint32_t timestamp;
+        bool realign = false;
+        if (ready == AMP_BOTH_SIDES)
+        {
+            timestamp = leftTime + (int32_t)(rightTime - leftTime) / 2;
+            const uint32_t skew = abs((int32_t)(rightTime - leftTime));
+            STATS_RECORD(STAT_AMP_SKEW, skew);
+            realign = skew > AMP_REALIGN_SKEW;
+        }
+        else
+        {
+            timestamp = ready == bit(SIDE_LEFT) ? leftTime : rightTime;
+        }
+        lastTimestamp = timestamp;
+
+        // One prediction and one burst for both sides.
+        Matrix<2, 1, float> state;
+        imuManager.kalman.predict(timestamp, state);
+        PairedHighSpeedData paired;
+        paired.timestamp = timestamp;
+        paired.position = state(0, 0);
+        paired.velocity = state(1, 0);
+        paired.isTransmitting = isTransmitting;
+        STATS_START(readStart);
+        PM_LOCK(PM_LOCK_AMP_BURST);
+        for (uint8_t side = SIDE_LEFT; side <= SIDE_RIGHT; side++)
+        {
+            if (ready & bit(side))
+            {
+                // The first collect() reads both sides if both are ready.
+                paired.raw[side] = ampReader.collect((EnumSide)side);
+            }
+        }
+        PM_UNLOCK(PM_LOCK_AMP_BURST);
+        STATS_END(STAT_AMP_READ_PAIRED, readStart);
+
+        // Handle each side. Either perform offset calibration or use the data. While both sides keep arriving, their
+        // decimators stay in step so the filtered records are still pairs.
+        bool send[2] = {false, false};
+        bool filtered[2] = {false, false};
+        HighSpeedData data[2];
+        for (uint8_t side = SIDE_LEFT; side <= SIDE_RIGHT; side++)
+        {
+            sides[side].rearm();
+            if (ready & bit(side))
+            {
+                data[side] = paired.side((EnumSide)side);
+                if (sides[side].processReading(data[side]))
+                {
+                    filtered[side] = true;
+                    send[side] = sides[side].decimate(data[side]);
+                }
+            }
+            else
+            {
+                sides[side].processMissing();
+            }
+        }
+
+        // A side that missed a reading or used it for offset compensation is no longer in step with the other side and
+        // its outputs would never line up again. Start both filters together from the next pair.
+        if (filtered[SIDE_LEFT] != filtered[SIDE_RIGHT])
+        {
+            sides[SIDE_LEFT].resetDecimator();
+            sides[SIDE_RIGHT].resetDecimator();
+        }
+
+        if (send[SIDE_LEFT] && send[SIDE_RIGHT])
+        {
+            paired.timestamp = data[SIDE_LEFT].timestamp;
+            paired.position = data[SIDE_LEFT].position;
+            paired.velocity = data[SIDE_LEFT].velocity;
+            for (uint8_t side = SIDE_LEFT; side <= SIDE_RIGHT; side++)
+            {
+                paired.raw[side] = data[side].raw;
+                paired.torque[side] = data[side].torque;
+            }
+            connectionBasePtr->addPairedHighSpeed(paired);
+        }
+        else
+        {
+            for (uint8_t side = SIDE_LEFT; side <= SIDE_RIGHT; side++)
+            {
+                if (send[side])
+                {
+                    connectionBasePtr->addHighSpeed(data[side], (EnumSide)side);
+                }
+            }
+        }
+
+        // The oscillators drift apart. Start both ADCs together again before a pair no longer fits in the wait above
+        // (a side that missed the wait makes the next pair's gap close to a whole period).
+        if (realign && millis() - lastRealign >= AMP_REALIGN_INTERVAL)
+        {
+            LOGD("AMP", "Realigning the amps after a gap of %luus", (uint32_t)abs((int32_t)(rightTime - leftTime)));
+            m_realignAmps();
+            lastRealign = millis();
+        }
+    }
+}
+
+void PowerMeter::m_realignAmps()
+{
+    for (uint8_t side = SIDE_LEFT; side <= SIDE_RIGHT; side++)
+    {
+        sides[side].disarm();
+    }
+    m_resetAmps();
+
+    // Anything that was ready before the reset can't be read now. Only re-arm the interrupts, as recalibrating the
+    // ADC offsets with startAmp() would drop around 100ms of readings every time the amps are realigned.
+    ampReader.clearReady();
+    xTaskNotifyStateClear(NULL);
+    ulTaskNotifyValueClear(NULL, AMP_BOTH_SIDES);
+    for (uint8_t side = SIDE_LEFT; side <= SIDE_RIGHT; side++)
+    {
+        sides[side].rearm();
+    }
+}
+#endif
+
 void PowerMeter::powerDown()
 {
     LOGI("Power", "Power down");
     digitalWrite(PIN_AMP_PWDN, LOW);
     digitalWrite(PIN_POWER_SAVE, LOW);
+    i2cManager.setSampling(false);
     leds.powerDown();
+    if (!i2cManager.flush(pdMS_TO_TICKS(100)))
+    {
+        LOGW("Power", "Timed out waiting for the I2C task");
+    }
+}
+
+void PowerMeter::m_resetAmps()
+{
+    // Reset sequence specified in the ADS1232 datasheet.
+    digitalWrite(PIN_AMP_PWDN, HIGH);
+    delayMicroseconds(26);
+    digitalWrite(PIN_AMP_PWDN, LOW);
+    delayMicroseconds(26);
+    digitalWrite(PIN_AMP_PWDN, HIGH);
 }
 
 void PowerMeter::powerUp()
@@ -419,13 +633,14 @@ void PowerMeter::powerUp()
     LOGI("Power", "Power up");
     // Set pin modes. // TODO: OOP
     pinMode(PIN_POWER_SAVE, OUTPUT);
-    pinMode(PIN_AMP1_SCLK, OUTPUT);
-    pinMode(PIN_AMP2_SCLK, OUTPUT);
     pinMode(PIN_AMP_PWDN, OUTPUT);
     pinMode(PIN_AMP1_DOUT, INPUT);
     pinMode(PIN_AMP2_DOUT, INPUT);
     pinMode(PIN_ACCEL_INTERRUPT, INPUT);
 
+    // Clock pins are set up by the reader. This runs on the same core as the amp tasks, as required by the reader.
+    ampReader.begin();
+
     // pinMode(PIN_LEDR, OUTPUT);
     // pinMode(PIN_LEDG, OUTPUT);
 
@@ -433,12 +648,7 @@ void PowerMeter::powerUp()
     digitalWrite(PIN_POWER_SAVE, HIGH); // Turn on the strain gauges.
     delay(5);                           // Way longer than required, but should let the reference and strain gauge voltages settle.
 
-    // Reset sequence specified in the ADS1232 datasheet.
-    digitalWrite(PIN_AMP_PWDN, HIGH);
-    delayMicroseconds(26);
-    digitalWrite(PIN_AMP_PWDN, LOW);
-    delayMicroseconds(26);
-    digitalWrite(PIN_AMP_PWDN, HIGH);
+    m_resetAmps();
 
     // Enable interrupts for the amplifiers
     sides[SIDE_LEFT].startAmp();
@@ -446,6 +656,11 @@ void PowerMeter::powerUp()
 
     // Start the IMU
     imuManager.startEstimating();
+
+    // Keep the temperatures used for compensation up to date. Waiting for the first sample means the first
+    // housekeeping message has real temperatures.
+    i2cManager.setSampling(true);
+    i2cManager.flush(pdMS_TO_TICKS(100));
 }
 
 void PowerMeter::offsetCompensate()
@@ -461,28 +676,40 @@ uint32_t PowerMeter::batteryVoltage()
     return (analogRead(PIN_BATTERY_VOLTAGE) * SUPPLY_VOLTAGE) >> 12;
 }
 
+float PowerMeter::batteryCurrent()
+{
+#ifdef PIN_BATTERY_CURRENT
+    return analogReadMilliVolts(PIN_BATTERY_CURRENT) * BATTERY_CURRENT_SCALE;
+#else
+    return NAN;
+#endif
+}
+
 bool waitLowSpeedNofity(uint32_t timeout)
 {
+    const uint32_t bothSides = (2 << SIDE_LEFT) | (2 << SIDE_RIGHT);
+    const TickType_t start = xTaskGetTickCount();
     uint32_t notifyBits = 0;
-    bool success;
-    do
+    while ((notifyBits & bothSides) != bothSides)
     {
+        // The timeout is from when this was called so that one side notifying doesn't restart it.
+        const TickType_t elapsed = xTaskGetTickCount() - start;
         // Don't clear anything now as we will loop until the bit for each side is set (2 notifications).
-        success = xTaskNotifyWait(0x00, 0x00, &notifyBits, timeout);
-    } while (notifyBits != ((2 << SIDE_LEFT) | (2 << SIDE_RIGHT)) && success);
-
-    // Clear the bits ready for the next notification.
-    if (success)
-    {
-        // No timeouts
-        ulTaskNotifyValueClear(lowSpeedTaskHandle, 0xffffffff);
+        if (elapsed >= timeout || !xTaskNotifyWait(0x00, 0x00, &notifyBits, timeout - elapsed))
+        {
+            return false;
+        }
     }
-    return success;
+
+    // Clear the bits ready for the next notification (only when there were no timeouts).
+    ulTaskNotifyValueClear(lowSpeedTaskHandle, 0xffffffff);
+    return true;
 }
 
 void taskLowSpeed(void *pvParameters)
 {
     LOGI("LS", "Low speed task started");
+    taskStarted(TASK_LOW_SPEED);
     while (true)
     {
         LowSpeedData lowSpeed;
@@ -515,10 +742,17 @@ void taskLowSpeed(void *pvParameters)
 void debugMemory()
 {
     SERIAL_TAKE();
-    log_printf("Free memory: %lu\n", esp_get_free_heap_size());
-    log_printf("  - LS:   %lu\n", uxTaskGetStackHighWaterMark(lowSpeedTaskHandle));
-    log_printf("  - IMU:  %lu\n", uxTaskGetStackHighWaterMark(imuTaskHandle));
-    log_printf("  - Conn: %lu\n", uxTaskGetStackHighWaterMark(connectionTaskHandle));
-    log_printf("  - This: %lu\n", uxTaskGetStackHighWaterMark(NULL));
+    log_printf("Free memory: %lu (lowest %lu)\n", esp_get_free_heap_size(), esp_get_minimum_free_heap_size());
+    log_printf("Connection arena: %u of %u bytes\n", Connection::arena().used(), Connection::arena().capacity());
+    log_printf("Stack headroom (of %lu bytes reserved):\n", taskStackTotal());
+    for (uint8_t i = 0; i < TASK_COUNT; i++)
+    {
+        uint32_t headroom;
+        if (taskStackHeadroom((EnumTask)i, headroom))
+        {
+            log_printf("  - %-10s %5lu of %lu\n", taskName((EnumTask)i), headroom, taskStackSize((EnumTask)i));
+        }
+    }
+    log_printf("  - This:      %5lu\n", uxTaskGetStackHighWaterMark(NULL));
     SERIAL_GIVE();
 }
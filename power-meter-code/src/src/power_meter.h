@@ -4,14 +4,19 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-28
+ * @date 2026-10-14
  */
 #pragma once
 
 #include "../defines.h"
 #include "imu.h"
 #include "temperature.h"
+#include "i2c_manager.h"
 #include "data_points.h"
+#include "amp_reader.h"
+#include "stats.h"
+#include "pipeline.h"
+#include "decimator.h"
 
 /**
  * @brief Class for interfacing with a single strain gauge and temperature sensor.
@@ -23,20 +28,15 @@ public:
     /**
      * @brief Construct a new Strain Gauge object.
      *
+     * The clock pin is managed by `AmpReader` so that both sides can be read at the same time.
+     *
      * @param pinDout the data out / data ready pin to use (input).
-     * @param pinSclk the clock pin to use (output).
      * @param irqAmp the interrupt handler to use when more data is available from the ADC.
      * @param i2cAddress the I2C address of the temperature sensor on this side, set by physical jumpers / solder
      *                   bridges.
      */
-    Side(const EnumSide side, const uint8_t pinDout, const uint8_t pinSclk, void (*irqAmp)(), const uint8_t i2cAddress)
-        : m_side(side), m_pinDout(pinDout), m_pinSclk(pinSclk), m_irq(irqAmp), tempSensor(i2cAddress) {}
-
-    /**
-     * @brief Initialises the hardware specific to the side.
-     *
-     */
-    void begin();
+    Side(const EnumSide side, const uint8_t pinDout, void (*irqAmp)(), const uint8_t i2cAddress)
+        : m_side(side), m_pinDout(pinDout), m_irq(irqAmp), tempSensor(i2cAddress) {}
 
     /**
      * @brief Creates a freeRTOS task to handle data input from the ADC.
@@ -54,15 +54,58 @@ public:
 
     /**
      * @brief Handles a raw data point.
-     * 
-     * Calculates the torque, sends high speed data and sums energy to calculate average power.
-     * 
-     * @param timestamp the timestamp in microseconds.
-     * @param position the angle and velocity.
-     * @param raw the raw value from the ADC.
-     * @param isTransmitting whether the MCU was transmitting / performing activities that could affect the reading.
+     *
+     * If offset compensation is running, the reading is used for that. Otherwise calculates the torque and sums
+     * energy to calculate average power. The caller sends the data.
+     *
+     * @param data the reading with everything but the torque filled in. The torque is written to this.
+     * @return true if the data should be sent.
+     * @return false if the reading was used for offset compensation.
+     */
+    bool processReading(HighSpeedData &data);
+
+    /**
+     * @brief Filters and decimates a processed reading down to the configured high speed output rate.
+     *
+     * @param data the reading from `processReading()`. This is replaced by the filtered record when one is ready.
+     * @return true if `data` should be sent.
+     * @return false if the reading was only added to the filter.
+     */
+    bool decimate(HighSpeedData &data);
+
+    /**
+     * @brief Starts the decimation filter again from the next reading.
+     *
+     */
+    void resetDecimator() { m_decimator.reset(); }
+
+    /**
+     * @brief Handles a sample period where no reading arrived.
+     *
+     * Low speed data still needs to be sent in the event that one side dies, so this checks whether a rotation
+     * notification is needed.
+     *
      */
-    void processData(uint32_t timestamp, Matrix<2, 1, float> position, uint32_t raw, bool isTransmitting);
+    void processMissing();
+
+    /**
+     * @brief Enables the data ready interrupt again once the reading has been collected.
+     *
+     */
+    void rearm();
+
+    /**
+     * @brief Seeds the power accumulator with the rotation count restored after a fast wake.
+     *
+     * @param rotations the restored rotation count.
+     */
+    void restoreRotation(uint32_t rotations) { m_accumulator.restoreRotation(rotations); }
+
+    /**
+     * @brief Stops the data ready interrupt until `rearm()` is called.
+     *
+     */
+    void disarm();
 
     /**
      * @brief Tells the ADC to perform offset calibration the next time data is read.
@@ -87,7 +130,8 @@ public:
     void startAmp();
 
     /**
-     * @brief The temperature sensor used for temperature compensation on this side.
+     * @brief The temperature sensor used for temperature compensation on this side. This is only accessed over I2C by
+     * the `I2CManager`, other tasks should only call `getLastTemp()`.
      *
      */
     TempSensor tempSensor;
@@ -98,47 +142,54 @@ public:
      */
     TaskHandle_t taskHandle;
 
-    float averagePower; // The average power for the previous rotation.
-private:
+#ifdef STATS_ENABLE
     /**
-     * @brief Pins specific to this amplifier.
+     * @brief Cycle count when the data ready interrupt occurred.
      *
      */
-    const uint8_t m_pinDout, m_pinSclk;
+    volatile uint32_t irqCycles;
+#endif
 
+    float averagePower; // The average power for the previous rotation.
+private:
     /**
-     * @brief Reads the ADC.
-     * Note that there is a short window to call this in between samples - only call this in the interrupt /
-     * notification task.
-     * @return uint32_t the raw value.
+     * @brief Data ready pin specific to this amplifier.
+     *
      */
-    uint32_t m_readADC();
+    const uint8_t m_pinDout;
 
     /**
      * @brief Handles a new raw data point.
      *
+     * The conversion is only worked out again when the calibration or temperature has changed.
+     *
      * @param raw the reading to convert to a torque.
      * @param temperature the temperature of the gauges.
      */
     float m_calculateTorque(uint32_t raw, float temperature);
 
     /**
-     * @brief If this is the first reading in a new rotation, update the average power.
-     * 
-     * @param timestamp 
+     * @brief The conversion from raw readings to torque, and the calibration version and temperature it is for.
+     *
      */
-    void m_updateAveragePower(uint32_t timestamp);
+    TorqueConversion m_conversion;
+    uint32_t m_conversionVersion = 0;
+    float m_conversionTemp = NAN; // Never equal to a temperature, so the first reading calculates the conversion.
 
-    bool m_adcOffsetCalibration = false;
+    /**
+     * @brief If this is the first reading in a new rotation, update the average power.
+     *
+     * @param timestamp the time of the reading about to be accumulated, or now if there isn't one.
+     * @param power the power of that reading, or 0 if there isn't one.
+     */
+    void m_updateAveragePower(uint32_t timestamp, float power);
 
     const EnumSide m_side;
 
     void (*m_irq)();
 
-    // Variables for accumulating energy
-    uint32_t m_lastTime, m_segStartTime; // Time that the last sample occurred and time that the current period started.
-    float m_energy; // Accumulator for the energy.
-    uint32_t m_lastRotation; // What the last rotation was on.
+    PowerAccumulator m_accumulator; // Energy and torque profile for the current rotation.
+    Decimator<HighSpeedData> m_decimator; // Anti-aliasing before sending (only changes the data that is sent).
 
     /**
      * @brief Number of samples remaining to complete offset compensation.
@@ -147,6 +198,19 @@ private:
      * 
      */
     uint8_t m_offsetSteps = 0;
+
+    /**
+     * @brief Sum of the readings (each divided by OFFSET_COMPENSATION_SAMPLES) so far in offset compensation. This is
+     * published as the new offset once finished.
+     *
+     */
+    uint32_t m_offsetSum = 0;
+
+    /**
+     * @brief Protects the offset sum and offset compensation steps for this side.
+     *
+     */
+    portMUX_TYPE m_offsetSpinlock = portMUX_INITIALIZER_UNLOCKED;
 };
 
 /**
@@ -156,6 +220,15 @@ private:
  */
 void taskAmp(void *pvParameters);
 
+#ifdef AMP_SYNCHRONISED
+/**
+ * @brief Task for reading ADC data from both sides as pairs.
+ *
+ * @param pvParameters is a pointer to the power meter.
+ */
+void taskAmpPaired(void *pvParameters);
+#endif
+
 /**
  * @brief Interrupt for when an amplifier / ADC has data.
  *
@@ -246,8 +319,10 @@ public:
      * @brief Construct a new All Strain Gauges object. The left and right strain gauge objects are also initialised.
      *
      */
-    PowerMeter() : sides{Side(SIDE_LEFT, PIN_AMP2_DOUT, PIN_AMP2_SCLK, &irqAmp<SIDE_LEFT, PIN_AMP2_DOUT>, TEMP2_I2C),
-                         Side(SIDE_RIGHT, PIN_AMP1_DOUT, PIN_AMP1_SCLK, &irqAmp<SIDE_RIGHT, PIN_AMP1_DOUT>, TEMP1_I2C)} {}
+    PowerMeter() : sides{Side(SIDE_LEFT, PIN_AMP2_DOUT, &irqAmp<SIDE_LEFT, PIN_AMP2_DOUT>, TEMP2_I2C),
+                         Side(SIDE_RIGHT, PIN_AMP1_DOUT, &irqAmp<SIDE_RIGHT, PIN_AMP1_DOUT>, TEMP1_I2C)},
+                   ampReader(PIN_AMP2_DOUT, PIN_AMP2_SCLK, PIN_AMP1_DOUT, PIN_AMP1_SCLK),
+                   i2cManager(sides[SIDE_LEFT].tempSensor, sides[SIDE_RIGHT].tempSensor) {}
 
     /**
      * @brief Initialises the power meter hardware.
@@ -255,6 +330,29 @@ public:
      */
     void begin();
 
+    /**
+     * @brief Creates the tasks that read the amplifiers. This is a task for each side, or a single task for both with
+     * AMP_SYNCHRONISED.
+     *
+     */
+    void createAmpTasks();
+
+#ifdef AMP_SYNCHRONISED
+    /**
+     * @brief Reads both amplifiers as pairs and runs as the task for both sides.
+     *
+     * Both ADCs are started together by the shared PIN_AMP_PWDN reset, so each one raises data ready at about the same
+     * time each period. Once both have, both are clocked out in a single burst and one prediction at the midpoint of
+     * the two interrupts is used for both sides. The ADCs run from their own oscillators, so the gap between them
+     * drifts over time (see STAT_AMP_SKEW). Once the gap passes AMP_REALIGN_SKEW, both are reset together again. If
+     * one side doesn't have data within AMP_PAIR_TIMEOUT, the other is read alone so that one side failing doesn't
+     * stop the other. This is well under a sample period so the first side's next reading can't replace the one
+     * waiting to be read.
+     *
+     */
+    void readPairedTask();
+#endif
+
     /**
      * @brief Puts the strain gauges, amps and other components into low power mode.
      *
@@ -281,6 +379,13 @@ public:
      */
     uint32_t batteryVoltage();
 
+    /**
+     * @brief Measures the battery current.
+     *
+     * @return float the battery current in mA, or NAN if PIN_BATTERY_CURRENT isn't defined.
+     */
+    float batteryCurrent();
+
     /**
      * @brief Keeps a record of the current orientation and speed.
      *
@@ -293,18 +398,49 @@ public:
      */
     Side sides[2];
 
+    /**
+     * @brief Clocks data out of the ADCs for both sides.
+     *
+     */
+    AmpReader ampReader;
+
+    /**
+     * @brief Owns the I2C bus that the temperature sensors and their LEDs are on.
+     *
+     */
+    I2CManager i2cManager;
+
     /**
      * @brief LEDs on the device.
      * 
      */
     LEDs leds;
+
+private:
+    /**
+     * @brief Pulses the shared PIN_AMP_PWDN pin to reset both ADCs, after which they start converting together.
+     *
+     */
+    void m_resetAmps();
+
+#ifdef AMP_SYNCHRONISED
+    /**
+     * @brief Resets both ADCs from the paired task so their data ready interrupts line up again.
+     *
+     * Readings are missed while the ADCs settle after the reset. Data ready from before the reset is discarded. The ADC
+     * offset calibration is not repeated.
+     *
+     */
+    void m_realignAmps();
+#endif
 };
 
 /**
  * @brief Waits until a full revolution has been completed and both tasks have calculated their average power.
  * 
- * @param timeout the timeout in ticks. As two notifications are expected, the maximum timeout could theoretically be
- *                double this value.
+ * @param timeout the total time to wait for both notifications in ticks.
+ * @return true if both sides notified in time.
+ * @return false if the timeout expired first.
  */
 bool waitLowSpeedNofity(uint32_t timeout);
 
@@ -316,6 +452,6 @@ bool waitLowSpeedNofity(uint32_t timeout);
 void taskLowSpeed(void *pvParameters);
 
 /**
- * @brief Prints memory usage info.
+ * @brief Prints the free heap, connection arena use and the stack headroom of each task.
  */
 void debugMemory();
\ No newline at end of file
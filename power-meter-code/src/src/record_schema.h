@@ -0,0 +1,218 @@
+/**
+ * @file record_schema.h
+ * @brief Wire layouts of the records sent by the power meter, listed once for the firmware and host decoders.
+ *
+ * Each layout is an X-macro that calls `FIELD(name, type, value)` for each field in the order it is sent, where `type`
+ * is the type on the wire and `value` is the expression written when serialising (using the record's members). Fields
+ * in packed records also have a `scale` that the value was multiplied by (see PACKED_*_SCALE).
+ *
+ * The layouts are turned into packed structs, so offsets and sizes are worked out by the compiler. The firmware
+ * serialises records with SCHEMA_SERIALISE() and host code can use the same structs and field lists to decode them (see
+ * `scripts-testing/decoder`). All values are little endian. This file doesn't depend on anything else in the firmware
+ * so that it can be used on its own.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+/**
+ * @brief Formats for high speed packets. The format in use is announced in the about message.
+ *
+ * - Legacy packets are an array of records that contain floats and full timestamps.
+ * - Packed packets start with a header containing the format version, a base timestamp and a base velocity. Each
+ *   record after this contains a 16 bit time delta from the previous record and fixed point values.
+ */
+#define PACKET_FORMAT_LEGACY 0
+#define PACKET_FORMAT_PACKED 1
+
+/**
+ * @brief Version in the header of packed IMU packets, which add the IMU sample rate to the end of the header as the
+ * rate can change with cadence. Strain gauge packets use PACKET_FORMAT_PACKED as the version.
+ *
+ */
+#define PACKED_VERSION_SAMPLE_RATE 2
+
+/**
+ * @brief Formats for low speed messages. The format in use is announced in the about message.
+ *
+ * - JSON messages are human readable, with the cadence calculated on the device.
+ * - Binary messages are the LowSpeedData::toBytes() record, which is also used in the flash log.
+ */
+#define LOW_SPEED_FORMAT_JSON 0
+#define LOW_SPEED_FORMAT_BINARY 1
+
+/**
+ * @brief Scale factors for converting floats to 16 bit fixed point numbers in packed records. The float is multiplied
+ * by the scale factor and rounded when packing.
+ *
+ */
+#define PACKED_ANGLE_SCALE (32767 / M_PI) // Full range is +-pi radians.
+#define PACKED_VELOCITY_SCALE 1000        // mrad/s, +-32 rad/s from the base velocity.
+#define PACKED_TORQUE_SCALE 100           // 0.01 Nm, +-327 Nm.
+#define PACKED_ACCEL_SCALE 500            // 0.002 m/s^2, +-65 m/s^2.
+#define PACKED_GYRO_SCALE 500             // 0.002 rad/s, +-65 rad/s.
+
+/**
+ * @brief Largest time difference between consecutive records that can be represented in a packed packet.
+ *
+ */
+#define PACKED_MAX_DELTA UINT16_MAX
+
+/**
+ * @brief A 24 bit unsigned integer for raw strain gauge readings in packed records.
+ *
+ */
+struct __attribute__((packed)) PackedUInt24
+{
+    uint8_t bytes[3];
+
+    PackedUInt24(uint32_t value = 0) { memcpy(bytes, &value, 3); }
+    operator uint32_t() const { return bytes[0] | (bytes[1] << 8) | ((uint32_t)bytes[2] << 16); }
+};
+
+/**
+ * @brief Low speed record (`/power/power` in binary, flash log and ESP-NOW).
+ *
+ */
+#define LOW_SPEED_SCHEMA(FIELD)                                 \
+    FIELD(timestamp, uint32_t, timestamp)                       \
+    FIELD(rotationCount, uint32_t, rotationCount)               \
+    FIELD(lastRotationDuration, uint32_t, lastRotationDuration) \
+    FIELD(power, float, power)                                  \
+    FIELD(balance, float, balance)                              \
+    FIELD(rotationEvent, uint8_t, rotationEvent)
+
+/**
+ * @brief Fields at the start of every legacy high speed and IMU record.
+ *
+ */
+#define BASE_SCHEMA(FIELD)                \
+    FIELD(timestamp, uint32_t, timestamp) \
+    FIELD(velocity, float, velocity)      \
+    FIELD(position, float, position)
+
+/**
+ * @brief Legacy IMU record.
+ *
+ */
+#define IMU_FIELDS(FIELD)          \
+    FIELD(xAccel, float, xAccel)   \
+    FIELD(yAccel, float, yAccel)   \
+    FIELD(zAccel, float, zAccel)   \
+    FIELD(xGyro, float, xGyro)     \
+    FIELD(yGyro, float, yGyro)     \
+    FIELD(zGyro, float, zGyro)
+#define IMU_SCHEMA(FIELD) BASE_SCHEMA(FIELD) IMU_FIELDS(FIELD)
+
+/**
+ * @brief Legacy strain gauge record.
+ *
+ */
+#define HIGH_SPEED_FIELDS(FIELD)         \
+    FIELD(raw, uint32_t, raw)            \
+    FIELD(torque, float, torque)         \
+    FIELD(power, float, power())         \
+    FIELD(isTransmitting, uint8_t, isTransmitting)
+#define HIGH_SPEED_SCHEMA(FIELD) BASE_SCHEMA(FIELD) HIGH_SPEED_FIELDS(FIELD)
+
+/**
+ * @brief Header of packed strain gauge packets and of packed IMU packets (which also have the sample rate).
+ *
+ */
+#define PACKED_HEADER_SCHEMA(FIELD)                \
+    FIELD(version, uint8_t, PACKET_FORMAT_PACKED)  \
+    FIELD(timestamp, uint32_t, timestamp)          \
+    FIELD(velocity, float, velocity)
+#define PACKED_IMU_HEADER_SCHEMA(FIELD)                  \
+    FIELD(version, uint8_t, PACKED_VERSION_SAMPLE_RATE)  \
+    FIELD(timestamp, uint32_t, timestamp)                \
+    FIELD(velocity, float, velocity)                     \
+    FIELD(sampleRate, uint16_t, sampleRate)
+
+/**
+ * @brief Fields at the start of every packed record. These are relative to the previous record or the header, so
+ * decoders need to handle them specially rather than just dividing by the scale.
+ *
+ */
+#define PACKED_BASE_SCHEMA(FIELD)                                                              \
+    FIELD(delta, uint16_t, (uint16_t)(timestamp - previousTimestamp), 1)                       \
+    FIELD(position, int16_t, toFixed(position, PACKED_ANGLE_SCALE), PACKED_ANGLE_SCALE)        \
+    FIELD(velocity, int16_t, toFixed(velocity - baseVelocity, PACKED_VELOCITY_SCALE), PACKED_VELOCITY_SCALE)
+
+/**
+ * @brief Packed IMU record.
+ *
+ */
+#define PACKED_IMU_FIELDS(FIELD)                                                  \
+    FIELD(xAccel, int16_t, toFixed(xAccel, PACKED_ACCEL_SCALE), PACKED_ACCEL_SCALE) \
+    FIELD(yAccel, int16_t, toFixed(yAccel, PACKED_ACCEL_SCALE), PACKED_ACCEL_SCALE) \
+    FIELD(zAccel, int16_t, toFixed(zAccel, PACKED_ACCEL_SCALE), PACKED_ACCEL_SCALE) \
+    FIELD(xGyro, int16_t, toFixed(xGyro, PACKED_GYRO_SCALE), PACKED_GYRO_SCALE)     \
+    FIELD(yGyro, int16_t, toFixed(yGyro, PACKED_GYRO_SCALE), PACKED_GYRO_SCALE)     \
+    FIELD(zGyro, int16_t, toFixed(zGyro, PACKED_GYRO_SCALE), PACKED_GYRO_SCALE)
+#define PACKED_IMU_SCHEMA(FIELD) PACKED_BASE_SCHEMA(FIELD) PACKED_IMU_FIELDS(FIELD)
+
+/**
+ * @brief Packed strain gauge record. Power isn't sent as it can be calculated from the torque and velocity.
+ *
+ */
+#define PACKED_HIGH_SPEED_FIELDS(FIELD)                                               \
+    FIELD(torque, int16_t, toFixed(torque, PACKED_TORQUE_SCALE), PACKED_TORQUE_SCALE) \
+    FIELD(raw, PackedUInt24, raw, 1)                                                  \
+    FIELD(isTransmitting, uint8_t, isTransmitting, 1)
+#define PACKED_HIGH_SPEED_SCHEMA(FIELD) PACKED_BASE_SCHEMA(FIELD) PACKED_HIGH_SPEED_FIELDS(FIELD)
+
+/**
+ * @brief Turns a schema into a packed struct with a member for each field.
+ *
+ */
+#define SCHEMA_WIRE_FIELD(name, type, ...) type name;
+#define SCHEMA_WIRE_STRUCT(structName, schema) \
+    struct __attribute__((packed)) structName  \
+    {                                          \
+        schema(SCHEMA_WIRE_FIELD)              \
+    }
+
+SCHEMA_WIRE_STRUCT(LowSpeedWire, LOW_SPEED_SCHEMA);
+SCHEMA_WIRE_STRUCT(BaseWire, BASE_SCHEMA);
+SCHEMA_WIRE_STRUCT(IMUWire, IMU_SCHEMA);
+SCHEMA_WIRE_STRUCT(HighSpeedWire, HIGH_SPEED_SCHEMA);
+SCHEMA_WIRE_STRUCT(PackedHeaderWire, PACKED_HEADER_SCHEMA);
+SCHEMA_WIRE_STRUCT(PackedIMUHeaderWire, PACKED_IMU_HEADER_SCHEMA);
+SCHEMA_WIRE_STRUCT(PackedBaseWire, PACKED_BASE_SCHEMA);
+SCHEMA_WIRE_STRUCT(PackedIMUWire, PACKED_IMU_SCHEMA);
+SCHEMA_WIRE_STRUCT(PackedHighSpeedWire, PACKED_HIGH_SPEED_SCHEMA);
+
+// Sizes are part of the protocol (see documents/mqtt_topics.md). If one of these fails, the layout has changed.
+static_assert(sizeof(LowSpeedWire) == 21, "Low speed record layout changed");
+static_assert(sizeof(BaseWire) == 12, "Base record layout changed");
+static_assert(sizeof(IMUWire) == 36, "IMU record layout changed");
+static_assert(sizeof(HighSpeedWire) == 25, "High speed record layout changed");
+static_assert(sizeof(PackedHeaderWire) == 9, "Packed header layout changed");
+static_assert(sizeof(PackedIMUHeaderWire) == 11, "Packed IMU header layout changed");
+static_assert(sizeof(PackedBaseWire) == 6, "Packed base record layout changed");
+static_assert(sizeof(PackedIMUWire) == 18, "Packed IMU record layout changed");
+static_assert(sizeof(PackedHighSpeedWire) == 12, "Packed high speed record layout changed");
+
+/**
+ * @brief Serialises a record using a schema. Use inside a member function of the record so that the values in the
+ * schema can use its members.
+ *
+ * @param wireType the struct made from the schema using SCHEMA_WIRE_STRUCT().
+ * @param schema the schema.
+ * @param buffer the buffer to write to. This needs to be at least `sizeof(wireType)` bytes long.
+ */
+#define SCHEMA_SET_FIELD(name, type, value, ...) wire.name = value;
+#define SCHEMA_SERIALISE(wireType, schema, buffer) \
+    do                                             \
+    {                                              \
+        wireType wire;                             \
+        schema(SCHEMA_SET_FIELD)                   \
+        memcpy(buffer, &wire, sizeof(wire));       \
+    } while (0)
@@ -0,0 +1,102 @@
+/**
+ * @file ring_buffer.cpp
+ * @brief Lock-free single producer, single consumer ring buffer for passing high speed data between tasks.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "ring_buffer.h"
+#include "data_points.h"
+#include <new>
+
+template <typename T>
+bool RingBuffer<T>::begin(uint32_t capacity, void *storage)
+{
+    if (!storage)
+    {
+        return false;
+    }
+    m_items = static_cast<T *>(storage);
+    for (uint32_t i = 0; i < capacity + 1; i++)
+    {
+        new (m_items + i) T;
+    }
+    m_slots = capacity + 1;
+    m_head.store(0);
+    m_tail.store(0);
+    return true;
+}
+
+template <typename T>
+uint32_t RingBuffer<T>::capacity()
+{
+    return m_slots ? m_slots - 1 : 0;
+}
+
+template <typename T>
+bool RingBuffer<T>::push(const T &item)
+{
+    if (!m_slots)
+    {
+        // Not allocated.
+        return false;
+    }
+
+    // Check there is space.
+    const uint32_t head = m_head.load(std::memory_order_relaxed);
+    const uint32_t next = head + 1 == m_slots ? 0 : head + 1;
+    if (next == m_tail.load(std::memory_order_acquire))
+    {
+        // Full.
+        return false;
+    }
+
+    // Copy the record in before publishing it to the consumer.
+    m_items[head] = item;
+    m_head.store(next, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+uint32_t RingBuffer<T>::available()
+{
+    const uint32_t head = m_head.load(std::memory_order_acquire);
+    const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+    return head >= tail ? head - tail : m_slots - tail + head;
+}
+
+template <typename T>
+uint32_t RingBuffer<T>::peek(T *&items, uint32_t count, uint32_t offset)
+{
+    const uint32_t waiting = available();
+    if (offset >= waiting)
+    {
+        // Nothing to give.
+        return 0;
+    }
+    uint32_t start = m_tail.load(std::memory_order_relaxed) + offset;
+    if (start >= m_slots)
+    {
+        start -= m_slots;
+    }
+
+    // Only give records up to the end of the storage so the block is contiguous.
+    const uint32_t contiguous = min(waiting - offset, m_slots - start);
+    items = m_items + start;
+    return min(count, contiguous);
+}
+
+template <typename T>
+void RingBuffer<T>::pop(uint32_t count)
+{
+    uint32_t tail = m_tail.load(std::memory_order_relaxed) + count;
+    if (tail >= m_slots)
+    {
+        tail -= m_slots;
+    }
+    m_tail.store(tail, std::memory_order_release);
+}
+
+template class RingBuffer<HighSpeedData>;
+template class RingBuffer<IMUData>;
@@ -0,0 +1,103 @@
+/**
+ * @file ring_buffer.h
+ * @brief Lock-free single producer, single consumer ring buffer for passing high speed data between tasks.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include "../defines.h"
+#include <atomic>
+
+/**
+ * @brief Ring buffer that passes records from exactly one producer task to exactly one consumer task.
+ *
+ * Unlike a FreeRTOS queue, adding and removing records doesn't take a kernel lock. The consumer can also access
+ * records in place in contiguous blocks rather than copying them out one at a time.
+ *
+ * Only one task may call `push()` and only one (other) task may call `available()`, `peek()` and `pop()`.
+ *
+ * @tparam T is the type of record to store.
+ */
+template <typename T>
+class RingBuffer
+{
+public:
+    /**
+     * @brief Gets the number of bytes of storage needed for a given capacity.
+     *
+     * @param capacity the maximum number of records that can be held at once.
+     * @return constexpr size_t the size of the storage to pass to `begin()`.
+     */
+    static constexpr size_t storageSize(uint32_t capacity) { return (capacity + 1) * sizeof(T); }
+
+    /**
+     * @brief Sets up the buffer in memory provided by the caller.
+     *
+     * @param capacity the maximum number of records that can be held at once.
+     * @param storage at least `storageSize(capacity)` bytes, aligned for `T`. This must outlive the buffer.
+     * @return true the buffer is ready.
+     * @return false no storage was given.
+     */
+    bool begin(uint32_t capacity, void *storage);
+
+    /**
+     * @brief Gets the maximum number of records that can be held at once.
+     *
+     * @return uint32_t the capacity. This is 0 if the buffer has not been allocated.
+     */
+    uint32_t capacity();
+
+    /**
+     * @brief Adds a record to the buffer (producer only).
+     *
+     * @param item the record to copy into the buffer.
+     * @return true the record was added.
+     * @return false the buffer is full or not allocated. The record was dropped.
+     */
+    bool push(const T &item);
+
+    /**
+     * @brief Gets the number of records waiting to be read (consumer only).
+     *
+     * @return uint32_t the number of records.
+     */
+    uint32_t available();
+
+    /**
+     * @brief Gets a contiguous block of the oldest records without removing them (consumer only).
+     *
+     * Fewer records than requested may be given if the block would wrap around the end of the buffer. Call this again
+     * after `pop()` to get the rest.
+     *
+     * @param items is set to point to the oldest record (after skipping `offset` records).
+     * @param count the maximum number of records wanted.
+     * @param offset the number of the oldest records to skip over.
+     * @return uint32_t the number of records that can be read from `items`.
+     */
+    uint32_t peek(T *&items, uint32_t count, uint32_t offset = 0);
+
+    /**
+     * @brief Removes the oldest records once they are no longer needed (consumer only).
+     *
+     * @param count the number of records to remove. This must not be more than `available()`.
+     */
+    void pop(uint32_t count);
+
+private:
+    /**
+     * @brief Storage for the records (not owned). One slot is always left empty to tell a full buffer from an empty
+     * one.
+     *
+     */
+    T *m_items = nullptr;
+    uint32_t m_slots = 0;
+
+    /**
+     * @brief Index of the next slot to write (only changed by the producer) and the next slot to read (only changed
+     * by the consumer).
+     *
+     */
+    std::atomic<uint32_t> m_head{0}, m_tail{0};
+};
@@ -8,7 +8,7 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-10-01
+ * @date 2026-10-14
  */
 #include "states.h"
 extern SemaphoreHandle_t serialMutex;
@@ -18,6 +18,9 @@ extern SemaphoreHandle_t serialMutex;
 extern Connection *connectionBasePtr;
 extern PowerMeter powerMeter;
 extern Config config;
+#include "power_manager.h"
+#include "fast_wake.h"
+extern FastWake fastWake;
 
 #include "soc/rtc_cntl_reg.h"
 
@@ -29,14 +32,18 @@ State *StateActive::enter()
     // Main housekeeping loop
     while (m_isActive())
     {
-        // Populate and send the housekeeping data. Update the temperatures at the same time.
+        // Populate and send the housekeeping data. The temperatures are kept up to date by the I2C task.
         HousekeepingData housekeeping;
-        housekeeping.temperatures[SIDE_LEFT] = powerMeter.sides[SIDE_LEFT].tempSensor.readTemp();
-        housekeeping.temperatures[SIDE_RIGHT] = powerMeter.sides[SIDE_RIGHT].tempSensor.readTemp();
+        housekeeping.temperatures[SIDE_LEFT] = powerMeter.sides[SIDE_LEFT].tempSensor.getLastTemp();
+        housekeeping.temperatures[SIDE_RIGHT] = powerMeter.sides[SIDE_RIGHT].tempSensor.getLastTemp();
         housekeeping.temperatures[SIDE_IMU_TEMP] = powerMeter.imuManager.getLastTemperature();
         housekeeping.battery = powerMeter.batteryVoltage();
-        housekeeping.offsets[SIDE_LEFT] = config.strain[SIDE_LEFT].offset;
-        housekeeping.offsets[SIDE_RIGHT] = config.strain[SIDE_RIGHT].offset;
+        housekeeping.current = powerMeter.batteryCurrent();
+        {
+            CalibrationReader calibration;
+            housekeeping.offsets[SIDE_LEFT] = calibration->strain[SIDE_LEFT].offset;
+            housekeeping.offsets[SIDE_RIGHT] = calibration->strain[SIDE_RIGHT].offset;
+        }
         connectionBasePtr->addHousekeeping(housekeeping);
 
         // Shut down if the battery is flat a certain number of times in a row.
@@ -57,6 +64,9 @@ State *StateActive::enter()
         }
 
         debugMemory();
+#ifdef POWER_MANAGEMENT
+        powerManager.update(); // In case the config was changed.
+#endif
 
         // Delay for ~10s whilst checking UI regularly.
         for (int i = 0; i < 100; i++)
@@ -155,6 +165,15 @@ State *StateSleep::enter()
     delay(2000);
     powerMeter.powerDown();
     LOGD("Sleep", "Going to sleep");
+
+    // Save the filter and rotation count so that waking up can carry on from here.
+    FastWakeFilter filter;
+    filter.state = powerMeter.imuManager.kalman.getState();
+    filter.covariance = powerMeter.imuManager.kalman.getCovariance();
+    uint32_t rotationTime;
+    powerMeter.imuManager.getLastRotation(filter.rotations, rotationTime);
+    fastWake.prepareSleep(filter);
+    config.flush(); // In case the config changed just before sleeping.
 #ifdef ACCEL_RTC_CAPABLE
     esp_sleep_enable_ext0_wakeup((gpio_num_t)PIN_ACCEL_INTERRUPT, HIGH);
 #else
@@ -174,6 +193,7 @@ State *StateFlatBattery::enter()
     powerMeter.imuManager.enableMotion(); // TODO: Shutdown entirely.
     delay(2000);
     powerMeter.powerDown();
+    config.flush();
     LOGD("Flat", "Going to sleep permenantly");
     esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
     esp_deep_sleep_start();
@@ -184,6 +204,7 @@ void reboot(bool dfu)
     LOGW("Reboot", "About to reboot.");
     connectionBasePtr->disable();
     powerMeter.powerDown();
+    config.flush(); // Don't lose a save that is still waiting.
     if (dfu)
     {
         LOGW("Reboot", "Will reboot into DFU mode, reset to exit afterwards.");
@@ -193,19 +214,18 @@ void reboot(bool dfu)
     // Allow plenty of time to shut everything down nicely. Flash the LEDs so it is a bit more obvious.
     for (uint8_t i = 0; i < 25; i++)
     {
-        powerMeter.sides[SIDE_LEFT].tempSensor.setLED(true);
-        powerMeter.sides[SIDE_LEFT].tempSensor.setLED(true);
+        powerMeter.i2cManager.setLEDs(true);
         digitalWrite(PIN_LEDR, HIGH);
         digitalWrite(PIN_LEDG, HIGH);
         delay(100);
-        powerMeter.sides[SIDE_LEFT].tempSensor.setLED(false);
-        powerMeter.sides[SIDE_LEFT].tempSensor.setLED(false);
+        powerMeter.i2cManager.setLEDs(false);
         digitalWrite(PIN_LEDR, LOW);
         digitalWrite(PIN_LEDG, LOW);
         delay(100);
     }
 
     // Enough warning, should be ok to reboot.
+    powerMeter.i2cManager.flush(pdMS_TO_TICKS(100));
     esp_restart();
 }
 
@@ -0,0 +1,80 @@
+/**
+ * @file static_arena.h
+ * @brief Fixed block of memory that buffers are handed out from at startup instead of the heap.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATIC_ARENA_ALIGN 8 // Every allocation starts on a multiple of this many bytes.
+
+/**
+ * @brief Bump allocator over a statically allocated block.
+ *
+ * Memory is only ever handed out, never given back, so this is only meant for buffers that are created once in
+ * `begin()` and last until the next reset. Because the block is linked into `.bss`, its size shows up in the build's
+ * memory report and running out is found at startup (or at compile time using `padded()`) rather than part way
+ * through a ride.
+ *
+ * This isn't thread safe. Only allocate from it during startup.
+ *
+ */
+class StaticArena
+{
+public:
+    /**
+     * @brief Construct a new Static Arena object.
+     *
+     * @param storage the block to hand memory out from. This should be aligned to STATIC_ARENA_ALIGN.
+     * @param size the size of the block in bytes.
+     */
+    constexpr StaticArena(uint8_t *storage, size_t size) : m_storage(storage), m_capacity(size) {}
+
+    /**
+     * @brief Gets the space an allocation takes up in the arena once padded for alignment.
+     *
+     * Add these up in a `static_assert` to check a set of buffers fits at compile time.
+     *
+     * @param size the size requested in bytes.
+     * @return constexpr size_t the size rounded up to a multiple of STATIC_ARENA_ALIGN.
+     */
+    static constexpr size_t padded(size_t size) { return (size + STATIC_ARENA_ALIGN - 1) & ~(size_t)(STATIC_ARENA_ALIGN - 1); }
+
+    /**
+     * @brief Hands out the next block of memory.
+     *
+     * @param size the number of bytes needed.
+     * @return void* the start of the block, or nullptr if there isn't enough left.
+     */
+    void *allocate(size_t size)
+    {
+        if (padded(size) > m_capacity - m_used)
+        {
+            return nullptr;
+        }
+        void *block = m_storage + m_used;
+        m_used += padded(size);
+        return block;
+    }
+
+    /**
+     * @brief Gets the number of bytes handed out so far (including padding).
+     *
+     */
+    size_t used() const { return m_used; }
+
+    /**
+     * @brief Gets the size of the arena in bytes.
+     *
+     */
+    size_t capacity() const { return m_capacity; }
+
+private:
+    uint8_t *m_storage;
+    size_t m_capacity;
+    size_t m_used = 0;
+};
@@ -0,0 +1,58 @@
+/**
+ * @file stats.cpp
+ * @brief Low overhead histograms for timing the hot paths.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "stats.h"
+#include "data_points.h"
+
+// Size of bucket 0 for each stat as a power of 2. Chosen so the interesting range is in the middle buckets.
+#define STATS_SHIFT_CYCLES 7  // 128 cycles (0.5us at 240MHz) up to 2^21 cycles (8.7ms).
+#define STATS_SHIFT_PUBLISH 10 // 1024 cycles (4.3us at 240MHz) up to 2^24 cycles (70ms).
+#define STATS_SHIFT_QUEUE 0    // 1 record up to 2^14 records.
+#define STATS_SHIFT_ERASE 8    // 256us up to 2^22us (4.2s).
+#define STATS_SHIFT_SKEW 0     // 1us up to 2^14us (16ms).
+
+Stats::Stats()
+{
+    for (uint8_t i = 0; i < STAT_COUNT; i++)
+    {
+        m_histograms[i].shift = STATS_SHIFT_CYCLES;
+    }
+    m_histograms[STAT_MQTT_PUBLISH].shift = STATS_SHIFT_PUBLISH;
+    m_histograms[STAT_QUEUE_LEFT].shift = STATS_SHIFT_QUEUE;
+    m_histograms[STAT_QUEUE_RIGHT].shift = STATS_SHIFT_QUEUE;
+    m_histograms[STAT_QUEUE_IMU].shift = STATS_SHIFT_QUEUE;
+    m_histograms[STAT_FLASH_ERASE].shift = STATS_SHIFT_ERASE;
+    m_histograms[STAT_AMP_SKEW].shift = STATS_SHIFT_SKEW;
+}
+
+void Stats::toBytes(uint8_t *buffer)
+{
+    // Header
+    const uint8_t version = STATS_FORMAT_VERSION;
+    const uint32_t time = millis();
+    const uint16_t cpuFrequency = getCpuFrequencyMhz();
+    const uint8_t histogramCount = STAT_COUNT;
+    const uint8_t bucketCount = STATS_BUCKETS;
+    ADD_TO_BYTES(version, buffer, 0);
+    ADD_TO_BYTES(time, buffer, 1);
+    ADD_TO_BYTES(cpuFrequency, buffer, 5);
+    ADD_TO_BYTES(histogramCount, buffer, 7);
+    ADD_TO_BYTES(bucketCount, buffer, 8);
+
+    // Each histogram
+    uint8_t *histogramBuffer = buffer + STATS_HEADER_SIZE;
+    for (uint8_t i = 0; i < STAT_COUNT; i++)
+    {
+        const Histogram &histogram = m_histograms[i];
+        ADD_TO_BYTES(histogram.shift, histogramBuffer, 0);
+        ADD_TO_BYTES(histogram.count, histogramBuffer, 1);
+        ADD_TO_BYTES(histogram.max, histogramBuffer, 5);
+        ADD_TO_BYTES(histogram.buckets, histogramBuffer, 9);
+        histogramBuffer += Histogram::HISTOGRAM_BYTES_SIZE;
+    }
+}
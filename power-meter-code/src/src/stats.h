@@ -0,0 +1,138 @@
+/**
+ * @file stats.h
+ * @brief Low overhead histograms for timing the hot paths.
+ *
+ * Durations are measured in CPU cycles using `esp_cpu_get_cycle_count()`. The cycle counter is per core, so the start
+ * and end of each measurement must be on the same core. This is the case for the interrupts as they are attached from
+ * the acquisition core, which their tasks are pinned to.
+ *
+ * Comment out `STATS_ENABLE` in `defines.h` to compile all of this out.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include "../defines.h"
+#include <esp_cpu.h>
+
+#define STATS_BUCKETS 16
+#define STATS_FORMAT_VERSION 1
+
+/**
+ * @brief Things that are measured.
+ *
+ */
+enum EnumStat
+{
+    STAT_AMP_LATENCY_LEFT,  // Cycles from the left DOUT interrupt to the amp task running.
+    STAT_AMP_LATENCY_RIGHT, // Cycles from the right DOUT interrupt to the amp task running.
+    STAT_IMU_LATENCY,       // Cycles from the IMU interrupt to the IMU task running.
+    STAT_AMP_READ_LEFT,     // Cycles taken by AmpReader::collect() for the left side.
+    STAT_AMP_READ_RIGHT,    // Cycles taken by AmpReader::collect() for the right side.
+    STAT_KALMAN_UPDATE,     // Cycles taken by CrankEstimator::update() (mostly Kalman::update()).
+    STAT_MQTT_PUBLISH,      // Cycles taken to publish an MQTT message.
+    STAT_QUEUE_LEFT,        // Records waiting in the left buffer when a new one is added.
+    STAT_QUEUE_RIGHT,       // Records waiting in the right buffer when a new one is added.
+    STAT_QUEUE_IMU,         // Records waiting in the IMU buffer when a new one is added.
+    STAT_FLASH_ERASE,       // Microseconds taken to erase a flash log sector (the flash cache is off meanwhile).
+    STAT_AMP_SKEW,          // Microseconds between the left and right DOUT interrupts of a pair (AMP_SYNCHRONISED only).
+    STAT_AMP_READ_PAIRED,   // Cycles taken to read both sides in one burst (AMP_SYNCHRONISED only).
+    STAT_COUNT
+};
+
+/**
+ * @brief Histogram with power of 2 sized buckets.
+ *
+ * Bucket 0 counts values less than `2^shift`. Bucket `n` counts values from `2^(shift + n - 1)` up to
+ * `2^(shift + n)`. The last bucket also counts everything larger.
+ */
+class Histogram
+{
+public:
+    /**
+     * @brief Adds a value to the histogram.
+     *
+     * @param value the value to add.
+     */
+    inline void record(uint32_t value)
+    {
+        const uint32_t scaled = value >> shift;
+        uint32_t bucket = scaled ? 32 - __builtin_clz(scaled) : 0;
+        if (bucket >= STATS_BUCKETS)
+        {
+            bucket = STATS_BUCKETS - 1;
+        }
+        buckets[bucket]++;
+        count++;
+        if (value > max)
+        {
+            max = value;
+        }
+    }
+
+    uint8_t shift = 0;
+    uint32_t count = 0;
+    uint32_t max = 0;
+    uint32_t buckets[STATS_BUCKETS] = {0};
+
+    static const int HISTOGRAM_BYTES_SIZE = 1 + 4 + 4 + 4 * STATS_BUCKETS;
+};
+
+/**
+ * @brief Collection of histograms for each thing that is measured.
+ *
+ * Each histogram should only be recorded to from a single task so that no locking is needed. Counts are cumulative
+ * since boot. They are read from another task, so a snapshot may be off by a sample or so.
+ */
+class Stats
+{
+public:
+    /**
+     * @brief Construct a new Stats object and sets the bucket sizes.
+     *
+     */
+    Stats();
+
+    /**
+     * @brief Adds a value to a histogram.
+     *
+     * @param stat the histogram to add to.
+     * @param value the value to add.
+     */
+    inline void record(EnumStat stat, uint32_t value) { m_histograms[stat].record(value); }
+
+    /**
+     * @brief Converts a snapshot of all histograms to bytes for transmission.
+     *
+     * @param buffer the buffer to put the data in. This needs to be at least STATS_BYTES_SIZE bytes long.
+     */
+    void toBytes(uint8_t *buffer);
+
+    static const int STATS_HEADER_SIZE = 1 + 4 + 2 + 1 + 1;
+    static const int STATS_BYTES_SIZE = STATS_HEADER_SIZE + STAT_COUNT * Histogram::HISTOGRAM_BYTES_SIZE;
+
+private:
+    Histogram m_histograms[STAT_COUNT];
+};
+
+#ifdef STATS_ENABLE
+extern Stats stats;
+
+// Saves the current cycle count in a new variable.
+#define STATS_START(name) const uint32_t name = esp_cpu_get_cycle_count()
+
+// Saves the current cycle count in an existing variable (use in interrupts).
+#define STATS_MARK(variable) variable = esp_cpu_get_cycle_count()
+
+// Records the number of cycles since `name` was set.
+#define STATS_END(stat, name) stats.record(stat, esp_cpu_get_cycle_count() - (name))
+
+// Records a value such as a queue depth.
+#define STATS_RECORD(stat, value) stats.record(stat, value)
+#else
+#define STATS_START(name)
+#define STATS_MARK(variable)
+#define STATS_END(stat, name)
+#define STATS_RECORD(stat, value)
+#endif
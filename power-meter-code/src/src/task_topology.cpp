@@ -0,0 +1,136 @@
+/**
+ * @file task_topology.cpp
+ * @brief Stack sizes, priorities and core affinities of each task in one place.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "task_topology.h"
+
+extern SemaphoreHandle_t serialMutex;
+
+#if TASK_PROFILE == TASK_PROFILE_DUAL_CORE
+#define TASK_CORE_NETWORK 0
+#else
+#define TASK_CORE_NETWORK TASK_CORE_ACQUISITION
+#endif
+
+// Only the amp tasks used by this build get a stack.
+#ifdef AMP_SYNCHRONISED
+#define TASK_STACK_AMP_SIDE 0
+#define TASK_STACK_AMP_PAIRED 4096
+#else
+#define TASK_STACK_AMP_SIDE 4096
+#define TASK_STACK_AMP_PAIRED 0
+#endif
+
+// Order must match EnumTask. Stack sizes are in bytes.
+static constexpr TaskTopology taskTopology[TASK_COUNT] = {
+    // Name, stack, priority, core
+    {"LED", 2048, 1, TASK_CORE_NETWORK},
+    {"Connection", 8192, 1, TASK_CORE_NETWORK},
+    {"LowSpeed", 4096, 1, TASK_CORE_ACQUISITION},
+    {"IMU", 4096, 3, TASK_CORE_ACQUISITION}, // Make this a higher priority than other tasks.
+    {"Amp0", TASK_STACK_AMP_SIDE, 2, TASK_CORE_ACQUISITION},
+    {"Amp1", TASK_STACK_AMP_SIDE, 2, TASK_CORE_ACQUISITION},
+    {"I2C", 3072, 1, TASK_CORE_NETWORK},
+    {"MQTT TX", 4096, 2, TASK_CORE_NETWORK}, // Above the connection task so packets are sent as soon as queued.
+    {"Config", 4096, 1, TASK_CORE_NETWORK},
+    {"Amps", TASK_STACK_AMP_PAIRED, 2, TASK_CORE_ACQUISITION}}; // Replaces Amp0 and Amp1 with AMP_SYNCHRONISED.
+
+/**
+ * @brief Where a task's stack starts in `taskStacks`.
+ *
+ */
+static constexpr uint32_t stackOffset(uint8_t task)
+{
+    return task ? stackOffset(task - 1) + taskTopology[task - 1].stackSize : 0;
+}
+
+// Stacks and control blocks for every task. Stack sizes are in bytes on the ESP32, the same as StackType_t.
+static_assert(sizeof(StackType_t) == 1, "Stack sizes are in bytes");
+static StackType_t taskStacks[stackOffset(TASK_COUNT)];
+static StaticTask_t taskBuffers[TASK_COUNT];
+static TaskHandle_t taskHandles[TASK_COUNT] = {};
+
+// Bit n is set once task n has started. Created by the first call to createTask(), which is always from setup().
+static StaticEventGroup_t startedBuffer;
+static EventGroupHandle_t startedEvents = NULL;
+
+bool createTask(EnumTask task, TaskFunction_t function, void *parameter, TaskHandle_t *handle)
+{
+    if (!startedEvents)
+    {
+        startedEvents = xEventGroupCreateStatic(&startedBuffer);
+    }
+
+    const TaskTopology &topology = taskTopology[task];
+    if (taskHandles[task] || !topology.stackSize)
+    {
+        LOGE("Tasks", "Couldn't create task '%s' as it already exists or has no stack", topology.name);
+        return false;
+    }
+    TaskHandle_t created = xTaskCreateStaticPinnedToCore(
+        function,
+        topology.name,
+        topology.stackSize,
+        parameter,
+        topology.priority,
+        taskStacks + stackOffset(task),
+        &taskBuffers[task],
+        topology.core);
+    if (!created)
+    {
+        LOGE("Tasks", "Couldn't create task '%s'", topology.name);
+        return false;
+    }
+    taskHandles[task] = created;
+    if (handle)
+    {
+        *handle = created;
+    }
+    LOGD("Tasks", "Created '%s' on core %d with priority %d", topology.name, topology.core, topology.priority);
+    return true;
+}
+
+void taskStarted(EnumTask task)
+{
+    xEventGroupSetBits(startedEvents, 1UL << task);
+}
+
+bool waitForTask(EnumTask task, TickType_t timeout)
+{
+    const EventBits_t bit = 1UL << task;
+    if (!(xEventGroupWaitBits(startedEvents, bit, pdFALSE, pdTRUE, timeout) & bit))
+    {
+        LOGW("Tasks", "Timed out waiting for '%s' to start", taskTopology[task].name);
+        return false;
+    }
+    return true;
+}
+
+const char *taskName(EnumTask task)
+{
+    return taskTopology[task].name;
+}
+
+uint32_t taskStackSize(EnumTask task)
+{
+    return taskTopology[task].stackSize;
+}
+
+bool taskStackHeadroom(EnumTask task, uint32_t &headroom)
+{
+    if (!taskHandles[task])
+    {
+        return false;
+    }
+    headroom = uxTaskGetStackHighWaterMark(taskHandles[task]);
+    return true;
+}
+
+uint32_t taskStackTotal()
+{
+    return sizeof(taskStacks);
+}
@@ -0,0 +1,143 @@
+/**
+ * @file task_topology.h
+ * @brief Stack sizes, priorities and core affinities of each task in one place.
+ *
+ * Every task's stack and control block are allocated statically, so the total is known at build time (see
+ * `tools/memory_report.py`) and creating a task can't fail because the heap is fragmented.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include "../defines.h"
+
+/**
+ * @brief Available task profiles. Select one by defining `TASK_PROFILE` in `platformio.ini`.
+ *
+ * - `TASK_PROFILE_SINGLE_CORE` runs every task on core 1 (the original arrangement).
+ * - `TASK_PROFILE_DUAL_CORE` runs the connection and LED tasks on core 0 alongside the WiFi / BLE stacks so that
+ *   slow transmissions don't compete with the acquisition pipeline (IMU, amps and low speed) on core 1.
+ */
+#define TASK_PROFILE_SINGLE_CORE 0
+#define TASK_PROFILE_DUAL_CORE 1
+
+#ifndef TASK_PROFILE
+#define TASK_PROFILE TASK_PROFILE_DUAL_CORE
+#endif
+
+#if (TASK_PROFILE != TASK_PROFILE_SINGLE_CORE) && (TASK_PROFILE != TASK_PROFILE_DUAL_CORE)
+#error "Unsupported task profile (set TASK_PROFILE in platformio.ini)."
+#endif
+
+/**
+ * @brief Core that the acquisition tasks run on.
+ *
+ * The amp tasks must be on the same core as the Arduino loop as `AmpReader::begin()` is called from there and the
+ * dedicated GPIO bundles it creates only work on that core.
+ */
+#ifdef ARDUINO_RUNNING_CORE
+#define TASK_CORE_ACQUISITION ARDUINO_RUNNING_CORE
+#else
+#define TASK_CORE_ACQUISITION 1
+#endif
+
+/**
+ * @brief Tasks created by the power meter.
+ *
+ */
+enum EnumTask
+{
+    TASK_LED,
+    TASK_CONNECTION,
+    TASK_LOW_SPEED,
+    TASK_IMU,
+    TASK_AMP_LEFT,
+    TASK_AMP_RIGHT,
+    TASK_I2C,
+    TASK_MQTT_TX,
+    TASK_CONFIG_SAVE,
+    TASK_AMP_PAIRED,
+    TASK_COUNT
+};
+
+#define TASK_START_TIMEOUT pdMS_TO_TICKS(1000) // Longest time to wait for a task to start before carrying on.
+
+/**
+ * @brief How a task should be created.
+ *
+ */
+struct TaskTopology
+{
+    const char *name;
+    uint32_t stackSize;
+    UBaseType_t priority;
+    BaseType_t core;
+};
+
+/**
+ * @brief Creates a task using the settings for it in the current profile.
+ *
+ * The stack comes from a static block reserved for the task, so each task can only be created once.
+ *
+ * @param task the task to create.
+ * @param function the function to run.
+ * @param parameter the parameter to pass to the function.
+ * @param handle where to store the handle of the created task.
+ * @return true the task was created.
+ * @return false the task could not be created.
+ */
+bool createTask(EnumTask task, TaskFunction_t function, void *parameter, TaskHandle_t *handle);
+
+/**
+ * @brief Tells anything waiting in `waitForTask()` that a task has finished starting.
+ *
+ * Call this from the task once it is ready to receive notifications (its handle and any state other tasks rely on
+ * have been set up).
+ *
+ * @param task the task that is ready.
+ */
+void taskStarted(EnumTask task);
+
+/**
+ * @brief Waits until a task has called `taskStarted()`. This replaces fixed delays when starting tasks in order.
+ *
+ * @param task the task to wait for.
+ * @param timeout the maximum time to wait in ticks.
+ * @return true the task has started.
+ * @return false the timeout expired first.
+ */
+bool waitForTask(EnumTask task, TickType_t timeout);
+
+/**
+ * @brief Gets the name of a task.
+ *
+ * @param task the task.
+ * @return const char* the name given to FreeRTOS.
+ */
+const char *taskName(EnumTask task);
+
+/**
+ * @brief Gets the size of the stack reserved for a task.
+ *
+ * @param task the task.
+ * @return uint32_t the size in bytes. This is 0 for tasks that aren't used in this build.
+ */
+uint32_t taskStackSize(EnumTask task);
+
+/**
+ * @brief Gets the smallest amount of stack a task has had free since it was created.
+ *
+ * @param task the task.
+ * @param headroom the number of bytes is written to this.
+ * @return true if the task has been created.
+ * @return false if it hasn't (headroom is unchanged).
+ */
+bool taskStackHeadroom(EnumTask task, uint32_t &headroom);
+
+/**
+ * @brief Gets the total size of the stacks reserved for all tasks.
+ *
+ * @return uint32_t the size in bytes.
+ */
+uint32_t taskStackTotal();
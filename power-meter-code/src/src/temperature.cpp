@@ -5,13 +5,12 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-04
+ * @date 2026-10-14
  */
 
 #include "temperature.h"
 
 extern SemaphoreHandle_t serialMutex;
-extern portMUX_TYPE spinlock;
 
 void TempSensor::begin()
 {
@@ -22,13 +21,6 @@ void TempSensor::begin()
     Wire.endTransmission(true);
 }
 
-float TempSensor::readTemp()
-{
-    startCapture();
-    delay(12);
-    return readTempRegister();
-}
-
 void TempSensor::startCapture()
 {
     Wire.beginTransmission(m_i2cAddress);
@@ -64,9 +56,7 @@ float TempSensor::readTempRegister()
     }
 
     // Store the temperature as the most recent.
-    taskENTER_CRITICAL(&spinlock);
-    m_lastTemp = temperature;
-    taskEXIT_CRITICAL(&spinlock);
+    m_lastTemp.store(temperature, std::memory_order_relaxed);
 
     // Return the temperature as well.
     return temperature;
@@ -94,8 +84,5 @@ void TempSensor::setLED(bool state)
 
 float TempSensor::getLastTemp()
 {
-    taskENTER_CRITICAL(&spinlock);
-    float temp = m_lastTemp;
-    taskEXIT_CRITICAL(&spinlock);
-    return temp;
+    return m_lastTemp.load(std::memory_order_relaxed);
 }
\ No newline at end of file
@@ -5,16 +5,19 @@
  *
  * @author Jotham Gates and Oscar Varney, MHP
  * @version 0.1.0
- * @date 2024-09-04
+ * @date 2026-10-14
  */
 
 #pragma once
 
 #include "../defines.h"
 #include <Wire.h>
+#include <atomic>
 
 /**
  * @brief Class for communicating with a P3T1755 temperature sensor.
+ *
+ * The methods that use the bus are only called by the `I2CManager` task. Other tasks should use `getLastTemp()`.
  * 
  */
 class TempSensor
@@ -33,16 +36,6 @@ public:
      */
     void begin();
 
-    /**
-     * @brief Reads the current temperature in celcius.
-     * 
-     * This reading is synchronous and will take at least 12ms. For faster reading, consider using continuous
-     * measurement instead of single shot or calling `startCapture()` in advance of calling `readTempRegister()`.
-     * 
-     * @return float the current temperature.
-     */
-    float readTemp();
-
     /**
      * @brief Starts a single shot temperature capture.
      * 
@@ -102,5 +95,10 @@ private:
 
     uint8_t m_polarity;
 
-    float m_lastTemp;
+    /**
+     * @brief Last temperature read. This is written by one task and read by others, so is atomic rather than needing
+     * a lock.
+     *
+     */
+    std::atomic<float> m_lastTemp{INVALID_TEMPERATURE};
 };
\ No newline at end of file
@@ -0,0 +1,316 @@
+/**
+ * @file benchmark.cpp
+ * @brief Micro-benchmarks for the hot paths of the firmware, compiled for a computer.
+ *
+ * Build and run with `make run`. Each benchmark reports the average time per call and the number of heap allocations
+ * per call (counted by replacing the global `operator new`). Inputs are calculated from a simulated crank before
+ * timing so that only the code under test is measured.
+ *
+ * The absolute times are for the computer the benchmark is run on, not the ESP32. They are mainly useful for
+ * comparing before and after a change.
+ *
+ * An optional argument only runs the benchmarks with names containing it, for example `./benchmark kalman`.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include "kalman.h"
+#include "data_points.h"
+#include "crank_maths.h"
+#include "json_writer.h"
+#include "decimator.h"
+#include "record_decoder.h"
+
+#define ITERATIONS 2000000
+#define INPUT_COUNT 1024 // Power of 2 so that inputs can be picked with a mask.
+#define INPUT_MASK (INPUT_COUNT - 1)
+#define SAMPLE_PERIOD 10000 // us between IMU updates (100Hz).
+#define AMP_PERIOD 12500    // us between strain gauge readings (80Hz).
+#define PACKET_RECORDS 40   // Records in each packet that is decoded.
+
+// Heap allocations since the start.
+static std::atomic<uint32_t> allocations(0);
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *pointer = malloc(size ? size : 1);
+    if (!pointer)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *pointer) noexcept { free(pointer); }
+void operator delete[](void *pointer) noexcept { free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { free(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { free(pointer); }
+
+// Results are added to this so that the compiler can't remove the code under test.
+static volatile float sink;
+
+/**
+ * @brief Simulated inputs from a crank rotating at a roughly constant speed.
+ *
+ */
+struct Inputs
+{
+    float xAccel[INPUT_COUNT];
+    float yAccel[INPUT_COUNT];
+    float angle[INPUT_COUNT];
+    float velocity[INPUT_COUNT];
+    uint32_t raw[INPUT_COUNT];
+    Matrix<2, 1, float> measurement[INPUT_COUNT];
+    HighSpeedData highSpeed[INPUT_COUNT];
+    IMUData imu[INPUT_COUNT];
+};
+static Inputs inputs;
+
+/**
+ * @brief Fills in the inputs.
+ *
+ */
+void generateInputs()
+{
+    const float velocity = 8; // rad/s, approximately 76 rpm.
+    for (int i = 0; i < INPUT_COUNT; i++)
+    {
+        float angle = fmodf(velocity * i * SAMPLE_PERIOD * 1e-6f + M_PI, 2 * M_PI) - M_PI;
+        inputs.angle[i] = angle;
+        inputs.velocity[i] = velocity + 0.02f * cosf(i * 0.7f);
+        inputs.xAccel[i] = GRAVITY * cosf(angle) + 0.05f * sinf(i * 1.3f);
+        inputs.yAccel[i] = GRAVITY * sinf(angle);
+        inputs.raw[i] = 8388608 + (int32_t)(100000 * sinf(angle)); // Around the middle of the 24 bit range.
+        inputs.measurement[i] = {angle, inputs.velocity[i]};
+
+        HighSpeedData &highSpeed = inputs.highSpeed[i];
+        highSpeed.timestamp = i * AMP_PERIOD;
+        highSpeed.position = angle;
+        highSpeed.velocity = inputs.velocity[i];
+        highSpeed.raw = inputs.raw[i];
+        highSpeed.torque = 30 * sinf(angle);
+
+        IMUData &imu = inputs.imu[i];
+        imu.timestamp = i * SAMPLE_PERIOD;
+        imu.position = angle;
+        imu.velocity = inputs.velocity[i];
+        imu.xAccel = inputs.xAccel[i];
+        imu.yAccel = inputs.yAccel[i];
+        imu.zAccel = 0.1f;
+        imu.xGyro = 0.01f;
+        imu.yGyro = -0.01f;
+        imu.zGyro = inputs.velocity[i];
+    }
+}
+
+/**
+ * @brief Times a function and prints the results.
+ *
+ * @tparam F the type of the function.
+ * @param filter only run if the name contains this (nullptr to always run).
+ * @param name the name of the benchmark.
+ * @param function called with the iteration number.
+ */
+template <typename F>
+void run(const char *filter, const char *name, F function)
+{
+    if (filter && !strstr(name, filter))
+    {
+        return;
+    }
+
+    // Warm up the caches and branch predictors.
+    for (int i = 0; i < INPUT_COUNT; i++)
+    {
+        function(i);
+    }
+
+    const uint32_t startAllocations = allocations.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        function(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    const uint32_t endAllocations = allocations.load(std::memory_order_relaxed);
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / ITERATIONS;
+    double allocationsPerOp = (double)(endAllocations - startAllocations) / ITERATIONS;
+    printf("%-28s %9.2f ns/op %9.3f allocs/op\n", name, ns, allocationsPerOp);
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = argc > 1 ? argv[1] : nullptr;
+    generateInputs();
+    printf("%-28s %12s %16s\n", "benchmark", "time", "allocations");
+
+    // Kalman filter (imu.cpp and power_meter.cpp).
+    Matrix<2, 2, float> qEnvCovariance = DEFAULT_KALMAN_Q;
+    Matrix<2, 2, float> rMeasCovariance = DEFAULT_KALMAN_R;
+    Kalman<float> kalman(qEnvCovariance, rMeasCovariance, KALMAN_X0, KALMAN_P0);
+    run(filter, "kalman/update", [&](int i)
+        { kalman.update(inputs.measurement[i & INPUT_MASK], (uint32_t)i * SAMPLE_PERIOD); });
+    const uint32_t lastUpdate = (uint32_t)(ITERATIONS - 1) * SAMPLE_PERIOD;
+    run(filter, "kalman/predict", [&](int i)
+        {
+            Matrix<2, 1, float> predicted;
+            kalman.predict(lastUpdate + (i & INPUT_MASK) * 10, predicted);
+            sink = sink + predicted(0, 0); });
+
+    // Strain gauge and angle calculations (crank_maths.h).
+    const float coefficient = DEFAULT_STRAIN_COEFFICIENT;
+    run(filter, "maths/rawToTorque", [&](int i)
+        { sink = sink + rawToTorque(inputs.raw[i & INPUT_MASK], 8388608, coefficient, 0.001f,
+                                    DEFAULT_STRAIN_TEST_TEMP, 30); });
+    const TorqueConversion conversion = makeTorqueConversion(8388608, coefficient, 0.001f, 0, DEFAULT_STRAIN_TEST_TEMP, 30);
+    run(filter, "maths/applyTorqueConversion", [&](int i)
+        { sink = sink + applyTorqueConversion(inputs.raw[i & INPUT_MASK], conversion); });
+    run(filter, "maths/accelToAngle", [&](int i)
+        { sink = sink + accelToAngle(inputs.xAccel[i & INPUT_MASK], inputs.yAccel[i & INPUT_MASK]); });
+    run(filter, "maths/angleToSector", [&](int i)
+        { sink = sink + angleToSector(inputs.angle[i & INPUT_MASK]); });
+    run(filter, "maths/timeSinceWrap", [&](int i)
+        { sink = sink + timeSinceWrap(inputs.angle[(i - 1) & INPUT_MASK], inputs.velocity[(i - 1) & INPUT_MASK],
+                                      inputs.angle[i & INPUT_MASK], inputs.velocity[i & INPUT_MASK], SAMPLE_PERIOD); });
+
+    // Anti-aliased decimation down to 20Hz (decimator.cpp). Timestamps keep increasing so the filter isn't reset.
+    Decimator<HighSpeedData> highSpeedDecimator;
+    highSpeedDecimator.configure(1000000 / AMP_PERIOD, 20);
+    run(filter, "decimate/highSpeed", [&](int i)
+        {
+            HighSpeedData data = inputs.highSpeed[i & INPUT_MASK];
+            data.timestamp = (uint32_t)i * AMP_PERIOD;
+            if (highSpeedDecimator.add(data, data))
+            {
+                sink = sink + data.torque;
+            } });
+    Decimator<IMUData> imuDecimator;
+    imuDecimator.configure(1000000 / SAMPLE_PERIOD, 20);
+    run(filter, "decimate/imu", [&](int i)
+        {
+            IMUData data = inputs.imu[i & INPUT_MASK];
+            data.timestamp = (uint32_t)i * SAMPLE_PERIOD;
+            if (imuDecimator.add(data, data))
+            {
+                sink = sink + data.xAccel;
+            } });
+
+    // Serialisation (data_points.cpp).
+    uint8_t buffer[TorqueProfile::PROFILE_MAX_BYTES_SIZE];
+    run(filter, "serialise/highSpeed", [&](int i)
+        {
+            inputs.highSpeed[i & INPUT_MASK].toBytes(buffer);
+            sink = sink + buffer[0]; });
+    run(filter, "serialise/highSpeedPacked", [&](int i)
+        {
+            HighSpeedData &data = inputs.highSpeed[i & INPUT_MASK];
+            data.toPackedBytes(buffer, data.timestamp - AMP_PERIOD, 8);
+            sink = sink + buffer[0]; });
+    run(filter, "serialise/imu", [&](int i)
+        {
+            inputs.imu[i & INPUT_MASK].toBytes(buffer);
+            sink = sink + buffer[0]; });
+    run(filter, "serialise/imuPacked", [&](int i)
+        {
+            IMUData &data = inputs.imu[i & INPUT_MASK];
+            data.toPackedBytes(buffer, data.timestamp - SAMPLE_PERIOD, 8);
+            sink = sink + buffer[0]; });
+
+    // Decoding whole packets on a computer (scripts-testing/decoder). Columns are cleared rather than recreated, so
+    // memory is only allocated while warming up.
+    uint8_t packet[PACKET_RECORDS * HighSpeedData::FAST_BYTES_SIZE];
+    for (int i = 0; i < PACKET_RECORDS; i++)
+    {
+        inputs.highSpeed[i].toBytes(packet + i * HighSpeedData::FAST_BYTES_SIZE);
+    }
+    HighSpeedColumns highSpeedColumns;
+    run(filter, "decode/highSpeedPacket", [&](int i)
+        {
+            highSpeedColumns.clear();
+            decodeHighSpeedPacket(packet, sizeof(packet), PACKET_FORMAT_LEGACY, highSpeedColumns);
+            sink = sink + highSpeedColumns.torque[i % PACKET_RECORDS]; });
+
+    inputs.highSpeed[0].packedHeader(packet);
+    for (int i = 0; i < PACKET_RECORDS; i++)
+    {
+        const uint32_t previous = inputs.highSpeed[i ? i - 1 : 0].timestamp;
+        inputs.highSpeed[i].toPackedBytes(packet + HighSpeedData::PACKED_HEADER_SIZE + i * HighSpeedData::PACKED_BYTES_SIZE,
+                                          previous, inputs.highSpeed[0].velocity);
+    }
+    const size_t packedLength = HighSpeedData::PACKED_HEADER_SIZE + PACKET_RECORDS * HighSpeedData::PACKED_BYTES_SIZE;
+    run(filter, "decode/highSpeedPacked", [&](int i)
+        {
+            highSpeedColumns.clear();
+            decodeHighSpeedPacket(packet, packedLength, PACKET_FORMAT_PACKED, highSpeedColumns);
+            sink = sink + highSpeedColumns.torque[i % PACKET_RECORDS]; });
+
+    inputs.imu[0].packedHeader(packet);
+    for (int i = 0; i < PACKET_RECORDS; i++)
+    {
+        const uint32_t previous = inputs.imu[i ? i - 1 : 0].timestamp;
+        inputs.imu[i].toPackedBytes(packet + IMUData::PACKED_HEADER_SIZE + i * IMUData::PACKED_BYTES_SIZE, previous,
+                                    inputs.imu[0].velocity);
+    }
+    IMUColumns imuColumns;
+    run(filter, "decode/imuPacked", [&](int i)
+        {
+            imuColumns.clear();
+            decodeIMUPacket(packet, IMUData::PACKED_HEADER_SIZE + PACKET_RECORDS * IMUData::PACKED_BYTES_SIZE,
+                            PACKET_FORMAT_PACKED, imuColumns);
+            sink = sink + imuColumns.xAccel[i % PACKET_RECORDS]; });
+
+    LowSpeedData lowSpeed = {10, 785000, 5000000, 250, 0.5f};
+    run(filter, "serialise/lowSpeed", [&](int i)
+        {
+            lowSpeed.timestamp = i;
+            lowSpeed.toBytes(buffer);
+            sink = sink + buffer[0]; });
+
+    // JSON formatting of the low speed message (connection_mqtt.cpp), compared to the printf version it replaced.
+    char text[100];
+    run(filter, "json/lowSpeed", [&](int i)
+        {
+            lowSpeed.timestamp = i;
+            JsonWriter json(text, sizeof(text));
+            json.beginObject();
+            json.addUInt("timestamp", lowSpeed.timestamp);
+            json.addFixed("cadence", lowSpeed.cadence(), 1);
+            json.addUInt("rotations", lowSpeed.rotationCount);
+            json.addFixed("power", lowSpeed.power, 1);
+            json.addFixed("balance", lowSpeed.balance, 1);
+            json.endObject();
+            sink = sink + text[json.length() - 2]; });
+    run(filter, "json/lowSpeedPrintf", [&](int i)
+        {
+            lowSpeed.timestamp = i;
+            int length = snprintf(text, sizeof(text),
+                                  "{\"timestamp\":%u,\"cadence\":%.1f,\"rotations\":%u,\"power\":%.1f,\"balance\":%.1f}",
+                                  lowSpeed.timestamp, lowSpeed.cadence(), lowSpeed.rotationCount, lowSpeed.power,
+                                  lowSpeed.balance);
+            sink = sink + text[length - 2]; });
+
+    TorqueProfile profile;
+    profile.timestamp = 0;
+    profile.duration = 785000;
+    profile.binCount = 36;
+    for (int i = 0; i < PROFILE_MAX_BINS; i++)
+    {
+        profile.torque[i] = BaseData::toFixed(30 * sinf(i * 2 * M_PI / profile.binCount), PACKED_TORQUE_SCALE);
+    }
+    run(filter, "serialise/torqueProfile", [&](int i)
+        {
+            profile.timestamp = i;
+            profile.toBytes(buffer);
+            sink = sink + buffer[0]; });
+
+    return 0;
+}
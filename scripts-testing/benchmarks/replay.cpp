@@ -0,0 +1,574 @@
+/**
+ * @file replay.cpp
+ * @brief Replays a recorded session through the firmware's processing pipeline on a computer.
+ *
+ * Build with `make replay` and run with `./replay [options] RECORDING_DIR`, where `RECORDING_DIR` is a folder written
+ * by `log_power_meter.py -m csv`. The IMU and strain gauge readings are merged in timestamp order and passed through
+ * `CrankEstimator`, `Kalman::predict()`, `applyTorqueConversion()` and `PowerAccumulator` in the same order as the IMU
+ * and amp tasks do. Low speed records are generated the same way as the low speed task, once both sides have finished a
+ * rotation.
+ *
+ * The recording should be made with `imuHowOften` set to 1 so that every IMU frame is available. The logged x and y
+ * accelerations have already been corrected for centripetal acceleration, so this is undone before they are replayed.
+ *
+ * Options:
+ *   -o, --output DIR           Writes the replayed records to DIR in the same format as `log_power_meter.py`.
+ *   -r, --repeat N             Number of timed runs to average the throughput over (default 10).
+ *   -b, --profile-bins N       Number of torque profile bins (default 36, 0 to disable).
+ *   --offset-left RAW          Strain gauge offsets. Defaults to the first row of `housekeeping.csv`.
+ *   --offset-right RAW
+ *   --coefficient-left NM      Strain gauge coefficients. Defaults to DEFAULT_STRAIN_COEFFICIENT.
+ *   --coefficient-right NM
+ *   --temp-coefficient K       Thermal coefficient. Defaults to DEFAULT_STRAIN_TEMP_CO.
+ *
+ * The RMS differences between the recorded and replayed positions and torques are printed so that changes to the
+ * pipeline can be checked against a known good recording.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <vector>
+#include "pipeline.h"
+
+#define LINE_LENGTH 1024
+#define MAX_PATH_LENGTH 512
+
+/**
+ * @brief Types of recorded readings.
+ *
+ */
+enum EnumEvent
+{
+    EVENT_LEFT = SIDE_LEFT,
+    EVENT_RIGHT = SIDE_RIGHT,
+    EVENT_IMU
+};
+
+/**
+ * @brief A single recorded reading.
+ *
+ */
+struct Event
+{
+    uint8_t type;      // EnumEvent
+    uint32_t timestamp; // Device timestamp (us).
+    double unixTime;
+    float position, velocity; // As recorded.
+
+    // IMU readings.
+    float xAccel, yAccel, zAccel, xGyro, yGyro, zGyro;
+
+    // Strain gauge readings.
+    uint32_t raw;
+    float torque; // As recorded.
+    bool transmitting;
+};
+
+/**
+ * @brief Settings for the replay.
+ *
+ */
+struct Options
+{
+    const char *input = nullptr;
+    const char *output = nullptr;
+    int repeat = 10;
+    uint8_t profileBins = 36;
+    uint32_t offset[2] = {DEFAULT_STRAIN_OFFSET, DEFAULT_STRAIN_OFFSET};
+    bool offsetGiven[2] = {false, false};
+    float coefficient[2] = {DEFAULT_STRAIN_COEFFICIENT, DEFAULT_STRAIN_COEFFICIENT};
+    float tempCoefficient = DEFAULT_STRAIN_TEMP_CO;
+    float temperature[2] = {DEFAULT_STRAIN_TEST_TEMP, DEFAULT_STRAIN_TEST_TEMP};
+};
+
+/**
+ * @brief Files to write the replayed records to.
+ *
+ */
+struct Outputs
+{
+    FILE *strain[2];
+    FILE *profile[2];
+    FILE *imu;
+    FILE *slow;
+};
+
+/**
+ * @brief Sums of squared differences between the recording and the replay.
+ *
+ */
+struct Accuracy
+{
+    double position[3] = {0, 0, 0}; // Indexed by EnumEvent.
+    double torque[2] = {0, 0};
+    uint32_t count[3] = {0, 0, 0};
+};
+
+/**
+ * @brief Opens a file in a directory.
+ *
+ * @return FILE* the file or nullptr if it couldn't be opened.
+ */
+FILE *openFile(const char *directory, const char *name, const char *mode)
+{
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    FILE *file = fopen(path, mode);
+    if (!file && mode[0] == 'w')
+    {
+        fprintf(stderr, "Couldn't create '%s'.\n", path);
+        exit(1);
+    }
+    return file;
+}
+
+/**
+ * @brief Reads the IMU records from `imu.csv`.
+ *
+ */
+void loadIMU(const char *directory, std::vector<Event> &events)
+{
+    FILE *file = openFile(directory, "imu.csv", "r");
+    if (!file)
+    {
+        fprintf(stderr, "No imu.csv in '%s'.\n", directory);
+        exit(1);
+    }
+
+    char line[LINE_LENGTH];
+    fgets(line, sizeof(line), file); // Heading.
+    while (fgets(line, sizeof(line), file))
+    {
+        Event event = {};
+        event.type = EVENT_IMU;
+        if (sscanf(line, "%lf,%u,%*d,%f,%f,%f,%f,%f,%f,%f,%f", &event.unixTime, &event.timestamp, &event.velocity,
+                   &event.position, &event.xAccel, &event.yAccel, &event.zAccel, &event.xGyro, &event.yGyro,
+                   &event.zGyro) == 10)
+        {
+            // Undo the centripetal correction so that the replay can apply it again.
+            event.xAccel = correctCentripetal(event.xAccel, -IMU_OFFSET_X, event.zGyro);
+            event.yAccel = correctCentripetal(event.yAccel, -IMU_OFFSET_Y, event.zGyro);
+            events.push_back(event);
+        }
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Reads the strain gauge records for a side from `left_strain.csv` or `right_strain.csv`.
+ *
+ */
+void loadStrain(const char *directory, EnumSide side, std::vector<Event> &events)
+{
+    FILE *file = openFile(directory, side == SIDE_LEFT ? "left_strain.csv" : "right_strain.csv", "r");
+    if (!file)
+    {
+        fprintf(stderr, "No %s strain gauge data, skipping.\n", side == SIDE_LEFT ? "left" : "right");
+        return;
+    }
+
+    char line[LINE_LENGTH];
+    fgets(line, sizeof(line), file); // Heading.
+    while (fgets(line, sizeof(line), file))
+    {
+        Event event = {};
+        event.type = side;
+        char transmitting[6] = "";
+        if (sscanf(line, "%lf,%u,%*d,%f,%f,%u,%f,%*f,%5s", &event.unixTime, &event.timestamp, &event.velocity,
+                   &event.position, &event.raw, &event.torque, transmitting) == 7)
+        {
+            event.transmitting = !strcmp(transmitting, "True");
+            events.push_back(event);
+        }
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Uses the offsets and temperatures from the first row of `housekeeping.csv` if there is one.
+ *
+ */
+void loadHousekeeping(const char *directory, Options &options)
+{
+    FILE *file = openFile(directory, "housekeeping.csv", "r");
+    if (!file)
+    {
+        return;
+    }
+
+    char line[LINE_LENGTH];
+    fgets(line, sizeof(line), file); // Heading.
+    double unixTime;
+    float temperature[2], imuTemperature, battery;
+    uint32_t offset[2];
+    if (fgets(line, sizeof(line), file) &&
+        sscanf(line, "%lf,%f,%f,%f,%f,%u,%u", &unixTime, &temperature[SIDE_LEFT], &temperature[SIDE_RIGHT],
+               &imuTemperature, &battery, &offset[SIDE_LEFT], &offset[SIDE_RIGHT]) == 7)
+    {
+        for (uint8_t side = 0; side < 2; side++)
+        {
+            if (!options.offsetGiven[side])
+            {
+                options.offset[side] = offset[side];
+            }
+            if (temperature[side] != INVALID_TEMPERATURE)
+            {
+                options.temperature[side] = temperature[side];
+            }
+        }
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Wraps an angle difference to be between -pi and pi.
+ *
+ */
+float angleDifference(float a, float b)
+{
+    float difference = fmodf(a - b + 3 * M_PI, 2 * M_PI);
+    if (difference < 0)
+    {
+        difference += 2 * M_PI;
+    }
+    return difference - M_PI;
+}
+
+/**
+ * @brief Writes a torque profile in the same format as `log_power_meter.py`.
+ *
+ */
+void writeProfile(FILE *file, double unixTime, TorqueProfile &profile)
+{
+    fprintf(file, "%f,%u,%u", unixTime, profile.timestamp, profile.duration);
+    for (uint8_t i = 0; i < profile.binCount; i++)
+    {
+        if (profile.torque[i] == PROFILE_EMPTY_BIN)
+        {
+            fprintf(file, ",nan");
+        }
+        else
+        {
+            fprintf(file, ",%.2f", profile.torque[i] / (float)PACKED_TORQUE_SCALE);
+        }
+    }
+    fprintf(file, "\n");
+}
+
+/**
+ * @brief Runs every event through the pipeline once.
+ *
+ * @param events the events in timestamp order.
+ * @param options the calibration to use.
+ * @param outputs where to write the records (nullptr to not write anything).
+ * @param accuracy where to add the differences from the recording (nullptr to not calculate them).
+ * @return uint32_t the number of rotations counted.
+ */
+uint32_t replay(const std::vector<Event> &events, const Options &options, Outputs *outputs, Accuracy *accuracy)
+{
+    // Equivalent of IMUManager and the two sides.
+    Matrix<2, 2, float> qEnvCovariance = DEFAULT_KALMAN_Q;
+    Matrix<2, 2, float> rMeasCovariance = DEFAULT_KALMAN_R;
+    Kalman<float> kalman(qEnvCovariance, rMeasCovariance, KALMAN_X0, KALMAN_P0);
+    CrankEstimator estimator;
+    PowerAccumulator accumulators[2];
+    float averagePower[2] = {0, 0};
+    uint32_t rotations = 0, lastRotationTime = 0, lastRotationDuration = 0;
+    uint8_t notifyBits = 0; // Sides that have finished the current rotation, as sent to the low speed task.
+    uint32_t lastImuTimestamp = 0, lastStrainTimestamp[2] = {0, 0};
+
+    // Side::m_calculateTorque() only works this out when the calibration or temperature changes.
+    TorqueConversion conversions[2];
+    for (uint8_t side = 0; side < 2; side++)
+    {
+        conversions[side] = makeTorqueConversion(options.offset[side], options.coefficient[side],
+                                                 options.tempCoefficient, 0, DEFAULT_STRAIN_TEST_TEMP,
+                                                 options.temperature[side]);
+    }
+
+    for (const Event &event : events)
+    {
+        if (event.type == EVENT_IMU)
+        {
+            // IMUManager::processIMUEvent()
+            IMUData data;
+            if (estimator.update(kalman, event.timestamp, event.xAccel, event.yAccel, event.zGyro, data))
+            {
+                rotations++;
+                lastRotationDuration = estimator.rotationTime() - lastRotationTime;
+                lastRotationTime = estimator.rotationTime();
+            }
+
+            if (outputs)
+            {
+                fprintf(outputs->imu, "%f,%u,%d,%f,%f,%f,%f,%f,%f,%f,%f\n", event.unixTime, data.timestamp,
+                        (int32_t)(data.timestamp - lastImuTimestamp), data.velocity, data.position, data.xAccel,
+                        data.yAccel, event.zAccel, event.xGyro, event.yGyro, data.zGyro);
+                lastImuTimestamp = data.timestamp;
+            }
+            if (accuracy)
+            {
+                float difference = angleDifference(data.position, event.position);
+                accuracy->position[EVENT_IMU] += difference * difference;
+                accuracy->count[EVENT_IMU]++;
+            }
+        }
+        else
+        {
+            // Side::readDataTask() and Side::processData()
+            const uint8_t side = event.type;
+            Matrix<2, 1, float> state;
+            kalman.predict(event.timestamp, state);
+            HighSpeedData data;
+            data.timestamp = event.timestamp;
+            data.position = state(0, 0);
+            data.velocity = state(1, 0);
+            data.raw = event.raw;
+            data.torque = applyTorqueConversion(event.raw, conversions[side]);
+            data.isTransmitting = event.transmitting;
+
+            TorqueProfile profile;
+            if (accumulators[side].update(data.timestamp, data.velocity * data.torque, rotations, lastRotationTime,
+                                          options.profileBins, profile))
+            {
+                averagePower[side] = accumulators[side].averagePower();
+                notifyBits |= 1 << side;
+                if (outputs && profile.binCount)
+                {
+                    writeProfile(outputs->profile[side], event.unixTime, profile);
+                }
+            }
+            accumulators[side].add(data);
+
+            if (outputs)
+            {
+                fprintf(outputs->strain[side], "%f,%u,%d,%f,%f,%u,%f,%f,%s\n", event.unixTime, data.timestamp,
+                        (int32_t)(data.timestamp - lastStrainTimestamp[side]), data.velocity, data.position, data.raw,
+                        data.torque, data.velocity * data.torque, data.isTransmitting ? "True" : "False");
+                lastStrainTimestamp[side] = data.timestamp;
+            }
+            if (accuracy)
+            {
+                float difference = angleDifference(data.position, event.position);
+                accuracy->position[side] += difference * difference;
+                accuracy->torque[side] += (data.torque - event.torque) * (data.torque - event.torque);
+                accuracy->count[side]++;
+            }
+
+            // taskLowSpeed()
+            if (notifyBits == ((1 << SIDE_LEFT) | (1 << SIDE_RIGHT)))
+            {
+                notifyBits = 0;
+                LowSpeedData lowSpeed;
+                lowSpeed.timestamp = lastRotationTime;
+                lowSpeed.lastRotationDuration = lastRotationDuration;
+                lowSpeed.rotationCount = rotations;
+                lowSpeed.power = averagePower[SIDE_LEFT] + averagePower[SIDE_RIGHT];
+                lowSpeed.balance = 100 * averagePower[SIDE_LEFT] / lowSpeed.power;
+                lowSpeed.rotationEvent = true;
+                if (outputs)
+                {
+                    fprintf(outputs->slow, "%f,%u,%f,%u,%f,%f\n", event.unixTime, lowSpeed.timestamp,
+                            lowSpeed.cadence(), lowSpeed.rotationCount, lowSpeed.power, lowSpeed.balance);
+                }
+            }
+        }
+    }
+    return rotations;
+}
+
+/**
+ * @brief Opens the output files and writes the headings.
+ *
+ */
+void openOutputs(const char *directory, Outputs &outputs)
+{
+    const char *strainHeading = "Unix Timestamp [s],Device Timestamp [us],Timestep[us],Velocity [rad/s],Position [rad],Raw [uint24],Torque [Nm],Power [W],Transmitting [bool]\n";
+    const char *profileHeading = "Unix Timestamp [s],Device Timestamp [us],Duration [us],Bin Torques [Nm]...\n";
+    outputs.strain[SIDE_LEFT] = openFile(directory, "left_strain.csv", "w");
+    outputs.strain[SIDE_RIGHT] = openFile(directory, "right_strain.csv", "w");
+    outputs.profile[SIDE_LEFT] = openFile(directory, "left_profile.csv", "w");
+    outputs.profile[SIDE_RIGHT] = openFile(directory, "right_profile.csv", "w");
+    outputs.imu = openFile(directory, "imu.csv", "w");
+    outputs.slow = openFile(directory, "slow.csv", "w");
+    for (uint8_t side = 0; side < 2; side++)
+    {
+        fputs(strainHeading, outputs.strain[side]);
+        fputs(profileHeading, outputs.profile[side]);
+    }
+    fputs("Unix Timestamp [s],Device Timestamp [us],Timestep[us],Velocity [rad/s],Position [rad],Acceleration X [m/s^2],Acceleration Y [m/s^2],Acceleration Z [m/s^2],Gyro A [rad/s],Gyro B [rad/s],Gyro Z [rad/s]\n", outputs.imu);
+    fputs("Unix Timestamp [s],Device Timestamp [us],Cadence [rpm],Rotations [#],Power [W],Balance [%]\n", outputs.slow);
+}
+
+/**
+ * @brief Closes the output files.
+ *
+ */
+void closeOutputs(Outputs &outputs)
+{
+    for (uint8_t side = 0; side < 2; side++)
+    {
+        fclose(outputs.strain[side]);
+        fclose(outputs.profile[side]);
+    }
+    fclose(outputs.imu);
+    fclose(outputs.slow);
+}
+
+/**
+ * @brief Prints the usage and exits.
+ *
+ */
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-o OUTPUT_DIR] [-r REPEAT] [-b PROFILE_BINS] [--offset-left RAW] [--offset-right RAW] "
+                    "[--coefficient-left NM] [--coefficient-right NM] [--temp-coefficient K] RECORDING_DIR\n",
+            name);
+    exit(1);
+}
+
+/**
+ * @brief Reads the command line options.
+ *
+ */
+void parseOptions(int argc, char **argv, Options &options)
+{
+    enum
+    {
+        OPTION_OFFSET_LEFT = 256,
+        OPTION_OFFSET_RIGHT,
+        OPTION_COEFFICIENT_LEFT,
+        OPTION_COEFFICIENT_RIGHT,
+        OPTION_TEMP_COEFFICIENT
+    };
+    static const struct option longOptions[] = {
+        {"output", required_argument, nullptr, 'o'},
+        {"repeat", required_argument, nullptr, 'r'},
+        {"profile-bins", required_argument, nullptr, 'b'},
+        {"offset-left", required_argument, nullptr, OPTION_OFFSET_LEFT},
+        {"offset-right", required_argument, nullptr, OPTION_OFFSET_RIGHT},
+        {"coefficient-left", required_argument, nullptr, OPTION_COEFFICIENT_LEFT},
+        {"coefficient-right", required_argument, nullptr, OPTION_COEFFICIENT_RIGHT},
+        {"temp-coefficient", required_argument, nullptr, OPTION_TEMP_COEFFICIENT},
+        {nullptr, 0, nullptr, 0}};
+
+    int option;
+    while ((option = getopt_long(argc, argv, "o:r:b:", longOptions, nullptr)) != -1)
+    {
+        switch (option)
+        {
+        case 'o':
+            options.output = optarg;
+            break;
+        case 'r':
+            options.repeat = atoi(optarg);
+            break;
+        case 'b':
+            options.profileBins = atoi(optarg);
+            break;
+        case OPTION_OFFSET_LEFT:
+        case OPTION_OFFSET_RIGHT:
+            options.offset[option - OPTION_OFFSET_LEFT] = strtoul(optarg, nullptr, 10);
+            options.offsetGiven[option - OPTION_OFFSET_LEFT] = true;
+            break;
+        case OPTION_COEFFICIENT_LEFT:
+        case OPTION_COEFFICIENT_RIGHT:
+            options.coefficient[option - OPTION_COEFFICIENT_LEFT] = atof(optarg);
+            break;
+        case OPTION_TEMP_COEFFICIENT:
+            options.tempCoefficient = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1 || options.repeat < 1)
+    {
+        usage(argv[0]);
+    }
+    options.input = argv[optind];
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    parseOptions(argc, argv, options);
+
+    // Load and merge the recording. Timestamps are compared relative to the first one so that a single overflow of
+    // the microsecond counter is handled.
+    std::vector<Event> events;
+    loadIMU(options.input, events);
+    loadStrain(options.input, SIDE_LEFT, events);
+    loadStrain(options.input, SIDE_RIGHT, events);
+    loadHousekeeping(options.input, options);
+    if (events.empty())
+    {
+        fprintf(stderr, "Nothing to replay.\n");
+        return 1;
+    }
+    uint32_t firstTimestamp = events[0].timestamp;
+    for (const Event &event : events)
+    {
+        if ((int32_t)(event.timestamp - firstTimestamp) < 0)
+        {
+            firstTimestamp = event.timestamp;
+        }
+    }
+    std::stable_sort(events.begin(), events.end(), [firstTimestamp](const Event &a, const Event &b)
+                     { return a.timestamp - firstTimestamp < b.timestamp - firstTimestamp; });
+    const double duration = (events.back().timestamp - firstTimestamp) * 1e-6;
+    printf("Loaded %zu records spanning %.1fs. Offsets: %u, %u. Temperatures: %.2fC, %.2fC.\n", events.size(),
+           duration, options.offset[SIDE_LEFT], options.offset[SIDE_RIGHT], options.temperature[SIDE_LEFT],
+           options.temperature[SIDE_RIGHT]);
+
+    // Untimed run to write the results and compare against the recording.
+    Accuracy accuracy;
+    Outputs outputs;
+    if (options.output)
+    {
+        mkdir(options.output, 0777);
+        openOutputs(options.output, outputs);
+    }
+    uint32_t rotations = replay(events, options, options.output ? &outputs : nullptr, &accuracy);
+    if (options.output)
+    {
+        closeOutputs(outputs);
+        printf("Wrote the replayed records to '%s'.\n", options.output);
+    }
+    printf("Rotations: %u\n", rotations);
+    const char *names[] = {"left", "right", "imu"};
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        if (accuracy.count[i])
+        {
+            printf("RMS difference from recording (%-5s): position %.6frad", names[i],
+                   sqrt(accuracy.position[i] / accuracy.count[i]));
+            if (i != EVENT_IMU)
+            {
+                printf(", torque %.6fNm", sqrt(accuracy.torque[i] / accuracy.count[i]));
+            }
+            printf("\n");
+        }
+    }
+
+    // Timed runs for the throughput. The rotation count is kept so that the work can't be optimised away.
+    volatile uint32_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < options.repeat; i++)
+    {
+        sink = sink + replay(events, options, nullptr, nullptr);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count() / options.repeat;
+    printf("Throughput: %.3fms per run, %.0f records/s, %.0fx real time (averaged over %d runs).\n", seconds * 1e3,
+           events.size() / seconds, duration / seconds, options.repeat);
+    return 0;
+}
@@ -0,0 +1,16 @@
+/**
+ * @file Arduino.h
+ * @brief Minimal stand in for the Arduino core so that the pure firmware sources can be compiled on a computer.
+ *
+ * Only what `data_points.cpp` and `kalman.cpp` use is provided. Anything that needs the hardware or FreeRTOS should
+ * stay out of the benchmarked sources rather than being stubbed here.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
@@ -0,0 +1,13 @@
+/**
+ * @file constants.h
+ * @brief Uses the example constants when the firmware doesn't have its own `constants.h`.
+ *
+ * A `constants.h` next to `defines.h` in the firmware takes priority over this one, so a calibrated power meter is
+ * benchmarked with its own settings.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include "../../../power-meter-code/src/constants.example.h"
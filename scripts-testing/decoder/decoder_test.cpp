@@ -0,0 +1,270 @@
+/**
+ * @file decoder_test.cpp
+ * @brief Checks that the decoder gets back the records that the firmware serialised.
+ *
+ * Build and run with `make test`. Records are serialised using the firmware's `toBytes()`, `packedHeader()` and
+ * `toPackedBytes()` (compiled from `data_points.cpp` against the benchmark shims), decoded and compared field by field.
+ * Legacy and low speed fields must match exactly. Packed fields must be within one fixed point step, and the power
+ * calculated for packed strain gauge records must be within the error that those steps allow. The programme exits with
+ * an error if anything doesn't match.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include <cmath>
+#include <cstdio>
+#include "data_points.h"
+#include "record_decoder.h"
+
+#define RECORDS 50          // Records in each packet.
+#define SAMPLE_PERIOD 12500 // us between records.
+
+static int failures = 0;
+
+/**
+ * @brief Checks a single value, printing it if it doesn't match.
+ *
+ * @param name what is being checked.
+ * @param index the record.
+ * @param actual the decoded value.
+ * @param expected the value that was serialised.
+ * @param tolerance the largest difference allowed (0 for an exact match).
+ */
+static void check(const char *name, size_t index, double actual, double expected, double tolerance = 0)
+{
+    if (!(fabs(actual - expected) <= tolerance))
+    {
+        printf("%s[%zu] is %.9g, expected %.9g (tolerance %.3g)\n", name, index, actual, expected, tolerance);
+        failures++;
+    }
+}
+
+/**
+ * @brief Checks that the decoder reported success and gave the expected number of records.
+ *
+ */
+template <typename Columns>
+static bool checkDecoded(const char *name, bool decoded, const Columns &columns)
+{
+    if (!decoded || columns.size() != RECORDS)
+    {
+        printf("%s: decoded %d with %zu records, expected %d\n", name, decoded, columns.size(), RECORDS);
+        failures++;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Creates strain gauge records over the range of each field.
+ *
+ */
+static void makeHighSpeed(HighSpeedData *records)
+{
+    for (int i = 0; i < RECORDS; i++)
+    {
+        HighSpeedData &data = records[i];
+        data.timestamp = 1000000 + i * SAMPLE_PERIOD + (i % 7) * 100;
+        data.position = -M_PI + 2 * M_PI * i / RECORDS;
+        data.velocity = 8 + 3 * sinf(i * 0.4f);
+        data.raw = (i * 335544) & 0xffffff;
+        data.torque = 150 * sinf(i * 0.7f) - 20;
+        data.isTransmitting = i % 3 == 0;
+    }
+}
+
+/**
+ * @brief Creates IMU records over the range of each field.
+ *
+ */
+static void makeIMU(IMUData *records)
+{
+    for (int i = 0; i < RECORDS; i++)
+    {
+        IMUData &data = records[i];
+        data.timestamp = 2000000 + i * SAMPLE_PERIOD + (i % 5) * 50;
+        data.position = M_PI - 2 * M_PI * i / RECORDS;
+        data.velocity = -5 + 2 * cosf(i * 0.3f);
+        data.xAccel = 60 * sinf(i * 0.5f);
+        data.yAccel = -60 * cosf(i * 0.2f);
+        data.zAccel = 9.81f + i * 0.1f;
+        data.xGyro = 60 * cosf(i * 0.9f);
+        data.yGyro = -0.5f * i;
+        data.zGyro = 40 * sinf(i * 1.1f);
+        data.sampleRate = 208;
+    }
+}
+
+/**
+ * @brief Checks the fields common to all high speed records.
+ *
+ * @param packed whether to allow a fixed point step of error (packed) or require an exact match (legacy).
+ */
+template <typename Columns, typename Data>
+static void checkBase(const char *name, const Columns &columns, const Data *records, bool packed)
+{
+    for (int i = 0; i < RECORDS; i++)
+    {
+        char field[64];
+        snprintf(field, sizeof(field), "%s.timestamp", name);
+        check(field, i, columns.timestamp[i], records[i].timestamp);
+        snprintf(field, sizeof(field), "%s.position", name);
+        check(field, i, columns.position[i], records[i].position, packed ? 1 / PACKED_ANGLE_SCALE : 0);
+        snprintf(field, sizeof(field), "%s.velocity", name);
+        check(field, i, columns.velocity[i], records[i].velocity, packed ? 1.0 / PACKED_VELOCITY_SCALE : 0);
+    }
+}
+
+static void testHighSpeed()
+{
+    HighSpeedData records[RECORDS];
+    makeHighSpeed(records);
+
+    // Legacy.
+    uint8_t packet[RECORDS * HighSpeedData::FAST_BYTES_SIZE];
+    for (int i = 0; i < RECORDS; i++)
+    {
+        records[i].toBytes(packet + i * HighSpeedData::FAST_BYTES_SIZE);
+    }
+    HighSpeedColumns columns;
+    if (checkDecoded("highSpeed", decodeHighSpeedPacket(packet, sizeof(packet), PACKET_FORMAT_LEGACY, columns), columns))
+    {
+        checkBase("highSpeed", columns, records, false);
+        for (int i = 0; i < RECORDS; i++)
+        {
+            check("highSpeed.raw", i, columns.raw[i], records[i].raw);
+            check("highSpeed.torque", i, columns.torque[i], records[i].torque);
+            check("highSpeed.power", i, columns.power[i], records[i].velocity * records[i].torque); // As power().
+            check("highSpeed.isTransmitting", i, columns.isTransmitting[i], records[i].isTransmitting);
+        }
+    }
+
+    // Packed.
+    records[0].packedHeader(packet);
+    for (int i = 0; i < RECORDS; i++)
+    {
+        records[i].toPackedBytes(packet + HighSpeedData::PACKED_HEADER_SIZE + i * HighSpeedData::PACKED_BYTES_SIZE,
+                                 records[i ? i - 1 : 0].timestamp, records[0].velocity);
+    }
+    const size_t packedLength = HighSpeedData::PACKED_HEADER_SIZE + RECORDS * HighSpeedData::PACKED_BYTES_SIZE;
+    columns.clear();
+    if (checkDecoded("highSpeedPacked", decodeHighSpeedPacket(packet, packedLength, PACKET_FORMAT_PACKED, columns), columns))
+    {
+        checkBase("highSpeedPacked", columns, records, true);
+        const double torqueStep = 1.0 / PACKED_TORQUE_SCALE;
+        const double velocityStep = 1.0 / PACKED_VELOCITY_SCALE;
+        for (int i = 0; i < RECORDS; i++)
+        {
+            check("highSpeedPacked.raw", i, columns.raw[i], records[i].raw);
+            check("highSpeedPacked.torque", i, columns.torque[i], records[i].torque, torqueStep);
+            check("highSpeedPacked.isTransmitting", i, columns.isTransmitting[i], records[i].isTransmitting);
+
+            // Power is calculated from the decoded velocity and torque, so is out by as much as their errors allow.
+            const double powerStep = fabs(records[i].velocity) * torqueStep + fabs(records[i].torque) * velocityStep +
+                                     velocityStep * torqueStep;
+            check("highSpeedPacked.power", i, columns.power[i], records[i].velocity * records[i].torque, powerStep);
+        }
+    }
+
+    // Packets that aren't a whole number of records are rejected.
+    columns.clear();
+    if (decodeHighSpeedPacket(packet, packedLength - 1, PACKET_FORMAT_PACKED, columns) || columns.size())
+    {
+        printf("highSpeedPacked: a truncated packet was decoded\n");
+        failures++;
+    }
+}
+
+static void testIMU()
+{
+    IMUData records[RECORDS];
+    makeIMU(records);
+
+    // Legacy. The sample rate isn't sent.
+    uint8_t packet[RECORDS * IMUData::IMU_BYTES_SIZE];
+    for (int i = 0; i < RECORDS; i++)
+    {
+        records[i].toBytes(packet + i * IMUData::IMU_BYTES_SIZE);
+    }
+    IMUColumns columns;
+    if (checkDecoded("imu", decodeIMUPacket(packet, sizeof(packet), PACKET_FORMAT_LEGACY, columns), columns))
+    {
+        checkBase("imu", columns, records, false);
+        for (int i = 0; i < RECORDS; i++)
+        {
+            check("imu.xAccel", i, columns.xAccel[i], records[i].xAccel);
+            check("imu.yAccel", i, columns.yAccel[i], records[i].yAccel);
+            check("imu.zAccel", i, columns.zAccel[i], records[i].zAccel);
+            check("imu.xGyro", i, columns.xGyro[i], records[i].xGyro);
+            check("imu.yGyro", i, columns.yGyro[i], records[i].yGyro);
+            check("imu.zGyro", i, columns.zGyro[i], records[i].zGyro);
+            check("imu.sampleRate", i, columns.sampleRate[i], 0);
+        }
+    }
+
+    // Packed.
+    records[0].packedHeader(packet);
+    for (int i = 0; i < RECORDS; i++)
+    {
+        records[i].toPackedBytes(packet + IMUData::PACKED_HEADER_SIZE + i * IMUData::PACKED_BYTES_SIZE,
+                                 records[i ? i - 1 : 0].timestamp, records[0].velocity);
+    }
+    const size_t packedLength = IMUData::PACKED_HEADER_SIZE + RECORDS * IMUData::PACKED_BYTES_SIZE;
+    columns.clear();
+    if (checkDecoded("imuPacked", decodeIMUPacket(packet, packedLength, PACKET_FORMAT_PACKED, columns), columns))
+    {
+        checkBase("imuPacked", columns, records, true);
+        const double accelStep = 1.0 / PACKED_ACCEL_SCALE;
+        const double gyroStep = 1.0 / PACKED_GYRO_SCALE;
+        for (int i = 0; i < RECORDS; i++)
+        {
+            check("imuPacked.xAccel", i, columns.xAccel[i], records[i].xAccel, accelStep);
+            check("imuPacked.yAccel", i, columns.yAccel[i], records[i].yAccel, accelStep);
+            check("imuPacked.zAccel", i, columns.zAccel[i], records[i].zAccel, accelStep);
+            check("imuPacked.xGyro", i, columns.xGyro[i], records[i].xGyro, gyroStep);
+            check("imuPacked.yGyro", i, columns.yGyro[i], records[i].yGyro, gyroStep);
+            check("imuPacked.zGyro", i, columns.zGyro[i], records[i].zGyro, gyroStep);
+            check("imuPacked.sampleRate", i, columns.sampleRate[i], records[0].sampleRate);
+        }
+    }
+}
+
+static void testLowSpeed()
+{
+    LowSpeedData records[RECORDS];
+    uint8_t data[RECORDS * LowSpeedData::LOW_SPEED_BYTES_SIZE];
+    for (int i = 0; i < RECORDS; i++)
+    {
+        records[i] = {(uint32_t)i, 750000 + i * 1000u, 3000000 + i * 750000u, 100 + i * 5.5f, 0.4f + i * 0.004f};
+        records[i].rotationEvent = i % 2;
+        records[i].toBytes(data + i * LowSpeedData::LOW_SPEED_BYTES_SIZE);
+    }
+    LowSpeedColumns columns;
+    if (checkDecoded("lowSpeed", decodeLowSpeedRecords(data, sizeof(data), columns), columns))
+    {
+        for (int i = 0; i < RECORDS; i++)
+        {
+            check("lowSpeed.timestamp", i, columns.timestamp[i], records[i].timestamp);
+            check("lowSpeed.rotationCount", i, columns.rotationCount[i], records[i].rotationCount);
+            check("lowSpeed.lastRotationDuration", i, columns.lastRotationDuration[i], records[i].lastRotationDuration);
+            check("lowSpeed.power", i, columns.power[i], records[i].power);
+            check("lowSpeed.balance", i, columns.balance[i], records[i].balance);
+            check("lowSpeed.rotationEvent", i, columns.rotationEvent[i], records[i].rotationEvent);
+        }
+    }
+}
+
+int main()
+{
+    testHighSpeed();
+    testIMU();
+    testLowSpeed();
+    if (failures)
+    {
+        printf("FAILED: %d mismatches\n", failures);
+        return 1;
+    }
+    printf("PASSED\n");
+    return 0;
+}
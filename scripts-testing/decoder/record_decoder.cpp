@@ -0,0 +1,195 @@
+/**
+ * @file record_decoder.cpp
+ * @brief Decodes the binary records sent by the power meter on a computer.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include "record_decoder.h"
+#include <algorithm>
+
+/**
+ * @brief Copies a field from each record into a column.
+ *
+ * @param column the column to write to, already big enough.
+ * @param records the first record.
+ * @param count the number of records.
+ * @param stride the size of each record.
+ * @param offset the offset of the field in each record.
+ */
+template <typename T>
+static void copyColumn(T *column, const uint8_t *records, size_t count, size_t stride, size_t offset)
+{
+    records += offset;
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(column + i, records + i * stride, sizeof(T));
+    }
+}
+
+/**
+ * @brief Converts a fixed point field from each packed record and writes it into a column.
+ *
+ * @tparam W the type on the wire.
+ * @param column the column to write to, already big enough.
+ * @param records the first record.
+ * @param count the number of records.
+ * @param stride the size of each record.
+ * @param offset the offset of the field in each record.
+ * @param scale the number the value was multiplied by before sending.
+ */
+template <typename W, typename T>
+static void scaleColumn(T *column, const uint8_t *records, size_t count, size_t stride, size_t offset, float scale)
+{
+    records += offset;
+    for (size_t i = 0; i < count; i++)
+    {
+        W value;
+        memcpy(&value, records + i * stride, sizeof(W));
+        column[i] = static_cast<float>(value) / scale;
+    }
+}
+
+/**
+ * @brief Decodes the fields common to all packed records.
+ *
+ * Timestamps are the sum of the deltas from the base timestamp and velocities are relative to the base velocity, so
+ * these can't be converted independently.
+ *
+ */
+template <typename Wire, typename Columns>
+static void decodePackedBase(Columns &columns, size_t start, const uint8_t *records, size_t count, uint32_t timestamp,
+                             float velocity)
+{
+    uint32_t *timestamps = columns.timestamp.data() + start;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint16_t delta;
+        memcpy(&delta, records + i * sizeof(Wire) + offsetof(Wire, delta), sizeof(delta));
+        timestamp += delta;
+        timestamps[i] = timestamp;
+    }
+    scaleColumn<int16_t>(columns.position.data() + start, records, count, sizeof(Wire), offsetof(Wire, position),
+                         PACKED_ANGLE_SCALE);
+
+    float *velocities = columns.velocity.data() + start;
+    scaleColumn<int16_t>(velocities, records, count, sizeof(Wire), offsetof(Wire, velocity), PACKED_VELOCITY_SCALE);
+    for (size_t i = 0; i < count; i++)
+    {
+        velocities[i] += velocity;
+    }
+}
+
+// Helpers for going through the fields in a schema. `Wire`, `columns`, `start`, `records` and `count` need to be
+// defined where these are used.
+#define DECODER_RESIZE(name, ...) columns.name.resize(start + count);
+#define DECODER_COPY(name, type, ...) \
+    copyColumn(columns.name.data() + start, records, count, sizeof(Wire), offsetof(Wire, name));
+#define DECODER_SCALE(name, type, value, scale) \
+    scaleColumn<type>(columns.name.data() + start, records, count, sizeof(Wire), offsetof(Wire, name), scale);
+
+/**
+ * @brief Decodes legacy records, which are copied as is.
+ *
+ */
+#define DECODE_LEGACY(wireType, schema)             \
+    do                                              \
+    {                                               \
+        typedef wireType Wire;                      \
+        if (length % sizeof(Wire))                  \
+        {                                           \
+            return false;                           \
+        }                                           \
+        const uint8_t *records = data;              \
+        const size_t count = length / sizeof(Wire); \
+        schema(DECODER_RESIZE)                      \
+        schema(DECODER_COPY)                        \
+        return true;                                \
+    } while (0)
+
+bool decodeIMUPacket(const uint8_t *data, size_t length, uint8_t format, IMUColumns &columns)
+{
+    const size_t start = columns.size();
+    if (format == PACKET_FORMAT_LEGACY)
+    {
+        typedef IMUWire Wire;
+        if (length % sizeof(Wire))
+        {
+            return false;
+        }
+        const uint8_t *records = data;
+        const size_t count = length / sizeof(Wire);
+        IMU_COLUMN_SCHEMA(DECODER_RESIZE)
+        IMU_SCHEMA(DECODER_COPY)
+        return true;
+    }
+
+    // Packed. Older firmware didn't send the sample rate.
+    if (format != PACKET_FORMAT_PACKED || !length)
+    {
+        return false;
+    }
+    PackedIMUHeaderWire header = {};
+    const size_t headerSize = data[0] == PACKED_VERSION_SAMPLE_RATE ? sizeof(PackedIMUHeaderWire)
+                                                                    : sizeof(PackedHeaderWire);
+    if ((data[0] != PACKED_VERSION_SAMPLE_RATE && data[0] != PACKET_FORMAT_PACKED) || length < headerSize)
+    {
+        return false;
+    }
+    memcpy(&header, data, headerSize);
+
+    typedef PackedIMUWire Wire;
+    if ((length - headerSize) % sizeof(Wire))
+    {
+        return false;
+    }
+    const uint8_t *records = data + headerSize;
+    const size_t count = (length - headerSize) / sizeof(Wire);
+    IMU_COLUMN_SCHEMA(DECODER_RESIZE)
+    decodePackedBase<Wire>(columns, start, records, count, header.timestamp, header.velocity);
+    PACKED_IMU_FIELDS(DECODER_SCALE)
+    std::fill(columns.sampleRate.begin() + start, columns.sampleRate.end(), header.sampleRate);
+    return true;
+}
+
+bool decodeHighSpeedPacket(const uint8_t *data, size_t length, uint8_t format, HighSpeedColumns &columns)
+{
+    const size_t start = columns.size();
+    if (format == PACKET_FORMAT_LEGACY)
+    {
+        DECODE_LEGACY(HighSpeedWire, HIGH_SPEED_SCHEMA);
+    }
+
+    // Packed.
+    PackedHeaderWire header;
+    if (format != PACKET_FORMAT_PACKED || length < sizeof(header) || data[0] != PACKET_FORMAT_PACKED)
+    {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    typedef PackedHighSpeedWire Wire;
+    if ((length - sizeof(header)) % sizeof(Wire))
+    {
+        return false;
+    }
+    const uint8_t *records = data + sizeof(header);
+    const size_t count = (length - sizeof(header)) / sizeof(Wire);
+    HIGH_SPEED_SCHEMA(DECODER_RESIZE)
+    decodePackedBase<Wire>(columns, start, records, count, header.timestamp, header.velocity);
+    PACKED_HIGH_SPEED_FIELDS(DECODER_SCALE)
+
+    // Power isn't sent.
+    for (size_t i = start; i < start + count; i++)
+    {
+        columns.power[i] = columns.velocity[i] * columns.torque[i];
+    }
+    return true;
+}
+
+bool decodeLowSpeedRecords(const uint8_t *data, size_t length, LowSpeedColumns &columns)
+{
+    const size_t start = columns.size();
+    DECODE_LEGACY(LowSpeedWire, LOW_SPEED_SCHEMA);
+}
@@ -0,0 +1,107 @@
+/**
+ * @file record_decoder.h
+ * @brief Decodes the binary records sent by the power meter on a computer.
+ *
+ * The layouts come from the firmware's `record_schema.h`, so a change to a record only needs to be made once. Records
+ * are decoded straight into columns (one `std::vector` per field), which is faster for whole recordings than decoding
+ * a struct at a time and suits plotting and analysis. Each call appends to the columns, so messages can be decoded as
+ * they arrive and the columns reused by calling `clear()`.
+ *
+ * Build the library using `make` from this directory and include `record_decoder.h` and `libdecoder.a`. This assumes
+ * the computer is little endian like the ESP32.
+ *
+ * @author Jotham Gates and Oscar Varney, MHP
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "record_schema.h"
+
+/**
+ * @brief Generates a column for each field in a schema and methods that apply to all of them.
+ *
+ */
+#define DECODER_COLUMN(name, type, ...) std::vector<type> name;
+#define DECODER_CLEAR(name, ...) name.clear();
+#define DECODER_COLUMNS(schema)                             \
+    schema(DECODER_COLUMN)                                  \
+                                                            \
+    /** @brief The number of records decoded. */            \
+    size_t size() const { return timestamp.size(); }        \
+                                                            \
+    /** @brief Removes all records, keeping the memory. */ \
+    void clear() { schema(DECODER_CLEAR) }
+
+/**
+ * @brief The sample rate is only in the header of packed IMU packets. It is 0 for legacy packets and packed packets
+ * from firmware that didn't send it.
+ *
+ */
+#define IMU_COLUMN_SCHEMA(FIELD) IMU_SCHEMA(FIELD) FIELD(sampleRate, uint16_t, sampleRate)
+
+/**
+ * @brief Decoded IMU records. Records from packed packets are converted back to floats.
+ *
+ */
+struct IMUColumns
+{
+    DECODER_COLUMNS(IMU_COLUMN_SCHEMA)
+};
+
+/**
+ * @brief Decoded strain gauge records for one side. Power is calculated for records from packed packets.
+ *
+ */
+struct HighSpeedColumns
+{
+    DECODER_COLUMNS(HIGH_SPEED_SCHEMA)
+};
+
+/**
+ * @brief Decoded low speed records.
+ *
+ */
+struct LowSpeedColumns
+{
+    DECODER_COLUMNS(LOW_SPEED_SCHEMA)
+};
+
+/**
+ * @brief Decodes an IMU message (`/power/imu`) and appends the records to the columns.
+ *
+ * @param data the payload of the message.
+ * @param length the length of the payload in bytes.
+ * @param format `"packet-format"` from the about message (PACKET_FORMAT_LEGACY or PACKET_FORMAT_PACKED).
+ * @param columns the columns to append to.
+ * @return true if the message was decoded.
+ * @return false if the message wasn't valid for the format. Nothing is appended.
+ */
+bool decodeIMUPacket(const uint8_t *data, size_t length, uint8_t format, IMUColumns &columns);
+
+/**
+ * @brief Decodes a strain gauge message (`/power/fast/left` or `/power/fast/right`) and appends the records to the
+ * columns.
+ *
+ * @param data the payload of the message.
+ * @param length the length of the payload in bytes.
+ * @param format `"packet-format"` from the about message (PACKET_FORMAT_LEGACY or PACKET_FORMAT_PACKED).
+ * @param columns the columns to append to.
+ * @return true if the message was decoded.
+ * @return false if the message wasn't valid for the format. Nothing is appended.
+ */
+bool decodeHighSpeedPacket(const uint8_t *data, size_t length, uint8_t format, HighSpeedColumns &columns);
+
+/**
+ * @brief Decodes one or more binary low speed records (`/power/power` with `"low-speed-format": 1` or low speed
+ * backfill entries) and appends them to the columns.
+ *
+ * @param data the records.
+ * @param length the length of the records in bytes.
+ * @param columns the columns to append to.
+ * @return true if the records were decoded.
+ * @return false if the length isn't a multiple of the record size. Nothing is appended.
+ */
+bool decodeLowSpeedRecords(const uint8_t *data, size_t length, LowSpeedColumns &columns);
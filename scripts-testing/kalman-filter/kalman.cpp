@@ -1 +1 @@
-../../power-meter-code/src/kalman.cpp
\ No newline at end of file
+../../power-meter-code/src/src/kalman.cpp
\ No newline at end of file
@@ -1 +1 @@
-../../power-meter-code/src/kalman.h
\ No newline at end of file
+../../power-meter-code/src/src/kalman.h
\ No newline at end of file
@@ -0,0 +1,179 @@
+/**
+ * @file kalman_benchmark.cpp
+ * @brief Benchmark comparing the closed-form and generic Kalman filter implementations.
+ *
+ * Build and run with `make benchmark`. This compiles this file twice, once with the default closed-form implementation
+ * and once with `KALMAN_GENERIC` defined, then runs both with `float` and `double`. The generic build saves its final
+ * states using `-o FILE` and the closed-form build checks its own against them using `-c FILE`, exiting with an error
+ * if any differ by more than the tolerance for the type.
+ *
+ * @version 0.1.0
+ * @date 2026-10-14
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "kalman.cpp"
+
+#ifdef KALMAN_CLOSED_FORM
+#define IMPLEMENTATION "closed-form"
+#else
+#define IMPLEMENTATION "generic"
+#endif
+
+#define ITERATIONS 1000000
+#define SAMPLE_PERIOD 10000 // us between IMU updates (100Hz).
+#define PREDICTS_PER_UPDATE 2 // Roughly 2 sides at 80Hz for each IMU sample.
+#define STATE_VALUES 7        // x (2), P (4) and the checksum of the predictions.
+#define FLOAT_TOLERANCE 1e-4  // Largest relative difference allowed between implementations.
+#define DOUBLE_TOLERANCE 1e-9
+
+/**
+ * @brief Runs the filter on a simulated crank rotating at a constant speed.
+ *
+ * @tparam T the type to calculate with.
+ * @param name the name of the type to print.
+ * @param state filled in with the final state (see `STATE_VALUES`).
+ */
+template <typename T>
+void benchmark(const char *name, double state[STATE_VALUES])
+{
+    Matrix<2, 2, T> qEnvCovariance = {2e-3, 0, 0, 0.1};
+    Matrix<2, 2, T> rMeasCovariance = {100, 0, 0, 1e-2};
+    Kalman<T> kalman(qEnvCovariance, rMeasCovariance, {0, 0}, {1000, 0, 0, 1000});
+
+    // Pre-calculate the measurements so only the filter is timed.
+    const T velocity = 8; // rad/s, approximately 76 rpm.
+    static Matrix<2, 1, T> measurements[1000];
+    for (int i = 0; i < 1000; i++)
+    {
+        T angle = fmod(velocity * i * SAMPLE_PERIOD * 1e-6 + M_PI, 2 * M_PI) - M_PI;
+        measurements[i] = {angle + (T)(0.05 * sin(i * 1.3)), velocity + (T)(0.02 * cos(i * 0.7))};
+    }
+
+    // Time updates.
+    uint32_t time = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        time += SAMPLE_PERIOD;
+        kalman.update(measurements[i % 1000], time);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double updateNs = std::chrono::duration<double, std::nano>(end - start).count() / ITERATIONS;
+
+    // Time state only predictions (as used by the amp tasks).
+    Matrix<2, 1, T> predicted;
+    T checksum = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS * PREDICTS_PER_UPDATE; i++)
+    {
+        kalman.predict(time + (i % SAMPLE_PERIOD), predicted);
+        checksum += predicted(0, 0);
+    }
+    end = std::chrono::steady_clock::now();
+    double predictNs = std::chrono::duration<double, std::nano>(end - start).count() / (ITERATIONS * PREDICTS_PER_UPDATE);
+
+    Matrix<2, 1, T> x = kalman.getState();
+    Matrix<2, 2, T> p = kalman.getCovariance();
+    printf("%-12s %-7s update: %7.1fns predict: %7.1fns | x = [%.6f, %.6f] P = [%.6e, %.6e; %.6e, %.6e] (%g)\n",
+           IMPLEMENTATION, name, updateNs, predictNs, (double)x(0, 0), (double)x(1, 0), (double)p(0, 0),
+           (double)p(0, 1), (double)p(1, 0), (double)p(1, 1), (double)checksum);
+
+    const double values[STATE_VALUES] = {(double)x(0, 0), (double)x(1, 0), (double)p(0, 0), (double)p(0, 1),
+                                         (double)p(1, 0), (double)p(1, 1), (double)checksum};
+    for (int i = 0; i < STATE_VALUES; i++)
+    {
+        state[i] = values[i];
+    }
+}
+
+/**
+ * @brief Checks that two final states match.
+ *
+ * @param name the name of the type to print.
+ * @param state the state from this implementation.
+ * @param reference the state from the other implementation.
+ * @param tolerance the largest relative difference allowed (relative to 1e-6 for values smaller than that).
+ * @return true if every value is within the tolerance.
+ */
+bool compare(const char *name, const double state[STATE_VALUES], const double reference[STATE_VALUES], double tolerance)
+{
+    bool matches = true;
+    for (int i = 0; i < STATE_VALUES; i++)
+    {
+        const double scale = fmax(1e-6, fabs(reference[i]));
+        if (!(fabs(state[i] - reference[i]) <= tolerance * scale))
+        {
+            printf("%s value %d is %.9e, but the reference is %.9e\n", name, i, state[i], reference[i]);
+            matches = false;
+        }
+    }
+    return matches;
+}
+
+int main(int argc, char *argv[])
+{
+    double states[2][STATE_VALUES];
+    benchmark<float>("float", states[0]);
+    benchmark<double>("double", states[1]);
+
+    if (argc == 3 && !strcmp(argv[1], "-o"))
+    {
+        // Save the states for the other implementation to check against.
+        FILE *file = fopen(argv[2], "w");
+        if (!file)
+        {
+            printf("Couldn't open '%s'\n", argv[2]);
+            return 1;
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            for (int j = 0; j < STATE_VALUES; j++)
+            {
+                fprintf(file, "%.17g\n", states[i][j]);
+            }
+        }
+        fclose(file);
+    }
+    else if (argc == 3 && !strcmp(argv[1], "-c"))
+    {
+        // Check against the states saved by the other implementation.
+        FILE *file = fopen(argv[2], "r");
+        if (!file)
+        {
+            printf("Couldn't open '%s'\n", argv[2]);
+            return 1;
+        }
+        double reference[2][STATE_VALUES];
+        for (int i = 0; i < 2; i++)
+        {
+            for (int j = 0; j < STATE_VALUES; j++)
+            {
+                if (fscanf(file, "%lf", &reference[i][j]) != 1)
+                {
+                    printf("'%s' is missing values\n", argv[2]);
+                    fclose(file);
+                    return 1;
+                }
+            }
+        }
+        fclose(file);
+
+        const bool matches = compare("float", states[0], reference[0], FLOAT_TOLERANCE) &
+                             compare("double", states[1], reference[1], DOUBLE_TOLERANCE);
+        if (!matches)
+        {
+            printf("FAILED: " IMPLEMENTATION " doesn't match the reference\n");
+            return 1;
+        }
+        printf("PASSED: " IMPLEMENTATION " matches the reference\n");
+    }
+    else if (argc != 1)
+    {
+        printf("Usage: %s [-o FILE | -c FILE]\n", argv[0]);
+        return 1;
+    }
+    return 0;
+}
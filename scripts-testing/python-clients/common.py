@@ -178,10 +178,55 @@ class Side(Enum):
     RIGHT = "right"
 
 
+PACKET_FORMAT_LEGACY = 0
+PACKET_FORMAT_PACKED = 1
+
+# Header version of packed IMU packets, which adds the sample rate (Hz) to the end of the header.
+PACKED_VERSION_SAMPLE_RATE = 2
+
+# Formats of low speed messages, as announced in the about message ("low-speed-format").
+LOW_SPEED_FORMAT_JSON = 0
+LOW_SPEED_FORMAT_BINARY = 1
+
+# Scale factors for fixed point values in packed records (see data_points.h in the firmware).
+PACKED_ANGLE_SCALE = 32767 / np.pi
+PACKED_VELOCITY_SCALE = 1000
+PACKED_TORQUE_SCALE = 100
+PACKED_ACCEL_SCALE = 500
+PACKED_GYRO_SCALE = 500
+PACKED_HEADER_FORMAT = "<BLf"
+PACKED_HEADER_SIZE = struct.calcsize(PACKED_HEADER_FORMAT)
+PACKED_SAMPLE_RATE_FORMAT = "<H"
+PACKED_SAMPLE_RATE_SIZE = struct.calcsize(PACKED_SAMPLE_RATE_FORMAT)
+
+
+def _unpack_packed_base(
+    data: bytes, previous_timestamp: int, base_velocity: float
+) -> Tuple[int, float, float]:
+    """Decodes the start of a packed record that is common to all record types.
+
+    Args:
+        data (bytes): The packed record.
+        previous_timestamp (int): The timestamp of the previous record in the packet.
+        base_velocity (float): The base velocity from the packet header.
+
+    Returns:
+        Tuple[int, float, float]: The timestamp, velocity and position.
+    """
+    delta, position, velocity = struct.unpack("<Hhh", data[:6])
+    timestamp = (previous_timestamp + delta) & 0xFFFFFFFF
+    return (
+        timestamp,
+        base_velocity + velocity / PACKED_VELOCITY_SCALE,
+        position / PACKED_ANGLE_SCALE,
+    )
+
+
 class IMUData:
     """Class for storing and processing data from the IMU."""
 
     SIZE = 36
+    PACKED_SIZE = 18
 
     def __init__(self, data: bytes) -> None:
         """Initialises the object.
@@ -201,6 +246,33 @@ class IMUData:
             self.gyro_z,
         ) = struct.unpack("<Lffffffff", data)
 
+    @classmethod
+    def from_packed(
+        cls, data: bytes, previous_timestamp: int, base_velocity: float
+    ) -> "IMUData":
+        """Creates an object from a record in a packed packet.
+
+        Args:
+            data (bytes): The packed record.
+            previous_timestamp (int): The timestamp of the previous record in the packet.
+            base_velocity (float): The base velocity from the packet header.
+
+        Returns:
+            IMUData: The decoded record.
+        """
+        result = cls.__new__(cls)
+        result.timestamp, result.velocity, result.position = _unpack_packed_base(
+            data, previous_timestamp, base_velocity
+        )
+        values = struct.unpack("<hhhhhh", data[6:])
+        result.accel_x, result.accel_y, result.accel_z = [
+            i / PACKED_ACCEL_SCALE for i in values[:3]
+        ]
+        result.gyro_x, result.gyro_y, result.gyro_z = [
+            i / PACKED_GYRO_SCALE for i in values[3:]
+        ]
+        return result
+
     def cadence(self) -> float:
         """Calculates the current cadence from the velocity.
 
@@ -217,6 +289,7 @@ class StrainData:
     """Class for storing and processing data from a strain gauge"""
 
     SIZE = 25
+    PACKED_SIZE = 12
 
     def __init__(self, data: bytes) -> None:
         """Initialises the object.
@@ -234,10 +307,226 @@ class StrainData:
             self.transmitting
         ) = struct.unpack("<LffLff?", data)
 
+    @classmethod
+    def from_packed(
+        cls, data: bytes, previous_timestamp: int, base_velocity: float
+    ) -> "StrainData":
+        """Creates an object from a record in a packed packet.
+
+        Args:
+            data (bytes): The packed record.
+            previous_timestamp (int): The timestamp of the previous record in the packet.
+            base_velocity (float): The base velocity from the packet header.
+
+        Returns:
+            StrainData: The decoded record.
+        """
+        result = cls.__new__(cls)
+        result.timestamp, result.velocity, result.position = _unpack_packed_base(
+            data, previous_timestamp, base_velocity
+        )
+        (torque,) = struct.unpack("<h", data[6:8])
+        result.torque = torque / PACKED_TORQUE_SCALE
+        result.raw = int.from_bytes(data[8:11], "little")
+        result.transmitting = bool(data[11])
+        result.power = result.torque * result.velocity
+        return result
+
     def __str__(self) -> str:
         return f"{self.timestamp:>10d}: {self.velocity:>8.2f}rad/s {self.position:>8.1f}rad {self.raw:>11d}raw {self.torque:>8.2f}Nm {self.power:>8.2f}W {'Currently' if self.transmitting else 'Not'} transmitting."
 
 
+def decode_packet(data: bytes, record_type: type, packet_format: int) -> list:
+    """Decodes a high speed MQTT message into a list of records.
+
+    Args:
+        data (bytes): The full MQTT message.
+        record_type (type): IMUData or StrainData.
+        packet_format (int): The packet format announced in the about message ("packet-format"). Devices that don't
+                             announce a format use PACKET_FORMAT_LEGACY.
+
+    Returns:
+        list: The records, oldest first. Records from packets that include the IMU sample rate have it in a
+              `sample_rate` attribute (Hz).
+    """
+    if packet_format == PACKET_FORMAT_LEGACY:
+        return [
+            record_type(data[i : i + record_type.SIZE])
+            for i in range(0, len(data), record_type.SIZE)
+        ]
+
+    # Packed format.
+    version, timestamp, base_velocity = struct.unpack(
+        PACKED_HEADER_FORMAT, data[:PACKED_HEADER_SIZE]
+    )
+    start = PACKED_HEADER_SIZE
+    sample_rate = None
+    if version == PACKED_VERSION_SAMPLE_RATE:
+        (sample_rate,) = struct.unpack(
+            PACKED_SAMPLE_RATE_FORMAT, data[start : start + PACKED_SAMPLE_RATE_SIZE]
+        )
+        start += PACKED_SAMPLE_RATE_SIZE
+    elif version != PACKET_FORMAT_PACKED:
+        raise ValueError(f"Unsupported packet format version {version}")
+    result = []
+    for i in range(start, len(data), record_type.PACKED_SIZE):
+        record = record_type.from_packed(
+            data[i : i + record_type.PACKED_SIZE], timestamp, base_velocity
+        )
+        if sample_rate is not None:
+            record.sample_rate = sample_rate
+        timestamp = record.timestamp
+        result.append(record)
+    return result
+
+
+# Entries in backfill messages (see flash_log.h in the firmware).
+LOG_ENTRY_LEFT = 0
+LOG_ENTRY_RIGHT = 1
+LOG_ENTRY_IMU = 2
+LOG_ENTRY_LOW_SPEED = 3
+LOG_ENTRY_PROFILE_LEFT = 4
+LOG_ENTRY_PROFILE_RIGHT = 5
+LOG_ENTRY_HEADER_FORMAT = "<BBH"
+LOG_ENTRY_HEADER_SIZE = struct.calcsize(LOG_ENTRY_HEADER_FORMAT)
+LOG_STATE_UNSENT = 0xFE
+LOW_SPEED_FORMAT = "<LLLff?"
+
+
+def decode_backfill(data: bytes) -> List[Tuple[int, bytes]]:
+    """Splits a backfill MQTT message into its entries.
+
+    High speed and IMU entries are always in the packed format. Entries that were interrupted by a reset are skipped.
+
+    Args:
+        data (bytes): The full MQTT message.
+
+    Returns:
+        List[Tuple[int, bytes]]: The type (LOG_ENTRY_...) and payload of each entry, oldest first.
+    """
+    result = []
+    i = 0
+    while i + LOG_ENTRY_HEADER_SIZE <= len(data):
+        entry_type, state, length = struct.unpack(
+            LOG_ENTRY_HEADER_FORMAT, data[i : i + LOG_ENTRY_HEADER_SIZE]
+        )
+        i += LOG_ENTRY_HEADER_SIZE
+        if state == LOG_STATE_UNSENT:
+            result.append((entry_type, data[i : i + length]))
+        i += length
+    return result
+
+
+def decode_low_speed(data: bytes) -> dict:
+    """Decodes a binary low speed record (from a backfill message or a `/power/power` message in the binary format)
+    into the same keys as a JSON `/power/power` message.
+
+    Args:
+        data (bytes): The entry payload.
+
+    Returns:
+        dict: The low speed data.
+    """
+    timestamp, rotations, duration, power, balance, rotation_event = struct.unpack(
+        LOW_SPEED_FORMAT, data
+    )
+    return {
+        "timestamp": timestamp,
+        "cadence": 60e6 / duration if rotation_event and duration else 0,
+        "rotations": rotations,
+        "power": power,
+        "balance": balance,
+    }
+
+
+# Torque profiles published once per rotation (see TorqueProfile in data_points.h in the firmware).
+PROFILE_HEADER_FORMAT = "<BLLB"
+PROFILE_HEADER_SIZE = struct.calcsize(PROFILE_HEADER_FORMAT)
+PROFILE_EMPTY_BIN = -32768
+
+
+class TorqueProfile:
+    """Average torque in equally sized angular bins over a single rotation of one side."""
+
+    def __init__(self, data: bytes) -> None:
+        _, self.timestamp, self.duration, bin_count = struct.unpack(
+            PROFILE_HEADER_FORMAT, data[:PROFILE_HEADER_SIZE]
+        )
+        packed = struct.unpack(
+            f"<{bin_count}h", data[PROFILE_HEADER_SIZE : PROFILE_HEADER_SIZE + 2 * bin_count]
+        )
+        # Bins without any samples are NaN.
+        self.torques = [
+            np.nan if value == PROFILE_EMPTY_BIN else value / PACKED_TORQUE_SCALE
+            for value in packed
+        ]
+
+    def bin_angles(self) -> List[float]:
+        """Calculates the angle at the centre of each bin in radians."""
+        bin_count = len(self.torques)
+        return [-np.pi + 2 * np.pi * (i + 0.5) / bin_count for i in range(bin_count)]
+
+    def __str__(self) -> str:
+        return f"{self.timestamp},{self.duration}," + ",".join(f"{torque:.2f}" for torque in self.torques)
+
+
+# Histograms published on the stats topic (see stats.h in the firmware), in order.
+STATS_NAMES = [
+    "amp-latency-left",
+    "amp-latency-right",
+    "imu-latency",
+    "amp-read-left",
+    "amp-read-right",
+    "kalman-update",
+    "mqtt-publish",
+    "queue-left",
+    "queue-right",
+    "queue-imu",
+    "flash-erase",
+    "amp-skew",
+    "amp-read-paired",
+]
+STATS_QUEUE_NAMES = ["queue-left", "queue-right", "queue-imu"]
+STATS_US_NAMES = ["flash-erase", "amp-skew"]  # Recorded in us rather than cycles.
+STATS_HEADER_FORMAT = "<BLHBB"
+STATS_HEADER_SIZE = struct.calcsize(STATS_HEADER_FORMAT)
+
+
+def decode_stats(data: bytes) -> dict:
+    """Decodes a stats MQTT message.
+
+    Args:
+        data (bytes): The full MQTT message.
+
+    Returns:
+        dict: The device time in ms, the CPU frequency in MHz and a dictionary of histograms. Each histogram has the
+              sample count, maximum and a list of (upper limit, count) buckets. Timing histograms are in us, queue
+              histograms are in records. The last bucket has no upper limit.
+    """
+    version, time, cpu_mhz, count, bucket_count = struct.unpack(
+        STATS_HEADER_FORMAT, data[:STATS_HEADER_SIZE]
+    )
+    if version != 1:
+        raise ValueError(f"Unsupported stats version {version}")
+    histogram_format = f"<BLL{bucket_count}L"
+    histogram_size = struct.calcsize(histogram_format)
+    histograms = {}
+    for i in range(count):
+        start = STATS_HEADER_SIZE + i * histogram_size
+        shift, samples, maximum, *buckets = struct.unpack(
+            histogram_format, data[start : start + histogram_size]
+        )
+        name = STATS_NAMES[i] if i < len(STATS_NAMES) else str(i)
+        scale = 1 if name in STATS_QUEUE_NAMES or name in STATS_US_NAMES else 1 / cpu_mhz
+        limits = [(1 << (shift + b)) * scale for b in range(bucket_count - 1)] + [None]
+        histograms[name] = {
+            "count": samples,
+            "max": maximum * scale,
+            "buckets": list(zip(limits, buckets)),
+        }
+    return {"time": time, "cpu-mhz": cpu_mhz, "histograms": histograms}
+
+
 class LiveChart(ABC):
     def __init__(
         self, fig: Figure, ax: Axes, max_history: int = None, title: str = ""
@@ -519,6 +808,7 @@ class StrainConfig(Config):
         self.strain_offset = data["offset"]
         self.strain_coef = data["coef"]
         self.temp_coef = data["temp-coef"]
+        self.temp_coef2 = data.get("temp-coef2", 0)
         self.temp_offset = data["temp-test"]
 
     def as_dict(self):
@@ -527,6 +817,7 @@ class StrainConfig(Config):
             "coef": self.strain_coef,
             "temp-test": self.temp_offset,
             "temp-coef": self.temp_coef,
+            "temp-coef2": self.temp_coef2,
         }
     
     def apply(self, raw_values:np.ndarray, temperatures:np.ndarray) -> np.ndarray:
@@ -539,7 +830,8 @@ class StrainConfig(Config):
         Returns:
             np.ndarray: The processed data.
         """
-        return self.strain_coef*(raw_values - self.strain_offset) * (1-self.temp_coef) * (temperatures - self.temp_offset)
+        difference = temperatures - self.temp_offset
+        return self.strain_coef*(raw_values - self.strain_offset) * (1 - difference*(self.temp_coef + self.temp_coef2*difference))
 
 
 class KalmanConfig(Config):
@@ -554,12 +846,46 @@ class KalmanConfig(Config):
 
 
 class MQTTConfig(Config):
-    def __init__(self, data: dict = {"length": 0, "broker": ""}) -> None:
+    def __init__(
+        self,
+        data: dict = {
+            "length": 0,
+            "format": PACKET_FORMAT_LEGACY,
+            "low-speed-format": LOW_SPEED_FORMAT_JSON,
+            "broker": "",
+        },
+    ) -> None:
         self.length = data["length"]
+        self.format = data.get("format", PACKET_FORMAT_LEGACY)
+        self.low_speed_format = data.get("low-speed-format", LOW_SPEED_FORMAT_JSON)
         self.broker = data["broker"]
 
     def as_dict(self):
-        return {"length": self.length, "broker": self.broker}
+        return {
+            "length": self.length,
+            "format": self.format,
+            "low-speed-format": self.low_speed_format,
+            "broker": self.broker,
+        }
+
+
+class BackpressureConfig(Config):
+    def __init__(
+        self,
+        data: dict = {"housekeeping": 0, "low-speed": 0, "high-speed": 0, "imu": 0},
+    ) -> None:
+        self.housekeeping = data.get("housekeeping", 0)
+        self.low_speed = data.get("low-speed", 0)
+        self.high_speed = data.get("high-speed", 0)
+        self.imu = data.get("imu", 0)
+
+    def as_dict(self):
+        return {
+            "housekeeping": self.housekeeping,
+            "low-speed": self.low_speed,
+            "high-speed": self.high_speed,
+            "imu": self.imu,
+        }
 
 
 class WiFiConfig(Config):
@@ -581,6 +907,9 @@ class PowerMeterConfig(Config):
         self.sleep_time = 0
         self.left_strain = StrainConfig()
         self.right_strain = StrainConfig()
+        self.backpressure = BackpressureConfig()
+        self.profile_bins = 36
+        self.high_speed = True
         self.mqtt = MQTTConfig()
         self.wifi = WiFiConfig()
 
@@ -592,6 +921,9 @@ class PowerMeterConfig(Config):
             "sleep-time": self.sleep_time,
             "left-strain": self.left_strain.as_dict(),
             "right-strain": self.right_strain.as_dict(),
+            "profile-bins": self.profile_bins,
+            "high-speed": self.high_speed,
+            "backpressure": self.backpressure.as_dict(),
             "mqtt": self.mqtt.as_dict(),
             "wifi": self.wifi.as_dict()
         }
@@ -608,6 +940,9 @@ class PowerMeterConfig(Config):
         self.sleep_time = data["sleep-time"]
         self.left_strain = StrainConfig(data["left-strain"])
         self.right_strain = StrainConfig(data["right-strain"])
+        self.backpressure = BackpressureConfig(data.get("backpressure", {}))
+        self.profile_bins = data.get("profile-bins", 36)
+        self.high_speed = data.get("high-speed", True)
         self.mqtt = MQTTConfig(data["mqtt"])
         self.wifi = WiFiConfig(data["wifi"])
 
@@ -1,6 +1,6 @@
 #!/usr/bin/env python3
 """log_power_meter.py
-usage: log_power_meter.py [--help] [-h HOST] [-m {graph,csv,both}] [-r MAX_RECORDS] [-o OUTPUT] [--no-about] [--no-housekeeping] [--no-imu] [--no-left] [--no-right] [--no-power]
+usage: log_power_meter.py [--help] [-h HOST] [-m {graph,csv,both}] [-r MAX_RECORDS] [-o OUTPUT] [--no-about] [--no-housekeeping] [--no-imu] [--no-left] [--no-right] [--no-power] [--no-backfill] [--no-stats] [--no-profile]
 
 Subscribes to MQTT data from the power meter, decodes it and saves the data to a file and or draws it on a live graph.
 
@@ -23,6 +23,9 @@ Topics to include:
   --no-left             If present, does not subscribe to messages containing high speed data from the left ADC. (default: False)
   --no-right            If present, does not subscribe to messages containing high speed data from the right ADC. (default: False)
   --no-power            If present, does not subscribe to messages containing slow power data. (default: False)
+  --no-backfill         If present, does not subscribe to messages containing data logged while disconnected. (default: False)
+  --no-stats            If present, does not subscribe to timing stats messages. (default: False)
+  --no-profile          If present, does not subscribe to torque profile messages. (default: False)
 
 Written by Jotham Gates and Oscar Varney for MHP, 2024. For more information, please see here: https://github.com/monash-human-power/power-meter
 """
@@ -40,7 +43,7 @@ import time
 import json
 import traceback
 
-from common import IMUData, StrainData, Side, IMULiveChart, TorqueLiveChart, PowerLiveChart, SideDataPair
+from common import IMUData, StrainData, Side, IMULiveChart, TorqueLiveChart, PowerLiveChart, SideDataPair, decode_packet, decode_backfill, decode_low_speed, decode_stats, TorqueProfile, PACKET_FORMAT_LEGACY, PACKET_FORMAT_PACKED, LOW_SPEED_FORMAT_JSON, LOW_SPEED_FORMAT_BINARY, LOG_ENTRY_LEFT, LOG_ENTRY_RIGHT, LOG_ENTRY_IMU, LOG_ENTRY_LOW_SPEED, LOG_ENTRY_PROFILE_LEFT, LOG_ENTRY_PROFILE_RIGHT
 
 # Topics
 MQTT_TOPIC_PREFIX = "/power/"
@@ -51,10 +54,21 @@ MQTT_TOPIC_HIGH_SPEED = MQTT_TOPIC_PREFIX + "fast/"
 MQTT_TOPIC_IMU = MQTT_TOPIC_PREFIX + "imu"
 MQTT_TOPIC_LEFT = MQTT_TOPIC_HIGH_SPEED + Side.LEFT.value
 MQTT_TOPIC_RIGHT = MQTT_TOPIC_HIGH_SPEED + Side.RIGHT.value
+MQTT_TOPIC_BACKFILL = MQTT_TOPIC_PREFIX + "backfill"
+MQTT_TOPIC_STATS = MQTT_TOPIC_PREFIX + "stats"
+MQTT_TOPIC_PROFILE = MQTT_TOPIC_PREFIX + "profile/"
+MQTT_TOPIC_PROFILE_LEFT = MQTT_TOPIC_PROFILE + Side.LEFT.value
+MQTT_TOPIC_PROFILE_RIGHT = MQTT_TOPIC_PROFILE + Side.RIGHT.value
 
 class DataHandler(ABC):
     """Class for accepting and processing data from the power meter."""
 
+    # Format of high speed packets, as announced in the latest about message.
+    packet_format = PACKET_FORMAT_LEGACY
+
+    # Format of low speed messages, as announced in the latest about message.
+    low_speed_format = LOW_SPEED_FORMAT_JSON
+
     @abstractmethod
     def add_imu(self, data: bytes) -> None:
         """Takes in bytes containing the data from the IMU and handles them.
@@ -99,6 +113,16 @@ class DataHandler(ABC):
         """
         pass
 
+    def add_profile(self, unix_time: float, data: bytes, side: Side) -> None:
+        """Accepts a torque profile for a single rotation from a side and handles it.
+
+        Args:
+            unix_time (float): The time the message was received.
+            data (bytes): The raw MQTT message containing the profile.
+            side (Side): The side the profile applies to.
+        """
+        pass
+
     def close(self) -> None:
         """Closes the handler safely."""
 
@@ -113,12 +137,7 @@ class DataHandler(ABC):
             List[IMUData]: A list of IMUData objects that were contained in the
                            data.
         """
-        # For each data object, extract it and add it to an array.
-        result = [
-            IMUData(data[i : i + IMUData.SIZE])
-            for i in range(0, len(data), IMUData.SIZE)
-        ]
-        return result
+        return decode_packet(data, IMUData, DataHandler.packet_format)
 
     def _process_strain(self, data: bytes) -> List[StrainData]:
         """Accepts a blob of bytes and converterts these into an array of
@@ -131,12 +150,7 @@ class DataHandler(ABC):
             List[StrainData]: A list of StrainData objects that were contained
             in the data.
         """
-        # For each data object, extract it and add it to an array.
-        result = [
-            StrainData(data[i : i + StrainData.SIZE])
-            for i in range(0, len(data), StrainData.SIZE)
-        ]
-        return result
+        return decode_packet(data, StrainData, DataHandler.packet_format)
 
 
 class CSVSide:
@@ -201,7 +215,7 @@ class CSVHandler(DataHandler):
         # Create the housekeeping file
         self.housekeeping_file = open(f"{output}/housekeeping.csv", "w", buffering=1)
         self.housekeeping_file.write(
-            "Unix Timestamp [s],Left Temperature [C],Right Temperature [C],IMU Temperature [C],Battery [mV],Left Offset [raw],Right Offset [raw]\n"
+            "Unix Timestamp [s],Left Temperature [C],Right Temperature [C],IMU Temperature [C],Battery [mV],Left Offset [raw],Right Offset [raw],Battery Current [mA]\n"
         )
 
         # Create the IMU file
@@ -221,6 +235,14 @@ class CSVHandler(DataHandler):
             "Unix Timestamp [s],Device Timestamp [us],Cadence [rpm],Rotations [#],Power [W],Balance [%]\n"
         )
 
+        # Create the torque profile files. Each bin is a column, starting from -pi radians.
+        self.profiles = {}
+        for side in (Side.LEFT, Side.RIGHT):
+            self.profiles[side] = open(f"{output}/{side.value}_profile.csv", "w", buffering=1)
+            self.profiles[side].write(
+                "Unix Timestamp [s],Device Timestamp [us],Duration [us],Bin Torques [Nm]...\n"
+            )
+
     def add_imu(self, unix_time: float, data: bytes) -> None:
         converted = self._process_imu(data)
         for i in converted:
@@ -239,7 +261,7 @@ class CSVHandler(DataHandler):
         print(f"Housekeeping: {data}")
         data = json.loads(data)
         self.housekeeping_file.write(
-            f"{unix_time},{data['temps']['left']},{data['temps']['right']},{data['temps']['imu']},{data['battery']},{data['left-offset']},{data['right-offset']}\n"
+            f"{unix_time},{data['temps']['left']},{data['temps']['right']},{data['temps']['imu']},{data['battery']},{data['left-offset']},{data['right-offset']},{data.get('current')}\n"
         )
 
     def add_fast(self, unix_time: float, data: str, side: Side) -> None:
@@ -256,12 +278,17 @@ class CSVHandler(DataHandler):
             f"{unix_time},{data['timestamp']},{data['cadence']},{data['rotations']},{data['power']},{data['balance']}\n"
         )
 
+    def add_profile(self, unix_time: float, data: bytes, side: Side) -> None:
+        self.profiles[side].write(f"{unix_time},{TorqueProfile(data)}\n")
+
     def close(self):
         print("Closing CSV Handler")
         self.imu_file.close()
         self.about_file.close()
         self.housekeeping_file.close()
         self.slow.close()
+        for file in self.profiles.values():
+            file.close()
 
 
 class GraphHandler(DataHandler):
@@ -330,6 +357,10 @@ class MultiHandler(DataHandler):
         for h in self.handlers:
             h.add_slow(unix_time, data)
 
+    def add_profile(self, unix_time: float, data: bytes, side: Side) -> None:
+        for h in self.handlers:
+            h.add_profile(unix_time, data, side)
+
     def close(self) -> None:
         for h in self.handlers:
             h.close()
@@ -373,6 +404,22 @@ def on_connect(
     else:
         print("Not subscribing to high-speed IMU messages.")
 
+    if not args.no_backfill:
+        mqtt_client.subscribe(MQTT_TOPIC_BACKFILL)
+    else:
+        print("Not subscribing to backfill messages.")
+
+    if not args.no_stats:
+        mqtt_client.subscribe(MQTT_TOPIC_STATS)
+    else:
+        print("Not subscribing to stats messages.")
+
+    if not args.no_profile:
+        mqtt_client.subscribe(MQTT_TOPIC_PROFILE_LEFT)
+        mqtt_client.subscribe(MQTT_TOPIC_PROFILE_RIGHT)
+    else:
+        print("Not subscribing to torque profile messages.")
+
 
 def on_message(client: mqtt.Client, userdata: None, msg: mqtt.MQTTMessage) -> None:
     """Handles a received message from MQTT.
@@ -385,6 +432,11 @@ def on_message(client: mqtt.Client, userdata: None, msg: mqtt.MQTTMessage) -> No
     t = time.time()
     if msg.topic == MQTT_TOPIC_ABOUT:
         print("About this device: " + msg.payload.decode())
+        about = json.loads(msg.payload)
+        DataHandler.packet_format = about.get("packet-format", PACKET_FORMAT_LEGACY)
+        DataHandler.low_speed_format = about.get(
+            "low-speed-format", LOW_SPEED_FORMAT_JSON
+        )
         handler.add_about(t, msg.payload.decode())
     elif msg.topic == MQTT_TOPIC_IMU:
         handler.add_imu(t, msg.payload)
@@ -395,8 +447,40 @@ def on_message(client: mqtt.Client, userdata: None, msg: mqtt.MQTTMessage) -> No
     elif msg.topic == MQTT_TOPIC_RIGHT:
         handler.add_fast(t, msg.payload, Side.RIGHT)
     elif msg.topic == MQTT_TOPIC_LOW_SPEED:
-        data = json.loads(msg.payload)
+        if DataHandler.low_speed_format == LOW_SPEED_FORMAT_BINARY:
+            data = decode_low_speed(msg.payload)
+        else:
+            data = json.loads(msg.payload)
         handler.add_slow(t, data)
+    elif msg.topic == MQTT_TOPIC_PROFILE_LEFT:
+        handler.add_profile(t, msg.payload, Side.LEFT)
+    elif msg.topic == MQTT_TOPIC_PROFILE_RIGHT:
+        handler.add_profile(t, msg.payload, Side.RIGHT)
+    elif msg.topic == MQTT_TOPIC_BACKFILL:
+        # Logged high speed data is always packed.
+        live_format = DataHandler.packet_format
+        DataHandler.packet_format = PACKET_FORMAT_PACKED
+        try:
+            for entry_type, payload in decode_backfill(msg.payload):
+                if entry_type == LOG_ENTRY_IMU:
+                    handler.add_imu(t, payload)
+                elif entry_type == LOG_ENTRY_LEFT:
+                    handler.add_fast(t, payload, Side.LEFT)
+                elif entry_type == LOG_ENTRY_RIGHT:
+                    handler.add_fast(t, payload, Side.RIGHT)
+                elif entry_type == LOG_ENTRY_LOW_SPEED:
+                    handler.add_slow(t, decode_low_speed(payload))
+                elif entry_type == LOG_ENTRY_PROFILE_LEFT:
+                    handler.add_profile(t, payload, Side.LEFT)
+                elif entry_type == LOG_ENTRY_PROFILE_RIGHT:
+                    handler.add_profile(t, payload, Side.RIGHT)
+        finally:
+            DataHandler.packet_format = live_format
+    elif msg.topic == MQTT_TOPIC_STATS:
+        stats = decode_stats(msg.payload)
+        print(f"Stats at {stats['time']}ms:")
+        for name, histogram in stats["histograms"].items():
+            print(f"  {name:>18}: {histogram['count']:>10d} samples, max {histogram['max']:.1f}")
 
 
 if __name__ == "__main__":
@@ -472,6 +556,21 @@ if __name__ == "__main__":
         help="If present, does not subscribe to messages containing slow power data.",
         action="store_true",
     )
+    group.add_argument(
+        "--no-backfill",
+        help="If present, does not subscribe to messages containing data logged while disconnected.",
+        action="store_true",
+    )
+    group.add_argument(
+        "--no-stats",
+        help="If present, does not subscribe to timing stats messages.",
+        action="store_true",
+    )
+    group.add_argument(
+        "--no-profile",
+        help="If present, does not subscribe to torque profile messages.",
+        action="store_true",
+    )
     args = parser.parse_args()
 
     # Setup the data handler
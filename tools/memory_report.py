@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""memory_report.py
+usage: memory_report.py [-h] [-n SYMBOLS] map
+
+Summarises statically allocated RAM by subsystem from a linker map file.
+
+Each input section in the DRAM and RTC output sections is attributed to the source file (for the firmware) or library
+it came from. Firmware files are reported individually (task stacks are in task_topology, connection buffers in
+connections and so on), everything else is grouped by library or framework archive. Heap allocations made at runtime
+(mostly WiFi, BLE and the MQTT client) aren't included. These are reported in the housekeeping topic instead.
+
+When listed in `extra_scripts` in platformio.ini, this also adds `-Wl,-Map` to the link and prints the report after
+each build.
+
+positional arguments:
+  map                   The linker map file to read.
+
+options:
+  -h, --help            show this help message and exit
+  -n SYMBOLS, --symbols SYMBOLS
+                        The number of largest symbols to list. (default: 15)
+
+Written by Jotham Gates and Oscar Varney for MHP, 2026
+"""
+
+import argparse
+import os
+import re
+from collections import defaultdict
+from typing import Dict, List, Tuple
+
+# Output sections that end up in RAM, grouped by the memory they use.
+RAM_SECTIONS = {
+    ".dram0.data": "DRAM",
+    ".dram0.bss": "DRAM",
+    ".noinit": "DRAM",
+    ".rtc.data": "RTC",
+    ".rtc.bss": "RTC",
+    ".rtc_noinit": "RTC",
+}
+
+_HEX = r"0x[0-9a-fA-F]+"
+_OUTPUT_SECTION = re.compile(r"^(\.\S+)")
+_INPUT_SECTION = re.compile(r"^ (\.\S+|COMMON)(?:\s+(" + _HEX + r")\s+(" + _HEX + r")\s+(.+))?$")
+_INPUT_CONTINUED = re.compile(r"^\s+(" + _HEX + r")\s+(" + _HEX + r")\s+(.+)$")
+_SYMBOL = re.compile(r"^\s+(" + _HEX + r")\s+([A-Za-z_][\w:$.]*)$")
+
+
+def subsystem(path: str) -> str:
+    """Works out which subsystem an object file belongs to."""
+    path = path.replace("\\", "/")
+    archive = re.match(r"(?:.*/)?(lib[^/(]+)\.a\((.+)\)$", path)
+    if archive:
+        # Framework or library archive.
+        return archive.group(1)
+    if "/src/src/" in path or path.endswith("/src/main.cpp.o"):
+        # Firmware source file.
+        return os.path.basename(path).split(".")[0]
+    library = re.search(r"/lib[^/]*/([^/]+)/", path)
+    if library:
+        return library.group(1)
+    return os.path.basename(path)
+
+
+def parse_map(path: str) -> List[Tuple[str, str, int, str]]:
+    """Reads the input sections placed in RAM.
+
+    Returns:
+        A list of (memory, subsystem, size, name) for each input section.
+    """
+    sections = []
+    memory = None
+    pending = None  # Input section name waiting for its address and size on the next line.
+    with open(path, "r", errors="replace") as file:
+        # Skip to the memory map (the earlier parts list discarded sections and archive members).
+        for line in file:
+            if line.startswith("Linker script and memory map"):
+                break
+
+        for line in file:
+            line = line.rstrip("\n")
+            output = _OUTPUT_SECTION.match(line)
+            if output:
+                memory = RAM_SECTIONS.get(output.group(1))
+                pending = None
+                continue
+            if memory is None:
+                continue
+
+            match = _INPUT_SECTION.match(line)
+            if match:
+                if match.group(2):
+                    sections.append([memory, subsystem(match.group(4)), int(match.group(3), 16), [], match.group(1)])
+                    pending = None
+                else:
+                    pending = match.group(1)
+                continue
+            if pending:
+                match = _INPUT_CONTINUED.match(line)
+                if match:
+                    sections.append([memory, subsystem(match.group(3)), int(match.group(2), 16), [], pending])
+                pending = None
+                continue
+
+            match = _SYMBOL.match(line)
+            if match and sections:
+                sections[-1][3].append(match.group(2))
+    return [(memory, system, size, section_name(section, symbols)) for memory, system, size, symbols, section in sections if size]
+
+
+def section_name(section: str, symbols: List[str]) -> str:
+    """Names an input section after its symbol if there is only one, otherwise after the section."""
+    if len(symbols) == 1:
+        return symbols[0]
+    # With -fdata-sections, each variable (including static ones that aren't listed as symbols) has its own section.
+    name = re.sub(r"^\.(?:s?bss|s?data|rtc\.\w+|noinit)\.", "", section)
+    return name if not symbols else f"{name} ({len(symbols)} symbols)"
+
+
+def report(path: str, symbols: int = 15) -> None:
+    """Prints RAM use per subsystem and the largest symbols."""
+    sections = parse_map(path)
+    totals: Dict[str, Dict[str, int]] = defaultdict(lambda: defaultdict(int))
+    largest = []
+    for memory, system, size, name in sections:
+        totals[memory][system] += size
+        largest.append((size, memory, system, name))
+
+    for memory in sorted(totals):
+        print(f"Static {memory} by subsystem ({sum(totals[memory].values())} bytes):")
+        for system, size in sorted(totals[memory].items(), key=lambda item: -item[1]):
+            print(f"  {size:8d}  {system}")
+    print(f"Largest {symbols} symbols:")
+    for size, memory, system, name in sorted(largest, reverse=True)[:symbols]:
+        print(f"  {size:8d}  {memory:4s}  {system}: {name}")
+
+
+try:
+    # Running from PlatformIO.
+    Import("env")  # type: ignore # noqa: F821
+
+    map_path = os.path.join(env.subst("$BUILD_DIR"), env.subst("${PROGNAME}.map"))  # type: ignore # noqa: F821
+    env.Append(LINKFLAGS=["-Wl,-Map," + map_path])  # type: ignore # noqa: F821
+
+    def _after_link(source, target, env):
+        report(map_path)
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", _after_link)  # type: ignore # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        parser = argparse.ArgumentParser(
+            description="Summarises statically allocated RAM by subsystem from a linker map file.",
+            formatter_class=argparse.ArgumentDefaultsHelpFormatter,
+            epilog="Written by Jotham Gates and Oscar Varney for MHP, 2026",
+        )
+        parser.add_argument("map", help="The linker map file to read.")
+        parser.add_argument("-n", "--symbols", type=int, default=15, help="The number of largest symbols to list.")
+        args = parser.parse_args()
+        report(args.map, args.symbols)